@@ -0,0 +1,173 @@
+// Benchmark of the windowed statistics (aggregate.c): cost per beat against
+// recomputing every window from scratch, a check of every summary against that
+// recomputation, and how many bytes summaries need compared to publishing every beat.
+// Exits 1 if any summary differs from the recomputation (ctest runs it for that).
+//
+//   aggregate_bench [--beats N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "aggregate.h"
+#include "tscodec.h"
+#include "batch.h"
+
+static double wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Heart rate drifting between rest and exercise, intervals with some jitter
+static bpm_sample_t *make_beats(size_t n) {
+    bpm_sample_t *beats = malloc(n * sizeof(*beats));
+    uint32_t t = 1000;
+    double bpm = 70;
+    for (size_t i = 0; i < n; i++) {
+        double target = (i / 2000) % 2 ? 150 : 65;
+        bpm += (target - bpm) * 0.01 + ((rand() % 5) - 2) * 0.3;
+        int ibi = (int)(60000 / bpm) + (rand() % 41) - 20;
+        t += (uint32_t)ibi;
+        beats[i] = (bpm_sample_t){ .timestamp_ms = t, .bpm = (int)(60000 / ibi), .ibi_ms = i ? ibi : 0 };
+    }
+    return beats;
+}
+
+// The same numbers the slow way, over beats[from..to)
+static void naive(const bpm_sample_t *b, size_t from, size_t to, agg_summary_t *s) {
+    memset(s, 0, sizeof(*s));
+    size_t n = to - from;
+    s->count = (uint16_t)n;
+    if (n == 0) {
+        return;
+    }
+    double sum = 0, sq = 0, ibi_sum = 0, ibi_sq = 0, diff_sq = 0;
+    int min = b[from].bpm, max = b[from].bpm;
+    size_t m = 0, diffs = 0;
+    for (size_t i = from; i < to; i++) {
+        sum += b[i].bpm;
+        sq += (double)b[i].bpm * b[i].bpm;
+        min = b[i].bpm < min ? b[i].bpm : min;
+        max = b[i].bpm > max ? b[i].bpm : max;
+        if (b[i].ibi_ms) {
+            m++;
+            ibi_sum += b[i].ibi_ms;
+            ibi_sq += (double)b[i].ibi_ms * b[i].ibi_ms;
+            if (i > from && b[i - 1].ibi_ms) {
+                double d = b[i].ibi_ms - b[i - 1].ibi_ms;
+                diff_sq += d * d;
+                diffs++;
+            }
+        }
+    }
+    s->bpm_min = (uint16_t)min;
+    s->bpm_max = (uint16_t)max;
+    s->bpm_mean_x10 = (uint16_t)lround(sum * 10 / n);
+    s->bpm_sd_x10 = (uint16_t)(sqrt(fmax(0, sq / n - (sum / n) * (sum / n))) * 10);
+    s->intervals = (uint16_t)m;
+    s->ibi_mean_ms = m ? (uint16_t)lround(ibi_sum / m) : 0;
+    s->sdnn_ms = m > 1 ? (uint16_t)sqrt(fmax(0, (ibi_sq - ibi_sum * ibi_sum / m) / (m - 1))) : 0;
+    s->rmssd_ms = diffs ? (uint16_t)sqrt(diff_sq / diffs) : 0;
+}
+
+static int off(uint16_t a, uint16_t b) {
+    return abs((int)a - (int)b) > 1;
+}
+
+// Returns the number of summaries that differ from the recomputation
+static size_t run(const bpm_sample_t *beats, size_t n, uint32_t window_ms, uint32_t step_ms) {
+    static agg_t agg;
+    agg_config_t config = { .window_ms = window_ms, .step_ms = step_ms };
+    bool tumbling = window_ms == step_ms;
+    agg_init(&agg, &config, beats[0].timestamp_ms);
+
+    // Incremental
+    size_t summaries = 0;
+    agg_summary_t s;
+    double t0 = wall_ns();
+    for (size_t i = 0; i < n; i++) {
+        while ((int32_t)(beats[i].timestamp_ms - agg.next_emit_ms) >= 0) {
+            agg_poll(&agg, agg.next_emit_ms, &s);
+            summaries++;
+        }
+        agg_add(&agg, &beats[i]);
+    }
+    double inc_ns = wall_ns() - t0;
+
+    // Again, checking every summary against the slow way
+    agg_init(&agg, &config, beats[0].timestamp_ms);
+    size_t mismatches = 0, from = 0;
+    double naive_ns = 0;
+    for (size_t i = 0; i < n; i++) {
+        while ((int32_t)(beats[i].timestamp_ms - agg.next_emit_ms) >= 0) {
+            uint32_t now = agg.next_emit_ms;
+            agg_poll(&agg, now, &s);
+            if (!tumbling) {
+                while (from < i && now - beats[from].timestamp_ms > window_ms) {
+                    from++;
+                }
+            }
+            agg_summary_t ref;
+            double t1 = wall_ns();
+            naive(beats, from, i, &ref);
+            naive_ns += wall_ns() - t1;
+            mismatches += s.count != ref.count || s.bpm_min != ref.bpm_min || s.bpm_max != ref.bpm_max ||
+                          off(s.bpm_mean_x10, ref.bpm_mean_x10) || off(s.bpm_sd_x10, ref.bpm_sd_x10) ||
+                          off(s.ibi_mean_ms, ref.ibi_mean_ms) || off(s.sdnn_ms, ref.sdnn_ms) ||
+                          off(s.rmssd_ms, ref.rmssd_ms) || s.intervals != ref.intervals;
+            if (tumbling) {
+                from = i;
+            }
+        }
+        agg_add(&agg, &beats[i]);
+    }
+
+    double minutes = (beats[n - 1].timestamp_ms - beats[0].timestamp_ms) / 60000.0;
+    printf("%-8s %3lus every %3lus: %5.1f ns/beat incremental, %7.0f ns/summary from scratch, "
+           "%zu summaries, %zu mismatches, %lu truncated, %.0f B/min\n",
+           tumbling ? "tumbling" : "sliding", (unsigned long)(window_ms / 1000), (unsigned long)(step_ms / 1000),
+           inc_ns / n, summaries ? naive_ns / summaries : 0.0, summaries, mismatches,
+           (unsigned long)agg.truncated, summaries * AGG_ENCODED_SIZE / minutes);
+    return mismatches;
+}
+
+// Bytes per minute when every beat is published in BATCH_MAX_SAMPLES batches
+static void raw_rate(const bpm_sample_t *beats, size_t n) {
+    static uint8_t buf[BATCH_PAYLOAD_MAX];
+    size_t bytes = 0;
+    for (size_t from = 0; from < n; from += BATCH_MAX_SAMPLES) {
+        ts_encoder_t enc;
+        ts_encoder_init(&enc, buf, sizeof(buf));
+        for (size_t i = from; i < n && i < from + BATCH_MAX_SAMPLES; i++) {
+            ts_encode(&enc, beats[i].timestamp_ms, beats[i].bpm);
+        }
+        bytes += ts_encoder_finish(&enc);
+    }
+    double minutes = (beats[n - 1].timestamp_ms - beats[0].timestamp_ms) / 60000.0;
+    printf("raw      every beat in batches of %d: %.0f B/min (%.0f publishes/min)\n",
+           BATCH_MAX_SAMPLES, bytes / minutes, n / (double)BATCH_MAX_SAMPLES / minutes);
+}
+
+int main(int argc, char **argv) {
+    size_t n = 200000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--beats") == 0 && i + 1 < argc) {
+            n = (size_t)atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--beats N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    srand(1);
+    bpm_sample_t *beats = make_beats(n);
+    raw_rate(beats, n);
+    size_t mismatches = run(beats, n, 60000, 60000);
+    mismatches += run(beats, n, 120000, 120000);
+    mismatches += run(beats, n, 60000, 10000);
+    mismatches += run(beats, n, 120000, 5000);
+    free(beats);
+    return mismatches ? 1 : 0;
+}
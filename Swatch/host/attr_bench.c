@@ -0,0 +1,204 @@
+// Stress test of the attribute store (attr_store.c): one writer task rewrites a value
+// as fast as it can while reader threads copy it and check every copy for a value
+// that is half old, half new. The same is done on a plain buffer (as ble.c had it)
+// and behind a mutex, for the torn reads and the cost.
+//
+//   attr_bench [--seconds N] [--readers N]
+//
+// Each value says what it should look like: byte i is (n + i) and the length is
+// 4 + (n & 15), so a copy can be checked without knowing which write it came from.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "attr_store.h"
+
+#define MAX_READERS 8
+
+typedef enum {
+    MODE_PLAIN,         // memcpy of a shared buffer, no synchronization
+    MODE_MUTEX,
+    MODE_SEQLOCK,       // attr_store
+} bench_mode_t;
+
+static const char *mode_names[] = { "plain", "mutex", "seqlock" };
+
+static bench_mode_t mode;
+static _Atomic bool running;
+static attr_value_t attr;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    uint16_t len;
+    uint8_t data[ATTR_VALUE_MAX];
+} plain;
+
+typedef struct {
+    uint64_t reads;
+    uint64_t torn;
+    uint64_t new_values;    // versions this reader hadn't seen before
+    uint64_t backwards;     // versions that went back
+} reader_stats_t;
+
+static uint64_t writes;
+
+static void make_value(uint32_t n, uint8_t *data, uint16_t *len) {
+    *len = 4 + (n & 15);
+    for (uint16_t i = 0; i < *len; i++) {
+        data[i] = (uint8_t)(n + i);
+    }
+}
+
+static bool intact(const uint8_t *data, uint16_t len) {
+    if (len != 4 + (data[0] & 15)) {
+        return false;
+    }
+    for (uint16_t i = 1; i < len; i++) {
+        if (data[i] != (uint8_t)(data[0] + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *writer(void *arg) {
+    (void)arg;
+    uint8_t data[ATTR_VALUE_MAX];
+    uint16_t len;
+    uint32_t n = 0;
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        make_value(++n, data, &len);
+        switch (mode) {
+            case MODE_PLAIN:
+                // Byte by byte through a volatile pointer, as a task preempted halfway would
+                for (uint16_t i = 0; i < len; i++) {
+                    ((volatile uint8_t *)plain.data)[i] = data[i];
+                }
+                *(volatile uint16_t *)&plain.len = len;
+                break;
+            case MODE_MUTEX:
+                pthread_mutex_lock(&mutex);
+                memcpy(plain.data, data, len);
+                plain.len = len;
+                pthread_mutex_unlock(&mutex);
+                break;
+            case MODE_SEQLOCK:
+                attr_write(&attr, data, len);
+                break;
+        }
+    }
+    writes = n;
+    return NULL;
+}
+
+static void *reader(void *arg) {
+    reader_stats_t *st = arg;
+    uint8_t data[ATTR_VALUE_MAX];
+    uint16_t len = 0;
+    uint32_t seen = 0, last = 0;
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        switch (mode) {
+            case MODE_PLAIN:
+                len = *(volatile uint16_t *)&plain.len;
+                for (uint16_t i = 0; i < len; i++) {
+                    data[i] = ((volatile uint8_t *)plain.data)[i];
+                }
+                break;
+            case MODE_MUTEX:
+                pthread_mutex_lock(&mutex);
+                len = plain.len;
+                memcpy(data, plain.data, len);
+                pthread_mutex_unlock(&mutex);
+                break;
+            case MODE_SEQLOCK:
+                // Every other read the way a notify path would do it
+                if (st->reads & 1) {
+                    if (!attr_read_if_changed(&attr, &seen, data, &len)) {
+                        st->reads++;
+                        continue;
+                    }
+                } else {
+                    seen = attr_read(&attr, data, &len);
+                }
+                st->new_values += seen != last;
+                st->backwards += (int32_t)(seen - last) < 0;
+                last = seen;
+                break;
+        }
+        st->reads++;
+        st->torn += !intact(data, len);
+    }
+    return NULL;
+}
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 2;
+    int readers = 3;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            readers = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds N] [--readers N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (readers < 1 || readers > MAX_READERS) {
+        fprintf(stderr, "--readers wants 1 to %d\n", MAX_READERS);
+        return 2;
+    }
+
+    int failures = 0;
+    printf("1 writer, %d readers, %.0f s per mode\n", readers, seconds);
+    for (mode = MODE_PLAIN; mode <= MODE_SEQLOCK; mode++) {
+        uint8_t data[ATTR_VALUE_MAX];
+        uint16_t len;
+        make_value(0, data, &len);
+        attr_init(&attr, ATTR_VALUE_MAX, data, len);
+        memcpy(plain.data, data, len);
+        plain.len = len;
+
+        reader_stats_t stats[MAX_READERS] = {0};
+        pthread_t writer_thread, reader_threads[MAX_READERS];
+        atomic_store(&running, true);
+        double start = wall_seconds();
+        pthread_create(&writer_thread, NULL, writer, NULL);
+        for (int r = 0; r < readers; r++) {
+            pthread_create(&reader_threads[r], NULL, reader, &stats[r]);
+        }
+        struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+        nanosleep(&ts, NULL);
+        atomic_store(&running, false);
+        pthread_join(writer_thread, NULL);
+        reader_stats_t total = {0};
+        for (int r = 0; r < readers; r++) {
+            pthread_join(reader_threads[r], NULL);
+            total.reads += stats[r].reads;
+            total.torn += stats[r].torn;
+            total.new_values += stats[r].new_values;
+            total.backwards += stats[r].backwards;
+        }
+        double elapsed = wall_seconds() - start;
+
+        printf("%-8s %6.1f M writes/s, %6.1f M reads/s, %llu torn reads", mode_names[mode], writes / elapsed / 1e6,
+               total.reads / elapsed / 1e6, (unsigned long long)total.torn);
+        if (mode == MODE_SEQLOCK) {
+            // Each reader sees a write at most once, so with none missed this is readers per write
+            printf(", %llu new values seen (%.2g per write), %llu versions went back",
+                   (unsigned long long)total.new_values, writes ? (double)total.new_values / writes : 0.0,
+                   (unsigned long long)total.backwards);
+            failures += total.torn > 0 || total.backwards > 0;
+        }
+        printf("\n");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+// Throughput of the lock-free channels (channel.c). The SPSC ring moves sensor records
+// from one producer thread to one consumer through a ring the size of the sample ring,
+// both as fast as they can. The latest-value slot is written as fast as possible while
+// reader threads copy it. Each is measured against the same thing behind
+// a pthread mutex, which is what a FreeRTOS queue or a locked buffer costs at least.
+//
+//   channel_bench [--seconds N] [--readers N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "channel.h"
+#include "sensor.h"
+
+#define RING_SIZE 64            // as SAMPLE_RING_SIZE
+#define MAX_READERS 8
+#define SLOT_WORDS (LATEST_SLOT_MAX_SIZE / sizeof(uint32_t))
+
+static _Atomic bool running;
+
+// The ring under test, or the same ring behind a mutex
+typedef struct {
+    spsc_ring_t ring;
+    sensor_record_t storage[RING_SIZE];
+    bool locked;
+    pthread_mutex_t mutex;
+    uint64_t pushed;
+    uint64_t full;
+    uint64_t popped;
+    uint64_t empty;
+} ring_bench_t;
+
+static bool push(ring_bench_t *b, const sensor_record_t *r) {
+    if (!b->locked) {
+        return spsc_push(&b->ring, r);
+    }
+    pthread_mutex_lock(&b->mutex);
+    bool ok = spsc_push(&b->ring, r);
+    pthread_mutex_unlock(&b->mutex);
+    return ok;
+}
+
+static bool pop(ring_bench_t *b, sensor_record_t *r) {
+    if (!b->locked) {
+        return spsc_pop(&b->ring, r);
+    }
+    pthread_mutex_lock(&b->mutex);
+    bool ok = spsc_pop(&b->ring, r);
+    pthread_mutex_unlock(&b->mutex);
+    return ok;
+}
+
+static void *ring_producer(void *arg) {
+    ring_bench_t *b = arg;
+    sensor_record_t r = { .sensor = SENSOR_HEART };
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        r.timestamp_ms++;
+        r.payload.beat.bpm = 60 + (r.timestamp_ms & 63);
+        if (push(b, &r)) {
+            b->pushed++;
+        } else {
+            // Where a task would wait, and on one CPU the consumer has to run
+            b->full++;
+            r.timestamp_ms--;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *ring_consumer(void *arg) {
+    ring_bench_t *b = arg;
+    sensor_record_t r;
+    // Drains what's left once the producer has stopped
+    while (atomic_load_explicit(&running, memory_order_relaxed) || spsc_count(&b->ring) > 0) {
+        if (pop(b, &r)) {
+            b->popped++;
+        } else {
+            b->empty++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// The slot under test, or a plain buffer behind a mutex
+typedef struct {
+    latest_slot_t slot;
+    bool locked;
+    pthread_mutex_t mutex;
+    uint32_t plain[SLOT_WORDS];
+    uint64_t writes;
+} slot_bench_t;
+
+typedef struct {
+    slot_bench_t *b;
+    uint64_t reads;
+} slot_reader_t;
+
+static void *slot_writer(void *arg) {
+    slot_bench_t *b = arg;
+    uint32_t value[SLOT_WORDS] = {0};
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        value[0]++;
+        if (b->locked) {
+            pthread_mutex_lock(&b->mutex);
+            memcpy(b->plain, value, sizeof(value));
+            pthread_mutex_unlock(&b->mutex);
+        } else {
+            latest_slot_write(&b->slot, value);
+        }
+        b->writes++;
+    }
+    return NULL;
+}
+
+static void *slot_reader(void *arg) {
+    slot_reader_t *r = arg;
+    uint32_t value[SLOT_WORDS];
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        if (r->b->locked) {
+            pthread_mutex_lock(&r->b->mutex);
+            memcpy(value, r->b->plain, sizeof(value));
+            pthread_mutex_unlock(&r->b->mutex);
+        } else {
+            latest_slot_read(&r->b->slot, value);
+        }
+        r->reads++;
+    }
+    return NULL;
+}
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_for(double seconds) {
+    struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+    atomic_store(&running, false);
+}
+
+static void bench_ring(bool locked, double seconds) {
+    static ring_bench_t b;
+    memset(&b, 0, sizeof(b));
+    spsc_init(&b.ring, b.storage, sizeof(sensor_record_t), RING_SIZE);
+    b.locked = locked;
+    pthread_mutex_init(&b.mutex, NULL);
+    pthread_t producer, consumer;
+    atomic_store(&running, true);
+    double start = wall_seconds();
+    pthread_create(&producer, NULL, ring_producer, &b);
+    pthread_create(&consumer, NULL, ring_consumer, &b);
+    run_for(seconds);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    double elapsed = wall_seconds() - start;
+    pthread_mutex_destroy(&b.mutex);
+    printf("ring %-7s %6.1f M records/s (%zu bytes each), %4.1f%% of pushes found it full, "
+           "%4.1f%% of pops found it empty\n", locked ? "mutex" : "spsc", b.popped / elapsed / 1e6,
+           sizeof(sensor_record_t), b.pushed + b.full ? 100.0 * b.full / (b.pushed + b.full) : 0.0,
+           b.popped + b.empty ? 100.0 * b.empty / (b.popped + b.empty) : 0.0);
+}
+
+static void bench_slot(bool locked, int readers, double seconds) {
+    static slot_bench_t b;
+    memset(&b, 0, sizeof(b));
+    latest_slot_init(&b.slot, b.plain, sizeof(b.plain));
+    b.locked = locked;
+    pthread_mutex_init(&b.mutex, NULL);
+    slot_reader_t reader_state[MAX_READERS] = {0};
+    pthread_t writer, reader_threads[MAX_READERS];
+    atomic_store(&running, true);
+    double start = wall_seconds();
+    pthread_create(&writer, NULL, slot_writer, &b);
+    for (int r = 0; r < readers; r++) {
+        reader_state[r].b = &b;
+        pthread_create(&reader_threads[r], NULL, slot_reader, &reader_state[r]);
+    }
+    run_for(seconds);
+    pthread_join(writer, NULL);
+    uint64_t reads = 0;
+    for (int r = 0; r < readers; r++) {
+        pthread_join(reader_threads[r], NULL);
+        reads += reader_state[r].reads;
+    }
+    double elapsed = wall_seconds() - start;
+    pthread_mutex_destroy(&b.mutex);
+    printf("slot %-7s %6.1f M writes/s, %6.1f M reads/s (%d bytes)\n", locked ? "mutex" : "seqlock",
+           b.writes / elapsed / 1e6, reads / elapsed / 1e6, LATEST_SLOT_MAX_SIZE);
+}
+
+int main(int argc, char **argv) {
+    double seconds = 1;
+    int readers = 2;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            readers = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds N] [--readers N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (readers < 1 || readers > MAX_READERS) {
+        fprintf(stderr, "--readers wants 1 to %d\n", MAX_READERS);
+        return 2;
+    }
+
+    printf("1 producer, 1 consumer, ring of %d; 1 writer, %d readers; %.0f s each\n", RING_SIZE, readers, seconds);
+    bench_ring(false, seconds);
+    bench_ring(true, seconds);
+    bench_slot(false, readers, seconds);
+    bench_slot(true, readers, seconds);
+    return 0;
+}
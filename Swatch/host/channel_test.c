@@ -0,0 +1,267 @@
+// Checks of the lock-free channels (channel.c): the SPSC ring across the 2^32 wrap of
+// its counters, when full and in order between two threads, and the latest-value slot
+// for torn reads under a writer that never stops. Run by ctest.
+//
+//   channel_test [--seconds N]
+//
+// Prints one line per check and exits 1 if any of them failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "channel.h"
+
+#define RING_SIZE 8
+#define SLOT_WORDS (LATEST_SLOT_MAX_SIZE / sizeof(uint32_t))
+#define MAX_READERS 4
+
+static int failures;
+
+#define CHECK(cond, ...) do {                   \
+        if (!(cond)) {                          \
+            printf("  FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                \
+            printf("\n");                       \
+            failures++;                         \
+        }                                       \
+    } while (0)
+
+static void report(const char *name, int failures_before) {
+    printf("%-28s %s\n", name, failures == failures_before ? "ok" : "FAILED");
+}
+
+static void test_init(void) {
+    int before = failures;
+    spsc_ring_t ring;
+    uint32_t storage[RING_SIZE];
+    latest_slot_t slot;
+    uint32_t value[2] = { 1, 2 };
+    CHECK(!spsc_init(&ring, storage, sizeof(uint32_t), 0), "capacity 0 accepted");
+    CHECK(!spsc_init(&ring, storage, sizeof(uint32_t), 6), "capacity 6 accepted");
+    CHECK(spsc_init(&ring, storage, sizeof(uint32_t), RING_SIZE), "capacity %d refused", RING_SIZE);
+    CHECK(!latest_slot_init(&slot, value, 6), "slot size 6 accepted");
+    CHECK(!latest_slot_init(&slot, value, LATEST_SLOT_MAX_SIZE + 4), "slot size above the maximum accepted");
+    CHECK(latest_slot_init(&slot, value, sizeof(value)), "slot size 8 refused");
+    report("init", before);
+}
+
+// Fills the ring past its capacity, then drains it
+static void test_full(void) {
+    int before = failures;
+    spsc_ring_t ring;
+    uint32_t storage[RING_SIZE], v;
+    spsc_init(&ring, storage, sizeof(uint32_t), RING_SIZE);
+    CHECK(!spsc_pop(&ring, &v), "pop from an empty ring");
+    for (uint32_t i = 0; i < RING_SIZE + 3; i++) {
+        bool ok = spsc_push(&ring, &i);
+        CHECK(ok == (i < RING_SIZE), "push %u returned %d", i, ok);
+    }
+    CHECK(spsc_count(&ring) == RING_SIZE, "count %u, want %d", spsc_count(&ring), RING_SIZE);
+    CHECK(atomic_load(&ring.pushed) == RING_SIZE, "pushed %u, want %d", atomic_load(&ring.pushed), RING_SIZE);
+    CHECK(atomic_load(&ring.dropped) == 3, "dropped %u, want 3", atomic_load(&ring.dropped));
+    for (uint32_t i = 0; i < RING_SIZE; i++) {
+        CHECK(spsc_pop(&ring, &v) && v == i, "pop %u got %u", i, v);
+    }
+    CHECK(!spsc_pop(&ring, &v), "pop after draining");
+    CHECK(spsc_count(&ring) == 0, "count %u after draining", spsc_count(&ring));
+    // Room again
+    CHECK(spsc_push(&ring, &v), "push after draining");
+    report("full ring", before);
+}
+
+// head and tail run freely, so start them just below 2^32 and go across
+static void test_wrap(void) {
+    int before = failures;
+    spsc_ring_t ring;
+    uint32_t storage[RING_SIZE], v;
+    spsc_init(&ring, storage, sizeof(uint32_t), RING_SIZE);
+    atomic_store(&ring.head, UINT32_MAX - 2);
+    atomic_store(&ring.tail, UINT32_MAX - 2);
+    uint32_t next_in = 0, next_out = 0;
+    for (int round = 0; round < 4 * RING_SIZE; round++) {
+        // Fill it up, which the wrap must not turn into "empty" or "overfull"
+        while (spsc_push(&ring, &next_in)) {
+            next_in++;
+        }
+        CHECK(spsc_count(&ring) == RING_SIZE, "count %u when full at head %u", spsc_count(&ring),
+              atomic_load(&ring.head));
+        // Take some out, a different number every round
+        for (int i = 0; i <= round % RING_SIZE; i++) {
+            CHECK(spsc_pop(&ring, &v) && v == next_out, "got %u, want %u at tail %u", v, next_out,
+                  atomic_load(&ring.tail));
+            next_out++;
+        }
+    }
+    while (spsc_pop(&ring, &v)) {
+        CHECK(v == next_out, "got %u, want %u", v, next_out);
+        next_out++;
+    }
+    CHECK(next_out == next_in, "%u out of %u in", next_out, next_in);
+    CHECK(atomic_load(&ring.head) < UINT32_MAX - 2, "head %u never wrapped", atomic_load(&ring.head));
+    report("wrap at 2^32", before);
+}
+
+static spsc_ring_t ring;
+static uint32_t ring_storage[RING_SIZE];
+static uint32_t producer_full;      // pushes refused, every one of them retried
+
+static void *producer(void *arg) {
+    uint32_t items = *(const uint32_t *)arg;
+    for (uint32_t i = 0; i < items;) {
+        if (spsc_push(&ring, &i)) {
+            i++;
+        } else {
+            // Let the consumer run, the host may have only one CPU
+            producer_full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// One thread pushes 0, 1, 2, ... into a small ring, this one checks they come out in order
+static void test_threads(void) {
+    int before = failures;
+    spsc_init(&ring, ring_storage, sizeof(uint32_t), RING_SIZE);
+    uint32_t items = 2000000;
+    pthread_t thread;
+    pthread_create(&thread, NULL, producer, &items);
+    uint32_t expect = 0, v, out_of_order = 0;
+    while (expect < items) {
+        if (spsc_pop(&ring, &v)) {
+            out_of_order += v != expect;
+            expect = v + 1;
+        } else {
+            sched_yield();
+        }
+    }
+    pthread_join(thread, NULL);
+    CHECK(out_of_order == 0, "%u records out of order", out_of_order);
+    CHECK(!spsc_pop(&ring, &v), "records left over");
+    CHECK(atomic_load(&ring.pushed) == items, "pushed %u, want %u", atomic_load(&ring.pushed), items);
+    CHECK(atomic_load(&ring.dropped) == producer_full, "dropped %u, producer saw %u refusals",
+          atomic_load(&ring.dropped), producer_full);
+    report("two threads in order", before);
+}
+
+// Without readers every write but the first replaces an unread value
+static void test_overwritten(void) {
+    int before = failures;
+    latest_slot_t slot;
+    uint32_t in[2] = { 0, 0 }, out[2];
+    latest_slot_init(&slot, in, sizeof(in));
+    for (uint32_t i = 1; i <= 3; i++) {
+        in[0] = in[1] = i;
+        latest_slot_write(&slot, in);
+    }
+    CHECK(atomic_load(&slot.overwritten) == 2, "overwritten %u, want 2", atomic_load(&slot.overwritten));
+    uint32_t version = latest_slot_read(&slot, out);
+    CHECK(out[0] == 3 && out[1] == 3, "read %u %u, want 3 3", out[0], out[1]);
+    CHECK(latest_slot_read(&slot, out) == version, "version changed without a write");
+    in[0] = in[1] = 4;
+    latest_slot_write(&slot, in);
+    CHECK(atomic_load(&slot.overwritten) == 2, "a value that was read counted as overwritten");
+    CHECK(latest_slot_read(&slot, out) != version && out[0] == 4, "new value not seen");
+    // The writer looking at its own value is not a reader picking it up
+    latest_slot_peek(&slot, out);
+    CHECK(out[0] == 4 && out[1] == 4, "peeked %u %u, want 4 4", out[0], out[1]);
+    in[0] = in[1] = 5;
+    latest_slot_write(&slot, in);
+    latest_slot_peek(&slot, out);
+    in[0] = in[1] = 6;
+    latest_slot_write(&slot, in);
+    CHECK(atomic_load(&slot.overwritten) == 3, "overwritten %u after a peek, want 3", atomic_load(&slot.overwritten));
+    report("slot overwrite count", before);
+}
+
+static latest_slot_t slot;
+static _Atomic bool running;
+
+typedef struct {
+    uint64_t reads;
+    uint64_t torn;
+    uint64_t backwards;
+} reader_stats_t;
+
+static void *slot_writer(void *arg) {
+    latest_slot_t *slot = arg;
+    uint32_t value[SLOT_WORDS];
+    for (uint32_t n = 1; atomic_load_explicit(&running, memory_order_relaxed); n++) {
+        for (size_t i = 0; i < SLOT_WORDS; i++) {
+            value[i] = n;
+        }
+        latest_slot_write(slot, value);
+    }
+    return NULL;
+}
+
+// Every word of a value is the same, and values only ever go up
+static void *slot_reader(void *arg) {
+    reader_stats_t *st = arg;
+    uint32_t value[SLOT_WORDS], last = 0;
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        latest_slot_read(&slot, value);
+        for (size_t i = 1; i < SLOT_WORDS; i++) {
+            if (value[i] != value[0]) {
+                st->torn++;
+                break;
+            }
+        }
+        st->backwards += value[0] < last;
+        last = value[0];
+        st->reads++;
+    }
+    return NULL;
+}
+
+static void test_torn(double seconds) {
+    int before = failures;
+    uint32_t zero[SLOT_WORDS] = {0};
+    latest_slot_init(&slot, zero, sizeof(zero));
+    reader_stats_t stats[MAX_READERS] = {0};
+    pthread_t writer, readers[MAX_READERS];
+    atomic_store(&running, true);
+    pthread_create(&writer, NULL, slot_writer, &slot);
+    for (int r = 0; r < MAX_READERS; r++) {
+        pthread_create(&readers[r], NULL, slot_reader, &stats[r]);
+    }
+    struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+    atomic_store(&running, false);
+    pthread_join(writer, NULL);
+    reader_stats_t total = {0};
+    for (int r = 0; r < MAX_READERS; r++) {
+        pthread_join(readers[r], NULL);
+        total.reads += stats[r].reads;
+        total.torn += stats[r].torn;
+        total.backwards += stats[r].backwards;
+    }
+    CHECK(total.reads > 0, "no reads");
+    CHECK(total.torn == 0, "%llu torn reads of %llu", (unsigned long long)total.torn,
+          (unsigned long long)total.reads);
+    CHECK(total.backwards == 0, "%llu reads went back", (unsigned long long)total.backwards);
+    report("slot torn reads", before);
+}
+
+int main(int argc, char **argv) {
+    double seconds = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds N]\n", argv[0]);
+            return 2;
+        }
+    }
+    test_init();
+    test_full();
+    test_wrap();
+    test_threads();
+    test_overwritten();
+    test_torn(seconds);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+// Compares the sample payload formats: the original one-publish-per-beat "%d", the
+// "<t0>|<dt>:<bpm>,..." text batches and the tscodec bit stream, on a few synthetic
+// heart-rate series. Reports size per sample and encode/decode cost.
+//
+//   codec_bench [--samples N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sensor.h"
+#include "batch.h"
+#include "tscodec.h"
+
+typedef struct {
+    const char *name;
+    uint32_t *ts;
+    int32_t *bpm;
+    size_t n;
+} series_t;
+
+static double wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void make_series(series_t *s, const char *name, size_t n, int kind) {
+    s->name = name;
+    s->n = n;
+    s->ts = malloc(n * sizeof(*s->ts));
+    s->bpm = malloc(n * sizeof(*s->bpm));
+    uint32_t t = 1000;
+    double bpm = 72;
+    for (size_t i = 0; i < n; i++) {
+        int jitter = 0;
+        if (kind == 1) {
+            // Resting: BPM drifts by a beat now and then, intervals jitter a little
+            bpm += (rand() % 3) - 1;
+            if (bpm < 55) bpm = 55;
+            if (bpm > 90) bpm = 90;
+            jitter = (rand() % 41) - 20;
+        } else if (kind == 2) {
+            // Exercise: ramps up and back down, bigger jitter
+            bpm = 70 + 90 * (i < n / 2 ? (double)i / (n / 2) : (double)(n - i) / (n / 2));
+            jitter = (rand() % 81) - 40;
+        }
+        int ibi = (int)(60000 / bpm) + jitter;
+        t += (uint32_t)ibi;
+        s->ts[i] = t;
+        s->bpm[i] = (int32_t)bpm;
+    }
+}
+
+// The text batch format data_send_task used before tscodec
+static size_t text_encode(const series_t *s, size_t from, size_t count, char *buf, size_t len) {
+    int used = snprintf(buf, len, "%lu|", (unsigned long)s->ts[from]);
+    uint32_t prev = s->ts[from];
+    for (size_t i = from; i < from + count; i++) {
+        used += snprintf(buf + used, len - used, "%s%lu:%ld", i > from ? "," : "",
+                         (unsigned long)(s->ts[i] - prev), (long)s->bpm[i]);
+        prev = s->ts[i];
+    }
+    return (size_t)used;
+}
+
+static void run(const series_t *s, size_t batch) {
+    static char text[1 << 16];
+    size_t batches = (s->n + batch - 1) / batch;
+    // Worst case is 35 + 38 bits per sample plus a header per batch
+    size_t buf_len = s->n * 10 + batches * (TSCODEC_HEADER_SIZE + 1);
+    uint8_t *buf = malloc(buf_len);
+    size_t *offsets = malloc((batches + 1) * sizeof(*offsets));
+    volatile size_t sink = 0;
+
+    // "%d" per beat (no timestamp at all)
+    double t0 = wall_ns();
+    size_t plain_bytes = 0;
+    for (size_t i = 0; i < s->n; i++) {
+        plain_bytes += (size_t)snprintf(text, sizeof(text), "%d", (int)s->bpm[i]);
+    }
+    double plain_ns = (wall_ns() - t0) / s->n;
+
+    // Text batches
+    t0 = wall_ns();
+    size_t text_bytes = 0;
+    for (size_t b = 0; b < batches; b++) {
+        size_t from = b * batch;
+        size_t count = from + batch > s->n ? s->n - from : batch;
+        text_bytes += text_encode(s, from, count, text, sizeof(text));
+    }
+    double text_ns = (wall_ns() - t0) / s->n;
+
+    // tscodec batches, then decode them again and check every sample
+    size_t codec_bytes = 0;
+    t0 = wall_ns();
+    for (size_t b = 0; b < batches; b++) {
+        size_t from = b * batch;
+        size_t count = from + batch > s->n ? s->n - from : batch;
+        ts_encoder_t enc;
+        ts_encoder_init(&enc, buf + codec_bytes, buf_len - codec_bytes);
+        for (size_t i = from; i < from + count; i++) {
+            if (!ts_encode(&enc, s->ts[i], s->bpm[i])) {
+                fprintf(stderr, "encode ran out of space\n");
+                exit(1);
+            }
+        }
+        offsets[b] = codec_bytes;
+        codec_bytes += ts_encoder_finish(&enc);
+    }
+    double codec_ns = (wall_ns() - t0) / s->n;
+    offsets[batches] = codec_bytes;
+
+    t0 = wall_ns();
+    size_t decoded = 0, wrong = 0;
+    for (size_t b = 0; b < batches; b++) {
+        ts_decoder_t dec;
+        ts_decoder_init(&dec, buf + offsets[b], offsets[b + 1] - offsets[b]);
+        uint32_t t;
+        int32_t v;
+        while (ts_decode(&dec, &t, &v)) {
+            wrong += t != s->ts[decoded] || v != s->bpm[decoded];
+            decoded++;
+        }
+        sink += ts_decoder_used(&dec);
+    }
+    double decode_ns = (wall_ns() - t0) / s->n;
+
+    printf("%-9s batch %-5zu %%d %.2f B (%3.0f ns) | text %.2f B (%3.0f ns) | tscodec %.2f B = %.1f bits (%3.0f ns enc, %3.0f ns dec), %.1fx smaller than text%s\n",
+           s->name, batch,
+           (double)plain_bytes / s->n, plain_ns,
+           (double)text_bytes / s->n, text_ns,
+           (double)codec_bytes / s->n, codec_bytes * 8.0 / s->n, codec_ns, decode_ns,
+           (double)text_bytes / codec_bytes,
+           decoded == s->n && wrong == 0 ? "" : "  ROUND TRIP FAILED");
+    (void)sink;
+    free(buf);
+    free(offsets);
+}
+
+int main(int argc, char **argv) {
+    size_t n = 100000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            n = (size_t)atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--samples N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    srand(1);
+    series_t series[3];
+    make_series(&series[0], "stable", n, 0);
+    make_series(&series[1], "resting", n, 1);
+    make_series(&series[2], "exercise", n, 2);
+
+    printf("bytes per sample (and cost per sample) for %zu samples\n", n);
+    for (int i = 0; i < 3; i++) {
+        run(&series[i], BATCH_MAX_SAMPLES);
+        run(&series[i], 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+// Benchmark of the inbound command path (command.c): cost of routing, parsing and
+// queueing one command compared to the old copy + strtol handler, reassembly of
+// fragmented calibration blobs, and a producer/consumer run across two threads the
+// way the MQTT and sensor tasks use it. Exits 1 if a command came out corrupt or out
+// of order.
+//
+//   command_bench [--commands N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "esp_log.h"
+#include "command.h"
+
+#define BUFFER_SIZE 1024    // receive buffer of the MQTT client, bigger messages come in pieces
+
+static double wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Delivers a message the way ESP-MQTT does: in BUFFER_SIZE pieces, topic on the first one only
+static void deliver(const char *topic, const void *data, int len) {
+    int offset = 0;
+    do {
+        int chunk = len - offset > BUFFER_SIZE ? BUFFER_SIZE : len - offset;
+        esp_mqtt_event_t event = {
+            .event_id = MQTT_EVENT_DATA,
+            .topic = offset == 0 ? (char *)topic : NULL,
+            .topic_len = offset == 0 ? (int)strlen(topic) : 0,
+            .data = (char *)data + offset,
+            .data_len = chunk,
+            .total_data_len = len,
+            .current_data_offset = offset,
+        };
+        command_handle_event(&event);
+        offset += chunk;
+    } while (offset < len);
+}
+
+static void drain(void) {
+    command_t cmd;
+    for (int owner = 0; owner < CMD_OWNER_COUNT; owner++) {
+        while (command_take(owner, &cmd)) {
+            command_release(&cmd);
+        }
+    }
+}
+
+// What the MQTT handler did before: copy into a stack buffer and strtol it
+static volatile long old_sink;
+static void old_handler(const char *data, int len) {
+    char buffer[16] = {0};
+    snprintf(buffer, sizeof(buffer), "%.*s", len, data);
+    char *end = NULL;
+    long bpm = strtol(buffer, &end, 10);
+    if (end != buffer && *end == '\0') {
+        old_sink = bpm;
+    }
+}
+
+static void bench_small(uint32_t n) {
+    static const struct { const char *topic; const char *payload; } msgs[] = {
+        { "hexagon", "72" },
+        { COMMAND_TOPIC_PREFIX "bpm", "150" },
+        { COMMAND_TOPIC_PREFIX "policy", "2:30000:5000:120:40" },
+        { COMMAND_TOPIC_PREFIX "alarm", "130,45" },
+    };
+    command_init();
+
+    double t0 = wall_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        old_handler(msgs[i & 1].payload, (int)strlen(msgs[i & 1].payload));
+    }
+    double old_ns = (wall_ns() - t0) / n;
+
+    t0 = wall_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        deliver(msgs[i & 3].topic, msgs[i & 3].payload, (int)strlen(msgs[i & 3].payload));
+        if ((i & 3) == 3) {
+            drain();
+        }
+    }
+    double new_ns = (wall_ns() - t0) / n;
+
+    printf("small    old copy+strtol %.0f ns (BPM only, no routing) | route+parse+queue %.0f ns, %lu dispatched, %lu bad\n",
+           old_ns, new_ns, (unsigned long)command_stats.dispatched, (unsigned long)command_stats.bad_payload);
+}
+
+static void fill(uint8_t *blob, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        blob[i] = (uint8_t)(seed * 31 + i * 7);
+    }
+}
+
+static bool check(const command_t *cmd, uint32_t seed) {
+    uint8_t expect[COMMAND_BLOB_SIZE];
+    fill(expect, cmd->len, seed);
+    const uint8_t *blob = command_blob(cmd);
+    return blob != NULL && memcmp(blob, expect, cmd->len) == 0;
+}
+
+static void bench_blobs(uint32_t n) {
+    static uint8_t blob[8192];
+    command_t cmd;
+    command_init();
+
+    // Reassembly of blobs that need two fragments
+    size_t len = COMMAND_BLOB_SIZE;
+    uint32_t good = 0;
+    double t0 = wall_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        fill(blob, len, i);
+        deliver(COMMAND_TOPIC_PREFIX "calibration", blob, (int)len);
+        if (command_take(CMD_OWNER_SENSOR, &cmd)) {
+            good += cmd.len == len && check(&cmd, i);
+            command_release(&cmd);
+        }
+    }
+    double ns = (wall_ns() - t0) / n;
+    printf("blobs    %u byte calibration in 2 fragments: %.0f ns each (%.2f GB/s), %lu of %lu intact\n",
+           (unsigned)len, ns, len / ns, (unsigned long)good, (unsigned long)n);
+
+    // Broken input: too big, a fragment missing, all blobs still held by the owner
+    command_init();
+    deliver(COMMAND_TOPIC_PREFIX "calibration", blob, COMMAND_BLOB_SIZE + 1);
+    esp_mqtt_event_t first = {
+        .topic = COMMAND_TOPIC_PREFIX "calibration", .topic_len = sizeof(COMMAND_TOPIC_PREFIX "calibration") - 1,
+        .data = (char *)blob, .data_len = BUFFER_SIZE, .total_data_len = 1500,
+    };
+    command_handle_event(&first);
+    deliver(COMMAND_TOPIC_PREFIX "bpm", "80", 2);
+    for (int i = 0; i < COMMAND_BLOB_COUNT + 1; i++) {
+        deliver(COMMAND_TOPIC_PREFIX "calibration", blob, 100);
+    }
+    deliver(COMMAND_TOPIC_PREFIX "nope", "1", 1);
+    deliver(COMMAND_TOPIC_PREFIX "policy", "1:2:3", 5);
+    deliver(COMMAND_TOPIC_PREFIX "bpm", "-5", 2);
+    printf("errors   too big %lu, incomplete %lu, unknown topic %lu, bad payload %lu (expected 2, 1, 1, 2)\n",
+           (unsigned long)command_stats.too_big, (unsigned long)command_stats.incomplete,
+           (unsigned long)command_stats.unknown_topic, (unsigned long)command_stats.bad_payload);
+    drain();
+}
+
+// Two threads: this one plays the MQTT task, the consumer plays the sensor task
+static _Atomic bool producing;
+static uint32_t consumed, corrupt, out_of_order;
+
+static void *consumer(void *arg) {
+    (void)arg;
+    command_t cmd;
+    int32_t last = -1;
+    while (1) {
+        bool done = !atomic_load(&producing);
+        if (!command_take(CMD_OWNER_SENSOR, &cmd)) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        if (cmd.id == CMD_CALIBRATION) {
+            // The sequence number is in the first 4 bytes
+            uint32_t seq;
+            memcpy(&seq, command_blob(&cmd), sizeof(seq));
+            uint8_t expect[COMMAND_BLOB_SIZE];
+            fill(expect, cmd.len, seq);
+            corrupt += memcmp(command_blob(&cmd) + 4, expect + 4, cmd.len - 4) != 0;
+            command_release(&cmd);
+        } else {
+            out_of_order += cmd.args[0] <= last;
+            last = cmd.args[0];
+        }
+        consumed++;
+    }
+    return NULL;
+}
+
+static void bench_threads(uint32_t n) {
+    static uint8_t blob[1500];
+    char text[16];
+    command_init();
+    atomic_store(&producing, true);
+    pthread_t thread;
+    pthread_create(&thread, NULL, consumer, NULL);
+
+    double t0 = wall_ns();
+    for (uint32_t i = 0; i < n; i++) {
+        if (i % 8 == 0) {
+            fill(blob, sizeof(blob), i);
+            memcpy(blob, &i, sizeof(i));
+            deliver(COMMAND_TOPIC_PREFIX "calibration", blob, sizeof(blob));
+        } else {
+            int len = snprintf(text, sizeof(text), "%lu", (unsigned long)i);
+            deliver(COMMAND_TOPIC_PREFIX "bpm", text, len);
+        }
+        // The MQTT task waits for the network between messages
+        sched_yield();
+    }
+    double ns = (wall_ns() - t0) / n;
+    atomic_store(&producing, false);
+    pthread_join(thread, NULL);
+
+    printf("threads  %lu sent, %lu consumed, %lu dropped (queue full %lu, no blob %lu), %lu corrupt, %lu out of order, %.0f ns per send\n",
+           (unsigned long)n, (unsigned long)consumed,
+           (unsigned long)(command_stats.queue_full + command_stats.too_big),
+           (unsigned long)command_stats.queue_full, (unsigned long)command_stats.too_big,
+           (unsigned long)corrupt, (unsigned long)out_of_order, ns);
+}
+
+int main(int argc, char **argv) {
+    uint32_t n = 1000000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--commands") == 0 && i + 1 < argc) {
+            n = (uint32_t)atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--commands N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    bench_small(n);
+    bench_blobs(n / 10);
+    bench_threads(n);
+    return corrupt || out_of_order ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+// Checks of the inbound command path (command.c): topic lookup including topics that
+// land on a taken hash slot, and the reassembly of fragmented messages when a fragment
+// doesn't follow on, a message is too big, a whole message cuts into a fragmented one
+// and both blobs are held by their owner. Run by ctest.
+//
+//   command_test
+//
+// Prints one line per check and exits 1 if any of them failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "command.h"
+
+#define CALIBRATION COMMAND_TOPIC_PREFIX "calibration"
+
+static int failures;
+
+#define CHECK(cond, ...) do {                   \
+        if (!(cond)) {                          \
+            printf("  FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                \
+            printf("\n");                       \
+            failures++;                         \
+        }                                       \
+    } while (0)
+
+static void report(const char *name, int failures_before) {
+    printf("%-28s %s\n", name, failures == failures_before ? "ok" : "FAILED");
+}
+
+// One MQTT_EVENT_DATA: len bytes of a total-byte message at offset, topic on the first one only
+static bool event(const char *topic, const uint8_t *data, size_t offset, size_t len, size_t total) {
+    esp_mqtt_event_t e = {
+        .event_id = MQTT_EVENT_DATA,
+        .topic = offset == 0 ? (char *)topic : NULL,
+        .topic_len = offset == 0 ? (int)strlen(topic) : 0,
+        .data = (char *)data + offset,
+        .data_len = (int)len,
+        .total_data_len = (int)total,
+        .current_data_offset = (int)offset,
+    };
+    return command_handle_event(&e);
+}
+
+static bool text(const char *topic, const char *payload) {
+    return event(topic, (const uint8_t *)payload, 0, strlen(payload), strlen(payload));
+}
+
+// A whole message in pieces of chunk bytes
+static void pieces(const char *topic, const uint8_t *data, size_t len, size_t chunk) {
+    for (size_t offset = 0; offset < len; offset += chunk) {
+        event(topic, data, offset, len - offset < chunk ? len - offset : chunk, len);
+    }
+}
+
+static uint8_t payload[2 * COMMAND_BLOB_SIZE];
+
+static void fill(uint8_t seed) {
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t)(seed + i * 7);
+    }
+}
+
+// The next command for the sensor task, checked for its blob contents
+static bool take_blob(command_t *cmd, uint8_t seed, size_t len) {
+    if (!command_take(CMD_OWNER_SENSOR, cmd) || cmd->id != CMD_CALIBRATION || cmd->len != len) {
+        return false;
+    }
+    fill(seed);
+    return command_blob(cmd) != NULL && memcmp(command_blob(cmd), payload, len) == 0;
+}
+
+static bool nothing_queued(void) {
+    command_t cmd;
+    return !command_take(CMD_OWNER_SENSOR, &cmd) && !command_take(CMD_OWNER_DATA_SEND, &cmd);
+}
+
+// command.c's topic hash (FNV-1a) and table size, to find topics that land on a route's slot
+#define ROUTE_SLOTS 16
+
+static uint32_t topic_hash(const char *topic) {
+    uint32_t h = 2166136261u;
+    for (; *topic; topic++) {
+        h = (h ^ (uint8_t)*topic) * 16777619u;
+    }
+    return h;
+}
+
+static void test_routes(void) {
+    int before = failures;
+    command_init();
+    static const struct {
+        const char *topic;
+        const char *payload;
+        command_owner_t owner;
+        command_id_t id;
+        int argc;
+    } good[] = {
+        { "hexagon", "72", CMD_OWNER_SENSOR, CMD_BPM_OVERRIDE, 1 },
+        { COMMAND_TOPIC_PREFIX "bpm", "80\n", CMD_OWNER_SENSOR, CMD_BPM_OVERRIDE, 1 },
+        { COMMAND_TOPIC_PREFIX "policy", "2:30000:5000:120:40", CMD_OWNER_DATA_SEND, CMD_PUBLISH_POLICY, 5 },
+        { COMMAND_TOPIC_PREFIX "alarm", "130,45", CMD_OWNER_DATA_SEND, CMD_ALARM_LIMITS, 2 },
+        { COMMAND_TOPIC_PREFIX "agg", "60000 10000 1", CMD_OWNER_DATA_SEND, CMD_AGGREGATION, 3 },
+    };
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+        command_t cmd;
+        CHECK(text(good[i].topic, good[i].payload), "%s not taken", good[i].topic);
+        CHECK(command_take(good[i].owner, &cmd) && cmd.id == good[i].id && cmd.argc == good[i].argc &&
+              cmd.blob == COMMAND_NO_BLOB, "%s came out wrong", good[i].topic);
+    }
+    fill(1);
+    CHECK(event(CALIBRATION, payload, 0, 10, 10), "calibration not taken");
+    command_t cmd;
+    CHECK(take_blob(&cmd, 1, 10), "calibration blob wrong");
+    command_release(&cmd);
+    CHECK(command_stats.dispatched == 6, "dispatched %u", command_stats.dispatched);
+
+    // Near misses of a route, and topics that hash to a slot a route already has: the
+    // probe must go past them by comparing the topic, not just the slot
+    CHECK(!text("hexago", "72") && !text("hexagon/", "72") && !text("other/topic", "72"), "non-command topic taken");
+    CHECK(text(COMMAND_TOPIC_PREFIX "bp", "72") && text(COMMAND_TOPIC_PREFIX "bpmx", "72"), "unknown command topic not claimed");
+    int colliding = 0;
+    char topic[48];
+    for (size_t r = 0; r < sizeof(good) / sizeof(good[0]); r++) {
+        uint32_t slot = topic_hash(good[r].topic) & (ROUTE_SLOTS - 1);
+        for (int i = 0, found = 0; found < 4 && i < 100000; i++) {
+            snprintf(topic, sizeof(topic), COMMAND_TOPIC_PREFIX "x%d", i);
+            if ((topic_hash(topic) & (ROUTE_SLOTS - 1)) == slot) {
+                CHECK(text(topic, "72"), "%s not claimed", topic);
+                found++;
+                colliding++;
+            }
+        }
+    }
+    CHECK(colliding == 4 * (int)(sizeof(good) / sizeof(good[0])), "%d colliding topics found", colliding);
+    CHECK(command_stats.unknown_topic == 2 + (uint32_t)colliding, "unknown_topic %u, want %d",
+          command_stats.unknown_topic, 2 + colliding);
+    CHECK(nothing_queued(), "an unknown topic was dispatched");
+
+    // Bad payloads on a known topic
+    CHECK(text(COMMAND_TOPIC_PREFIX "bpm", "7x") && text(COMMAND_TOPIC_PREFIX "alarm", "130") &&
+          text(COMMAND_TOPIC_PREFIX "bpm", "72:") && text(COMMAND_TOPIC_PREFIX "bpm", "1234567890"),
+          "bad payload not claimed");
+    CHECK(command_stats.bad_payload == 4, "bad_payload %u", command_stats.bad_payload);
+    CHECK(nothing_queued(), "a bad payload was dispatched");
+    report("routes and hash collisions", before);
+}
+
+static void test_fragments(void) {
+    int before = failures;
+    command_t cmd;
+    command_init();
+
+    // In order, in odd pieces
+    fill(2);
+    pieces(CALIBRATION, payload, 1500, 333);
+    CHECK(take_blob(&cmd, 2, 1500), "reassembled blob wrong");
+    command_release(&cmd);
+    // Small commands in pieces need a blob too
+    pieces(COMMAND_TOPIC_PREFIX "policy", (const uint8_t *)"2:30000:5000:120:40", 19, 4);
+    CHECK(command_take(CMD_OWNER_DATA_SEND, &cmd) && cmd.argc == 5 && cmd.args[1] == 30000,
+          "fragmented policy wrong");
+    CHECK(command_stats.incomplete == 0, "incomplete %u", command_stats.incomplete);
+
+    // A fragment that doesn't follow on: dropped, blob freed, the rest ignored
+    fill(3);
+    event(CALIBRATION, payload, 0, 500, 1500);
+    event(NULL, payload, 600, 500, 1500);
+    CHECK(command_stats.incomplete == 1, "gap: incomplete %u", command_stats.incomplete);
+    CHECK(!event(NULL, payload, 1100, 400, 1500), "fragment after a dropped message claimed");
+    // One running past the end of its message
+    event(CALIBRATION, payload, 0, 500, 1000);
+    event(NULL, payload, 500, 600, 1000);
+    CHECK(command_stats.incomplete == 2, "overrun: incomplete %u", command_stats.incomplete);
+    CHECK(nothing_queued(), "a broken message was dispatched");
+
+    // A whole command while a fragmented one is missing pieces: the old one is dropped,
+    // the new one goes through
+    event(CALIBRATION, payload, 0, 500, 1500);
+    CHECK(text(COMMAND_TOPIC_PREFIX "bpm", "90"), "whole command not taken");
+    CHECK(command_stats.incomplete == 3, "cut in: incomplete %u", command_stats.incomplete);
+    CHECK(command_take(CMD_OWNER_SENSOR, &cmd) && cmd.id == CMD_BPM_OVERRIDE && cmd.args[0] == 90,
+          "whole command lost");
+    CHECK(!event(NULL, payload, 500, 500, 1500), "rest of the dropped message claimed");
+
+    // Every blob freed above: both can be held at once now
+    command_t held[COMMAND_BLOB_COUNT];
+    for (int i = 0; i < COMMAND_BLOB_COUNT; i++) {
+        fill((uint8_t)(10 + i));
+        pieces(CALIBRATION, payload, 1200, 1000);
+        CHECK(take_blob(&held[i], (uint8_t)(10 + i), 1200), "blob %d after the broken messages wrong", i);
+    }
+
+    // With both held the next blob has nowhere to go, all of its pieces are swallowed
+    uint32_t too_big = command_stats.too_big;
+    fill(20);
+    pieces(CALIBRATION, payload, 1200, 1000);
+    event(CALIBRATION, payload, 0, 10, 10);
+    CHECK(command_stats.too_big == too_big + 2, "too_big %u, want %u", command_stats.too_big, too_big + 2);
+    CHECK(nothing_queued(), "a blob without a buffer was dispatched");
+    // Plain commands don't need one
+    CHECK(text(COMMAND_TOPIC_PREFIX "bpm", "91") && command_take(CMD_OWNER_SENSOR, &cmd) && cmd.args[0] == 91,
+          "plain command blocked by held blobs");
+    // Giving one back makes room again, and the other one is untouched
+    command_release(&held[0]);
+    fill(21);
+    pieces(CALIBRATION, payload, 1200, 1000);
+    CHECK(take_blob(&cmd, 21, 1200), "blob after a release wrong");
+    fill(11);
+    CHECK(memcmp(command_blob(&held[1]), payload, 1200) == 0, "held blob overwritten");
+    command_release(&cmd);
+    command_release(&held[1]);
+
+    // Bigger than a blob: dropped whole, without touching the blobs
+    too_big = command_stats.too_big;
+    fill(30);
+    pieces(CALIBRATION, payload, COMMAND_BLOB_SIZE + 1, 1000);
+    CHECK(command_stats.too_big == too_big + 1, "oversize: too_big %u", command_stats.too_big);
+    CHECK(command_stats.incomplete == 3, "oversize counted as incomplete");
+    CHECK(nothing_queued(), "an oversize message was dispatched");
+    pieces(CALIBRATION, payload, COMMAND_BLOB_SIZE, 1000);
+    CHECK(take_blob(&held[0], 30, COMMAND_BLOB_SIZE), "blob of exactly COMMAND_BLOB_SIZE wrong");
+    pieces(CALIBRATION, payload, COMMAND_BLOB_SIZE, 1000);
+    CHECK(take_blob(&held[1], 30, COMMAND_BLOB_SIZE), "second full blob wrong");
+    command_release(&held[0]);
+    command_release(&held[1]);
+    report("fragments and blobs", before);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        fprintf(stderr, "usage: %s\n", argv[0]);
+        return 2;
+    }
+    esp_log_level_set("*", ESP_LOG_NONE);
+    test_routes();
+    test_fragments();
+    return failures ? 1 : 0;
+}
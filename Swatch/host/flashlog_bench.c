@@ -0,0 +1,163 @@
+// Benchmark of the offline store (flashlog.c) against a file-backed partition: append
+// throughput and wear, boot scan time, and replay throughput.
+//
+//   flashlog_bench [--records N] [--size KB] [--file PATH]
+//
+// Flash timings on the chip are estimated from typical SPI NOR figures, the host only
+// shows how much work the code asks the flash to do.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "host_standins.h"
+#include "batch.h"
+#include "flashlog.h"
+
+#define LABEL "hrlog"
+
+// Typical SPI NOR figures (erase 4 KB sector, program one 256 byte page)
+#define CHIP_ERASE_US 45000.0
+#define CHIP_PAGE_PROGRAM_US 700.0
+
+static double wall_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// One realistic payload: BATCH_MAX_SAMPLES beats encoded the way data_send_task does it
+static size_t make_payload(uint8_t *buf, size_t len, uint32_t *t) {
+    static bpm_batch_t batch;
+    batch_init(&batch, BATCH_MAX_SAMPLES, BATCH_MAX_AGE_MS);
+    for (int i = 0; i < BATCH_MAX_SAMPLES; i++) {
+        int bpm = 60 + rand() % 40;
+        *t += 60000 / bpm;
+        bpm_sample_t s = { .timestamp_ms = *t, .bpm = bpm, .ibi_ms = 60000 / bpm };
+        batch_add(&batch, &s);
+    }
+    uint16_t encoded;
+    return batch_encode(&batch, buf, len, &encoded);
+}
+
+static void print_flash(const char *what, const host_partition_stats_t *before, uint64_t payload_bytes) {
+    host_partition_stats_t now;
+    host_partition_get_stats(LABEL, &now);
+    uint64_t written = now.bytes_written - before->bytes_written;
+    uint32_t erases = now.sector_erases - before->sector_erases;
+    uint32_t writes = now.write_calls - before->write_calls;
+    // Every write call programs at least one page, long ones one per 256 bytes
+    double pages = writes + written / 256.0;
+    printf("  %-8s %lu write calls, %.1f KB written", what, (unsigned long)writes, written / 1024.0);
+    if (payload_bytes) {
+        printf(" (%.2fx the payload)", (double)written / payload_bytes);
+    }
+    printf(", %lu erases, est. %.1f ms on chip\n", (unsigned long)erases,
+           (erases * CHIP_ERASE_US + pages * CHIP_PAGE_PROGRAM_US) / 1000.0);
+}
+
+int main(int argc, char **argv) {
+    uint32_t records = 20000;
+    uint32_t size_kb = 256;
+    char path[256];
+    snprintf(path, sizeof(path), "/tmp/flashlog_bench_%d.bin", (int)getpid());
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--records") == 0 && i + 1 < argc) {
+            records = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size_kb = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+            snprintf(path, sizeof(path), "%s", argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--records N] [--size KB] [--file PATH]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    unlink(path);
+    if (!host_partition_add(LABEL, path, size_kb * 1024)) {
+        fprintf(stderr, "can't create %s\n", path);
+        return 1;
+    }
+
+    static flashlog_t log;
+    static uint8_t payload[BATCH_PAYLOAD_MAX];
+    static uint8_t replay[2048];
+    host_partition_stats_t mark;
+
+    // Append path
+    if (flashlog_open(&log, LABEL) != ESP_OK) {
+        return 1;
+    }
+    host_partition_get_stats(LABEL, &mark);
+    uint32_t t = 0;
+    uint64_t payload_bytes = 0;
+    double worst_us = 0;
+    double start = wall_us();
+    for (uint32_t i = 0; i < records; i++) {
+        size_t len = make_payload(payload, sizeof(payload), &t);
+        double t0 = wall_us();
+        if (flashlog_append(&log, payload, len) != ESP_OK) {
+            fprintf(stderr, "append %lu failed\n", (unsigned long)i);
+            return 1;
+        }
+        double us = wall_us() - t0;
+        if (us > worst_us) {
+            worst_us = us;
+        }
+        payload_bytes += len;
+    }
+    double append_us = wall_us() - start;
+    printf("append   %lu records (%.0f bytes avg) into %lu KB: %.0f records/s, worst %.0f us\n",
+           (unsigned long)records, (double)payload_bytes / records, (unsigned long)size_kb,
+           records / (append_us / 1e6), worst_us);
+    print_flash("flash", &mark, payload_bytes);
+    printf("  kept %lu, lost %lu to wrap-around\n", (unsigned long)log.pending, (unsigned long)log.lost);
+
+    // Boot scan
+    uint32_t kept = log.pending;
+    start = wall_us();
+    if (flashlog_open(&log, LABEL) != ESP_OK) {
+        return 1;
+    }
+    printf("reopen   %.2f ms, found %lu unsent records%s\n", (wall_us() - start) / 1000.0,
+           (unsigned long)log.pending, log.pending == kept ? "" : " (MISMATCH)");
+
+    // Replay path
+    host_partition_get_stats(LABEL, &mark);
+    uint32_t publishes = 0;
+    uint64_t replay_bytes = 0;
+    start = wall_us();
+    while (log.pending > 0) {
+        flashlog_span_t span;
+        size_t len = flashlog_read(&log, replay, sizeof(replay), &span);
+        if (span.records == 0 && span.skipped == 0) {
+            break;
+        }
+        flashlog_consume(&log, &span);
+        replay_bytes += len;
+        publishes++;
+    }
+    double replay_us = wall_us() - start;
+    printf("replay   %lu records in %lu payloads (%.0f bytes avg): %.0f records/s, %.1f MB/s, %lu corrupt\n",
+           (unsigned long)log.replayed, (unsigned long)publishes,
+           publishes ? (double)replay_bytes / publishes : 0.0,
+           log.replayed / (replay_us / 1e6), replay_bytes / replay_us, (unsigned long)log.corrupt);
+    print_flash("flash", &mark, 0);
+
+    // Nothing may come back after a reboot once it was replayed
+    flashlog_open(&log, LABEL);
+    printf("reopen   %lu unsent records after replay\n", (unsigned long)log.pending);
+
+    host_partition_stats_t all;
+    host_partition_get_stats(LABEL, &all);
+    printf("wear     %lu..%lu erases per sector, %lu writes over programmed bits\n",
+           (unsigned long)all.min_sector_erases, (unsigned long)all.max_sector_erases,
+           (unsigned long)all.bit_set_attempts);
+
+    unlink(path);
+    return 0;
+}
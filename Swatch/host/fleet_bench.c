@@ -0,0 +1,672 @@
+// Fleet simulator: N watches in one process against a broker stand-in, to size a broker
+// and to see what a firmware change does at fleet scale, without hardware and without
+// the public broker in MQTT_BROKER_URI.
+//
+//   fleet_bench [--watches N] [--seconds N] [--broker-rate MSG_PER_S] [--rtt MS]
+//               [--drops PER_WATCH_HOUR] [--drop-len S] [--outage AT:LEN] [--qos 0|1] [--seed N]
+//
+// Every watch runs data_send_task's loop (sendloop.c), one instance each: the publish
+// scheduler, the sample batch and its tscodec encoding, the window statistics, the outbox
+// with its QoS 1 window and a flash log (in RAM) for what can't be sent. Beats come from a random
+// walk per watch with an exercise bout now and then, instead of the PPG. Everything is in
+// simulated time on one thread, so a run takes far less than it simulates.
+//
+// The broker takes --broker-rate messages per second (0 = no limit), in arrival order,
+// each one RTT/2 after it was sent, and sends the PUBACK back after another RTT/2. A
+// CONNECT costs it one message too, so a reconnect storm after --outage shows up in the
+// queue. --drops disconnects each watch at random that often per hour, for --drop-len
+// seconds. A watch retries a failed connect every MQTT_RECONNECT_MS, as ESP-MQTT does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "batch.h"
+#include "publish.h"
+#include "aggregate.h"
+#include "sendloop.h"
+#include "metrics.h"
+#include "tscodec.h"
+#include "esp_log.h"
+#include "host_standins.h"
+
+#define MAX_WATCHES 1000
+#define TICK_MS 10
+
+// ESP-MQTT's reconnect_timeout_ms default
+#define MQTT_RECONNECT_MS 10000
+
+// Watches boot over this long, and need this long after boot for Wi-Fi and DHCP
+#define BOOT_SPREAD_MS 10000
+#define WIFI_UP_MS 1700
+
+// Offline log per watch (4 sectors)
+#define WATCH_LOG_SIZE (16 * 1024)
+
+typedef enum {
+    MSG_CONNECT,
+    MSG_SAMPLES,
+    MSG_BACKLOG,
+    MSG_SUMMARY,
+    MSG_KINDS,
+} msg_kind_t;
+
+static const char *kind_names[] = { "connect", "samples", "backlog", "summary" };
+
+typedef struct {
+    char topic[24], backlog_topic[32], agg_topic[32];
+    char log_label[17];
+
+    // Beats
+    double bpm, rest_bpm;
+    uint32_t next_beat_ms;
+    uint32_t exercise_until_ms;
+
+    // What data_send_task keeps
+    sendloop_t loop;
+
+    // Connection, from the client's side
+    uint32_t boot_ms;
+    bool connected;
+    bool connecting;
+    uint32_t generation;        // bumped on every disconnect, stale acks are dropped
+    uint32_t reconnect_at_ms;
+    uint32_t link_back_ms;      // link dropped until then
+    int next_msg_id;
+    int unacked[OUTBOX_ENTRIES];
+    uint8_t unacked_count;
+
+    uint32_t wake_ms;
+
+    // Samples the broker got, one bit per 250 ms slot (beats are further apart)
+    uint8_t *seen;
+    uint32_t seen_slots;
+    uint8_t *entered;           // and the ones that went into the batch, same slots
+    uint32_t kept;              // beats the policy let through
+    uint32_t repeated;          // beats the policy dropped that a heartbeat sent anyway
+} watch_t;
+
+// A message on its way to the broker, or waiting in its queue
+typedef struct {
+    uint16_t watch;
+    uint8_t kind;
+    uint8_t qos;
+    uint32_t generation;
+    int msg_id;
+    uint32_t sent_ms;
+    uint16_t len;
+    uint16_t wire;              // bytes on the wire, MQTT header included
+    uint8_t *payload;
+} in_msg_t;
+
+// A PUBACK or CONNACK on its way back
+typedef struct {
+    uint16_t watch;
+    uint8_t kind;
+    uint32_t generation;
+    int msg_id;
+    uint32_t sent_ms;
+    uint32_t at_ms;
+} reply_t;
+
+typedef struct {
+    void *items;
+    size_t item_size;
+    size_t head, count, capacity;
+} fifo_t;
+
+typedef struct {
+    uint32_t *values;
+    size_t count, capacity;
+} latencies_t;
+
+static uint32_t sim_now;
+static watch_t *watches;
+static int watch_count = 100;
+static double broker_rate = 0;
+static uint32_t rtt_ms = 60;
+static uint8_t data_qos = 1;
+static bool broker_up = true;
+
+static fifo_t inbound, replies;
+static double broker_free_ms;           // when the broker is done with what it has
+static size_t queue_peak;
+static double busy_ms;
+
+static uint32_t msgs[MSG_KINDS];
+static uint64_t payload_bytes[MSG_KINDS];
+static uint64_t wire_bytes;
+static uint32_t dropped_in_flight;
+static uint32_t unique_samples, duplicate_samples;
+static uint32_t link_drops, outage_drops, connects;
+static latencies_t sample_latency, ack_latency, connect_latency;
+static uint8_t replay_payload[REPLAY_PAYLOAD_MAX];     // the report reads the flash logs with it
+
+static void fifo_init(fifo_t *f, size_t item_size) {
+    memset(f, 0, sizeof(*f));
+    f->item_size = item_size;
+}
+
+static void fifo_push(fifo_t *f, const void *item) {
+    if (f->count == f->capacity) {
+        size_t capacity = f->capacity ? f->capacity * 2 : 1024;
+        uint8_t *items = malloc(capacity * f->item_size);
+        for (size_t i = 0; i < f->count; i++) {
+            memcpy(items + i * f->item_size, (uint8_t *)f->items + ((f->head + i) % f->capacity) * f->item_size,
+                   f->item_size);
+        }
+        free(f->items);
+        f->items = items;
+        f->capacity = capacity;
+        f->head = 0;
+    }
+    memcpy((uint8_t *)f->items + ((f->head + f->count) % f->capacity) * f->item_size, item, f->item_size);
+    f->count++;
+}
+
+static void *fifo_front(fifo_t *f) {
+    return f->count ? (uint8_t *)f->items + f->head * f->item_size : NULL;
+}
+
+static void fifo_pop(fifo_t *f) {
+    f->head = (f->head + 1) % f->capacity;
+    f->count--;
+}
+
+static void record(latencies_t *l, uint32_t v) {
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : 4096;
+        l->values = realloc(l->values, l->capacity * sizeof(uint32_t));
+    }
+    l->values[l->count++] = v;
+}
+
+static double uniform(void) {
+    return rand() / (RAND_MAX + 1.0);
+}
+
+// --- Broker side ---------------------------------------------------------------------
+
+static void count_samples(watch_t *w, const uint8_t *data, size_t len, uint32_t now) {
+    ts_decoder_t dec;
+    while (len > 0 && ts_decoder_init(&dec, data, len)) {
+        uint32_t t;
+        int32_t bpm;
+        while (ts_decode(&dec, &t, &bpm)) {
+            record(&sample_latency, now - t);
+            uint32_t slot = t / 250;
+            if (slot >= w->seen_slots) {
+                continue;
+            }
+            if (w->seen[slot / 8] & (1u << (slot % 8))) {
+                duplicate_samples++;
+            } else {
+                w->seen[slot / 8] |= 1u << (slot % 8);
+                unique_samples++;
+            }
+        }
+        size_t used = ts_decoder_used(&dec);
+        data += used;
+        len -= used;
+    }
+}
+
+// Sets the bit of a sample's slot, true if it wasn't set yet
+static bool mark_slot(const watch_t *w, uint8_t *bits, uint32_t t) {
+    uint32_t slot = t / 250;
+    if (slot >= w->seen_slots || (bits[slot / 8] & (1u << (slot % 8)))) {
+        return false;
+    }
+    bits[slot / 8] |= 1u << (slot % 8);
+    return true;
+}
+
+// Samples in a payload the broker never got, marked as seen so that they count once
+static uint32_t count_undelivered(watch_t *w, const uint8_t *data, size_t len) {
+    uint32_t n = 0;
+    ts_decoder_t dec;
+    while (len > 0 && ts_decoder_init(&dec, data, len)) {
+        uint32_t t;
+        int32_t bpm;
+        while (ts_decode(&dec, &t, &bpm)) {
+            n += mark_slot(w, w->seen, t);
+        }
+        size_t used = ts_decoder_used(&dec);
+        data += used;
+        len -= used;
+    }
+    return n;
+}
+
+// Takes what has arrived, as fast as the broker can, and queues the replies
+static void broker_run(uint32_t now) {
+    double service_ms = broker_rate > 0 ? 1000.0 / broker_rate : 0;
+    size_t waiting = 0;
+    in_msg_t *m;
+    while ((m = fifo_front(&inbound)) != NULL && m->sent_ms + rtt_ms / 2 <= now) {
+        watch_t *w = &watches[m->watch];
+        // Dead connection, or a broker that is down: the message is gone
+        if (!broker_up || m->generation != w->generation) {
+            dropped_in_flight += m->kind != MSG_CONNECT;
+            free(m->payload);
+            fifo_pop(&inbound);
+            continue;
+        }
+        double arrived = m->sent_ms + rtt_ms / 2;
+        double start = broker_free_ms > arrived ? broker_free_ms : arrived;
+        if (start > now) {
+            // Still busy; the rest waits in its queue
+            for (size_t i = 0; i < inbound.count; i++) {
+                in_msg_t *q = (in_msg_t *)inbound.items + (inbound.head + i) % inbound.capacity;
+                if (q->sent_ms + rtt_ms / 2 > now) {
+                    break;
+                }
+                waiting++;
+            }
+            break;
+        }
+        broker_free_ms = start + service_ms;
+        busy_ms += service_ms;
+        uint32_t done = (uint32_t)(start + service_ms);
+
+        msgs[m->kind]++;
+        payload_bytes[m->kind] += m->len;
+        wire_bytes += m->wire;
+        if (m->kind == MSG_SAMPLES || m->kind == MSG_BACKLOG) {
+            count_samples(w, m->payload, m->len, done);
+        }
+        if (m->kind == MSG_CONNECT || m->qos == 1) {
+            reply_t r = { m->watch, m->kind, m->generation, m->msg_id, m->sent_ms, done + rtt_ms / 2 };
+            fifo_push(&replies, &r);
+        }
+        free(m->payload);
+        fifo_pop(&inbound);
+    }
+    if (waiting > queue_peak) {
+        queue_peak = waiting;
+    }
+}
+
+// --- Client side (what ESP-MQTT does for the firmware) ---------------------------------
+
+static void send_connect(watch_t *w, uint32_t now) {
+    in_msg_t m = { (uint16_t)(w - watches), MSG_CONNECT, 0, w->generation, 0, now, 0, 40, NULL };
+    w->connecting = true;
+    fifo_push(&inbound, &m);
+}
+
+static int send_to_broker(void *ctx, const char *topic, const uint8_t *data, size_t len, int qos) {
+    watch_t *w = ctx;
+    msg_kind_t kind = topic == w->topic ? MSG_SAMPLES : topic == w->backlog_topic ? MSG_BACKLOG : MSG_SUMMARY;
+    int msg_id = qos ? ++w->next_msg_id : 0;
+    in_msg_t m = {
+        .watch = (uint16_t)(w - watches),
+        .kind = (uint8_t)kind,
+        .qos = (uint8_t)qos,
+        .generation = w->generation,
+        .msg_id = msg_id,
+        .sent_ms = sim_now,
+        .len = (uint16_t)len,
+        // Fixed header, topic length and topic, message id
+        .wire = (uint16_t)((len + strlen(topic) + 4 < 128 ? 2 : 3) + 2 + strlen(topic) + (qos ? 2 : 0) + len),
+        .payload = malloc(len),
+    };
+    memcpy(m.payload, data, len);
+    fifo_push(&inbound, &m);
+    if (qos) {
+        // A message the outbox timed out and sent again leaves its old id behind
+        if (w->unacked_count == OUTBOX_ENTRIES) {
+            memmove(w->unacked, w->unacked + 1, (OUTBOX_ENTRIES - 1) * sizeof(int));
+            w->unacked_count--;
+        }
+        w->unacked[w->unacked_count++] = msg_id;
+    }
+    return msg_id;
+}
+
+static void disconnect(watch_t *w, uint32_t now, uint32_t back_ms) {
+    w->generation++;
+    w->connected = false;
+    w->connecting = false;
+    w->link_back_ms = back_ms;
+    w->reconnect_at_ms = back_ms > now ? back_ms : now;
+    w->wake_ms = now;
+}
+
+static void deliver_replies(uint32_t now) {
+    reply_t *r;
+    while ((r = fifo_front(&replies)) != NULL && r->at_ms <= now) {
+        watch_t *w = &watches[r->watch];
+        if (r->generation == w->generation && broker_up) {
+            if (r->kind == MSG_CONNECT) {
+                w->connected = true;
+                w->connecting = false;
+                connects++;
+                record(&connect_latency, now - r->sent_ms);
+                // The client sends what was never acknowledged again
+                for (uint8_t i = 0; i < w->unacked_count; i++) {
+                    outbox_ack_push(&w->loop.outbox, w->unacked[i], true);
+                }
+                w->unacked_count = 0;
+            } else {
+                for (uint8_t i = 0; i < w->unacked_count; i++) {
+                    if (w->unacked[i] == r->msg_id) {
+                        w->unacked[i] = w->unacked[--w->unacked_count];
+                        outbox_ack_push(&w->loop.outbox, r->msg_id, false);
+                        record(&ack_latency, now - r->sent_ms);
+                        break;
+                    }
+                }
+            }
+            w->wake_ms = now;
+        }
+        fifo_pop(&replies);
+    }
+}
+
+// --- One watch: the data send task ----------------------------------------------------
+
+static void watch_init(watch_t *w, int id, uint32_t seconds) {
+    snprintf(w->topic, sizeof(w->topic), "fleet/%04d", id);
+    snprintf(w->backlog_topic, sizeof(w->backlog_topic), "%s/backlog", w->topic);
+    snprintf(w->agg_topic, sizeof(w->agg_topic), "%s/agg", w->topic);
+    snprintf(w->log_label, sizeof(w->log_label), "hrlog%d", id);
+    w->rest_bpm = 55 + uniform() * 30;
+    w->bpm = w->rest_bpm;
+    w->boot_ms = (uint32_t)(uniform() * BOOT_SPREAD_MS);
+    w->next_beat_ms = w->boot_ms + 1000;
+    w->reconnect_at_ms = w->boot_ms + WIFI_UP_MS;
+    w->wake_ms = w->boot_ms;
+    w->seen_slots = (seconds * 1000 + BOOT_SPREAD_MS) / 250 + 8;
+    w->seen = calloc(w->seen_slots / 8 + 1, 1);
+    w->entered = calloc(w->seen_slots / 8 + 1, 1);
+
+    // mqtt.c's settings, with this watch's topics and flash log
+    sendloop_config_t config = {
+        .bpm_topic = w->topic,
+        .backlog_topic = w->backlog_topic,
+        .agg_topic = w->agg_topic,
+        .backlog_partition = host_partition_add(w->log_label, NULL, WATCH_LOG_SIZE) ? w->log_label : NULL,
+        .policy = PUBLISH_POLICY_DEFAULT,
+        .agg = { .window_ms = AGG_WINDOW_MS, .step_ms = AGG_STEP_MS },
+        .raw = AGG_PUBLISH_RAW,
+        .qos = data_qos,
+        .window = OUTBOX_WINDOW,
+        .send = send_to_broker,
+        .send_ctx = w,
+    };
+    sendloop_init(&w->loop, &config, w->boot_ms);
+}
+
+// Resting heart rate with some wander, and a bout of exercise (up to alarm levels) now and then
+static void make_beat(watch_t *w) {
+    uint32_t t = w->next_beat_ms;
+    if (t >= w->exercise_until_ms && uniform() < 0.0005) {
+        w->exercise_until_ms = t + 60000 + (uint32_t)(uniform() * 240000);
+    }
+    double target = t < w->exercise_until_ms ? w->rest_bpm + 70 : w->rest_bpm;
+    w->bpm += (target - w->bpm) * 0.02 + (uniform() - 0.5) * 2;
+    int ibi = (int)(60000 / w->bpm) + (int)(uniform() * 40) - 20;
+    bpm_sample_t sample = { .timestamp_ms = t, .bpm = (int)(60000 / ibi), .ibi_ms = ibi };
+    w->next_beat_ms = t + (uint32_t)ibi;
+
+    if (sendloop_take_beat(&w->loop, &sample, false)) {
+        mark_slot(w, w->entered, t);
+        w->kept++;
+    }
+}
+
+static uint32_t min_u32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+// One pass of data_send_task's loop, then when it would wake up next
+static void watch_step(watch_t *w, uint32_t now) {
+    if (w->connecting && now >= w->reconnect_at_ms) {
+        // No CONNACK in time, try again
+        w->connecting = false;
+    }
+    if (!w->connected && !w->connecting && now >= w->reconnect_at_ms) {
+        // The link has to be there for the CONNECT to go anywhere
+        if (now >= w->link_back_ms) {
+            send_connect(w, now);
+        }
+        w->reconnect_at_ms = now + MQTT_RECONNECT_MS;
+    }
+
+    while (w->next_beat_ms <= now) {
+        make_beat(w);
+    }
+    uint32_t heartbeats = w->loop.heartbeats;
+    sendloop_run(&w->loop, w->connected, now);
+    // A heartbeat repeats the newest beat, which the deadband may have kept out of the batch
+    if (w->loop.heartbeats != heartbeats && mark_slot(w, w->entered, w->loop.sched.last_seen.timestamp_ms)) {
+        w->repeated++;
+    }
+
+    uint32_t wake = min_u32(w->next_beat_ms, now + min_u32(sendloop_ms_until(&w->loop, now), UINT32_MAX - now));
+    if (!w->connected) {
+        wake = min_u32(wake, w->reconnect_at_ms);
+    }
+    w->wake_ms = wake > now ? wake : now + TICK_MS;
+}
+
+// --- Report ---------------------------------------------------------------------------
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Samples the broker never got that are still in the batch (a heartbeat may have put one
+// there again that did get through)
+static uint32_t samples_waiting(watch_t *w) {
+    uint32_t n = 0;
+    for (uint16_t i = 0; i < w->loop.batch.count; i++) {
+        n += mark_slot(w, w->seen, batch_at(&w->loop.batch, i)->timestamp_ms);
+    }
+    return n;
+}
+
+// What the run ended with on its way to the broker: in the outbox, on the network, in flash.
+// Reads the flash log empty, so only for the report.
+static uint32_t samples_on_the_way(watch_t *w) {
+    uint32_t n = 0;
+    outbox_t *ob = &w->loop.outbox;
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        outbox_entry_t *e = &ob->entries[i];
+        if (e->state == OUTBOX_FREE || e->topic == w->agg_topic) {
+            continue;
+        }
+        // The blocks of a message, put back together as outbox_pump does
+        uint8_t *dst = ob->scratch;
+        size_t left = e->len;
+        for (int16_t block = e->first_block; left > 0; block = ob->next_block[block]) {
+            size_t chunk = left > OUTBOX_BLOCK_SIZE ? OUTBOX_BLOCK_SIZE : left;
+            memcpy(dst, ob->blocks[block], chunk);
+            dst += chunk;
+            left -= chunk;
+        }
+        n += count_undelivered(w, ob->scratch, e->len);
+    }
+    for (size_t i = 0; i < inbound.count; i++) {
+        in_msg_t *m = (in_msg_t *)inbound.items + (inbound.head + i) % inbound.capacity;
+        if (&watches[m->watch] == w && (m->kind == MSG_SAMPLES || m->kind == MSG_BACKLOG)) {
+            n += count_undelivered(w, m->payload, m->len);
+        }
+    }
+    flashlog_span_t span;
+    size_t len;
+    while (w->loop.backlog_ok &&
+           (len = flashlog_read(&w->loop.backlog, replay_payload, sizeof(replay_payload), &span)) > 0) {
+        n += count_undelivered(w, replay_payload, len);
+        flashlog_consume(&w->loop.backlog, &span);
+    }
+    return n;
+}
+
+static void print_latencies(const char *name, latencies_t *l) {
+    if (l->count == 0) {
+        printf("%-16s no samples\n", name);
+        return;
+    }
+    qsort(l->values, l->count, sizeof(l->values[0]), cmp_u32);
+    printf("%-16s n=%-8zu p50=%-6lu p90=%-6lu p99=%-6lu max=%lu ms\n", name, l->count,
+           (unsigned long)l->values[l->count * 50 / 100], (unsigned long)l->values[l->count * 90 / 100],
+           (unsigned long)l->values[l->count * 99 / 100], (unsigned long)l->values[l->count - 1]);
+}
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 600;
+    double drops_per_hour = 0, drop_len = 30;
+    double outage_at = 0, outage_len = 0;
+    int qos = 1;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--watches") == 0 && i + 1 < argc) {
+            watch_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--broker-rate") == 0 && i + 1 < argc) {
+            broker_rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rtt") == 0 && i + 1 < argc) {
+            rtt_ms = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--drops") == 0 && i + 1 < argc) {
+            drops_per_hour = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--drop-len") == 0 && i + 1 < argc) {
+            drop_len = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--outage") == 0 && i + 1 < argc &&
+                   sscanf(argv[++i], "%lf:%lf", &outage_at, &outage_len) == 2) {
+            // parsed
+        } else if (strcmp(argv[i], "--qos") == 0 && i + 1 < argc) {
+            qos = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned)atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--watches N] [--seconds N] [--broker-rate MSG_PER_S] [--rtt MS] "
+                            "[--drops PER_WATCH_HOUR] [--drop-len S] [--outage AT:LEN] [--qos 0|1] [--seed N]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (watch_count < 1 || watch_count > MAX_WATCHES || (qos != 0 && qos != 1)) {
+        fprintf(stderr, "--watches wants 1 to %d, --qos 0 or 1\n", MAX_WATCHES);
+        return 2;
+    }
+    data_qos = (uint8_t)qos;
+    srand(seed);
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    fifo_init(&inbound, sizeof(in_msg_t));
+    fifo_init(&replies, sizeof(reply_t));
+    watches = calloc(watch_count, sizeof(watch_t));
+    for (int i = 0; i < watch_count; i++) {
+        watch_init(&watches[i], i, (uint32_t)seconds);
+    }
+
+    double wall_start = wall_seconds();
+    uint32_t end_ms = (uint32_t)(seconds * 1000);
+    double drop_chance = drops_per_hour * TICK_MS / 3600000.0;
+    for (sim_now = 0; sim_now < end_ms; sim_now += TICK_MS) {
+        uint32_t now = sim_now;
+
+        // The broker going away takes every connection with it
+        bool up = !(outage_len > 0 && now >= outage_at * 1000 && now < (outage_at + outage_len) * 1000);
+        if (up != broker_up) {
+            broker_up = up;
+            if (!up) {
+                for (int i = 0; i < watch_count; i++) {
+                    if (watches[i].connected || watches[i].connecting) {
+                        outage_drops++;
+                    }
+                    // The link is fine, the client finds out at its next try
+                    disconnect(&watches[i], now, 0);
+                    watches[i].reconnect_at_ms = now + (uint32_t)(uniform() * MQTT_RECONNECT_MS);
+                }
+            }
+        }
+
+        broker_run(now);
+        deliver_replies(now);
+        for (int i = 0; i < watch_count; i++) {
+            watch_t *w = &watches[i];
+            if (now < w->boot_ms) {
+                continue;
+            }
+            if (drop_chance > 0 && w->connected && uniform() < drop_chance) {
+                link_drops++;
+                disconnect(w, now, now + (uint32_t)(drop_len * 1000));
+            }
+            if (w->wake_ms <= now) {
+                watch_step(w, now);
+            }
+        }
+    }
+    double wall_s = wall_seconds() - wall_start;
+
+    uint32_t total_msgs = 0, kept = 0, repeated = 0, waiting = 0, on_the_way = 0, overwritten = 0, in_flash = 0, flash_lost = 0;
+    uint32_t resent = 0, full = 0;
+    for (int k = 0; k < MSG_KINDS; k++) {
+        total_msgs += msgs[k];
+    }
+    for (int i = 0; i < watch_count; i++) {
+        watch_t *w = &watches[i];
+        kept += w->kept;
+        repeated += w->repeated;
+        waiting += samples_waiting(w);
+        overwritten += w->loop.batch.overwritten;
+        in_flash += w->loop.backlog.pending;
+        flash_lost += w->loop.backlog.lost;
+        on_the_way += samples_on_the_way(w);
+        resent += w->loop.outbox.stats.resent;
+        full += w->loop.outbox.stats.full;
+    }
+
+    char rate[32] = "unlimited";
+    if (broker_rate > 0) {
+        snprintf(rate, sizeof(rate), "%.0f msg/s", broker_rate);
+    }
+    printf("fleet            %d watches, %.0f s simulated in %.1f s wall, QoS %d, broker %s, RTT %lu ms\n",
+           watch_count, seconds, wall_s, qos, rate, (unsigned long)rtt_ms);
+    printf("broker           %.1f msg/s, %.0f payload B/s, %.0f wire B/s, busy %.0f%%, queue peak %zu\n",
+           total_msgs / seconds, (double)(payload_bytes[MSG_SAMPLES] + payload_bytes[MSG_BACKLOG] +
+                                          payload_bytes[MSG_SUMMARY]) / seconds,
+           wire_bytes / seconds, 100 * busy_ms / (seconds * 1000), queue_peak);
+    for (int k = 0; k < MSG_KINDS; k++) {
+        printf("  %-14s %lu messages, %.2f/s, %llu bytes\n", kind_names[k], (unsigned long)msgs[k],
+               msgs[k] / seconds, (unsigned long long)payload_bytes[k]);
+    }
+    // The firmware's own histogram, every watch's publishes in it (power-of-two buckets)
+    metrics_hist_snapshot_t snap;
+    metrics_hist_peek(&metrics_publish_latency, &snap);
+    printf("%-16s n=%-8lu p50<=%-4lu p90<=%-4lu p99<=%-4lu max=%lu ms\n", "sample->outbox", (unsigned long)snap.count,
+           (unsigned long)metrics_hist_percentile(&snap, 50), (unsigned long)metrics_hist_percentile(&snap, 90),
+           (unsigned long)metrics_hist_percentile(&snap, 99), (unsigned long)snap.max);
+    print_latencies("sample->broker", &sample_latency);
+    print_latencies("publish->puback", &ack_latency);
+    print_latencies("connect", &connect_latency);
+    // Whatever went into a batch and is not somewhere else was lost: QoS 0 messages on a dead
+    // link, flash sectors erased before their replay. Below 0 the books are wrong.
+    int64_t lost = (int64_t)kept + repeated - unique_samples - waiting - on_the_way - overwritten;
+    printf("samples          %lu kept by the policy, %lu more sent by heartbeats, %lu unique at the broker, "
+           "%lu duplicates, %lu waiting in RAM, %lu on the way (outbox, network, flash), "
+           "%lu overwritten in the batch, %lld lost%s\n",
+           (unsigned long)kept, (unsigned long)repeated, (unsigned long)unique_samples,
+           (unsigned long)duplicate_samples, (unsigned long)waiting, (unsigned long)on_the_way,
+           (unsigned long)overwritten, (long long)lost, lost < 0 ? " (ACCOUNTING ERROR)" : "");
+    printf("flash            %lu batches left at the end, %lu batches lost to a full log\n",
+           (unsigned long)in_flash, (unsigned long)flash_lost);
+    printf("connections      %lu connects, %lu random drops, %lu dropped by the outage, %lu messages lost in "
+           "flight, %lu resent, %lu outbox full\n",
+           (unsigned long)connects, (unsigned long)link_drops, (unsigned long)outage_drops,
+           (unsigned long)dropped_in_flight, (unsigned long)resent, (unsigned long)full);
+    return 0;
+}
@@ -0,0 +1,260 @@
+// Benchmark of the deferred log (dlog.c): what one log call costs the task that makes it,
+// formatted on the spot as ESP_LOGx does against recorded for the log task, and two
+// stress runs where producer threads log while the log task's drain prints into a
+// checker that parses every line. In the first the producers log --rate records/s
+// between them and the drain runs every DLOG_DRAIN_MS as dlog_task does, which shows
+// what drops at that rate; in the second they log as fast as they can and the drain
+// never sleeps while there is something to print, which saturates the ring.
+//
+//   log_bench [--seconds N] [--threads N] [--baud N] [--rate N]
+//
+// On the chip an ESP_LOGx line also waits for the UART once its small FIFO is full, so
+// the formatted cost is reported with the time the line takes on the wire at --baud.
+// Every stress record carries a check value made from its other arguments, so a record
+// that was half overwritten shows up, as do duplicates and records that never came out.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "esp_log.h"
+#include "dlog.h"
+
+#define TAG "BENCH"
+#define MAX_THREADS 8
+#define CALLS 200000
+
+// About what the firmware logs through DLOG: a beat line and a BLE notify per beat, and
+// the motion and publish lines (records/s, all tasks together)
+#define FIRMWARE_RATE 10
+
+#define CHECK(t, n) (((t) * 2654435761u) ^ (n))
+
+static _Atomic bool running;
+static _Atomic bool draining;
+static int pipe_read;         // what the drain prints, for the checker
+static double period_ns;      // between two records of one producer, 0 for flat out
+static double stagger_ns;     // between the starts of two paced producers
+
+typedef struct {
+    uint64_t lines;
+    uint64_t garbled;
+    uint64_t duplicates;
+    uint64_t out_of_order;      // per producer, from records on different cores in the same ms
+} check_stats_t;
+
+static double wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Formatted the way the host esp_log.h does it, into a buffer instead of the console
+static double format_ns(char *line, size_t size) {
+    double t0 = wall_ns();
+    for (int i = 0; i < CALLS; i++) {
+        snprintf(line, size, "I (%lu) %s: Beat: %d BPM (IBI %d ms)%s\n", (unsigned long)esp_log_timestamp(), TAG,
+                 60 + (i & 63), 800 + (i & 255), (i & 7) ? "" : ", moving");
+    }
+    return (wall_ns() - t0) / CALLS;
+}
+
+// Recorded, the ring drained (untimed) whenever it is full
+static double record_ns(void) {
+    double total = 0;
+    for (int i = 0; i < CALLS; i += DLOG_RING_SIZE) {
+        double t0 = wall_ns();
+        for (int j = i; j < i + DLOG_RING_SIZE; j++) {
+            DLOGI(TAG, "Beat: %d BPM (IBI %d ms)%s", 60 + (j & 63), 800 + (j & 255), (j & 7) ? "" : ", moving");
+        }
+        total += wall_ns() - t0;
+        dlog_drain();
+    }
+    return total / CALLS;
+}
+
+// A level that isn't compiled in (DLOG_LEVEL is INFO)
+static double compiled_out_ns(void) {
+    volatile int bpm = 70;
+    double t0 = wall_ns();
+    for (int i = 0; i < CALLS; i++) {
+        DLOGD(TAG, "Beat: %d BPM (IBI %d ms)", bpm, 800);
+    }
+    return (wall_ns() - t0) / CALLS;
+}
+
+static void sleep_until(double at_ns) {
+    struct timespec ts = { (time_t)(at_ns / 1e9), (long)(at_ns - (time_t)(at_ns / 1e9) * 1e9) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+// Paced producers start spread over one period, so they don't all log at once
+static void *producer(void *arg) {
+    uint32_t t = (uint32_t)(uintptr_t)arg;
+    double next = wall_ns() + stagger_ns * t;
+    for (uint32_t n = 0; atomic_load_explicit(&running, memory_order_relaxed); n++) {
+        if (period_ns > 0) {
+            sleep_until(next);
+            next += period_ns;
+        }
+        DLOGI(TAG, "t=%u n=%u check=%u", t, n, CHECK(t, n));
+    }
+    return NULL;
+}
+
+static void *drainer(void *arg) {
+    (void)arg;
+    while (atomic_load(&draining)) {
+        if (period_ns > 0) {
+            usleep(DLOG_DRAIN_MS * 1000);
+            dlog_drain();
+        } else if (dlog_drain() == 0) {
+            usleep(100);
+        }
+    }
+    dlog_drain();
+    fflush(stdout);
+    return NULL;
+}
+
+// Reads what the drain prints (stdout is the write end of a pipe) and checks every line
+static void *checker(void *arg) {
+    check_stats_t *st = arg;
+    FILE *in = fdopen(pipe_read, "r");
+    int64_t last[MAX_THREADS];
+    char line[DLOG_LINE_MAX + 32];
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < MAX_THREADS; i++) {
+        last[i] = -1;
+    }
+    while (fgets(line, sizeof(line), in)) {
+        unsigned long ts;
+        unsigned t, n, check;
+        st->lines++;
+        if (sscanf(line, "I (%lu) " TAG ": t=%u n=%u check=%u", &ts, &t, &n, &check) != 4 || t >= MAX_THREADS ||
+            check != CHECK(t, n)) {
+            st->garbled++;
+            continue;
+        }
+        if ((int64_t)n == last[t]) {
+            st->duplicates++;
+        } else if ((int64_t)n < last[t]) {
+            st->out_of_order++;
+        }
+        if ((int64_t)n > last[t]) {
+            last[t] = n;
+        }
+    }
+    fclose(in);
+    return NULL;
+}
+
+// One stress run at rate records/s (0 for flat out). Returns 1 if the checker found a
+// line it shouldn't have, or a record that was written never came out.
+static int stress(FILE *out, int threads, double seconds, int rate) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return 1;
+    }
+    fflush(stdout);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+    dlog_stats_t before, after;
+    dlog_get_stats(&before);
+
+    period_ns = rate > 0 ? 1e9 * threads / rate : 0;
+    stagger_ns = period_ns / threads;
+    pipe_read = fds[0];
+    check_stats_t check;
+    pthread_t checker_thread, drainer_thread, producers[MAX_THREADS];
+    pthread_create(&checker_thread, NULL, checker, &check);
+    atomic_store(&draining, true);
+    pthread_create(&drainer_thread, NULL, drainer, NULL);
+    atomic_store(&running, true);
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&producers[t], NULL, producer, (void *)(uintptr_t)t);
+    }
+    struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+    atomic_store(&running, false);
+    for (int t = 0; t < threads; t++) {
+        pthread_join(producers[t], NULL);
+    }
+    atomic_store(&draining, false);
+    pthread_join(drainer_thread, NULL);
+    // Closing the pipe ends the checker's input
+    fflush(stdout);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    pthread_join(checker_thread, NULL);
+    dlog_get_stats(&after);
+
+    uint32_t written = after.written - before.written;
+    uint32_t dropped = after.dropped - before.dropped;
+    uint32_t printed = after.printed - before.printed;
+    if (rate > 0) {
+        fprintf(out, "%d producers at %d records/s, drained every %d ms, %.0f s: %lu written, %lu printed, "
+                     "%lu dropped (%.1f%%, ring full)\n", threads, rate, DLOG_DRAIN_MS, seconds,
+                (unsigned long)written, (unsigned long)printed, (unsigned long)dropped,
+                written + dropped ? 100.0 * dropped / (written + dropped) : 0.0);
+    } else {
+        fprintf(out, "%d producers flat out, drained nonstop, %.0f s: %.0f k records/s written, %.0f k/s printed, "
+                     "%.1f%% dropped (ring full)\n", threads, seconds, written / seconds / 1e3,
+                printed / seconds / 1e3, written + dropped ? 100.0 * dropped / (written + dropped) : 0.0);
+    }
+    fprintf(out, "  checked %llu lines: %llu garbled, %llu duplicates, %llu out of order across cores, %lld missing\n",
+            (unsigned long long)check.lines, (unsigned long long)check.garbled,
+            (unsigned long long)check.duplicates, (unsigned long long)check.out_of_order,
+            (long long)written - (long long)check.lines);
+    return check.garbled || check.duplicates || check.lines != written || printed != written ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 2;
+    int threads = 4;
+    int baud = 115200;
+    int rate = FIRMWARE_RATE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc) {
+            baud = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds N] [--threads N] [--baud N] [--rate N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS || baud <= 0 || rate <= 0) {
+        fprintf(stderr, "--threads wants 1 to %d, --baud and --rate more than 0\n", MAX_THREADS);
+        return 2;
+    }
+
+    // The drain prints to stdout, the results go to where stdout was
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(out, NULL, _IOLBF, 0);
+    if (!freopen("/dev/null", "w", stdout)) {
+        return 1;
+    }
+
+    char line[DLOG_LINE_MAX];
+    double fmt = format_ns(line, sizeof(line));
+    double wire = strlen(line) * 10 * 1e9 / baud;
+    double rec = record_ns();
+    double off = compiled_out_ns();
+    fprintf(out, "per call: ESP_LOGI %.0f ns formatting + %.0f us on the wire at %d baud, "
+                 "DLOGI %.0f ns, DLOGD compiled out %.1f ns\n", fmt, wire / 1e3, baud, rec, off);
+
+    int failed = stress(out, threads, seconds, rate);
+    failed |= stress(out, threads, seconds, 0);
+    return failed;
+}
@@ -0,0 +1,224 @@
+// Benchmark of the motion kernel (motion.c): samples per second and time per block
+// against a straightforward per-sample version with branches, a check that both give the
+// same blocks, and how close the step count gets on synthetic walking and running.
+//
+//   motion_bench [--seconds N] [--rate HZ]
+//
+// The signals are what sensor.c simulates: 1 g at an angle, a bounce per step and noise.
+// "moving" bounces as hard as walking but without steps in it (arm gestures), which is
+// what the still / moving / walking / running classification has to tell apart.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "motion.h"
+
+#define BLOCK_MS 250
+#define NOISE_MG 15
+
+typedef struct {
+    const char *name;
+    activity_t expected;
+    double per_minute;      // bounces per minute
+    double accel_mg;        // size of the bounce
+    bool steps;             // whether a bounce is a step
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "still",  ACTIVITY_STILL,   0,   0,   false },
+    { "moving", ACTIVITY_MOVING,  40,  120, false },
+    { "walk",   ACTIVITY_WALKING, 110, 300, true },
+    { "run",    ACTIVITY_RUNNING, 165, 800, true },
+};
+
+static double wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// n samples of a scenario, returns the steps in it
+static uint32_t make_signal(const scenario_t *sc, uint16_t rate, size_t n, int16_t *x, int16_t *y, int16_t *z) {
+    uint32_t steps = 0;
+    double phase = 0;
+    for (size_t i = 0; i < n; i++) {
+        phase += sc->per_minute / 60.0 / rate;
+        if (phase >= 1) {
+            phase -= 1;
+            steps += sc->steps;
+        }
+        double noise = (rand() % (2 * NOISE_MG + 1)) - NOISE_MG;
+        double g_mg = 1000 + sin(2 * M_PI * phase) * sc->accel_mg + noise;
+        x[i] = (int16_t)lround(g_mg * 0.26 * MOTION_LSB_PER_G / 1000);
+        y[i] = (int16_t)lround(noise * MOTION_LSB_PER_G / 1000);
+        z[i] = (int16_t)lround(g_mg * 0.97 * MOTION_LSB_PER_G / 1000);
+    }
+    return steps;
+}
+
+// The same integer math one sample at a time: a ring for the moving sum and an if for
+// every decision. Blocks must come out identical.
+typedef struct {
+    motion_t p;                             // parameters and cadence ring, from motion_init
+    int32_t ring[MOTION_MAX_RATE_HZ / 10];  // last smooth_len deviations
+    uint16_t ring_pos;
+    int32_t sum;
+} naive_t;
+
+static int32_t naive_mg_to_dev(int32_t mg) {
+    int32_t s = mg * MOTION_LSB_PER_G / 1000;
+    return 2 * s + s * s / MOTION_LSB_PER_G;
+}
+
+static void naive_block(naive_t *m, const int16_t *x, const int16_t *y, const int16_t *z, size_t n,
+                        motion_block_t *out) {
+    motion_t *p = &m->p;
+    int32_t limit = naive_mg_to_dev(MOTION_ARTIFACT_MG);
+    int64_t dev_sum = 0;
+    uint32_t abs_sum = 0, moving = 0, steps = 0;
+
+    if (!p->gravity_ready && n > 0) {
+        p->gravity = (int32_t)(((uint32_t)(x[0] * x[0]) + (uint32_t)(y[0] * y[0]) + (uint32_t)(z[0] * z[0])) >> 12);
+        p->gravity_ready = true;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint32_t sq = (uint32_t)(x[i] * x[i]) + (uint32_t)(y[i] * y[i]) + (uint32_t)(z[i] * z[i]);
+        int32_t dev = (int32_t)(sq >> 12) - p->gravity;
+        m->sum += dev - m->ring[m->ring_pos];
+        m->ring[m->ring_pos] = dev;
+        m->ring_pos = (m->ring_pos + 1) % p->smooth_len;
+
+        if (p->armed && m->sum > p->step_threshold && p->since_step >= p->min_step_gap) {
+            steps++;
+            p->armed = 0;
+            p->since_step = 0;
+        } else if (p->since_step < p->min_step_gap) {
+            p->since_step++;
+        }
+        if (m->sum < 0) {
+            p->armed = 1;
+        }
+
+        dev_sum += dev;
+        abs_sum += (uint32_t)abs(dev);
+        if (abs(dev) > limit) {
+            moving++;
+        }
+    }
+    if (n == 0) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    p->gravity += (int32_t)(dev_sum / (int64_t)n) >> 2;
+    p->block_steps[p->block_pos] = (uint8_t)(steps > 255 ? 255 : steps);
+    p->block_samples[p->block_pos] = (uint16_t)n;
+    p->block_pos = (p->block_pos + 1) % MOTION_CADENCE_BLOCKS;
+    uint32_t window_steps = 0, window_samples = 0;
+    for (int i = 0; i < MOTION_CADENCE_BLOCKS; i++) {
+        window_steps += p->block_steps[i];
+        window_samples += p->block_samples[i];
+    }
+    uint32_t cadence = window_steps * 60u * p->rate_hz / window_samples;
+    uint32_t intensity = abs_sum / n * 1000u / (2 * MOTION_LSB_PER_G);
+
+    out->steps = (uint8_t)(steps > 255 ? 255 : steps);
+    out->activity = intensity < MOTION_STILL_MG ? ACTIVITY_STILL
+                  : cadence >= MOTION_RUN_SPM   ? ACTIVITY_RUNNING
+                  : cadence >= MOTION_WALK_SPM  ? ACTIVITY_WALKING
+                                                : ACTIVITY_MOVING;
+    out->artifact = moving * 100 >= n * MOTION_ARTIFACT_PERCENT;
+    out->intensity_mg = (uint16_t)(intensity > UINT16_MAX ? UINT16_MAX : intensity);
+    out->cadence_spm = (uint16_t)cadence;
+    p->steps += steps;
+    p->artifact_blocks += out->artifact;
+}
+
+static bool same_block(const motion_block_t *a, const motion_block_t *b) {
+    return a->steps == b->steps && a->activity == b->activity && a->artifact == b->artifact &&
+           a->intensity_mg == b->intensity_mg && a->cadence_spm == b->cadence_spm;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 600;
+    int rate = 100;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--seconds N] [--rate HZ]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rate < MOTION_MIN_RATE_HZ || rate > MOTION_MAX_RATE_HZ) {
+        fprintf(stderr, "--rate wants %d to %d Hz\n", MOTION_MIN_RATE_HZ, MOTION_MAX_RATE_HZ);
+        return 2;
+    }
+
+    size_t block = (size_t)rate * BLOCK_MS / 1000;
+    size_t blocks = (size_t)(seconds * 1000 / BLOCK_MS);
+    size_t n = block * blocks;
+    int16_t *x = malloc(n * sizeof(*x));
+    int16_t *y = malloc(n * sizeof(*y));
+    int16_t *z = malloc(n * sizeof(*z));
+    motion_block_t *fast_out = malloc(blocks * sizeof(*fast_out));
+    motion_block_t *naive_out = malloc(blocks * sizeof(*naive_out));
+    srand(1);
+
+    printf("%d Hz, %zu samples per %d ms block, %.0f s per scenario\n", rate, block, BLOCK_MS, seconds);
+    int failures = 0;
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        const scenario_t *sc = &scenarios[s];
+        uint32_t truth = make_signal(sc, (uint16_t)rate, n, x, y, z);
+
+        // Best of a few runs, each on fresh state
+        double fast_ns = 1e30, naive_ns = 1e30;
+        motion_t motion;
+        naive_t naive;
+        for (int run = 0; run < 5; run++) {
+            motion_init(&motion, (uint16_t)rate);
+            double t0 = wall_ns();
+            for (size_t b = 0; b < blocks; b++) {
+                motion_process_block(&motion, x + b * block, y + b * block, z + b * block, block, &fast_out[b]);
+            }
+            double t1 = wall_ns();
+            memset(&naive, 0, sizeof(naive));
+            motion_init(&naive.p, (uint16_t)rate);
+            for (size_t b = 0; b < blocks; b++) {
+                naive_block(&naive, x + b * block, y + b * block, z + b * block, block, &naive_out[b]);
+            }
+            double t2 = wall_ns();
+            fast_ns = t1 - t0 < fast_ns ? t1 - t0 : fast_ns;
+            naive_ns = t2 - t1 < naive_ns ? t2 - t1 : naive_ns;
+        }
+
+        size_t mismatches = 0, right = 0, artifacts = 0;
+        // The cadence needs MOTION_CADENCE_BLOCKS blocks to settle
+        size_t settled = blocks > MOTION_CADENCE_BLOCKS ? blocks - MOTION_CADENCE_BLOCKS : 0;
+        for (size_t b = 0; b < blocks; b++) {
+            mismatches += !same_block(&fast_out[b], &naive_out[b]);
+            right += b >= MOTION_CADENCE_BLOCKS && fast_out[b].activity == sc->expected;
+            artifacts += fast_out[b].artifact;
+        }
+        failures += mismatches > 0;
+
+        printf("%-7s %5.1f ns/block (%6.1f naive), %6.1f M samples/s, steps %lu of %lu, "
+               "%s %.0f%% of blocks, artifact %.0f%%, %zu mismatches\n",
+               sc->name, fast_ns / blocks, naive_ns / blocks, n / fast_ns * 1e3,
+               (unsigned long)motion.steps, (unsigned long)truth, motion_activity_name(sc->expected),
+               settled ? 100.0 * right / settled : 0.0, 100.0 * artifacts / blocks, mismatches);
+    }
+    printf("ESP32 budget %d cycles per block (%.0f per sample, sensor task counts overruns)\n",
+           MOTION_BLOCK_BUDGET_CYCLES, (double)MOTION_BLOCK_BUDGET_CYCLES / block);
+
+    free(x);
+    free(y);
+    free(z);
+    free(fast_out);
+    free(naive_out);
+    return failures ? 1 : 0;
+}
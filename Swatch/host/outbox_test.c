@@ -0,0 +1,329 @@
+// Checks of the outbox (outbox.c): the block pool and its free list when full, freed
+// and reused in another order, sending in order across the wrap of seq, QoS 0 behind a
+// full QoS 1 window, and acks that are unknown, give-ups, timeouts and late. After every
+// step the pool and the in-flight count are checked against the entries. Run by ctest.
+//
+//   outbox_test
+//
+// Prints one line per check and exits 1 if any of them failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "outbox.h"
+
+#define MAX_SENT 64
+
+static int failures;
+
+#define CHECK(cond, ...) do {                   \
+        if (!(cond)) {                          \
+            printf("  FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                \
+            printf("\n");                       \
+            failures++;                         \
+        }                                       \
+    } while (0)
+
+static void report(const char *name, int failures_before) {
+    printf("%-28s %s\n", name, failures == failures_before ? "ok" : "FAILED");
+}
+
+static outbox_t ob;
+static const char topic[] = "t";
+
+// What the client was handed
+typedef struct {
+    uint8_t data[OUTBOX_MESSAGE_MAX];
+    size_t len;
+    int qos;
+    int msg_id;
+} sent_t;
+
+static sent_t sent[MAX_SENT];
+static int sent_count;
+static int next_msg_id;
+static bool client_refuses;
+
+static int send(void *ctx, const char *t, const uint8_t *data, size_t len, int qos) {
+    (void)ctx;
+    if (client_refuses || t != topic || sent_count == MAX_SENT) {
+        return -1;
+    }
+    sent_t *s = &sent[sent_count++];
+    memcpy(s->data, data, len);
+    s->len = len;
+    s->qos = qos;
+    s->msg_id = qos ? ++next_msg_id : 0;
+    return s->msg_id;
+}
+
+static void reset(uint8_t window) {
+    outbox_init(&ob, window);
+    sent_count = 0;
+    next_msg_id = 0;
+    client_refuses = false;
+}
+
+// Message n: its length and every byte follow from n, so a mixed-up chain shows
+static void fill(uint8_t *data, size_t len, uint32_t n) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)(n * 31 + i);
+    }
+}
+
+static bool put(uint32_t n, size_t len, uint8_t qos) {
+    uint8_t data[OUTBOX_MESSAGE_MAX];
+    fill(data, len, n);
+    return outbox_put(&ob, topic, data, len, qos);
+}
+
+static bool sent_is(const sent_t *s, uint32_t n, size_t len) {
+    uint8_t data[OUTBOX_MESSAGE_MAX];
+    fill(data, len, n);
+    return s->len == len && memcmp(s->data, data, len) == 0;
+}
+
+// Every block is either on the free list or in exactly one message's chain, and the
+// counters agree with the entries
+static void check_pool(const char *step) {
+    uint8_t owner[OUTBOX_BLOCKS] = {0};     // 0 none, 1 free list, 2 a message
+    int free_count = 0;
+    for (int16_t b = ob.free_block; b >= 0 && free_count <= OUTBOX_BLOCKS; b = ob.next_block[b]) {
+        CHECK(owner[b] == 0, "%s: block %d twice on the free list", step, b);
+        owner[b] = 1;
+        free_count++;
+    }
+    CHECK(free_count == ob.free_blocks, "%s: %d blocks on the free list, free_blocks %u", step, free_count,
+          ob.free_blocks);
+    int in_flight = 0;
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        const outbox_entry_t *e = &ob.entries[i];
+        if (e->state == OUTBOX_FREE) {
+            continue;
+        }
+        in_flight += e->state == OUTBOX_IN_FLIGHT;
+        int blocks = 0;
+        for (int16_t b = e->first_block; b >= 0 && blocks <= OUTBOX_BLOCKS; b = ob.next_block[b]) {
+            CHECK(owner[b] == 0, "%s: block %d of entry %d is %s", step, b, i, owner[b] == 1 ? "free" : "shared");
+            owner[b] = 2;
+            blocks++;
+        }
+        int want = e->len == 0 ? 1 : (e->len + OUTBOX_BLOCK_SIZE - 1) / OUTBOX_BLOCK_SIZE;
+        CHECK(blocks == want, "%s: entry %d has %d blocks for %u bytes", step, i, blocks, e->len);
+    }
+    for (int b = 0; b < OUTBOX_BLOCKS; b++) {
+        CHECK(owner[b] != 0, "%s: block %d lost", step, b);
+    }
+    CHECK(ob.stats.blocks_used == OUTBOX_BLOCKS - ob.free_blocks, "%s: blocks_used %u, %u free", step,
+          ob.stats.blocks_used, ob.free_blocks);
+    CHECK(ob.in_flight == in_flight, "%s: in_flight %u, %d entries in flight", step, ob.in_flight, in_flight);
+}
+
+static void test_full(void) {
+    int before = failures;
+    reset(OUTBOX_WINDOW);
+    // Blocks run out first with big messages
+    uint32_t n = 0;
+    while (put(n, 3 * OUTBOX_BLOCK_SIZE, 1)) {
+        n++;
+    }
+    CHECK(n == OUTBOX_BLOCKS / 3, "%u messages of 3 blocks, want %d", n, OUTBOX_BLOCKS / 3);
+    CHECK(ob.stats.full == 1, "full %u", ob.stats.full);
+    check_pool("blocks full");
+    // What is left over still takes a smaller one, if there is any
+    size_t left = ob.free_blocks * OUTBOX_BLOCK_SIZE;
+    CHECK(left == 0 ? !put(n, 1, 0) : put(n, left, 0), "%zu bytes left over", left);
+    CHECK(ob.stats.blocks_used == OUTBOX_BLOCKS, "blocks_used %u", ob.stats.blocks_used);
+    CHECK(!put(n + 1, 1, 0), "put into a full pool");
+    check_pool("pool full");
+
+    // Entries run out first with small messages
+    reset(OUTBOX_WINDOW);
+    for (n = 0; n < OUTBOX_ENTRIES; n++) {
+        CHECK(put(n, 1, 0), "small message %u refused", n);
+    }
+    CHECK(!put(n, 1, 0), "put with every entry taken");
+    CHECK(!outbox_has_room(&ob, 1), "room with every entry taken");
+    CHECK(ob.stats.blocks_used == OUTBOX_ENTRIES, "blocks_used %u", ob.stats.blocks_used);
+    check_pool("entries full");
+
+    // Too big for any pool
+    reset(OUTBOX_WINDOW);
+    CHECK(!put(0, OUTBOX_MESSAGE_MAX + 1, 0), "message above OUTBOX_MESSAGE_MAX taken");
+    check_pool("too big");
+    report("full pool and entries", before);
+}
+
+// Frees messages out of order, so the free list gets mixed up, then fills the pool again
+// with messages spanning several blocks and checks every byte that comes out
+static void test_reuse(void) {
+    int before = failures;
+    reset(OUTBOX_ENTRIES);
+    uint32_t n = 0;
+    while (put(n, 2 * OUTBOX_BLOCK_SIZE - 5, 1)) {
+        n++;
+    }
+    outbox_pump(&ob, send, NULL, 0);
+    CHECK(sent_count == (int)n, "%d sent of %u", sent_count, n);
+    check_pool("all in flight");
+    // Every other one first, then the rest backwards
+    for (int i = 0; i < sent_count; i += 2) {
+        outbox_ack_push(&ob, sent[i].msg_id, false);
+    }
+    outbox_poll(&ob, 0);
+    check_pool("half acked");
+    for (int i = sent_count - 1; i >= 0; i--) {
+        if (i % 2) {
+            outbox_ack_push(&ob, sent[i].msg_id, false);
+        }
+    }
+    outbox_poll(&ob, 0);
+    CHECK(ob.free_blocks == OUTBOX_BLOCKS && ob.in_flight == 0, "%u blocks free, %u in flight after all acks",
+          ob.free_blocks, ob.in_flight);
+    CHECK(ob.stats.acked == n, "acked %u of %u", ob.stats.acked, n);
+    check_pool("all acked");
+
+    // Sizes that don't fit the blocks evenly, on the scrambled free list
+    static const size_t sizes[] = { 1, OUTBOX_BLOCK_SIZE, OUTBOX_BLOCK_SIZE + 1, 5 * OUTBOX_BLOCK_SIZE - 1, 0, 77 };
+    int first = sent_count;
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        CHECK(put(100 + i, sizes[i], 0), "reused put of %zu bytes refused", sizes[i]);
+    }
+    check_pool("reused");
+    outbox_pump(&ob, send, NULL, 0);
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        CHECK(first + (int)i < sent_count && sent_is(&sent[first + i], 100 + i, sizes[i]),
+              "message %u (%zu bytes) came out wrong", i, sizes[i]);
+    }
+    CHECK(ob.free_blocks == OUTBOX_BLOCKS, "QoS 0 messages kept %d blocks", OUTBOX_BLOCKS - ob.free_blocks);
+    check_pool("reused and sent");
+    report("free and reuse blocks", before);
+}
+
+// seq runs freely, order must survive its wrap
+static void test_seq_wrap(void) {
+    int before = failures;
+    reset(OUTBOX_ENTRIES);
+    ob.next_seq = UINT32_MAX - 2;
+    for (uint32_t n = 0; n < 6; n++) {
+        put(n, 10, 0);
+    }
+    outbox_pump(&ob, send, NULL, 0);
+    CHECK(sent_count == 6, "%d sent", sent_count);
+    for (int i = 0; i < sent_count; i++) {
+        CHECK(sent_is(&sent[i], (uint32_t)i, 10), "message %d out of order across the wrap", i);
+    }
+    check_pool("seq wrap");
+    report("order across seq wrap", before);
+}
+
+// A QoS 0 message behind a full window waits too, then goes out in its turn
+static void test_window(void) {
+    int before = failures;
+    reset(2);
+    put(0, 10, 1);
+    put(1, 10, 1);
+    put(2, 10, 1);
+    put(3, 10, 0);
+    CHECK(outbox_pump(&ob, send, NULL, 0) == 2, "window of 2 let %d out", sent_count);
+    CHECK(ob.in_flight == 2 && outbox_queued(&ob) == 2, "%u in flight, %u queued", ob.in_flight, outbox_queued(&ob));
+    check_pool("window full");
+    // Nothing moves until an ack
+    CHECK(outbox_pump(&ob, send, NULL, 0) == 0, "pump with a full window sent something");
+    outbox_ack_push(&ob, sent[0].msg_id, false);
+    outbox_poll(&ob, 0);
+    check_pool("one acked");
+    // 2 takes the free slot; 3 is QoS 0 and needs none, so it follows
+    CHECK(outbox_pump(&ob, send, NULL, 0) == 2, "%d sent after the ack, want 2", sent_count - 2);
+    CHECK(sent_count == 4 && sent_is(&sent[2], 2, 10) && sent_is(&sent[3], 3, 10) && sent[3].qos == 0,
+          "wrong messages after the ack");
+    CHECK(ob.in_flight == 2 && outbox_queued(&ob) == 0, "%u in flight, %u queued", ob.in_flight, outbox_queued(&ob));
+    check_pool("QoS 0 sent");
+
+    // A client that refuses keeps everything queued, in order
+    put(4, 10, 0);
+    client_refuses = true;
+    CHECK(outbox_pump(&ob, send, NULL, 0) == 0 && ob.stats.send_failures == 1, "refused send counted %u",
+          ob.stats.send_failures);
+    CHECK(outbox_queued(&ob) == 1, "%u queued after a refusal", outbox_queued(&ob));
+    check_pool("client refused");
+    report("QoS 0 behind a full window", before);
+}
+
+static void test_acks(void) {
+    int before = failures;
+    reset(OUTBOX_WINDOW);
+    put(0, 10, 1);
+    put(1, 10, 1);
+    outbox_pump(&ob, send, NULL, 1000);
+    int id0 = sent[0].msg_id, id1 = sent[1].msg_id;
+
+    // An id nobody sent, and an ack for a message that is still queued
+    outbox_ack_push(&ob, 12345, false);
+    outbox_ack_push(&ob, 12345, true);
+    outbox_poll(&ob, 1000);
+    CHECK(ob.in_flight == 2 && ob.stats.acked == 0 && ob.stats.resent == 0, "unknown id changed something");
+    check_pool("unknown id");
+
+    // The client gives up on one: it goes again, with a new id
+    outbox_ack_push(&ob, id0, true);
+    outbox_poll(&ob, 1000);
+    CHECK(ob.in_flight == 1 && outbox_queued(&ob) == 1 && ob.stats.resent == 1, "give-up: %u in flight, resent %u",
+          ob.in_flight, ob.stats.resent);
+    check_pool("gave up");
+    // Its late ack while it is queued does nothing
+    outbox_ack_push(&ob, id0, false);
+    outbox_poll(&ob, 1000);
+    CHECK(ob.in_flight == 1 && outbox_queued(&ob) == 1 && ob.stats.acked == 0, "ack of a queued message applied");
+    check_pool("ack while queued");
+    outbox_pump(&ob, send, NULL, 2000);
+    CHECK(sent_count == 3 && sent_is(&sent[2], 0, 10) && sent[2].msg_id != id0, "give-up not sent again");
+    int id0_again = sent[2].msg_id;
+    check_pool("sent again");
+
+    // No ack for the other one: it times out, goes again, and then the ack for the old id
+    // comes in. The old id is gone, so only the new ack frees it.
+    CHECK(outbox_ms_until_timeout(&ob, 1000 + OUTBOX_ACK_TIMEOUT_MS - 10) == 10, "timeout in %u ms, want 10",
+          outbox_ms_until_timeout(&ob, 1000 + OUTBOX_ACK_TIMEOUT_MS - 10));
+    outbox_poll(&ob, 1000 + OUTBOX_ACK_TIMEOUT_MS);
+    CHECK(ob.in_flight == 1 && outbox_queued(&ob) == 1 && ob.stats.resent == 2, "timeout: %u in flight, resent %u",
+          ob.in_flight, ob.stats.resent);
+    check_pool("timed out");
+    outbox_pump(&ob, send, NULL, 1000 + OUTBOX_ACK_TIMEOUT_MS);
+    CHECK(sent_count == 4 && sent_is(&sent[3], 1, 10), "timed out message not sent again");
+    int id1_again = sent[3].msg_id;
+    outbox_ack_push(&ob, id1, false);
+    outbox_poll(&ob, 1000 + OUTBOX_ACK_TIMEOUT_MS);
+    CHECK(ob.in_flight == 2 && ob.stats.acked == 0, "old id after a resend freed something");
+    check_pool("old id acked");
+    outbox_ack_push(&ob, id1_again, false);
+    outbox_ack_push(&ob, id0_again, false);
+    outbox_poll(&ob, 1000 + OUTBOX_ACK_TIMEOUT_MS);
+    CHECK(ob.in_flight == 0 && ob.stats.acked == 2 && ob.free_blocks == OUTBOX_BLOCKS,
+          "after the new acks: %u in flight, %u acked, %u blocks free", ob.in_flight, ob.stats.acked, ob.free_blocks);
+    CHECK(outbox_ms_until_timeout(&ob, 0) == UINT32_MAX, "timeout with nothing in flight");
+    check_pool("all acked");
+
+    // A full ack ring refuses, the message then times out instead
+    for (int i = 0; i < OUTBOX_ACK_RING; i++) {
+        outbox_ack_push(&ob, 1000 + i, false);
+    }
+    CHECK(!outbox_ack_push(&ob, 2000, false), "ack ring took more than OUTBOX_ACK_RING");
+    outbox_poll(&ob, 0);
+    check_pool("ack ring drained");
+    report("acks, give-ups and timeouts", before);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        fprintf(stderr, "usage: %s\n", argv[0]);
+        return 2;
+    }
+    test_full();
+    test_reuse();
+    test_seq_wrap();
+    test_window();
+    test_acks();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,593 @@
+// End-to-end benchmark of the firmware pipeline on the host: the real sensor, data send
+// and BLE notify tasks run against the stand-ins in shim/ and every MQTT publish and BLE
+// notification is timed against the timestamp of the sample it carries.
+//
+//   pipeline_bench [--seconds N] [--scale X] [--outage AT:LEN]
+//                  [--policy DEADBAND:SILENCE_MS:MIN_INTERVAL_MS:HIGH:LOW] [--alarm-every S]
+//                  [--agg WINDOW_MS:STEP_MS:RAW] [--centrals N] [--mtu N] [--slow-link PER_S]
+//                  [--profile split|unpinned|shared] [--radio-load SHARE]
+//                  [--link-drop AT] [--ap-down AT:LEN] [--wifi-down AT:LEN]
+//                  [--qos 0|1] [--window N] [--uplink BYTES_PER_S] [--stall AT:LEN]
+//                  [--activity still|moving|walk|run|mixed] [--mqtt 3|5] [-v]
+//
+// --seconds is simulated time, --scale makes simulated time run X times faster,
+// --outage takes the broker down LEN seconds after AT seconds (samples go to the
+// file-backed flash log and are replayed afterwards), --policy replaces the publish
+// policy (see publish.h) and --alarm-every forces a 150 BPM beat every S seconds
+// through the MQTT override command. --agg changes the statistics windows (see
+// aggregate.h), RAW 0 stops publishing single beats except for alarms. --centrals
+// connects up to BLE_MAX_CONNECTIONS centrals that all ask for an MTU of --mtu, and
+// --slow-link lets the last of them take only PER_S notifications per second.
+// --profile places the tasks (see tasks.h) and --radio-load keeps CPU 0 busy for that
+// share of the time, as the radio stacks do under heavy traffic. Sensor jitter is in
+// simulated time, so use --scale 1 to see host scheduling as it is. --link-drop
+// deauthenticates the station at AT seconds, --ap-down takes the AP it is on away for
+// LEN seconds (the other one stays) and --wifi-down takes both away. --qos and --window
+// set how batches are delivered (see outbox.h), --uplink limits the bytes per second
+// that reach the broker and --stall leaves the connection half-open for LEN seconds.
+// Every sample is counted once however often it arrives; the rest are duplicates, and
+// samples that only ever went into a dead link are lost. --activity sets what the
+// simulated wearer does (mixed goes through all four, a minute each); steps counted are
+// compared with the steps simulated. --mqtt picks the protocol version (see mqtt.h); the
+// bytes every packet costs on top of its payload and the publishes the broker sent
+// straight back to the watch are reported for either.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "host_standins.h"
+#include "sensor.h"
+#include "mqtt.h"
+#include "hrs.h"
+#include "tscodec.h"
+#include "ble.h"
+#include "boot.h"
+#include "tasks.h"
+#include "wifi.h"
+#include "outbox.h"
+#include "metrics.h"
+
+void app_main(void);
+
+#define MAX_LATENCIES 65536
+
+typedef struct {
+    uint32_t values[MAX_LATENCIES];
+    size_t count;
+} latencies_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static latencies_t publish_latency;
+
+// What each fake central received
+typedef struct {
+    latencies_t latency;    // age of the newest beat when a notification arrived
+    latencies_t queued;     // time notifications waited in a rate limited link
+    uint32_t notifications;
+    uint32_t rr;            // RR-intervals received
+    uint32_t bytes;
+} central_t;
+
+static central_t centrals[BLE_MAX_CONNECTIONS];
+static latencies_t backlog_latency;
+static latencies_t alarm_latency;
+static bool in_alarm;
+static publish_policy_t policy = PUBLISH_POLICY_DEFAULT;
+static uint32_t publishes;
+static uint32_t backlog_publishes;
+static uint32_t backlog_samples;
+static uint32_t published_samples;
+static uint32_t published_bytes;
+static uint32_t activity_records;
+static uint32_t metrics_reports;
+static uint32_t summaries;
+static uint32_t summary_bytes;
+static char last_report[2048];
+static uint32_t link_lost_ms;       // when the bench last broke the link, 0 once something got out
+static uint32_t lost_to_publish_ms; // link broken -> next publish, last time
+
+// Sample timestamps, one bit per ms
+typedef struct {
+    uint8_t *bits;
+    size_t bytes;
+} ts_set_t;
+
+static ts_set_t arrived;        // reached the broker
+static ts_set_t sent_to_nowhere;  // went into a dead link at least once
+static uint32_t unique_samples;
+static uint32_t duplicate_samples;
+
+// Adds t, returns whether it was there already
+static bool ts_set_add(ts_set_t *set, uint32_t t) {
+    if (t / 8 >= set->bytes) {
+        size_t grown = (t / 8 + 1) * 2;
+        set->bits = realloc(set->bits, grown);
+        memset(set->bits + set->bytes, 0, grown - set->bytes);
+        set->bytes = grown;
+    }
+    bool had = set->bits[t / 8] & (1 << (t % 8));
+    set->bits[t / 8] |= 1 << (t % 8);
+    return had;
+}
+
+static bool ts_set_has(const ts_set_t *set, uint32_t t) {
+    return t / 8 < set->bytes && (set->bits[t / 8] & (1 << (t % 8)));
+}
+
+static void count_sample(uint32_t t) {
+    if (ts_set_add(&arrived, t)) {
+        duplicate_samples++;
+    } else {
+        unique_samples++;
+    }
+}
+
+// Samples that went into a dead link and never arrived another way
+static uint32_t lost_samples(void) {
+    uint32_t n = 0;
+    for (uint32_t t = 0; t < sent_to_nowhere.bytes * 8; t++) {
+        n += ts_set_has(&sent_to_nowhere, t) && !ts_set_has(&arrived, t);
+    }
+    return n;
+}
+
+static void record(latencies_t *l, uint32_t ms) {
+    if (l->count < MAX_LATENCIES) {
+        l->values[l->count++] = ms;
+    }
+}
+
+// Decodes the batch payloads in data (back to back) and records the age of every
+// sample. Returns the number of samples.
+static uint32_t decode_batches(const uint8_t *data, size_t len, uint32_t now, latencies_t *l) {
+    uint32_t n = 0;
+    ts_decoder_t dec;
+    while (len > 0 && ts_decoder_init(&dec, data, len)) {
+        uint32_t t;
+        int32_t bpm;
+        while (ts_decode(&dec, &t, &bpm)) {
+            record(l, now - t);
+            count_sample(t);
+            // First beat of every alarm episode (the one that has to be fast)
+            bool alarm = (policy.alarm_high_bpm && bpm >= policy.alarm_high_bpm) ||
+                         (policy.alarm_low_bpm && bpm <= policy.alarm_low_bpm);
+            if (alarm && !in_alarm) {
+                record(&alarm_latency, now - t);
+            }
+            in_alarm = alarm;
+            n++;
+        }
+        size_t used = ts_decoder_used(&dec);
+        data += used;
+        len -= used;
+    }
+    return n;
+}
+
+static void on_lost(const char *topic, const char *data, int len) {
+    if (strstr(topic, "/agg") || strstr(topic, "/metrics")) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    ts_decoder_t dec;
+    const uint8_t *p = (const uint8_t *)data;
+    size_t left = len > 0 ? (size_t)len : 0;
+    while (left > 0 && ts_decoder_init(&dec, p, left)) {
+        uint32_t t;
+        int32_t bpm;
+        while (ts_decode(&dec, &t, &bpm)) {
+            ts_set_add(&sent_to_nowhere, t);
+        }
+        size_t used = ts_decoder_used(&dec);
+        p += used;
+        left -= used;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void on_publish(const char *topic, const char *data, int len) {
+    uint32_t now = now_ms();
+    if (len <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (link_lost_ms) {
+        lost_to_publish_ms = now - link_lost_ms;
+        link_lost_ms = 0;
+    }
+    // Replayed batches and telemetry come on their own topics
+    if (strstr(topic, "/activity")) {
+        activity_records++;
+    } else if (strstr(topic, "/agg")) {
+        summaries++;
+        summary_bytes += len;
+    } else if (strstr(topic, "/metrics")) {
+        metrics_reports++;
+        snprintf(last_report, sizeof(last_report), "%.*s", len, data);
+    } else if (strstr(topic, "/backlog")) {
+        backlog_publishes++;
+        backlog_samples += decode_batches((const uint8_t *)data, len, now, &backlog_latency);
+    } else {
+        publishes++;
+        published_bytes += len;
+        published_samples += decode_batches((const uint8_t *)data, len, now, &publish_latency);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// Every beat the sensor task hands to BLE goes through here first (the link step wraps
+// ble_heart_rate_updated, see CMakeLists.txt), so the bench knows the newest one
+static _Atomic uint32_t newest_beat_ms;
+
+void __real_ble_heart_rate_updated(const bpm_sample_t *sample);
+void __wrap_ble_heart_rate_updated(const bpm_sample_t *sample) {
+    atomic_store(&newest_beat_ms, sample->timestamp_ms);
+    __real_ble_heart_rate_updated(sample);
+}
+
+// A notification carries the newest beat, so its age is measured against that
+// (a lower bound for one that sat in a rate limited link's queue)
+static void on_notify(uint16_t conn_id, uint16_t handle, const uint8_t *value, uint16_t len, uint32_t queued_ms) {
+    (void)handle;
+    uint32_t now = now_ms();
+    uint32_t newest = atomic_load(&newest_beat_ms);
+    if (conn_id >= BLE_MAX_CONNECTIONS || len < 2) {
+        return;
+    }
+    central_t *c = &centrals[conn_id];
+    size_t header = (value[0] & HRS_FLAG_VALUE_UINT16) ? 3 : 2;
+    pthread_mutex_lock(&lock);
+    c->notifications++;
+    c->bytes += len;
+    if ((value[0] & HRS_FLAG_RR_PRESENT) && len > header) {
+        c->rr += (len - header) / 2;
+    }
+    record(&c->latency, now - newest);
+    record(&c->queued, queued_ms);
+    pthread_mutex_unlock(&lock);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latencies(const char *name, latencies_t *l) {
+    if (l->count == 0) {
+        printf("%-18s no samples\n", name);
+        return;
+    }
+    qsort(l->values, l->count, sizeof(l->values[0]), cmp_u32);
+    printf("%-18s n=%-6zu p50=%-6lu p90=%-6lu p99=%-6lu max=%lu ms\n", name, l->count,
+           (unsigned long)l->values[l->count * 50 / 100],
+           (unsigned long)l->values[l->count * 90 / 100],
+           (unsigned long)l->values[l->count * 99 / 100],
+           (unsigned long)l->values[l->count - 1]);
+}
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 300;
+    double scale = 20;
+    double outage_at = 0, outage_len = 0;
+    double alarm_every = 0;
+    int central_count = 1;
+    int mtu = BLE_LOCAL_MTU;
+    double slow_link = 0;
+    double radio_load = 0;
+    double link_drop_at = -1;
+    double ap_down_at = 0, ap_down_len = 0;
+    double wifi_down_at = 0, wifi_down_len = 0;
+    double stall_at = 0, stall_len = 0;
+    int qos = -1, window = OUTBOX_WINDOW;
+    int mqtt_version = CONFIG_MQTT_PROTOCOL_5 ? 5 : 3;
+    uint32_t uplink = 0;
+    int activity = ACTIVITY_STILL;
+    bool mixed = false;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--outage") == 0 && i + 1 < argc &&
+                   sscanf(argv[++i], "%lf:%lf", &outage_at, &outage_len) == 2) {
+            // parsed above
+        } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            unsigned deadband, silence, interval, high, low;
+            if (sscanf(argv[++i], "%u:%u:%u:%u:%u", &deadband, &silence, &interval, &high, &low) != 5) {
+                fprintf(stderr, "--policy wants DEADBAND:SILENCE_MS:MIN_INTERVAL_MS:HIGH:LOW\n");
+                return 2;
+            }
+            policy.deadband_bpm = (uint16_t)deadband;
+            policy.max_silence_ms = silence;
+            policy.min_interval_ms = interval;
+            policy.alarm_high_bpm = (uint16_t)high;
+            policy.alarm_low_bpm = (uint16_t)low;
+        } else if (strcmp(argv[i], "--alarm-every") == 0 && i + 1 < argc) {
+            alarm_every = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--agg") == 0 && i + 1 < argc) {
+            unsigned window, step, raw;
+            if (sscanf(argv[++i], "%u:%u:%u", &window, &step, &raw) != 3 ||
+                !data_send_set_aggregation(&(agg_config_t){ .window_ms = window, .step_ms = step }, raw != 0)) {
+                fprintf(stderr, "--agg wants WINDOW_MS:STEP_MS:RAW with 0 < STEP_MS <= WINDOW_MS\n");
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--centrals") == 0 && i + 1 < argc) {
+            central_count = atoi(argv[++i]);
+            if (central_count < 1 || central_count > BLE_MAX_CONNECTIONS) {
+                fprintf(stderr, "--centrals wants 1 to %d\n", BLE_MAX_CONNECTIONS);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--mtu") == 0 && i + 1 < argc) {
+            mtu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--slow-link") == 0 && i + 1 < argc) {
+            slow_link = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            task_profile_t profile;
+            if (!tasks_profile_by_name(argv[++i], &profile)) {
+                fprintf(stderr, "--profile wants split, unpinned or shared\n");
+                return 2;
+            }
+            tasks_set_profile(profile);
+        } else if (strcmp(argv[i], "--radio-load") == 0 && i + 1 < argc) {
+            radio_load = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--link-drop") == 0 && i + 1 < argc) {
+            link_drop_at = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ap-down") == 0 && i + 1 < argc &&
+                   sscanf(argv[++i], "%lf:%lf", &ap_down_at, &ap_down_len) == 2) {
+            // parsed
+        } else if (strcmp(argv[i], "--wifi-down") == 0 && i + 1 < argc &&
+                   sscanf(argv[++i], "%lf:%lf", &wifi_down_at, &wifi_down_len) == 2) {
+            // parsed
+        } else if (strcmp(argv[i], "--qos") == 0 && i + 1 < argc) {
+            qos = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--uplink") == 0 && i + 1 < argc) {
+            uplink = (uint32_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "--stall") == 0 && i + 1 < argc &&
+                   sscanf(argv[++i], "%lf:%lf", &stall_at, &stall_len) == 2) {
+            // parsed
+        } else if (strcmp(argv[i], "--activity") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            mixed = strcmp(name, "mixed") == 0;
+            activity = strcmp(name, "moving") == 0 ? ACTIVITY_MOVING
+                     : strcmp(name, "walk") == 0   ? ACTIVITY_WALKING
+                     : strcmp(name, "run") == 0    ? ACTIVITY_RUNNING
+                                                   : ACTIVITY_STILL;
+        } else if (strcmp(argv[i], "--mqtt") == 0 && i + 1 < argc) {
+            mqtt_version = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [--seconds N] [--scale X] [--outage AT:LEN] "
+                            "[--policy D:S:I:H:L] [--alarm-every S] [--agg W:S:R] "
+                            "[--centrals N] [--mtu N] [--slow-link PER_S] "
+                            "[--profile split|unpinned|shared] [--radio-load SHARE] "
+                            "[--link-drop AT] [--ap-down AT:LEN] [--wifi-down AT:LEN] "
+                            "[--qos 0|1] [--window N] [--uplink BYTES_PER_S] [--stall AT:LEN] "
+                            "[--activity still|moving|walk|run|mixed] [--mqtt 3|5] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    if ((qos >= 0 || window != OUTBOX_WINDOW) &&
+        !data_send_set_delivery(qos >= 0 ? (uint8_t)qos : 1, (uint8_t)window)) {
+        fprintf(stderr, "--qos wants 0 or 1, --window 1 to %d\n", OUTBOX_ENTRIES);
+        return 2;
+    }
+    if (!mqtt_set_protocol(mqtt_version)) {
+        fprintf(stderr, "--mqtt wants 3 or 5\n");
+        return 2;
+    }
+
+    host_set_time_scale(scale);
+    esp_log_level_set("*", verbose ? ESP_LOG_INFO : ESP_LOG_WARN);
+    host_mqtt_set_publish_hook(on_publish);
+    host_mqtt_set_lost_hook(on_lost);
+    host_ble_set_notify_hook(on_notify);
+    data_send_set_policy(&policy);
+
+    // Fresh 256 KB offline log for every run
+    char log_path[64];
+    snprintf(log_path, sizeof(log_path), "/tmp/pipeline_bench_%d.bin", (int)getpid());
+    unlink(log_path);
+    host_partition_add("hrlog", log_path, 256 * 1024);
+
+    host_set_radio_load(radio_load);
+    host_mqtt_set_uplink(uplink);
+    sensor_sim_set_activity((activity_t)activity);
+    double wall_start = wall_seconds();
+    app_main();
+
+    // Connect the centrals and turn heart rate notifications on once the CCCD exists.
+    // Each one has to wait for the firmware to advertise again.
+    uint16_t cccd = 0;
+    while ((cccd = host_ble_find_handle(0x2902)) == 0) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    if (slow_link > 0) {
+        host_ble_set_link_rate((uint16_t)(central_count - 1), slow_link);
+    }
+    uint8_t enable[2] = {HRS_CCCD_NOTIFY & 0xFF, HRS_CCCD_NOTIFY >> 8};
+    for (uint16_t id = 0; id < central_count; id++) {
+        while (!host_ble_connect(id)) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+        host_ble_exchange_mtu(id, (uint16_t)mtu);
+        host_ble_write(id, cccd, enable, sizeof(enable));
+    }
+
+    // Drive the scenario in 100 ms steps
+    uint32_t start_ms = now_ms();
+    double next_alarm = alarm_every;
+    bool broker_down = false;
+    bool link_dropped = false, ap_down = false, wifi_down = false, stalled = false;
+    TickType_t wake = xTaskGetTickCount();
+    for (double t = 0; t < seconds; t += 0.1) {
+        // Only at the edges, the first connect is the firmware's own business
+        bool down = outage_len > 0 && t >= outage_at && t < outage_at + outage_len;
+        if (down != broker_down) {
+            host_mqtt_set_connected(!down);
+            broker_down = down;
+        }
+        if (link_drop_at >= 0 && t >= link_drop_at && !link_dropped) {
+            link_dropped = true;
+            pthread_mutex_lock(&lock);
+            link_lost_ms = now_ms();
+            pthread_mutex_unlock(&lock);
+            host_wifi_drop_link();
+        }
+        // AP 0 is the one the station picks while it is up
+        down = ap_down_len > 0 && t >= ap_down_at && t < ap_down_at + ap_down_len;
+        if (down != ap_down) {
+            if (down) {
+                pthread_mutex_lock(&lock);
+                link_lost_ms = now_ms();
+                pthread_mutex_unlock(&lock);
+            }
+            host_wifi_set_ap(0, !down);
+            ap_down = down;
+        }
+        down = wifi_down_len > 0 && t >= wifi_down_at && t < wifi_down_at + wifi_down_len;
+        if (down != wifi_down) {
+            if (down) {
+                pthread_mutex_lock(&lock);
+                link_lost_ms = now_ms();
+                pthread_mutex_unlock(&lock);
+            }
+            for (int ap = 0; ap < HOST_WIFI_APS; ap++) {
+                host_wifi_set_ap(ap, !down);
+            }
+            wifi_down = down;
+        }
+        down = stall_len > 0 && t >= stall_at && t < stall_at + stall_len;
+        if (down != stalled) {
+            if (down) {
+                pthread_mutex_lock(&lock);
+                link_lost_ms = now_ms();
+                pthread_mutex_unlock(&lock);
+            }
+            host_mqtt_set_stalled(down);
+            stalled = down;
+        }
+        if (mixed) {
+            activity_t now_doing = (activity_t)((int)(t / 60) % 4);
+            if ((int)now_doing != activity) {
+                sensor_sim_set_activity(now_doing);
+                activity = now_doing;
+            }
+        }
+        if (alarm_every > 0 && t >= next_alarm) {
+            host_mqtt_inject("hexagon", "150", 3);
+            next_alarm += alarm_every;
+        }
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(100));
+    }
+    double sim_s = (now_ms() - start_ms) / 1000.0;
+    double wall_s = wall_seconds() - wall_start;
+
+    pthread_mutex_lock(&lock);
+    printf("simulated %.0f s in %.1f s wall (scale %.0f)\n", sim_s, wall_s, scale);
+    printf("boot               first sample %lu ms, advertising %lu ms, IP %lu ms, MQTT %lu ms, first publish %lu ms\n",
+           (unsigned long)boot_ms(BOOT_FIRST_SAMPLE), (unsigned long)boot_ms(BOOT_BLE_ADVERTISING),
+           (unsigned long)boot_ms(BOOT_WIFI_GOT_IP), (unsigned long)boot_ms(BOOT_MQTT_CONNECTED),
+           (unsigned long)boot_ms(BOOT_FIRST_PUBLISH));
+    wifi_stats_t wifi;
+    wifi_get_stats(&wifi);
+    printf("wifi               %lu connects (%lu fast, %lu fast misses), %lu scans, %lu links lost, "
+           "outage last %lu ms max %lu ms\n",
+           (unsigned long)wifi.connects, (unsigned long)wifi.fast_connects, (unsigned long)wifi.fast_misses,
+           (unsigned long)wifi.scans, (unsigned long)wifi.disconnects, (unsigned long)wifi.last_outage_ms,
+           (unsigned long)wifi.max_outage_ms);
+    if (link_drop_at >= 0 || ap_down_len > 0 || wifi_down_len > 0 || stall_len > 0) {
+        printf("link lost->publish %lu ms, %lu publishes into a dead link\n", (unsigned long)lost_to_publish_ms,
+               (unsigned long)host_mqtt_dead_link_publishes());
+    }
+    print_latencies("sample->publish", &publish_latency);
+    print_latencies("sample->BLE", &centrals[0].latency);
+    if (backlog_publishes) {
+        print_latencies("sample->replay", &backlog_latency);
+    }
+    if (alarm_latency.count) {
+        print_latencies("alarm->publish", &alarm_latency);
+    }
+    metrics_hist_snapshot_t jitter;
+    sensor_jitter_since_boot(&jitter);
+    printf("sensor jitter      n=%-6lu p50=%-6lu p90=%-6lu p99=%-6lu max=%lu us (profile %s, radio load %.0f%%)\n",
+           (unsigned long)jitter.count, (unsigned long)metrics_hist_percentile(&jitter, 50),
+           (unsigned long)metrics_hist_percentile(&jitter, 90), (unsigned long)metrics_hist_percentile(&jitter, 99),
+           (unsigned long)jitter.max, tasks_profile_name(tasks_profile()), radio_load * 100);
+    printf("PPG samples/s      %d per simulated s, %.0f per wall s\n",
+           PPG_SAMPLE_RATE_HZ, sim_s * PPG_SAMPLE_RATE_HZ / wall_s);
+    printf("beats/s            %.2f published, %lu notifications (one per beat)\n",
+           published_samples / sim_s, (unsigned long)centrals[0].notifications);
+    uint32_t connected, subscribed, rr_lost;
+    ble_link_stats(&connected, &subscribed, &rr_lost);
+    for (int id = 0; id < central_count; id++) {
+        central_t *c = &centrals[id];
+        bool slow = slow_link > 0 && id == central_count - 1;
+        printf("central %d          %lu notifications, %.1f bytes avg, %lu RR-intervals%s\n", id,
+               (unsigned long)c->notifications, c->notifications ? (double)c->bytes / c->notifications : 0.0,
+               (unsigned long)c->rr, slow ? " (slow link)" : "");
+        if (id > 0) {
+            print_latencies("  newest beat age", &c->latency);
+        }
+        if (slow) {
+            print_latencies("  link queue wait", &c->queued);
+        }
+    }
+    printf("BLE links          %lu connected, %lu subscribed, MTU %d asked, %lu RR-intervals lost\n",
+           (unsigned long)connected, (unsigned long)subscribed, mtu, (unsigned long)rr_lost);
+    printf("policy             deadband %u BPM, silence %lu ms, interval %lu ms, alarms <=%u >=%u BPM\n",
+           policy.deadband_bpm, (unsigned long)policy.max_silence_ms, (unsigned long)policy.min_interval_ms,
+           policy.alarm_low_bpm, policy.alarm_high_bpm);
+    printf("publishes          %lu, %.1f/min (%.1f samples, %.1f bytes/sample)\n", (unsigned long)publishes,
+           publishes * 60.0 / sim_s, publishes ? (double)published_samples / publishes : 0.0,
+           published_samples ? (double)published_bytes / published_samples : 0.0);
+    if (backlog_publishes) {
+        printf("replayed           %lu samples in %lu publishes\n",
+               (unsigned long)backlog_samples, (unsigned long)backlog_publishes);
+    }
+    printf("samples delivered  %lu unique, %lu duplicates, %lu lost in a dead link\n",
+           (unsigned long)unique_samples, (unsigned long)duplicate_samples, (unsigned long)lost_samples());
+    size_t client_bytes, client_max;
+    uint32_t client_expired;
+    host_mqtt_outbox_stats(&client_bytes, &client_max, &client_expired);
+    printf("outbox             %lu/%d blocks max, %lu full, %lu resent; client outbox max %zu bytes, "
+           "%lu expired\n", (unsigned long)atomic_load(&metrics_data_send.outbox_blocks_max), OUTBOX_BLOCKS,
+           (unsigned long)atomic_load(&metrics_data_send.outbox_full),
+           (unsigned long)atomic_load(&metrics_data_send.outbox_resent), client_max, (unsigned long)client_expired);
+    printf("motion             %lu steps counted of %lu, %lu activity records, %lu beats flagged as artifacts\n",
+           (unsigned long)atomic_load(&metrics_data_send.steps), (unsigned long)sensor_sim_steps(),
+           (unsigned long)activity_records, (unsigned long)atomic_load(&metrics_data_send.artifact_beats));
+    host_mqtt_wire_stats_t wire;
+    host_mqtt_wire_stats(&wire);
+    printf("MQTT %d wire        %lu packets, %.1f bytes overhead/packet, %lu echoed back (%llu bytes), "
+           "%lu alias errors\n", mqtt_version, (unsigned long)wire.packets,
+           wire.packets ? (double)(wire.bytes - wire.payload_bytes) / wire.packets : 0.0,
+           (unsigned long)wire.echoed, (unsigned long long)wire.echoed_bytes, (unsigned long)wire.alias_errors);
+    printf("ring drops         %lu\n", (unsigned long)atomic_load(&sample_ring.dropped));
+    if (summaries) {
+        printf("window summaries   %lu, %.1f/min (%lu bytes)\n", (unsigned long)summaries,
+               summaries * 60.0 / sim_s, (unsigned long)summary_bytes);
+    }
+    if (metrics_reports) {
+        printf("metrics reports    %lu, last: %s\n", (unsigned long)metrics_reports, last_report);
+    }
+    pthread_mutex_unlock(&lock);
+    unlink(log_path);
+    return 0;
+}
@@ -0,0 +1,378 @@
+// Golden-output test and throughput bench of the PPG beat detector (ppg.c). Each trace
+// in traces/ (a minute of wrist PPG at 100 and 500 Hz, see make_ppg_traces.py) is fed
+// through ppg_process_block and the beats that come out (sample index, IBI, BPM) must
+// match the .expected file next to it exactly. Run by ctest.
+//
+//   ppg_test [--update] [--seconds N]
+//
+// The traces go through in blocks of a quarter second as the sensor task does, and
+// again in blocks of every size from 1 to 97 samples, which must not change a beat. Two
+// more runs check what a trace alone doesn't reach: beats coming faster than the caller
+// takes them, and a pause long enough (about 12 h at 100 Hz) that the gap in ms would
+// overflow. The beats are also compared with the true beats listed in the trace: away
+// from the disturbed stretch (arm swinging, lost contact) and the settling after it, at
+// least MIN_RECALL_PCT % of them must have a beat within 100 ms, and at most
+// MAX_FALSE_BEATS beats in the whole trace may be near no true beat. Every trace is run
+// for --seconds to report samples per second.
+//
+// --update writes the .expected files from what the detector does now; look at the
+// diff before committing it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ppg.h"
+
+#ifndef TRACE_DIR
+#define TRACE_DIR "traces"
+#endif
+
+#define MAX_SAMPLES 40000
+#define MAX_BEATS 256
+#define MAX_TRUE_BEATS 256
+
+// Accuracy floor against the true beats. After arm swinging and lost contact the
+// detector needs a few beats to trust the intervals again, so SETTLE_S more seconds are
+// left out of the recall. The first beat is never reported (it has no interval).
+#define MIN_RECALL_PCT 95
+#define MAX_FALSE_BEATS 2
+#define SETTLE_S 4
+
+typedef struct {
+    const char *name;
+    uint16_t rate_hz;
+    int32_t samples[MAX_SAMPLES];
+    size_t count;
+    uint32_t true_beats[MAX_TRUE_BEATS];
+    size_t true_count;
+    uint32_t disturbed_from, disturbed_to;  // seconds, from the "# disturbed" line
+} trace_t;
+
+typedef struct {
+    ppg_beat_t beats[MAX_BEATS];
+    size_t count;
+} beats_t;
+
+static int failures;
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// "# rate_hz N ...", "# beats i j k ..." and "# disturbed from to" lines, then one
+// sample per line
+static bool load_trace(trace_t *t, const char *name) {
+    char path[256], line[8192];
+    snprintf(path, sizeof(path), "%s/%s.txt", TRACE_DIR, name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("%s: can't open %s\n", name, path);
+        return false;
+    }
+    t->name = name;
+    t->rate_hz = 0;
+    t->count = 0;
+    t->true_count = 0;
+    t->disturbed_from = t->disturbed_to = 0;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned rate, from, to;
+        if (sscanf(line, "# rate_hz %u", &rate) == 1) {
+            t->rate_hz = (uint16_t)rate;
+        } else if (sscanf(line, "# disturbed %u %u", &from, &to) == 2) {
+            t->disturbed_from = from;
+            t->disturbed_to = to;
+        } else if (strncmp(line, "# beats", 7) == 0) {
+            char *p = line + 7, *end;
+            for (unsigned long v; (v = strtoul(p, &end, 10)), end != p && t->true_count < MAX_TRUE_BEATS; p = end) {
+                t->true_beats[t->true_count++] = (uint32_t)v;
+            }
+        } else if (line[0] != '#' && t->count < MAX_SAMPLES) {
+            t->samples[t->count++] = (int32_t)strtol(line, NULL, 10);
+        }
+    }
+    fclose(f);
+    if (t->rate_hz == 0 || t->count == 0) {
+        printf("%s: no rate or no samples in %s\n", name, path);
+        return false;
+    }
+    return true;
+}
+
+static void add_beats(beats_t *out, const ppg_beat_t *beats, size_t n) {
+    for (size_t i = 0; i < n && out->count < MAX_BEATS; i++) {
+        out->beats[out->count++] = beats[i];
+    }
+}
+
+// Feeds the trace in blocks of block samples, or of 1, 2, ... 97 samples over and over
+// if block is 0
+static void run(const trace_t *t, size_t block, beats_t *out) {
+    static ppg_t ppg;
+    ppg_beat_t beats[MAX_BEATS];
+    ppg_init(&ppg, t->rate_hz);
+    out->count = 0;
+    size_t size = 1;
+    for (size_t pos = 0; pos < t->count;) {
+        size_t n = block ? block : size;
+        if (n > t->count - pos) {
+            n = t->count - pos;
+        }
+        add_beats(out, beats, ppg_process_block(&ppg, t->samples + pos, n, beats, MAX_BEATS));
+        pos += n;
+        size = size % 97 + 1;
+    }
+}
+
+static bool same_beats(const beats_t *a, const beats_t *b, const char *what) {
+    for (size_t i = 0; i < a->count || i < b->count; i++) {
+        if (i >= a->count || i >= b->count || memcmp(&a->beats[i], &b->beats[i], sizeof(ppg_beat_t)) != 0) {
+            printf("  FAIL %s: beat %zu differs", what, i);
+            if (i < a->count) {
+                printf(", want %lu %u %u", (unsigned long)a->beats[i].sample_index, a->beats[i].ibi_ms,
+                       a->beats[i].bpm);
+            }
+            if (i < b->count) {
+                printf(", got %lu %u %u", (unsigned long)b->beats[i].sample_index, b->beats[i].ibi_ms,
+                       b->beats[i].bpm);
+            }
+            printf(" (sample_index ibi_ms bpm)\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool load_expected(const trace_t *t, beats_t *out) {
+    char path[256], line[128];
+    snprintf(path, sizeof(path), "%s/%s.expected", TRACE_DIR, t->name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("  FAIL can't open %s (ppg_test --update writes it)\n", path);
+        return false;
+    }
+    out->count = 0;
+    while (fgets(line, sizeof(line), f) && out->count < MAX_BEATS) {
+        unsigned long idx;
+        unsigned ibi, bpm;
+        if (line[0] != '#' && sscanf(line, "%lu %u %u", &idx, &ibi, &bpm) == 3) {
+            out->beats[out->count++] = (ppg_beat_t){ (uint32_t)idx, (uint16_t)ibi, (uint16_t)bpm };
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static bool write_expected(const trace_t *t, const beats_t *beats) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.expected", TRACE_DIR, t->name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("%s: can't write %s\n", t->name, path);
+        return false;
+    }
+    fprintf(f, "# ppg_process_block on %s.txt in blocks of %u samples: sample_index ibi_ms bpm\n", t->name,
+            t->rate_hz / 4);
+    for (size_t i = 0; i < beats->count; i++) {
+        fprintf(f, "%lu %u %u\n", (unsigned long)beats->beats[i].sample_index, beats->beats[i].ibi_ms,
+                beats->beats[i].bpm);
+    }
+    fclose(f);
+    printf("%s: wrote %zu beats to %s\n", t->name, beats->count, path);
+    return true;
+}
+
+typedef struct {
+    size_t matched;         // beats within 100 ms of a true one
+    size_t missed;          // true beats no beat was found for
+    size_t clean;           // true beats the floor counts: not the first, not disturbed
+    size_t clean_missed;
+} truth_t;
+
+static void compare_truth(const trace_t *t, const beats_t *beats, truth_t *out) {
+    uint32_t window = t->rate_hz / 10;
+    uint32_t from = t->disturbed_from * t->rate_hz, to = (t->disturbed_to + SETTLE_S) * t->rate_hz;
+    bool found[MAX_TRUE_BEATS] = { false };
+    memset(out, 0, sizeof(*out));
+    size_t j = 0;
+    for (size_t i = 0; i < beats->count; i++) {
+        uint32_t idx = beats->beats[i].sample_index;
+        while (j < t->true_count && t->true_beats[j] + window < idx) {
+            j++;
+        }
+        if (j < t->true_count && t->true_beats[j] <= idx + window) {
+            found[j++] = true;
+            out->matched++;
+        }
+    }
+    // Beats that start the detector or follow a rejected interval are never reported,
+    // so "missed" is the true beats minus what was found near one
+    out->missed = t->true_count - out->matched;
+    for (size_t i = 1; i < t->true_count; i++) {
+        if (t->true_beats[i] < from || t->true_beats[i] >= to) {
+            out->clean++;
+            out->clean_missed += !found[i];
+        }
+    }
+}
+
+// The accuracy floor: returns false (and says why) if the detector is below it
+static bool accurate_enough(const trace_t *t, const beats_t *beats, const truth_t *truth) {
+    bool ok = true;
+    if (truth->clean == 0 || (truth->clean - truth->clean_missed) * 100 < truth->clean * MIN_RECALL_PCT) {
+        printf("  FAIL %s: %zu of %zu true beats outside %u-%u s found, want %d%%\n", t->name,
+               truth->clean - truth->clean_missed, truth->clean, t->disturbed_from,
+               t->disturbed_to + SETTLE_S, MIN_RECALL_PCT);
+        ok = false;
+    }
+    if (beats->count - truth->matched > MAX_FALSE_BEATS) {
+        printf("  FAIL %s: %zu beats near no true beat, want at most %d\n", t->name,
+               beats->count - truth->matched, MAX_FALSE_BEATS);
+        ok = false;
+    }
+    return ok;
+}
+
+// Takes at most one beat per call, in calls of 10 s: beats that don't fit must still be
+// seen by the detector, or the interval after them spans two beats and is thrown away.
+// Each call must return the first of the beats it returns when there is room for all.
+static void check_max_beats(const trace_t *t) {
+    static ppg_t ppg, roomy;
+    ppg_beat_t beat, beats[MAX_BEATS];
+    beats_t got = { .count = 0 }, want = { .count = 0 };
+    ppg_init(&ppg, t->rate_hz);
+    ppg_init(&roomy, t->rate_hz);
+    size_t block = (size_t)t->rate_hz * 10;
+    for (size_t pos = 0; pos < t->count; pos += block) {
+        size_t n = block < t->count - pos ? block : t->count - pos;
+        add_beats(&got, &beat, ppg_process_block(&ppg, t->samples + pos, n, &beat, 1));
+        add_beats(&want, beats, ppg_process_block(&roomy, t->samples + pos, n, beats, MAX_BEATS) ? 1 : 0);
+    }
+    failures += !same_beats(&want, &got, "one beat per call");
+}
+
+// The trace, a flat line with no pulse at all, and the trace again. The pause is made so
+// long that the gap from the last peak before it to the first one after it is a multiple
+// of 2^32 / 1000 samples plus about one usual interval: counted in ms it would wrap to an
+// interval that looks right. No beat may come out for that peak.
+static void check_long_pause(const trace_t *t) {
+    static ppg_t ppg;
+    static int32_t flat[4096];
+    ppg_beat_t beats[MAX_BEATS];
+    uint32_t pause = 4000000, offset = 0, last_before = 0, first_after = 0;
+    uint64_t want_gap = 0;
+    for (size_t i = 0; i < sizeof(flat) / sizeof(flat[0]); i++) {
+        flat[i] = t->samples[0];
+    }
+
+    // First with some pause to see where the first peak after it lands, then with the
+    // pause that puts that peak at the wrapping gap
+    for (int pass = 0; pass < 2; pass++) {
+        ppg_init(&ppg, t->rate_hz);
+        ppg_process_block(&ppg, t->samples, t->count, beats, MAX_BEATS);
+        uint32_t usual_ms = ppg.bpm ? 60000u / ppg.bpm : 800;
+        for (uint32_t left = pause; left > 0;) {
+            uint32_t n = left < 4096 ? left : 4096;
+            ppg_process_block(&ppg, flat, n, beats, MAX_BEATS);
+            left -= n;
+        }
+        // A pulse still going at the end of the trace ends in the pause
+        last_before = ppg.last_peak;
+        uint32_t pause_end = ppg.samples;
+        // Sample by sample (which doesn't change a beat) to catch the first peak
+        first_after = last_before;
+        bool bogus = false;
+        for (size_t i = 0; i < 2 * (size_t)t->rate_hz; i++) {
+            size_t found = ppg_process_block(&ppg, &t->samples[i], 1, beats, MAX_BEATS);
+            if (first_after == last_before && ppg.last_peak != last_before) {
+                first_after = ppg.last_peak;
+            }
+            bogus |= found > 0 && beats[0].sample_index == first_after;
+        }
+        if (pass == 0) {
+            // The filters settle during any long pause, so the peak moves with the pause
+            offset = first_after - pause_end;
+            want_gap = (((uint64_t)1 << 32) + (uint64_t)usual_ms * t->rate_hz) / 1000 + 1;
+            pause = (uint32_t)(want_gap - offset - (pause_end - pause - last_before));
+        } else if (first_after - last_before != want_gap) {
+            printf("  FAIL long pause: gap of %lu samples, aimed at %llu\n",
+                   (unsigned long)(first_after - last_before), (unsigned long long)want_gap);
+            failures++;
+        } else if (bogus) {
+            printf("  FAIL long pause: a beat after %lu samples without one (wraps to %lu ms)\n",
+                   (unsigned long)want_gap, (unsigned long)((uint32_t)(want_gap * 1000u) / t->rate_hz));
+            failures++;
+        }
+    }
+}
+
+static void bench(const trace_t *t, double seconds, double *samples_per_s) {
+    static ppg_t ppg;
+    ppg_beat_t beats[MAX_BEATS];
+    size_t block = t->rate_hz / 4;
+    uint64_t samples = 0;
+    double start = wall_seconds(), elapsed;
+    ppg_init(&ppg, t->rate_hz);
+    do {
+        for (size_t pos = 0; pos + block <= t->count; pos += block) {
+            ppg_process_block(&ppg, t->samples + pos, block, beats, MAX_BEATS);
+        }
+        samples += t->count / block * block;
+        elapsed = wall_seconds() - start;
+    } while (elapsed < seconds);
+    *samples_per_s = samples / elapsed;
+}
+
+int main(int argc, char **argv) {
+    static const char *names[] = { "ppg_100hz", "ppg_500hz" };
+    static trace_t trace;
+    bool update = false;
+    double seconds = 0.5;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--update] [--seconds N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        if (!load_trace(&trace, names[n])) {
+            failures++;
+            continue;
+        }
+        static beats_t got, expected, odd_blocks;
+        run(&trace, trace.rate_hz / 4, &got);
+        if (update) {
+            failures += !write_expected(&trace, &got);
+            continue;
+        }
+        int before = failures;
+        if (load_expected(&trace, &expected)) {
+            failures += !same_beats(&expected, &got, "quarter-second blocks");
+        } else {
+            failures++;
+        }
+        run(&trace, 0, &odd_blocks);
+        failures += !same_beats(&got, &odd_blocks, "blocks of 1 to 97 samples");
+        check_max_beats(&trace);
+        check_long_pause(&trace);
+
+        truth_t truth;
+        double rate;
+        compare_truth(&trace, &got, &truth);
+        failures += !accurate_enough(&trace, &got, &truth);
+        bench(&trace, seconds, &rate);
+        printf("%-10s %3u Hz, %zu s: %zu beats (%zu within 100 ms of a true one, %zu of %zu true beats "
+               "not reported, %zu of them outside %u-%u s), %.1f M samples/s, %.1f ns/sample  %s\n",
+               trace.name, trace.rate_hz, trace.count / trace.rate_hz, got.count, truth.matched,
+               truth.missed, trace.true_count, truth.clean_missed, trace.disturbed_from,
+               trace.disturbed_to + SETTLE_S, rate / 1e6, 1e9 / rate, failures == before ? "ok" : "FAILED");
+    }
+    return failures ? 1 : 0;
+}
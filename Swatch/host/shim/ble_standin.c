@@ -0,0 +1,599 @@
+// Host stand-in for Bluedroid's GAP and GATT server. API calls are answered with the
+// matching events on a separate "BTC" thread, handles are assigned in order. Links can
+// be rate limited; their notifications then wait in a small queue and are delivered
+// from the BTC thread when the link gets to them.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_gatt_common_api.h"
+#include "host_standins.h"
+#include "host_time.h"
+
+#define HOST_GATTS_IF 3
+#define MAX_SERVICES 8
+#define MAX_ATTRS 64
+#define MAX_LINKS 8
+
+struct ble_event {
+    struct ble_event *next;
+    bool is_gap;
+    int id;
+    esp_ble_gap_cb_param_t gap;
+    esp_ble_gatts_cb_param_t gatts;
+    uint8_t value[ESP_GATT_MAX_ATTR_LEN];
+    uint16_t handles[MAX_ATTRS];
+};
+
+struct service {
+    uint16_t handle;
+    uint16_t next_handle;
+    uint16_t last_handle;
+};
+
+static esp_gap_ble_cb_t gap_cb;
+static esp_gatts_cb_t gatts_cb;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct ble_event *head;
+static struct ble_event *tail;
+static bool thread_started;
+static uint32_t next_trans_id = 1;
+
+static struct service services[MAX_SERVICES];
+static int service_count;
+static uint16_t next_handle = 1;
+static struct {
+    uint16_t uuid16;
+    uint16_t handle;
+} attrs[MAX_ATTRS];
+static int attr_count;
+
+static _Atomic(host_ble_notify_hook_t) notify_hook;
+
+static bool advertising;
+static uint16_t local_mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+
+struct packet {
+    uint64_t due_ns;
+    uint64_t queued_ns;
+    uint16_t handle;
+    uint16_t len;
+    uint8_t value[ESP_GATT_MAX_ATTR_LEN];
+};
+
+// A connected central (or the rate set for one that hasn't connected yet)
+struct link {
+    bool used;
+    bool up;
+    uint16_t conn_id;
+    double per_s;
+    uint64_t last_due_ns;
+    struct packet queue[HOST_BLE_LINK_QUEUE];
+    int first;
+    int count;
+    bool congested;
+};
+
+static struct link links[MAX_LINKS];
+
+static struct link *find_link(uint16_t conn_id, bool add) {
+    struct link *free_link = NULL;
+    for (int i = 0; i < MAX_LINKS; i++) {
+        if (links[i].used && links[i].conn_id == conn_id) {
+            return &links[i];
+        }
+        if (!links[i].used && !free_link) {
+            free_link = &links[i];
+        }
+    }
+    if (add && free_link) {
+        memset(free_link, 0, sizeof(*free_link));
+        free_link->used = true;
+        free_link->conn_id = conn_id;
+    }
+    return add ? free_link : NULL;
+}
+
+// Earliest queued notification on any link (UINT64_MAX if there is none)
+static uint64_t next_due_ns(void) {
+    uint64_t due = UINT64_MAX;
+    for (int i = 0; i < MAX_LINKS; i++) {
+        if (links[i].up && links[i].count && links[i].queue[links[i].first].due_ns < due) {
+            due = links[i].queue[links[i].first].due_ns;
+        }
+    }
+    return due;
+}
+
+// Takes one notification whose time has come off its link. *drained is set when
+// the link just stopped being congested.
+static bool take_due(uint64_t now, struct packet *out, uint16_t *conn_id, bool *drained) {
+    for (int i = 0; i < MAX_LINKS; i++) {
+        struct link *l = &links[i];
+        if (l->up && l->count && l->queue[l->first].due_ns <= now) {
+            *out = l->queue[l->first];
+            *conn_id = l->conn_id;
+            l->first = (l->first + 1) % HOST_BLE_LINK_QUEUE;
+            l->count--;
+            *drained = l->congested && l->count <= HOST_BLE_LINK_QUEUE / 2;
+            if (*drained) {
+                l->congested = false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static void deliver(uint16_t conn_id, const struct packet *p, uint64_t now) {
+    host_ble_notify_hook_t hook = atomic_load(&notify_hook);
+    if (hook) {
+        hook(conn_id, p->handle, p->value, p->len, (uint32_t)((now - p->queued_ns) / 1000000));
+    }
+}
+
+static void congest(uint16_t conn_id, bool congested) {
+    esp_ble_gatts_cb_param_t param = {
+        .congest = { .conn_id = conn_id, .congested = congested },
+    };
+    if (gatts_cb) {
+        gatts_cb(ESP_GATTS_CONGEST_EVT, HOST_GATTS_IF, &param);
+    }
+}
+
+static void *btc_thread(void *arg) {
+    (void)arg;
+    struct packet *p = malloc(sizeof(*p));
+    while (1) {
+        pthread_mutex_lock(&lock);
+        uint64_t due;
+        while (!head && (due = next_due_ns()) > host_sim_ns()) {
+            if (due == UINT64_MAX) {
+                pthread_cond_wait(&cond, &lock);
+            } else {
+                struct timespec deadline = host_wall_deadline(due);
+                pthread_cond_timedwait(&cond, &lock, &deadline);
+            }
+        }
+
+        // Links that got to their next notification
+        uint64_t now = host_sim_ns();
+        uint16_t conn_id;
+        bool drained;
+        while (take_due(now, p, &conn_id, &drained)) {
+            pthread_mutex_unlock(&lock);
+            deliver(conn_id, p, now);
+            if (drained) {
+                congest(conn_id, false);
+            }
+            pthread_mutex_lock(&lock);
+        }
+
+        struct ble_event *ev = head;
+        if (ev) {
+            head = ev->next;
+            if (!head) {
+                tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&lock);
+        if (!ev) {
+            continue;
+        }
+
+        if (ev->is_gap && gap_cb) {
+            gap_cb((esp_gap_ble_cb_event_t)ev->id, &ev->gap);
+        } else if (!ev->is_gap && gatts_cb) {
+            gatts_cb((esp_gatts_cb_event_t)ev->id, HOST_GATTS_IF, &ev->gatts);
+        }
+        free(ev);
+    }
+    return NULL;
+}
+
+// Caller holds lock
+static void start_thread(void) {
+    if (thread_started) {
+        return;
+    }
+    // Timed waits use the simulated clock's CLOCK_MONOTONIC deadlines
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, btc_thread, NULL);
+    pthread_detach(thread);
+    thread_started = true;
+}
+
+static struct ble_event *new_event(bool is_gap, int id) {
+    struct ble_event *ev = calloc(1, sizeof(*ev));
+    ev->is_gap = is_gap;
+    ev->id = id;
+    return ev;
+}
+
+static void post(struct ble_event *ev) {
+    pthread_mutex_lock(&lock);
+    start_thread();
+    if (tail) {
+        tail->next = ev;
+    } else {
+        head = ev;
+    }
+    tail = ev;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+static void remember_attr(uint16_t uuid16, uint16_t handle) {
+    pthread_mutex_lock(&lock);
+    if (attr_count < MAX_ATTRS) {
+        attrs[attr_count].uuid16 = uuid16;
+        attrs[attr_count].handle = handle;
+        attr_count++;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// Next free handle inside a service (0 if the service is unknown or full)
+static uint16_t take_handles(uint16_t service_handle, uint16_t count) {
+    uint16_t handle = 0;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < service_count; i++) {
+        if (services[i].handle == service_handle &&
+            services[i].next_handle + count - 1 <= services[i].last_handle) {
+            handle = services[i].next_handle;
+            services[i].next_handle += count;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return handle;
+}
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback) {
+    gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_device_name(const char *name) {
+    (void)name;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t *adv_data) {
+    (void)adv_data;
+    struct ble_event *ev = new_event(true, ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT);
+    ev->gap.adv_data_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params) {
+    (void)adv_params;
+    pthread_mutex_lock(&lock);
+    bool already = advertising;
+    advertising = true;
+    pthread_mutex_unlock(&lock);
+
+    struct ble_event *ev = new_event(true, ESP_GAP_BLE_ADV_START_COMPLETE_EVT);
+    ev->gap.adv_start_cmpl.status = already ? ESP_BT_STATUS_FAIL : ESP_BT_STATUS_SUCCESS;
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params) {
+    // The central takes the longest interval offered
+    struct ble_event *ev = new_event(true, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT);
+    ev->gap.update_conn_params.status = ESP_BT_STATUS_SUCCESS;
+    memcpy(ev->gap.update_conn_params.bda, params->bda, sizeof(esp_bd_addr_t));
+    ev->gap.update_conn_params.min_int = params->min_int;
+    ev->gap.update_conn_params.max_int = params->max_int;
+    ev->gap.update_conn_params.latency = params->latency;
+    ev->gap.update_conn_params.conn_int = params->max_int;
+    ev->gap.update_conn_params.timeout = params->timeout;
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu) {
+    if (mtu < ESP_GATT_DEF_BLE_MTU_SIZE || mtu > 517) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    local_mtu = mtu;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback) {
+    gatts_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id) {
+    struct ble_event *ev = new_event(false, ESP_GATTS_REG_EVT);
+    ev->gatts.reg.status = ESP_GATT_OK;
+    ev->gatts.reg.app_id = app_id;
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_create_service(esp_gatt_if_t gatts_if, esp_gatt_srvc_id_t *service_id, uint16_t num_handle) {
+    (void)gatts_if;
+    pthread_mutex_lock(&lock);
+    if (service_count == MAX_SERVICES) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_NO_MEM;
+    }
+    struct service *svc = &services[service_count++];
+    svc->handle = next_handle;
+    svc->next_handle = next_handle + 1;
+    svc->last_handle = next_handle + num_handle - 1;
+    next_handle += num_handle;
+    pthread_mutex_unlock(&lock);
+
+    struct ble_event *ev = new_event(false, ESP_GATTS_CREATE_EVT);
+    ev->gatts.create.status = ESP_GATT_OK;
+    ev->gatts.create.service_handle = svc->handle;
+    ev->gatts.create.service_id = *service_id;
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db, esp_gatt_if_t gatts_if,
+                                       uint16_t max_nb_attr, uint8_t srvc_inst_id) {
+    (void)gatts_if;
+    if (max_nb_attr == 0 || max_nb_attr > MAX_ATTRS ||
+        gatts_attr_db[0].att_desc.uuid_length != ESP_UUID_LEN_16 || gatts_attr_db[0].att_desc.length != 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct ble_event *ev = new_event(false, ESP_GATTS_CREAT_ATTR_TAB_EVT);
+    pthread_mutex_lock(&lock);
+    uint16_t first = next_handle;
+    next_handle += max_nb_attr;
+    pthread_mutex_unlock(&lock);
+
+    // Consecutive handles, like Bluedroid hands out for one table
+    for (uint16_t i = 0; i < max_nb_attr; i++) {
+        const esp_attr_desc_t *desc = &gatts_attr_db[i].att_desc;
+        ev->handles[i] = first + i;
+        if (desc->uuid_length == ESP_UUID_LEN_16) {
+            remember_attr((uint16_t)(desc->uuid_p[0] | (desc->uuid_p[1] << 8)), first + i);
+        }
+    }
+    const uint8_t *svc = gatts_attr_db[0].att_desc.value;
+    ev->gatts.add_attr_tab.status = ESP_GATT_OK;
+    ev->gatts.add_attr_tab.svc_uuid.len = ESP_UUID_LEN_16;
+    ev->gatts.add_attr_tab.svc_uuid.uuid.uuid16 = (uint16_t)(svc[0] | (svc[1] << 8));
+    ev->gatts.add_attr_tab.svc_inst_id = srvc_inst_id;
+    ev->gatts.add_attr_tab.num_handle = max_nb_attr;
+    ev->gatts.add_attr_tab.handles = ev->handles;
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_add_char(uint16_t service_handle, esp_bt_uuid_t *char_uuid, esp_gatt_perm_t perm,
+                                 esp_gatt_char_prop_t property, esp_attr_value_t *char_val,
+                                 esp_attr_control_t *control) {
+    (void)perm;
+    (void)property;
+    (void)char_val;
+    (void)control;
+    // Declaration + value, the value handle is the one reported
+    uint16_t decl = take_handles(service_handle, 2);
+    struct ble_event *ev = new_event(false, ESP_GATTS_ADD_CHAR_EVT);
+    ev->gatts.add_char.status = decl ? ESP_GATT_OK : ESP_GATT_ERROR;
+    ev->gatts.add_char.attr_handle = decl ? decl + 1 : 0;
+    ev->gatts.add_char.service_handle = service_handle;
+    ev->gatts.add_char.char_uuid = *char_uuid;
+    if (decl) {
+        remember_attr(char_uuid->uuid.uuid16, decl + 1);
+    }
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_add_char_descr(uint16_t service_handle, esp_bt_uuid_t *descr_uuid, esp_gatt_perm_t perm,
+                                       esp_attr_value_t *char_descr_val, esp_attr_control_t *control) {
+    (void)perm;
+    (void)char_descr_val;
+    (void)control;
+    uint16_t handle = take_handles(service_handle, 1);
+    struct ble_event *ev = new_event(false, ESP_GATTS_ADD_CHAR_DESCR_EVT);
+    ev->gatts.add_char_descr.status = handle ? ESP_GATT_OK : ESP_GATT_ERROR;
+    ev->gatts.add_char_descr.attr_handle = handle;
+    ev->gatts.add_char_descr.service_handle = service_handle;
+    ev->gatts.add_char_descr.descr_uuid = *descr_uuid;
+    if (handle) {
+        remember_attr(descr_uuid->uuid.uuid16, handle);
+    }
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle) {
+    struct ble_event *ev = new_event(false, ESP_GATTS_START_EVT);
+    ev->gatts.start.status = ESP_GATT_OK;
+    ev->gatts.start.service_handle = service_handle;
+    post(ev);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id, uint32_t trans_id,
+                                      esp_gatt_status_t status, esp_gatt_rsp_t *rsp) {
+    (void)gatts_if;
+    (void)conn_id;
+    (void)trans_id;
+    (void)status;
+    (void)rsp;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_set_attr_value(uint16_t attr_handle, uint16_t length, const uint8_t *value) {
+    (void)attr_handle;
+    (void)length;
+    (void)value;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t *value, bool need_confirm) {
+    (void)gatts_if;
+    (void)need_confirm;
+    if (value_len > ESP_GATT_MAX_ATTR_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    struct link *l = find_link(conn_id, false);
+    if (!l || !l->up) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    uint64_t now = host_sim_ns();
+    if (l->per_s <= 0) {
+        // Unlimited: the central has it right away
+        pthread_mutex_unlock(&lock);
+        struct packet p = { .queued_ns = now, .handle = attr_handle, .len = value_len };
+        memcpy(p.value, value, value_len);
+        deliver(conn_id, &p, now);
+        return ESP_OK;
+    }
+    if (l->count == HOST_BLE_LINK_QUEUE) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+
+    struct packet *p = &l->queue[(l->first + l->count) % HOST_BLE_LINK_QUEUE];
+    uint64_t period = (uint64_t)(1e9 / l->per_s);
+    p->due_ns = (l->last_due_ns > now ? l->last_due_ns : now) + period;
+    p->queued_ns = now;
+    p->handle = attr_handle;
+    p->len = value_len;
+    memcpy(p->value, value, value_len);
+    l->last_due_ns = p->due_ns;
+    l->count++;
+    bool now_congested = !l->congested && l->count == HOST_BLE_LINK_QUEUE;
+    if (now_congested) {
+        l->congested = true;
+    }
+    start_thread();
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    if (now_congested) {
+        struct ble_event *ev = new_event(false, ESP_GATTS_CONGEST_EVT);
+        ev->gatts.congest.conn_id = conn_id;
+        ev->gatts.congest.congested = true;
+        post(ev);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_close(esp_gatt_if_t gatts_if, uint16_t conn_id) {
+    (void)gatts_if;
+    host_ble_disconnect(conn_id);
+    return ESP_OK;
+}
+
+void host_ble_set_notify_hook(host_ble_notify_hook_t hook) {
+    atomic_store(&notify_hook, hook);
+}
+
+uint16_t host_ble_find_handle(uint16_t uuid16) {
+    uint16_t handle = 0;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < attr_count && !handle; i++) {
+        if (attrs[i].uuid16 == uuid16) {
+            handle = attrs[i].handle;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return handle;
+}
+
+bool host_ble_connect(uint16_t conn_id) {
+    pthread_mutex_lock(&lock);
+    struct link *l = advertising ? find_link(conn_id, true) : NULL;
+    if (!l || l->up) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    // The controller stops advertising when a central connects
+    advertising = false;
+    l->up = true;
+    l->first = l->count = 0;
+    l->congested = false;
+    pthread_mutex_unlock(&lock);
+
+    struct ble_event *ev = new_event(false, ESP_GATTS_CONNECT_EVT);
+    ev->gatts.connect.conn_id = conn_id;
+    ev->gatts.connect.remote_bda[5] = (uint8_t)conn_id;
+    ev->gatts.connect.conn_params.interval = 0x18;
+    ev->gatts.connect.conn_params.timeout = 500;
+    post(ev);
+    return true;
+}
+
+void host_ble_exchange_mtu(uint16_t conn_id, uint16_t mtu) {
+    struct ble_event *ev = new_event(false, ESP_GATTS_MTU_EVT);
+    pthread_mutex_lock(&lock);
+    ev->gatts.mtu.mtu = mtu < local_mtu ? mtu : local_mtu;
+    pthread_mutex_unlock(&lock);
+    ev->gatts.mtu.conn_id = conn_id;
+    post(ev);
+}
+
+void host_ble_disconnect(uint16_t conn_id) {
+    pthread_mutex_lock(&lock);
+    struct link *l = find_link(conn_id, false);
+    bool was_up = l && l->up;
+    if (l) {
+        l->used = false;
+        l->up = false;
+    }
+    pthread_mutex_unlock(&lock);
+    if (!was_up) {
+        return;
+    }
+
+    struct ble_event *ev = new_event(false, ESP_GATTS_DISCONNECT_EVT);
+    ev->gatts.disconnect.conn_id = conn_id;
+    ev->gatts.disconnect.remote_bda[5] = (uint8_t)conn_id;
+    ev->gatts.disconnect.reason = 0x13; // remote user terminated
+    post(ev);
+}
+
+void host_ble_set_link_rate(uint16_t conn_id, double per_s) {
+    pthread_mutex_lock(&lock);
+    struct link *l = find_link(conn_id, true);
+    if (l) {
+        l->per_s = per_s;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void host_ble_write(uint16_t conn_id, uint16_t handle, const uint8_t *value, uint16_t len) {
+    struct ble_event *ev = new_event(false, ESP_GATTS_WRITE_EVT);
+    if (len > sizeof(ev->value)) {
+        len = sizeof(ev->value);
+    }
+    memcpy(ev->value, value, len);
+    ev->gatts.write.conn_id = conn_id;
+    pthread_mutex_lock(&lock);
+    ev->gatts.write.trans_id = next_trans_id++;
+    pthread_mutex_unlock(&lock);
+    ev->gatts.write.handle = handle;
+    ev->gatts.write.need_rsp = true;
+    ev->gatts.write.len = len;
+    ev->gatts.write.value = ev->value;
+    post(ev);
+}
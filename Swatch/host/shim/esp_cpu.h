@@ -0,0 +1,14 @@
+#ifndef HOST_ESP_CPU_H
+#define HOST_ESP_CPU_H
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+// On the host one "cycle" is one nanosecond of wall time
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
+
+// CPU of the host the calling thread is on right now
+int esp_cpu_get_core_id(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef HOST_ESP_EVENT_H
+#define HOST_ESP_EVENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+
+#define ESP_EVENT_ANY_ID -1
+
+esp_err_t esp_event_loop_create_default(void);
+
+// Handlers for the default event loop. Posted events run the matching handlers right
+// away on the posting thread (the stand-in for the event loop task).
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t event_id, esp_event_handler_t handler, void *arg);
+esp_err_t esp_event_post(esp_event_base_t base, int32_t event_id, const void *event_data, size_t size,
+                         uint32_t ticks_to_wait);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef HOST_ESP_GAP_BLE_API_H
+#define HOST_ESP_GAP_BLE_API_H
+
+#include "esp_bt_defs.h"
+
+typedef enum { ADV_TYPE_IND = 0 } esp_ble_adv_type_t;
+typedef enum { ADV_CHNL_ALL = 0x07 } esp_ble_adv_channel_t;
+typedef enum { ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY = 0 } esp_ble_adv_filter_t;
+
+#define ESP_BLE_ADV_FLAG_GEN_DISC (0x01 << 1)
+#define ESP_BLE_ADV_FLAG_BREDR_NOT_SPT (0x01 << 2)
+
+typedef struct {
+    uint16_t adv_int_min;
+    uint16_t adv_int_max;
+    esp_ble_adv_type_t adv_type;
+    esp_ble_addr_type_t own_addr_type;
+    esp_bd_addr_t peer_addr;
+    esp_ble_addr_type_t peer_addr_type;
+    esp_ble_adv_channel_t channel_map;
+    esp_ble_adv_filter_t adv_filter_policy;
+} esp_ble_adv_params_t;
+
+typedef struct {
+    bool set_scan_rsp;
+    bool include_name;
+    bool include_txpower;
+    int min_interval;
+    int max_interval;
+    int appearance;
+    uint16_t manufacturer_len;
+    uint8_t *p_manufacturer_data;
+    uint16_t service_data_len;
+    uint8_t *p_service_data;
+    uint16_t service_uuid_len;
+    uint8_t *p_service_uuid;
+    uint8_t flag;
+} esp_ble_adv_data_t;
+
+typedef struct {
+    esp_bd_addr_t bda;
+    uint16_t min_int;
+    uint16_t max_int;
+    uint16_t latency;
+    uint16_t timeout;
+} esp_ble_conn_update_params_t;
+
+typedef enum {
+    ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT = 0,
+    ESP_GAP_BLE_ADV_START_COMPLETE_EVT = 6,
+    ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT = 17,
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT = 20,
+} esp_gap_ble_cb_event_t;
+
+typedef union {
+    struct {
+        esp_bt_status_t status;
+    } adv_data_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } adv_start_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } adv_stop_cmpl;
+    struct {
+        esp_bt_status_t status;
+        esp_bd_addr_t bda;
+        uint16_t min_int;
+        uint16_t max_int;
+        uint16_t latency;
+        uint16_t conn_int;
+        uint16_t timeout;
+    } update_conn_params;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+esp_err_t esp_ble_gap_set_device_name(const char *name);
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t *adv_data);
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params);
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params);
+
+#endif
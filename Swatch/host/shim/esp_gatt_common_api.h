@@ -0,0 +1,10 @@
+#ifndef HOST_ESP_GATT_COMMON_API_H
+#define HOST_ESP_GATT_COMMON_API_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Largest MTU the stand-in agrees to in host_ble_exchange_mtu()
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu);
+
+#endif
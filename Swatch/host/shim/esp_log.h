@@ -0,0 +1,33 @@
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+// On the host one level applies to every tag
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+esp_log_level_t host_log_level(void);
+esp_log_level_t esp_log_level_get(const char *tag);
+uint32_t esp_log_timestamp(void);
+
+#define HOST_LOG(level, letter, tag, format, ...) do {                                          \
+        if (host_log_level() >= (level)) {                                                      \
+            printf(letter " (%lu) %s: " format "\n", (unsigned long)esp_log_timestamp(), tag, ##__VA_ARGS__); \
+        }                                                                                       \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+
+#endif
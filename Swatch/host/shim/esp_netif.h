@@ -0,0 +1,37 @@
+#ifndef HOST_ESP_NETIF_H
+#define HOST_ESP_NETIF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef struct host_netif esp_netif_t;
+
+// Addresses are in network byte order, like lwIP keeps them
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) (int)(((const uint8_t *)&(ipaddr)->addr)[0]), (int)(((const uint8_t *)&(ipaddr)->addr)[1]), \
+                       (int)(((const uint8_t *)&(ipaddr)->addr)[2]), (int)(((const uint8_t *)&(ipaddr)->addr)[3])
+
+extern const char *const IP_EVENT;
+typedef enum { IP_EVENT_STA_GOT_IP, IP_EVENT_STA_LOST_IP } ip_event_t;
+
+typedef struct {
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_ESP_RANDOM_H
+#define HOST_ESP_RANDOM_H
+
+#include <stdint.h>
+
+// Pseudo random on the host, the same sequence every run
+uint32_t esp_random(void);
+
+#endif
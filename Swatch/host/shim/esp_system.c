@@ -0,0 +1,121 @@
+// Host stand-ins for the small ESP-IDF services the firmware touches during start-up.
+// They all succeed and do nothing unless noted. The ones that are slow on the chip take
+// about as long here (simulated, typical ESP32 numbers from the start-up log), so the
+// boot timings the firmware reports mean something.
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <malloc.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "esp_mac.h"
+#include "nvs_flash.h"
+#include "esp_random.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_system.h"
+#include "host_time.h"
+
+static _Atomic int log_level = ESP_LOG_INFO;
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+        case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_READ_ONLY: return "ESP_ERR_NVS_READ_ONLY";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    (void)tag;
+    atomic_store(&log_level, level);
+}
+
+esp_log_level_t host_log_level(void) {
+    return (esp_log_level_t)atomic_load(&log_level);
+}
+
+esp_log_level_t esp_log_level_get(const char *tag) {
+    return host_log_level();
+}
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(host_sim_ns() / 1000000ull);
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (esp_cpu_cycle_count_t)((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec);
+}
+
+int esp_cpu_get_core_id(void) {
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+int64_t esp_timer_get_time(void) {
+    return (int64_t)(host_sim_ns() / 1000ull);
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+    static const uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x5a, 0x7c, 0x00 };
+    memcpy(mac, host_mac, sizeof(host_mac));
+    mac[5] += (uint8_t)type;
+    return ESP_OK;
+}
+
+static _Atomic uint32_t min_free_heap = HOST_HEAP_SIZE;
+
+uint32_t esp_get_free_heap_size(void) {
+    struct mallinfo2 info = mallinfo2();
+    uint32_t free_heap = info.uordblks < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - (uint32_t)info.uordblks : 0;
+    uint32_t min = atomic_load(&min_free_heap);
+    while (free_heap < min && !atomic_compare_exchange_weak(&min_free_heap, &min, free_heap)) {
+    }
+    return free_heap;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    esp_get_free_heap_size();
+    return atomic_load(&min_free_heap);
+}
+
+// Reading the NVS pages (the blobs themselves are in nvs_standin.c)
+esp_err_t nvs_flash_init(void) { host_sim_delay_ms(25); return ESP_OK; }
+
+// xorshift32 from a fixed seed, so runs can be compared
+uint32_t esp_random(void) {
+    static _Atomic uint32_t state = 2463534242u;
+    uint32_t x = atomic_load(&state), next;
+    do {
+        next = x;
+        next ^= next << 13;
+        next ^= next >> 17;
+        next ^= next << 5;
+    } while (!atomic_compare_exchange_weak(&state, &x, next));
+    return next;
+}
+
+// Controller start-up with RF calibration, then the Bluedroid task and its storage
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode) { (void)mode; return ESP_OK; }
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg) { (void)cfg; host_sim_delay_ms(30); return ESP_OK; }
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) { (void)mode; host_sim_delay_ms(80); return ESP_OK; }
+esp_err_t esp_bluedroid_init(void) { host_sim_delay_ms(20); return ESP_OK; }
+esp_err_t esp_bluedroid_enable(void) { host_sim_delay_ms(160); return ESP_OK; }
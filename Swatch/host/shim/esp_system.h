@@ -0,0 +1,12 @@
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+// Heap numbers as if the firmware had HOST_HEAP_SIZE bytes of heap (malloc'd bytes count as used)
+#define HOST_HEAP_SIZE (300 * 1024)
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif
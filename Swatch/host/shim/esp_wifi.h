@@ -0,0 +1,81 @@
+#ifndef HOST_ESP_WIFI_H
+#define HOST_ESP_WIFI_H
+
+// Host stand-in for the Wi-Fi driver: every call succeeds after about as long as it takes
+// on an ESP32, and esp_wifi_connect() gets an IP address (IP_EVENT_STA_GOT_IP) a little
+// later from one of the simulated access points (see wifi_standin.c). Nothing is sent
+// anywhere.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+typedef struct {
+    int unused;
+} wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() { 0 }
+
+#define ESP_ERR_WIFI_BASE 0x3000
+#define ESP_ERR_WIFI_NOT_CONNECT (ESP_ERR_WIFI_BASE + 15)
+
+extern const char *const WIFI_EVENT;
+typedef enum {
+    WIFI_EVENT_STA_START = 2,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED,
+} wifi_event_t;
+
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA } wifi_mode_t;
+typedef enum { WIFI_IF_STA } wifi_interface_t;
+
+typedef enum { WIFI_FAST_SCAN, WIFI_ALL_CHANNEL_SCAN } wifi_scan_method_t;
+typedef enum { WIFI_CONNECT_AP_BY_SIGNAL, WIFI_CONNECT_AP_BY_SECURITY } wifi_sort_method_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    wifi_scan_method_t scan_method;
+    bool bssid_set;                 // only connect to this BSSID
+    uint8_t bssid[6];
+    uint8_t channel;                // 0 = unknown, scan all
+    uint16_t listen_interval;
+    wifi_sort_method_t sort_method;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+    int8_t rssi;
+} wifi_event_sta_disconnected_t;
+
+// Disconnect reasons the stand-in reports
+#define WIFI_REASON_AUTH_EXPIRE 2
+#define WIFI_REASON_ASSOC_LEAVE 8
+#define WIFI_REASON_BEACON_TIMEOUT 200
+#define WIFI_REASON_NO_AP_FOUND 201
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;                // channel
+    int8_t rssi;
+} wifi_ap_record_t;
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+
+#endif
@@ -0,0 +1,321 @@
+// Host stand-in for the FreeRTOS scheduler: every task is a pthread and time can run
+// faster than the wall clock so long runs finish quickly.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "host_time.h"
+
+struct host_task {
+    struct host_task *next;     // list of tasks started with xTaskCreate()
+    pthread_t thread;
+    char name[32];
+    TaskFunction_t fn;
+    void *arg;
+    uint32_t stack_depth;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+static __thread struct host_task *current_task;
+
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct host_task *tasks;
+static UBaseType_t task_count;
+static struct timespec first_task_start;
+
+static struct host_task *task_new(const char *name, uint32_t stack_depth) {
+    struct host_task *task = calloc(1, sizeof(*task));
+    if (!task) {
+        abort();
+    }
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->stack_depth = stack_depth;
+    pthread_mutex_init(&task->lock, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&task->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return task;
+}
+
+static void *task_entry(void *arg) {
+    struct host_task *task = arg;
+    current_task = task;
+    task->fn(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    (void)priority;
+    struct host_task *task = task_new(name, stack_depth);
+    task->fn = fn;
+    task->arg = arg;
+    if (handle) {
+        *handle = task;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (core != tskNO_AFFINITY && core < sysconf(_SC_NPROCESSORS_ONLN)) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    int err = pthread_create(&task->thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+
+    pthread_mutex_lock(&tasks_lock);
+    if (tasks == NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &first_task_start);
+    }
+    task->next = tasks;
+    tasks = task;
+    task_count++;
+    pthread_mutex_unlock(&tasks_lock);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+// Takes a task out of the task list (its handle stays valid, the memory is not reused)
+static void task_unlink(struct host_task *task) {
+    pthread_mutex_lock(&tasks_lock);
+    for (struct host_task **p = &tasks; *p; p = &(*p)->next) {
+        if (*p == task) {
+            *p = task->next;
+            task_count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tasks_lock);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL || task == current_task) {
+        if (current_task) {
+            task_unlink(current_task);
+        }
+        pthread_exit(NULL);
+    }
+    task_unlink(task);
+    pthread_cancel(task->thread);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    // Threads we didn't start (main, test harness) get a handle on first use
+    if (!current_task) {
+        current_task = task_new("main", 0);
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+    return task ? task->name : xTaskGetCurrentTaskHandle()->name;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    // Stack use is not tracked on the host
+    return task ? task->stack_depth : 0;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void) {
+    pthread_mutex_lock(&tasks_lock);
+    UBaseType_t count = task_count;
+    pthread_mutex_unlock(&tasks_lock);
+    return count;
+}
+
+static uint32_t elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (uint32_t)((to->tv_sec - from->tv_sec) * 1000000ll + (to->tv_nsec - from->tv_nsec) / 1000);
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t size, uint32_t *total_run_time) {
+    static const struct timespec zero;
+    pthread_mutex_lock(&tasks_lock);
+    if (size < task_count) {
+        pthread_mutex_unlock(&tasks_lock);
+        return 0;
+    }
+    UBaseType_t n = 0;
+    for (struct host_task *task = tasks; task; task = task->next, n++) {
+        struct timespec cpu = {0};
+        clockid_t clock;
+        if (pthread_getcpuclockid(task->thread, &clock) == 0) {
+            clock_gettime(clock, &cpu);
+        }
+        status[n] = (TaskStatus_t){
+            .xHandle = task,
+            .pcTaskName = task->name,
+            .xTaskNumber = task_count - n,
+            .eCurrentState = eBlocked,
+            .ulRunTimeCounter = elapsed_us(&zero, &cpu),
+            // Stack use is not tracked on the host
+            .usStackHighWaterMark = task->stack_depth,
+        };
+    }
+    if (total_run_time) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        *total_run_time = elapsed_us(&first_task_start, &now);
+    }
+    pthread_mutex_unlock(&tasks_lock);
+    return n;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(host_sim_ns() / 1000000ull);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    host_sleep_until_ns(host_sim_ns() + (uint64_t)ticks * 1000000ull);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment) {
+    *previous_wake += increment;
+    host_sleep_until_ns((uint64_t)*previous_wake * 1000000ull);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t timeout) {
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    if (timeout != portMAX_DELAY) {
+        deadline = host_wall_deadline(host_sim_ns() + (uint64_t)timeout * 1000000ull);
+    }
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify == 0) {
+        if (timeout == portMAX_DELAY) {
+            pthread_cond_wait(&task->cond, &task->lock);
+        } else if (pthread_cond_timedwait(&task->cond, &task->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    uint32_t value = task->notify;
+    if (value > 0) {
+        task->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+struct host_event_group {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    struct host_event_group *group = calloc(1, sizeof(*group));
+    if (!group) {
+        return NULL;
+    }
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&group->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t now = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->lock);
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    pthread_mutex_lock(&group->lock);
+    EventBits_t now = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return now;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t timeout) {
+    struct timespec deadline;
+    if (timeout != portMAX_DELAY) {
+        deadline = host_wall_deadline(host_sim_ns() + (uint64_t)timeout * 1000000ull);
+    }
+
+    pthread_mutex_lock(&group->lock);
+    while (wait_for_all ? (group->bits & bits) != bits : (group->bits & bits) == 0) {
+        if (timeout == portMAX_DELAY) {
+            pthread_cond_wait(&group->cond, &group->lock);
+        } else if (pthread_cond_timedwait(&group->cond, &group->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    EventBits_t now = group->bits;
+    bool met = wait_for_all ? (now & bits) == bits : (now & bits) != 0;
+    if (met && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->lock);
+    return now;
+}
+
+struct host_mutex {
+    pthread_mutex_t lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    struct host_mutex *mutex = calloc(1, sizeof(*mutex));
+    if (mutex) {
+        pthread_mutex_init(&mutex->lock, NULL);
+    }
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t timeout) {
+    if (timeout == portMAX_DELAY) {
+        return pthread_mutex_lock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    }
+    struct timespec deadline = host_wall_deadline(host_sim_ns() + (uint64_t)timeout * 1000000ull);
+    return pthread_mutex_clocklock(&mutex->lock, CLOCK_MONOTONIC, &deadline) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+    return pthread_mutex_unlock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+}
@@ -0,0 +1,34 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+// Host stand-in for FreeRTOS: tasks are pthreads, one tick is one (simulated) ms.
+// Only the parts the firmware uses are here.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+// Task list and run time counters (CPU time of the thread in us) are available
+#define configUSE_TRACE_FACILITY 1
+#define configGENERATE_RUN_TIME_STATS 1
+#define configSTACK_DEPTH_TYPE uint32_t
+
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(((uint64_t)(ticks) * 1000) / configTICK_RATE_HZ))
+
+// Simulated time runs this many times faster than the wall clock (default 1)
+void host_set_time_scale(double scale);
+
+#endif
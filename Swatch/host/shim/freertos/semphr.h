@@ -0,0 +1,13 @@
+#ifndef HOST_FREERTOS_SEMPHR_H
+#define HOST_FREERTOS_SEMPHR_H
+
+#include "freertos/queue.h"
+
+// Mutexes only (pthread mutexes, no priority inheritance on the host)
+typedef struct host_mutex *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t timeout);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
+
+#endif
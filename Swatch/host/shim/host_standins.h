@@ -0,0 +1,117 @@
+#ifndef HOST_STANDINS_H
+#define HOST_STANDINS_H
+
+// Hooks into the host stand-ins, for benchmarks and tools (not used by the firmware)
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Called for every MQTT publish the firmware makes
+typedef void (*host_mqtt_publish_hook_t)(const char *topic, const char *data, int len);
+void host_mqtt_set_publish_hook(host_mqtt_publish_hook_t hook);
+
+// Called instead for every publish that went into a dead or stalled link
+void host_mqtt_set_lost_hook(host_mqtt_publish_hook_t hook);
+
+// Delivers a message from "another client" to the firmware (MQTT_EVENT_DATA)
+void host_mqtt_inject(const char *topic, const char *data, int len);
+
+// Takes the broker down or brings it back (delivers MQTT_EVENT_DISCONNECTED / CONNECTED,
+// the latter right away if the station has an address)
+void host_mqtt_set_connected(bool connected);
+
+// Whether the Wi-Fi station has an IP address. The MQTT client can't reach the broker
+// without; it tries again every HOST_MQTT_RECONNECT_MS like ESP-MQTT does, or when told to
+// (esp_mqtt_client_reconnect).
+bool host_wifi_has_ip(void);
+#define HOST_MQTT_RECONNECT_MS 10000
+
+// A client that isn't told about a lost link only notices when its keepalive runs out.
+// Until then publishes "succeed" and go nowhere; this counts them.
+#define HOST_MQTT_KEEPALIVE_MS 120000
+uint32_t host_mqtt_dead_link_publishes(void);
+
+// The connection stops carrying anything (a half-open TCP connection) while stalled.
+// When the stall ends the client notices, reconnects and sends its outbox again.
+void host_mqtt_set_stalled(bool stalled);
+
+// Uplink to the broker in bytes per simulated second (0 = no limit). Publishes block
+// like a socket write once the send buffer is full, and PUBACKs come later.
+void host_mqtt_set_uplink(uint32_t bytes_per_s);
+
+// What went up to the broker: PUBLISH packets (resends included), their bytes on the
+// wire (fixed header, topic, packet id, MQTT 5 properties and payload) and the payload
+// bytes in them. What the broker sent back to us because we are subscribed to what we
+// publish. And publishes refused for a topic alias the broker doesn't know (it would
+// close the connection).
+typedef struct {
+    uint32_t packets;
+    uint64_t bytes;
+    uint64_t payload_bytes;
+    uint32_t echoed;
+    uint64_t echoed_bytes;
+    uint32_t alias_errors;
+} host_mqtt_wire_stats_t;
+void host_mqtt_wire_stats(host_mqtt_wire_stats_t *stats);
+
+// Topic aliases the broker takes (its CONNACK Topic Alias Maximum, Mosquitto's default)
+#define HOST_MQTT_TOPIC_ALIAS_MAX 10
+
+// The client's own outbox: QoS 1 bytes waiting for a PUBACK now and at most, and
+// messages it gave up on
+void host_mqtt_outbox_stats(size_t *bytes, size_t *max_bytes, uint32_t *expired);
+
+// Access points of our network: 0 on channel 6 (the strongest) and 1 on channel 11. Taking
+// the one the station is on down drops the link (WIFI_EVENT_STA_DISCONNECTED).
+#define HOST_WIFI_APS 2
+void host_wifi_set_ap(int ap, bool up);
+
+// The station loses its link (deauthenticated) while the access points stay up
+void host_wifi_drop_link(void);
+
+// Keeps core 0 (CPU 0 of the host) busy for this share of the time, like the Wi-Fi and
+// BT stacks under heavy traffic (0 = idle). Busy and idle time are wall time.
+void host_set_radio_load(double share);
+
+// Called for every BLE notification a central receives. queued_ms is the simulated time
+// it waited in the link's queue (0 unless the link is rate limited).
+typedef void (*host_ble_notify_hook_t)(uint16_t conn_id, uint16_t handle, const uint8_t *value, uint16_t len,
+                                       uint32_t queued_ms);
+void host_ble_set_notify_hook(host_ble_notify_hook_t hook);
+
+// Handle of the first attribute registered with this 16-bit UUID (0 if there is none yet)
+uint16_t host_ble_find_handle(uint16_t uuid16);
+
+// Pretend a central connects, asks for an MTU, writes an attribute or goes away (all
+// delivered on the BTC thread). Connecting fails while the firmware isn't advertising.
+bool host_ble_connect(uint16_t conn_id);
+void host_ble_exchange_mtu(uint16_t conn_id, uint16_t mtu);
+void host_ble_write(uint16_t conn_id, uint16_t handle, const uint8_t *value, uint16_t len);
+void host_ble_disconnect(uint16_t conn_id);
+
+// Lets a link carry only this many notifications per simulated second (0 = no limit).
+// Up to HOST_BLE_LINK_QUEUE wait in its queue; a full queue reports ESP_GATTS_CONGEST_EVT
+// and fails further sends until it is half empty again.
+#define HOST_BLE_LINK_QUEUE 8
+void host_ble_set_link_rate(uint16_t conn_id, double per_s);
+
+// Backs the data partition with this label by a file (created and erased if missing),
+// or by erased RAM if path is NULL. size must be a multiple of the 4 KB sector size.
+bool host_partition_add(const char *label, const char *path, uint32_t size);
+
+// What the firmware did to a partition so far
+typedef struct {
+    uint32_t read_calls;
+    uint64_t bytes_read;
+    uint32_t write_calls;
+    uint64_t bytes_written;
+    uint32_t sector_erases;
+    uint32_t min_sector_erases;     // wear spread over the sectors
+    uint32_t max_sector_erases;
+    uint32_t bit_set_attempts;      // bytes written over already programmed bits (a bug on real flash)
+} host_partition_stats_t;
+
+bool host_partition_get_stats(const char *label, host_partition_stats_t *stats);
+
+#endif
@@ -0,0 +1,50 @@
+#include <pthread.h>
+#include <errno.h>
+#include "freertos/FreeRTOS.h"
+#include "host_time.h"
+
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static uint64_t start_ns;
+static double time_scale = 1.0;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void record_start(void) {
+    start_ns = mono_ns();
+}
+
+void host_set_time_scale(double scale) {
+    pthread_once(&start_once, record_start);
+    if (scale > 0) {
+        time_scale = scale;
+    }
+}
+
+uint64_t host_sim_ns(void) {
+    pthread_once(&start_once, record_start);
+    return (uint64_t)((double)(mono_ns() - start_ns) * time_scale);
+}
+
+struct timespec host_wall_deadline(uint64_t sim_ns) {
+    pthread_once(&start_once, record_start);
+    uint64_t wall = start_ns + (uint64_t)((double)sim_ns / time_scale);
+    struct timespec ts = {
+        .tv_sec = (time_t)(wall / 1000000000ull),
+        .tv_nsec = (long)(wall % 1000000000ull),
+    };
+    return ts;
+}
+
+void host_sleep_until_ns(uint64_t sim_ns) {
+    struct timespec deadline = host_wall_deadline(sim_ns);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+void host_sim_delay_ms(uint32_t ms) {
+    host_sleep_until_ns(host_sim_ns() + (uint64_t)ms * 1000000ull);
+}
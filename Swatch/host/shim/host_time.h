@@ -0,0 +1,21 @@
+#ifndef HOST_TIME_H
+#define HOST_TIME_H
+
+// Simulated clock shared by the host stand-ins
+
+#include <stdint.h>
+#include <time.h>
+
+// Simulated ns since the program started (wall time * time scale)
+uint64_t host_sim_ns(void);
+
+// Sleeps until the simulated clock reaches sim_ns
+void host_sleep_until_ns(uint64_t sim_ns);
+
+// Sleeps for ms of simulated time (stand-in calls that take time on the chip)
+void host_sim_delay_ms(uint32_t ms);
+
+// CLOCK_MONOTONIC deadline for a simulated time, for pthread_cond_timedwait
+struct timespec host_wall_deadline(uint64_t sim_ns);
+
+#endif
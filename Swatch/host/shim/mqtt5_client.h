@@ -0,0 +1,33 @@
+#ifndef HOST_MQTT5_CLIENT_H
+#define HOST_MQTT5_CLIENT_H
+
+// Host stand-in for the MQTT 5 part of ESP-MQTT: the publish and subscribe properties.
+// Like on the real client they apply to every publish (subscribe) until set again.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mqtt_client.h"
+
+typedef struct {
+    bool payload_format_indicator;  // true: UTF-8 text
+    uint32_t message_expiry_interval;
+    uint16_t topic_alias;           // 0 = none
+    const char *response_topic;
+    const char *correlation_data;
+    uint16_t correlation_data_len;
+    const char *content_type;
+} esp_mqtt5_publish_property_config_t;
+
+typedef struct {
+    uint16_t subscribe_id;
+    bool no_local_flag;             // the broker doesn't send our own publishes back
+    bool retain_as_published_flag;
+    uint8_t retain_handle;
+} esp_mqtt5_subscribe_property_config_t;
+
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt_client_handle_t client,
+                                                const esp_mqtt5_publish_property_config_t *property);
+esp_err_t esp_mqtt5_client_set_subscribe_property(esp_mqtt_client_handle_t client,
+                                                  const esp_mqtt5_subscribe_property_config_t *property);
+
+#endif
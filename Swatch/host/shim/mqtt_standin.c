@@ -0,0 +1,758 @@
+// Host stand-in for the ESP-MQTT client. Events are delivered from a client thread,
+// like the real MQTT task, and publishes to a subscribed topic are echoed back.
+// Connecting needs the Wi-Fi stand-in to have an IP address and the broker to be up; a
+// failed connect is retried after the reconnect timeout, or earlier when the firmware
+// asks for it. A connection whose link went away is only noticed by the keepalive.
+// QoS 1 messages stay in the client's outbox until the broker's PUBACK comes back
+// (MQTT_EVENT_PUBLISHED), are sent again after a reconnect and given up on after
+// HOST_MQTT_OUTBOX_EXPIRE_MS (MQTT_EVENT_DELETED). The uplink can be slowed down
+// (host_mqtt_set_uplink) and the connection can stall (host_mqtt_set_stalled).
+// Under MQTT 5 the broker keeps the topic aliases of the connection, honours no-local
+// subscriptions, and every packet is counted with its properties (host_mqtt_wire_stats).
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "mqtt_client.h"
+#include "mqtt5_client.h"
+#include "host_standins.h"
+#include "host_time.h"
+
+#define MAX_SUBSCRIPTIONS 8
+
+// DNS lookup, TCP handshake and CONNECT/CONNACK with a broker on the internet (simulated ms)
+#define HOST_MQTT_CONNECT_MS 300
+
+// Receive buffer of the client (buffer.size in esp_mqtt_client_config_t, 1024 by default)
+#define HOST_MQTT_BUFFER_SIZE 1024
+
+// PUBLISH to the broker and PUBACK back, once the bytes are out (simulated ms)
+#define HOST_MQTT_RTT_MS 60
+
+// TCP send buffer (lwIP TCP_SND_BUF): a publish blocks while the uplink is this far behind
+#define HOST_MQTT_SNDBUF 5744
+
+// A QoS 1 message without a PUBACK is dropped from the outbox after this long (ms, the
+// ESP-MQTT default)
+#define HOST_MQTT_OUTBOX_EXPIRE_MS 30000
+
+// One QoS 1 message waiting for its PUBACK
+struct outbox_msg {
+    struct outbox_msg *next;
+    int msg_id;
+    char *topic;
+    char *data;
+    int len;
+    size_t packet_bytes;        // as it went the first time, a resend is the same packet
+    uint64_t queued_ns;
+    uint64_t ack_at_ns;         // 0: no ack coming, it goes again after the next connect
+};
+
+// A publish still on its way up a slow uplink
+struct wire_msg {
+    struct wire_msg *next;
+    char *topic;
+    char *data;
+    int len;
+    uint64_t arrive_ns;
+};
+
+struct pending_event {
+    struct pending_event *next;
+    esp_mqtt_event_id_t id;
+    int msg_id;
+    char *topic;
+    char *data;
+    int data_len;
+};
+
+struct esp_mqtt_client {
+    char uri[128];
+    esp_event_handler_t handler;
+    void *handler_args;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct pending_event *head;
+    struct pending_event *tail;
+    char *subscriptions[MAX_SUBSCRIPTIONS];
+    bool no_local[MAX_SUBSCRIPTIONS];
+    int subscription_count;
+    esp_mqtt_protocol_ver_t protocol;
+    _Atomic bool connected;
+    _Atomic int next_msg_id;
+
+    // Connection state, under lock
+    pthread_t link_thread;
+    pthread_cond_t link_cond;       // CLOCK_MONOTONIC, for timed waits
+    bool wanted;                    // started and not disconnected on purpose
+    uint64_t connect_at_ns;         // next connect attempt (simulated)
+
+    // The client's outbox and the uplink, under lock
+    struct outbox_msg *outbox;
+    size_t outbox_bytes;
+    size_t outbox_max_bytes;
+    uint32_t outbox_expired;
+    uint64_t outbox_limit;
+    uint64_t wire_free_ns;          // when the uplink has sent everything written so far
+    struct wire_msg *wire_head;     // written, not at the broker yet (oldest first)
+    struct wire_msg *wire_tail;
+
+    // MQTT 5, under lock: properties for the next publishes and subscribes, and the
+    // topic of every alias the broker knows on this connection
+    esp_mqtt5_publish_property_config_t publish_property;
+    char content_type[64];
+    bool subscribe_no_local;
+    char *aliases[HOST_MQTT_TOPIC_ALIAS_MAX + 1];
+
+    host_mqtt_wire_stats_t stats;   // under lock
+};
+
+static _Atomic bool broker_up = true;
+static _Atomic bool stalled;
+static _Atomic uint32_t uplink_bytes_per_s;
+static _Atomic uint32_t dead_link_publishes;
+
+static struct esp_mqtt_client the_client;
+static _Atomic(host_mqtt_publish_hook_t) publish_hook;
+static _Atomic(host_mqtt_publish_hook_t) lost_hook;
+
+void host_mqtt_set_publish_hook(host_mqtt_publish_hook_t hook) {
+    atomic_store(&publish_hook, hook);
+}
+
+void host_mqtt_set_lost_hook(host_mqtt_publish_hook_t hook) {
+    atomic_store(&lost_hook, hook);
+}
+
+static void post_event(struct esp_mqtt_client *client, esp_mqtt_event_id_t id, int msg_id,
+                       const char *topic, const char *data, int data_len) {
+    struct pending_event *ev = calloc(1, sizeof(*ev));
+    ev->id = id;
+    ev->msg_id = msg_id;
+    if (topic) {
+        ev->topic = strdup(topic);
+    }
+    if (data) {
+        ev->data = malloc(data_len > 0 ? data_len : 1);
+        memcpy(ev->data, data, data_len);
+        ev->data_len = data_len;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    if (client->tail) {
+        client->tail->next = ev;
+    } else {
+        client->head = ev;
+    }
+    client->tail = ev;
+    pthread_cond_signal(&client->cond);
+    pthread_mutex_unlock(&client->lock);
+}
+
+// The connection is gone (lock held). Clean session: the broker forgets our
+// subscriptions, and PUBACKs still on their way are lost.
+static void drop_session(struct esp_mqtt_client *client) {
+    for (int i = 0; i < client->subscription_count; i++) {
+        free(client->subscriptions[i]);
+    }
+    client->subscription_count = 0;
+    for (int i = 0; i <= HOST_MQTT_TOPIC_ALIAS_MAX; i++) {
+        free(client->aliases[i]);
+        client->aliases[i] = NULL;
+    }
+    for (struct outbox_msg *m = client->outbox; m; m = m->next) {
+        m->ack_at_ns = 0;
+    }
+    // So is whatever was still in the send buffer
+    host_mqtt_publish_hook_t hook = atomic_load(&lost_hook);
+    while (client->wire_head) {
+        struct wire_msg *w = client->wire_head;
+        client->wire_head = w->next;
+        if (hook) {
+            hook(w->topic, w->data, w->len);
+        }
+        free(w->topic);
+        free(w->data);
+        free(w);
+    }
+    client->wire_tail = NULL;
+    client->wire_free_ns = 0;
+}
+
+static size_t varint_bytes(size_t n) {
+    return n < 128 ? 1 : n < 16384 ? 2 : n < 2097152 ? 3 : 4;
+}
+
+// Size of a PUBLISH with the topic as sent (empty if only the alias goes) and, under
+// MQTT 5, the properties set for it (lock held)
+static size_t packet_bytes(struct esp_mqtt_client *client, const char *topic, int len, int qos) {
+    size_t rest = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + (size_t)len;
+    if (client->protocol == MQTT_PROTOCOL_V_5) {
+        const esp_mqtt5_publish_property_config_t *p = &client->publish_property;
+        size_t properties = (p->payload_format_indicator ? 2 : 0) + (p->topic_alias ? 3 : 0) +
+                            (p->content_type ? 3 + strlen(p->content_type) : 0);
+        rest += varint_bytes(properties) + properties;
+    }
+    return 1 + varint_bytes(rest) + rest;
+}
+
+// Puts a PUBLISH of that many bytes on the uplink (lock held). Without a rate limit it
+// is at the broker right away and 0 is returned; otherwise it is queued, the link thread
+// delivers it once it got there, and that time is returned.
+static uint64_t wire(struct esp_mqtt_client *client, const char *topic, const char *data, int len, size_t bytes) {
+    uint64_t now = host_sim_ns();
+    uint32_t rate = atomic_load(&uplink_bytes_per_s);
+    client->stats.packets++;
+    client->stats.bytes += bytes;
+    client->stats.payload_bytes += (size_t)len;
+    if (rate == 0) {
+        return 0;
+    }
+    uint64_t start = client->wire_free_ns > now ? client->wire_free_ns : now;
+    client->wire_free_ns = start + (uint64_t)bytes * 1000000000ull / rate;
+
+    struct wire_msg *w = calloc(1, sizeof(*w));
+    w->topic = strdup(topic);
+    w->data = malloc(len > 0 ? len : 1);
+    memcpy(w->data, data, len);
+    w->len = len;
+    w->arrive_ns = client->wire_free_ns;
+    if (client->wire_tail) {
+        client->wire_tail->next = w;
+    } else {
+        client->wire_head = w;
+    }
+    client->wire_tail = w;
+    pthread_cond_signal(&client->link_cond);
+    return client->wire_free_ns;
+}
+
+// Blocks like a socket write while the uplink is more than the send buffer behind
+static void wait_for_sndbuf(uint64_t done_ns) {
+    uint32_t rate = atomic_load(&uplink_bytes_per_s);
+    if (rate == 0) {
+        return;
+    }
+    uint64_t buffered_ns = (uint64_t)HOST_MQTT_SNDBUF * 1000000000ull / rate;
+    if (done_ns > host_sim_ns() + buffered_ns) {
+        host_sleep_until_ns(done_ns - buffered_ns);
+    }
+}
+
+// The broker got a message: the bench sees it, and so do we if we are subscribed
+static void deliver(struct esp_mqtt_client *client, const char *topic, const char *data, int len) {
+    host_mqtt_publish_hook_t hook = atomic_load(&publish_hook);
+    if (hook) {
+        hook(topic, data, len);
+    }
+    bool echo = false;
+    pthread_mutex_lock(&client->lock);
+    for (int i = 0; i < client->subscription_count; i++) {
+        if (!client->no_local[i] && strcmp(client->subscriptions[i], topic) == 0) {
+            echo = true;
+        }
+    }
+    if (echo) {
+        client->stats.echoed++;
+        client->stats.echoed_bytes += 4 + strlen(topic) + (size_t)len;
+    }
+    pthread_mutex_unlock(&client->lock);
+    if (echo) {
+        post_event(client, MQTT_EVENT_DATA, 0, topic, data, len);
+    }
+}
+
+static void remove_msg(struct esp_mqtt_client *client, struct outbox_msg **link) {
+    struct outbox_msg *m = *link;
+    *link = m->next;
+    client->outbox_bytes -= m->len;
+    free(m->topic);
+    free(m->data);
+    free(m);
+}
+
+#define MAX_DUE 32
+
+// Takes out the messages whose PUBACK arrived and the ones that expired (lock held).
+// Returns when the next one is due (UINT64_MAX if never).
+static uint64_t take_due(struct esp_mqtt_client *client, uint64_t now, int *acked, int *n_acked,
+                         int *expired, int *n_expired) {
+    uint64_t next = UINT64_MAX;
+    bool acks_arrive = atomic_load(&client->connected) && !atomic_load(&stalled);
+    uint64_t expire_ns = (uint64_t)HOST_MQTT_OUTBOX_EXPIRE_MS * 1000000ull;
+    *n_acked = *n_expired = 0;
+    struct outbox_msg **link = &client->outbox;
+    while (*link) {
+        struct outbox_msg *m = *link;
+        if (acks_arrive && m->ack_at_ns != 0 && m->ack_at_ns <= now && *n_acked < MAX_DUE) {
+            acked[(*n_acked)++] = m->msg_id;
+            remove_msg(client, link);
+            continue;
+        }
+        if (now - m->queued_ns >= expire_ns && *n_expired < MAX_DUE) {
+            expired[(*n_expired)++] = m->msg_id;
+            client->outbox_expired++;
+            remove_msg(client, link);
+            continue;
+        }
+        if (acks_arrive && m->ack_at_ns != 0 && m->ack_at_ns < next) {
+            next = m->ack_at_ns;
+        }
+        if (m->queued_ns + expire_ns < next) {
+            next = m->queued_ns + expire_ns;
+        }
+        link = &m->next;
+    }
+    return next;
+}
+
+// Waits for a signal or until the sooner of two simulated times (lock held)
+static void wait_until(struct esp_mqtt_client *client, uint64_t a, uint64_t b) {
+    uint64_t until = a < b ? a : b;
+    if (until == UINT64_MAX) {
+        pthread_cond_wait(&client->link_cond, &client->lock);
+        return;
+    }
+    struct timespec deadline = host_wall_deadline(until);
+    pthread_cond_timedwait(&client->link_cond, &client->lock, &deadline);
+}
+
+// Takes the oldest publish off the uplink if it reached the broker by now (lock held).
+// Bytes written into a stalled connection go nowhere.
+static struct wire_msg *take_arrived(struct esp_mqtt_client *client, uint64_t now, uint64_t *next) {
+    struct wire_msg *w = client->wire_head;
+    if (w == NULL || atomic_load(&stalled)) {
+        return NULL;
+    }
+    if (w->arrive_ns > now) {
+        if (w->arrive_ns < *next) {
+            *next = w->arrive_ns;
+        }
+        return NULL;
+    }
+    client->wire_head = w->next;
+    if (client->wire_head == NULL) {
+        client->wire_tail = NULL;
+    }
+    return w;
+}
+
+// After a connect, everything in the outbox without a PUBACK on its way goes again
+// (lock held on entry and exit)
+static void resend_outbox(struct esp_mqtt_client *client) {
+    struct outbox_msg *resend[MAX_DUE];
+    int n;
+    do {
+        n = 0;
+        for (struct outbox_msg *m = client->outbox; m && n < MAX_DUE; m = m->next) {
+            if (m->ack_at_ns == 0) {
+                uint64_t done = wire(client, m->topic, m->data, m->len, m->packet_bytes);
+                if (done == 0) {
+                    done = host_sim_ns();
+                    resend[n++] = m;
+                }
+                m->ack_at_ns = done + (uint64_t)HOST_MQTT_RTT_MS * 1000000ull;
+            }
+        }
+        // Only this thread frees messages, so they stay valid without the lock
+        pthread_mutex_unlock(&client->lock);
+        for (int i = 0; i < n; i++) {
+            deliver(client, resend[i]->topic, resend[i]->data, resend[i]->len);
+        }
+        pthread_mutex_lock(&client->lock);
+    } while (n == MAX_DUE && atomic_load(&client->connected));
+}
+
+// Connects whenever the client wants to be connected and isn't, and plays the keepalive
+// while it is: a connection without a link is dropped once the keepalive runs out
+static void *link_thread(void *arg) {
+    struct esp_mqtt_client *client = arg;
+    uint64_t dead_since_ns = 0;
+
+    pthread_mutex_lock(&client->lock);
+    while (1) {
+        uint64_t now = host_sim_ns();
+        int acked[MAX_DUE], expired[MAX_DUE], n_acked, n_expired;
+        uint64_t due = UINT64_MAX;
+        struct wire_msg *arrived = take_arrived(client, now, &due);
+        if (arrived) {
+            pthread_mutex_unlock(&client->lock);
+            deliver(client, arrived->topic, arrived->data, arrived->len);
+            free(arrived->topic);
+            free(arrived->data);
+            free(arrived);
+            pthread_mutex_lock(&client->lock);
+            continue;
+        }
+        uint64_t next_ack = take_due(client, now, acked, &n_acked, expired, &n_expired);
+        if (next_ack < due) {
+            due = next_ack;
+        }
+        if (n_acked > 0 || n_expired > 0) {
+            pthread_mutex_unlock(&client->lock);
+            for (int i = 0; i < n_acked; i++) {
+                post_event(client, MQTT_EVENT_PUBLISHED, acked[i], NULL, NULL, 0);
+            }
+            for (int i = 0; i < n_expired; i++) {
+                post_event(client, MQTT_EVENT_DELETED, expired[i], NULL, NULL, 0);
+            }
+            pthread_mutex_lock(&client->lock);
+            continue;
+        }
+        if (atomic_load(&client->connected)) {
+            if (host_wifi_has_ip()) {
+                dead_since_ns = 0;
+            } else if (dead_since_ns == 0) {
+                dead_since_ns = now;
+            } else if (now - dead_since_ns >= (uint64_t)HOST_MQTT_KEEPALIVE_MS * 1000000ull) {
+                atomic_store(&client->connected, false);
+                drop_session(client);
+                client->connect_at_ns = now + (uint64_t)HOST_MQTT_RECONNECT_MS * 1000000ull;
+                pthread_mutex_unlock(&client->lock);
+                post_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL, NULL, 0);
+                pthread_mutex_lock(&client->lock);
+                continue;
+            }
+            // Check the link once per simulated second
+            wait_until(client, now + 1000000000ull, due);
+            continue;
+        }
+        if (!client->wanted) {
+            wait_until(client, UINT64_MAX, due);
+            continue;
+        }
+        if (now < client->connect_at_ns) {
+            wait_until(client, client->connect_at_ns, due);
+            continue;
+        }
+
+        pthread_mutex_unlock(&client->lock);
+        host_sim_delay_ms(HOST_MQTT_CONNECT_MS);
+        pthread_mutex_lock(&client->lock);
+        if (!client->wanted || atomic_load(&client->connected)) {
+            continue;
+        }
+        if (host_wifi_has_ip() && atomic_load(&broker_up)) {
+            atomic_store(&client->connected, true);
+            dead_since_ns = 0;
+            pthread_mutex_unlock(&client->lock);
+            post_event(client, MQTT_EVENT_CONNECTED, 0, NULL, NULL, 0);
+            pthread_mutex_lock(&client->lock);
+            resend_outbox(client);
+        } else {
+            // Without a network (or broker) the connect fails and the client waits out its
+            // reconnect timeout
+            client->connect_at_ns = host_sim_ns() + (uint64_t)HOST_MQTT_RECONNECT_MS * 1000000ull;
+        }
+    }
+    return NULL;
+}
+
+static void *client_thread(void *arg) {
+    struct esp_mqtt_client *client = arg;
+
+    while (1) {
+        pthread_mutex_lock(&client->lock);
+        while (!client->head) {
+            pthread_cond_wait(&client->cond, &client->lock);
+        }
+        struct pending_event *ev = client->head;
+        client->head = ev->next;
+        if (!client->head) {
+            client->tail = NULL;
+        }
+        pthread_mutex_unlock(&client->lock);
+
+        // Like the real client, a message bigger than the receive buffer comes in several
+        // MQTT_EVENT_DATA events and only the first one has the topic
+        int offset = 0;
+        do {
+            int chunk = ev->data_len - offset;
+            if (chunk > HOST_MQTT_BUFFER_SIZE) {
+                chunk = HOST_MQTT_BUFFER_SIZE;
+            }
+            esp_mqtt_event_t event = {
+                .event_id = ev->id,
+                .client = client,
+                .msg_id = ev->msg_id,
+                .topic = offset == 0 ? ev->topic : NULL,
+                .topic_len = offset == 0 && ev->topic ? (int)strlen(ev->topic) : 0,
+                .data = ev->data ? ev->data + offset : NULL,
+                .data_len = chunk,
+                .total_data_len = ev->data_len,
+                .current_data_offset = offset,
+            };
+            if (client->handler) {
+                client->handler(client->handler_args, "MQTT_EVENTS", ev->id, &event);
+            }
+            offset += chunk;
+        } while (offset < ev->data_len);
+        free(ev->topic);
+        free(ev->data);
+        free(ev);
+    }
+    return NULL;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+    struct esp_mqtt_client *client = &the_client;
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->cond, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&client->link_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (config && config->broker.address.uri) {
+        strncpy(client->uri, config->broker.address.uri, sizeof(client->uri) - 1);
+    }
+    client->outbox_limit = config ? config->outbox.limit : 0;
+    client->protocol = config && config->session.protocol_ver == MQTT_PROTOCOL_V_5 ? MQTT_PROTOCOL_V_5
+                                                                                     : MQTT_PROTOCOL_V_3_1_1;
+    return client;
+}
+
+esp_err_t esp_mqtt_client_set_uri(esp_mqtt_client_handle_t client, const char *uri) {
+    strncpy(client->uri, uri, sizeof(client->uri) - 1);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void *handler_args) {
+    (void)event;
+    client->handler = handler;
+    client->handler_args = handler_args;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+    pthread_mutex_lock(&client->lock);
+    client->wanted = true;
+    client->connect_at_ns = host_sim_ns();
+    pthread_mutex_unlock(&client->lock);
+    if (pthread_create(&client->thread, NULL, client_thread, client) != 0 ||
+        pthread_create(&client->link_thread, NULL, link_thread, client) != 0) {
+        return ESP_FAIL;
+    }
+    pthread_detach(client->thread);
+    pthread_detach(client->link_thread);
+    return ESP_OK;
+}
+
+// Like ESP-MQTT: only does something while the client waits to reconnect
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client) {
+    pthread_mutex_lock(&client->lock);
+    bool waiting = !atomic_load(&client->connected);
+    if (waiting) {
+        client->wanted = true;
+        client->connect_at_ns = host_sim_ns();
+        pthread_cond_signal(&client->link_cond);
+    }
+    pthread_mutex_unlock(&client->lock);
+    return waiting ? ESP_OK : ESP_FAIL;
+}
+
+// Drops the connection; the client stays away until esp_mqtt_client_reconnect()
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client) {
+    pthread_mutex_lock(&client->lock);
+    client->wanted = false;
+    bool was = atomic_exchange(&client->connected, false);
+    if (was) {
+        drop_session(client);
+    }
+    pthread_cond_signal(&client->link_cond);
+    pthread_mutex_unlock(&client->lock);
+    if (was) {
+        post_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL, NULL, 0);
+    }
+    return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos) {
+    (void)qos;
+    pthread_mutex_lock(&client->lock);
+    if (client->subscription_count < MAX_SUBSCRIPTIONS) {
+        client->no_local[client->subscription_count] =
+            client->protocol == MQTT_PROTOCOL_V_5 && client->subscribe_no_local;
+        client->subscriptions[client->subscription_count++] = strdup(topic);
+    }
+    pthread_mutex_unlock(&client->lock);
+    return atomic_fetch_add(&client->next_msg_id, 1) + 1;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                            int len, int qos, int retain) {
+    (void)retain;
+    if (len <= 0) {
+        len = data ? (int)strlen(data) : 0;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    if (!atomic_load(&client->connected)) {
+        pthread_mutex_unlock(&client->lock);
+        return -1;
+    }
+    if (qos > 0 && client->outbox_limit && client->outbox_bytes + len > client->outbox_limit) {
+        pthread_mutex_unlock(&client->lock);
+        return -2;
+    }
+    // An empty topic means the alias alone, which the broker has to know already.
+    // Everything after this sees the full topic, like the broker's subscribers do.
+    size_t bytes = packet_bytes(client, topic, len, qos);
+    char resolved[128] = "";
+    if (client->protocol == MQTT_PROTOCOL_V_5) {
+        uint16_t alias = client->publish_property.topic_alias;
+        if (alias > HOST_MQTT_TOPIC_ALIAS_MAX) {
+            // ESP-MQTT checks this against the CONNACK and refuses
+            pthread_mutex_unlock(&client->lock);
+            return -1;
+        }
+        if (topic[0] == '\0') {
+            if (alias == 0 || client->aliases[alias] == NULL) {
+                client->stats.alias_errors++;
+                pthread_mutex_unlock(&client->lock);
+                return -1;
+            }
+            // Copied, a reconnect frees the table while this is still going
+            strncpy(resolved, client->aliases[alias], sizeof(resolved) - 1);
+            topic = resolved;
+        } else if (alias != 0 && (client->aliases[alias] == NULL || strcmp(client->aliases[alias], topic) != 0)) {
+            free(client->aliases[alias]);
+            client->aliases[alias] = strdup(topic);
+        }
+    }
+    // QoS 0 publishes have message id 0
+    int msg_id = qos > 0 ? atomic_fetch_add(&client->next_msg_id, 1) + 1 : 0;
+    // The client thinks it is connected, the bytes go into a socket that leads nowhere
+    bool dead = !host_wifi_has_ip() || atomic_load(&stalled);
+    uint64_t done = dead ? 0 : wire(client, topic, data, len, bytes);
+    bool arrived = done == 0;
+    if (arrived) {
+        done = host_sim_ns();
+    }
+    if (qos > 0) {
+        struct outbox_msg *m = calloc(1, sizeof(*m));
+        m->msg_id = msg_id;
+        m->topic = strdup(topic);
+        m->data = malloc(len > 0 ? len : 1);
+        memcpy(m->data, data, len);
+        m->len = len;
+        m->packet_bytes = bytes;
+        m->queued_ns = host_sim_ns();
+        m->ack_at_ns = dead ? 0 : done + (uint64_t)HOST_MQTT_RTT_MS * 1000000ull;
+        struct outbox_msg **tail = &client->outbox;
+        while (*tail) {
+            tail = &(*tail)->next;
+        }
+        *tail = m;
+        client->outbox_bytes += len;
+        if (client->outbox_bytes > client->outbox_max_bytes) {
+            client->outbox_max_bytes = client->outbox_bytes;
+        }
+        pthread_cond_signal(&client->link_cond);
+    }
+    pthread_mutex_unlock(&client->lock);
+
+    wait_for_sndbuf(done);
+    if (dead) {
+        atomic_fetch_add(&dead_link_publishes, 1);
+        host_mqtt_publish_hook_t hook = atomic_load(&lost_hook);
+        if (hook) {
+            hook(topic, data, len);
+        }
+    } else if (arrived) {
+        deliver(client, topic, data, len);
+    }
+    return msg_id;
+}
+
+void host_mqtt_set_connected(bool connected) {
+    struct esp_mqtt_client *client = &the_client;
+    if (atomic_exchange(&broker_up, connected) == connected) {
+        return;
+    }
+    pthread_mutex_lock(&client->lock);
+    bool dropped = !connected && atomic_exchange(&client->connected, false);
+    if (dropped) {
+        drop_session(client);
+        client->connect_at_ns = host_sim_ns() + (uint64_t)HOST_MQTT_RECONNECT_MS * 1000000ull;
+    } else if (connected) {
+        // The broker is back right when the client happens to retry
+        client->connect_at_ns = host_sim_ns();
+    }
+    pthread_cond_signal(&client->link_cond);
+    pthread_mutex_unlock(&client->lock);
+    if (dropped) {
+        post_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL, NULL, 0);
+    }
+}
+
+void host_mqtt_set_stalled(bool stall) {
+    struct esp_mqtt_client *client = &the_client;
+    if (atomic_exchange(&stalled, stall) == stall || stall) {
+        return;
+    }
+    // The keepalive finally noticed: the connection is dropped and made again right away
+    pthread_mutex_lock(&client->lock);
+    bool dropped = atomic_exchange(&client->connected, false);
+    if (dropped) {
+        drop_session(client);
+        client->connect_at_ns = host_sim_ns();
+    }
+    pthread_cond_signal(&client->link_cond);
+    pthread_mutex_unlock(&client->lock);
+    if (dropped) {
+        post_event(client, MQTT_EVENT_DISCONNECTED, 0, NULL, NULL, 0);
+    }
+}
+
+void host_mqtt_set_uplink(uint32_t bytes_per_s) {
+    atomic_store(&uplink_bytes_per_s, bytes_per_s);
+}
+
+void host_mqtt_outbox_stats(size_t *bytes, size_t *max_bytes, uint32_t *expired) {
+    struct esp_mqtt_client *client = &the_client;
+    pthread_mutex_lock(&client->lock);
+    *bytes = client->outbox_bytes;
+    *max_bytes = client->outbox_max_bytes;
+    *expired = client->outbox_expired;
+    pthread_mutex_unlock(&client->lock);
+}
+
+uint32_t host_mqtt_dead_link_publishes(void) {
+    return atomic_load(&dead_link_publishes);
+}
+
+void host_mqtt_inject(const char *topic, const char *data, int len) {
+    post_event(&the_client, MQTT_EVENT_DATA, 0, topic, data, len);
+}
+
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt_client_handle_t client,
+                                                const esp_mqtt5_publish_property_config_t *property) {
+    pthread_mutex_lock(&client->lock);
+    client->publish_property = *property;
+    if (property->content_type) {
+        strncpy(client->content_type, property->content_type, sizeof(client->content_type) - 1);
+        client->publish_property.content_type = client->content_type;
+    }
+    pthread_mutex_unlock(&client->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt5_client_set_subscribe_property(esp_mqtt_client_handle_t client,
+                                                  const esp_mqtt5_subscribe_property_config_t *property) {
+    pthread_mutex_lock(&client->lock);
+    client->subscribe_no_local = property->no_local_flag;
+    pthread_mutex_unlock(&client->lock);
+    return ESP_OK;
+}
+
+void host_mqtt_wire_stats(host_mqtt_wire_stats_t *stats) {
+    struct esp_mqtt_client *client = &the_client;
+    pthread_mutex_lock(&client->lock);
+    *stats = client->stats;
+    pthread_mutex_unlock(&client->lock);
+}
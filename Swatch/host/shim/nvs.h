@@ -0,0 +1,21 @@
+#ifndef HOST_NVS_H
+#define HOST_NVS_H
+
+// Host stand-in for NVS: blobs in memory, gone when the program exits
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "nvs_flash.h"
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
+
+#endif
@@ -0,0 +1,177 @@
+// Host stand-in for NVS. Blobs are kept in memory for as long as the program runs, so
+// every run starts like a first boot with empty flash.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "host_time.h"
+
+#define MAX_HANDLES 8
+#define MAX_ENTRIES 32
+#define NAME_MAX_LEN 16     // namespace and key names, with the terminator (like NVS)
+
+// Writing a blob and its page header (simulated ms)
+#define NVS_WRITE_MS 5
+
+typedef struct {
+    char ns[NAME_MAX_LEN];
+    char key[NAME_MAX_LEN];
+    void *data;
+    size_t len;
+} entry_t;
+
+typedef struct {
+    bool open;
+    bool writable;
+    char ns[NAME_MAX_LEN];
+} open_handle_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static entry_t entries[MAX_ENTRIES];
+static open_handle_t handles[MAX_HANDLES];
+
+// Handles are 1 based, 0 is never handed out
+static open_handle_t *get_handle(nvs_handle_t handle) {
+    if (handle == 0 || handle > MAX_HANDLES || !handles[handle - 1].open) {
+        return NULL;
+    }
+    return &handles[handle - 1];
+}
+
+static entry_t *find_entry(const char *ns, const char *key) {
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+        if (entries[i].data && strcmp(entries[i].ns, ns) == 0 && strcmp(entries[i].key, key) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    host_sim_delay_ms(400);
+    pthread_mutex_lock(&nvs_lock);
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+        free(entries[i].data);
+        entries[i].data = NULL;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    if (strlen(name) >= NAME_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    // Like NVS, a read-only open of a namespace nobody wrote to fails
+    bool exists = false;
+    for (int i = 0; i < MAX_ENTRIES && !exists; i++) {
+        exists = entries[i].data && strcmp(entries[i].ns, name) == 0;
+    }
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (open_mode == NVS_READONLY && !exists) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else {
+        for (int i = 0; i < MAX_HANDLES; i++) {
+            if (!handles[i].open) {
+                handles[i] = (open_handle_t){ .open = true, .writable = open_mode == NVS_READWRITE };
+                strcpy(handles[i].ns, name);
+                *out_handle = (nvs_handle_t)i + 1;
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    pthread_mutex_lock(&nvs_lock);
+    open_handle_t *h = get_handle(handle);
+    entry_t *e = h ? find_entry(h->ns, key) : NULL;
+    esp_err_t err = ESP_OK;
+    if (!h) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (!e) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out_value == NULL) {
+        *length = e->len;
+    } else if (*length < e->len) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, e->data, e->len);
+        *length = e->len;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    if (strlen(key) >= NAME_MAX_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_sim_delay_ms(NVS_WRITE_MS);
+    pthread_mutex_lock(&nvs_lock);
+    open_handle_t *h = get_handle(handle);
+    esp_err_t err = ESP_OK;
+    if (!h) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (!h->writable) {
+        err = ESP_ERR_NVS_READ_ONLY;
+    } else {
+        entry_t *e = find_entry(h->ns, key);
+        for (int i = 0; i < MAX_ENTRIES && !e; i++) {
+            if (!entries[i].data) {
+                e = &entries[i];
+                strcpy(e->ns, h->ns);
+                strcpy(e->key, key);
+            }
+        }
+        void *copy = e ? malloc(length ? length : 1) : NULL;
+        if (!copy) {
+            err = ESP_ERR_NO_MEM;
+        } else {
+            memcpy(copy, value, length);
+            free(e->data);
+            e->data = copy;
+            e->len = length;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    pthread_mutex_lock(&nvs_lock);
+    open_handle_t *h = get_handle(handle);
+    entry_t *e = h ? find_entry(h->ns, key) : NULL;
+    esp_err_t err = !h ? ESP_ERR_NVS_INVALID_HANDLE : !h->writable ? ESP_ERR_NVS_READ_ONLY :
+                    !e ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+    if (err == ESP_OK) {
+        free(e->data);
+        e->data = NULL;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+// Writes are immediate here
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    pthread_mutex_lock(&nvs_lock);
+    esp_err_t err = get_handle(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    pthread_mutex_lock(&nvs_lock);
+    open_handle_t *h = get_handle(handle);
+    if (h) {
+        h->open = false;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+}
@@ -0,0 +1,211 @@
+// Host stand-in for flash partitions, backed by a file or by RAM. Writes behave like NOR
+// flash (they can only clear bits, 1 -> 0) and erases must cover whole 4 KB sectors.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "esp_partition.h"
+#include "host_standins.h"
+
+#define SECTOR_SIZE 4096
+// Enough for one offline log per simulated watch in fleet_bench
+#define MAX_PARTITIONS 1024
+
+struct host_partition {
+    esp_partition_t part;
+    int fd;                 // -1 when the partition lives in mem
+    uint8_t *mem;
+    uint32_t *sector_erases;
+    host_partition_stats_t stats;
+};
+
+static struct host_partition partitions[MAX_PARTITIONS];
+static int partition_count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct host_partition *lookup(const esp_partition_t *part) {
+    struct host_partition *p = (struct host_partition *)((const char *)part - offsetof(struct host_partition, part));
+    if (p < partitions || p >= partitions + partition_count) {
+        return NULL;
+    }
+    return p;
+}
+
+static bool backing_read(struct host_partition *p, void *dst, size_t size, size_t offset) {
+    if (p->mem) {
+        memcpy(dst, p->mem + offset, size);
+        return true;
+    }
+    return pread(p->fd, dst, size, (off_t)offset) == (ssize_t)size;
+}
+
+static bool backing_write(struct host_partition *p, const void *src, size_t size, size_t offset) {
+    if (p->mem) {
+        memcpy(p->mem + offset, src, size);
+        return true;
+    }
+    return pwrite(p->fd, src, size, (off_t)offset) == (ssize_t)size;
+}
+
+static bool add_partition(const char *label, int fd, uint32_t size) {
+    uint8_t *mem = NULL;
+    if (fd < 0) {
+        // Fresh RAM starts out erased like a new file does
+        mem = malloc(size);
+        if (mem == NULL) {
+            return false;
+        }
+        memset(mem, 0xFF, size);
+    }
+
+    pthread_mutex_lock(&lock);
+    struct host_partition *p = &partitions[partition_count];
+    memset(p, 0, sizeof(*p));
+    p->part.type = ESP_PARTITION_TYPE_DATA;
+    p->part.subtype = 0x40;
+    p->part.size = size;
+    p->part.erase_size = SECTOR_SIZE;
+    strncpy(p->part.label, label, sizeof(p->part.label) - 1);
+    p->fd = fd;
+    p->mem = mem;
+    p->sector_erases = calloc(size / SECTOR_SIZE, sizeof(uint32_t));
+    partition_count++;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+bool host_partition_add(const char *label, const char *path, uint32_t size) {
+    if (partition_count == MAX_PARTITIONS || size == 0 || size % SECTOR_SIZE != 0) {
+        return false;
+    }
+    if (path == NULL) {
+        return add_partition(label, -1, size);
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // A new (or too short) file is filled up with erased flash
+    off_t current = lseek(fd, 0, SEEK_END);
+    if (current < (off_t)size) {
+        uint8_t erased[SECTOR_SIZE];
+        memset(erased, 0xFF, sizeof(erased));
+        for (off_t off = current; off < (off_t)size; off += SECTOR_SIZE) {
+            size_t n = (size_t)((off_t)size - off < SECTOR_SIZE ? (off_t)size - off : SECTOR_SIZE);
+            if (pwrite(fd, erased, n, off) != (ssize_t)n) {
+                close(fd);
+                return false;
+            }
+        }
+    }
+
+    return add_partition(label, fd, size);
+}
+
+bool host_partition_get_stats(const char *label, host_partition_stats_t *stats) {
+    bool found = false;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < partition_count; i++) {
+        struct host_partition *p = &partitions[i];
+        if (strncmp(p->part.label, label, sizeof(p->part.label)) != 0) {
+            continue;
+        }
+        *stats = p->stats;
+        uint32_t sectors = p->part.size / SECTOR_SIZE;
+        stats->min_sector_erases = UINT32_MAX;
+        stats->max_sector_erases = 0;
+        for (uint32_t s = 0; s < sectors; s++) {
+            if (p->sector_erases[s] < stats->min_sector_erases) stats->min_sector_erases = p->sector_erases[s];
+            if (p->sector_erases[s] > stats->max_sector_erases) stats->max_sector_erases = p->sector_erases[s];
+        }
+        found = true;
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    const esp_partition_t *found = NULL;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < partition_count && i < MAX_PARTITIONS; i++) {
+        const esp_partition_t *part = &partitions[i].part;
+        if ((type == ESP_PARTITION_TYPE_ANY || part->type == type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || part->subtype == subtype) &&
+            (label == NULL || strcmp(part->label, label) == 0)) {
+            found = part;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    struct host_partition *p = lookup(partition);
+    if (!p || src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (!backing_read(p, dst, size, src_offset)) {
+        return ESP_FAIL;
+    }
+    p->stats.read_calls++;
+    p->stats.bytes_read += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    struct host_partition *p = lookup(partition);
+    if (!p || dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Programming can only clear bits, so the result is old AND new
+    uint8_t chunk[256];
+    const uint8_t *in = src;
+    for (size_t done = 0; done < size; done += sizeof(chunk)) {
+        size_t n = size - done < sizeof(chunk) ? size - done : sizeof(chunk);
+        if (!backing_read(p, chunk, n, dst_offset + done)) {
+            return ESP_FAIL;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (~chunk[i] & in[done + i]) {
+                p->stats.bit_set_attempts++;
+            }
+            chunk[i] &= in[done + i];
+        }
+        if (!backing_write(p, chunk, n, dst_offset + done)) {
+            return ESP_FAIL;
+        }
+    }
+    p->stats.write_calls++;
+    p->stats.bytes_written += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    struct host_partition *p = lookup(partition);
+    if (!p || offset % SECTOR_SIZE != 0 || size % SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t erased[SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (size_t off = offset; off < offset + size; off += SECTOR_SIZE) {
+        if (!backing_write(p, erased, SECTOR_SIZE, off)) {
+            return ESP_FAIL;
+        }
+        p->sector_erases[off / SECTOR_SIZE]++;
+        p->stats.sector_erases++;
+    }
+    return ESP_OK;
+}
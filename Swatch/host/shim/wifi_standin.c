@@ -0,0 +1,325 @@
+// Host stand-in for the default event loop, netif and the Wi-Fi station. Each step takes
+// about as long as on an ESP32 next to its access point, and once connected the station
+// gets an address: IP_EVENT_STA_GOT_IP is posted from a Wi-Fi thread. Our network has
+// HOST_WIFI_APS access points that can be taken down (host_wifi_set_ap), and the link can
+// be dropped under the station (host_wifi_drop_link). The CPU time the radio stacks take
+// can be simulated too (host_set_radio_load).
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "host_standins.h"
+#include "host_time.h"
+
+// Simulated ms
+#define WIFI_INIT_MS 50         // driver, buffers and the Wi-Fi task
+#define WIFI_START_MS 100       // PHY calibration
+#define WIFI_SCAN_CHANNEL_MS 60 // probe and listen on one channel
+#define WIFI_SCAN_CHANNELS 13   // a full scan does them all
+#define WIFI_AUTH_MS 120        // authentication, association and the WPA2 handshake
+#define WIFI_DHCP_MS 500        // DHCP lease: DISCOVER, OFFER, REQUEST, ACK
+#define WIFI_DHCP_REBOOT_MS 100 // asking for the address we had before: REQUEST, ACK
+
+#define MAX_HANDLERS 16
+
+// Radio load comes in bursts of this many wall us per period
+#define RADIO_LOAD_PERIOD_US 2000
+
+const char *const WIFI_EVENT = "WIFI_EVENT";
+const char *const IP_EVENT = "IP_EVENT";
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} handler_t;
+
+static pthread_mutex_t handlers_lock = PTHREAD_MUTEX_INITIALIZER;
+static handler_t handlers[MAX_HANDLERS];
+static int handler_count;
+
+static _Atomic bool has_ip;
+
+esp_err_t esp_event_loop_create_default(void) { return ESP_OK; }
+esp_err_t esp_netif_init(void) { return ESP_OK; }
+esp_netif_t *esp_netif_create_default_wifi_sta(void) { return NULL; }
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t event_id, esp_event_handler_t handler, void *arg) {
+    pthread_mutex_lock(&handlers_lock);
+    if (handler_count == MAX_HANDLERS) {
+        pthread_mutex_unlock(&handlers_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    handlers[handler_count++] = (handler_t){ base, event_id, handler, arg };
+    pthread_mutex_unlock(&handlers_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t event_id, const void *event_data, size_t size,
+                         uint32_t ticks_to_wait) {
+    (void)size;
+    (void)ticks_to_wait;
+    // Handlers can register more handlers, so they run on a copy
+    handler_t matching[MAX_HANDLERS];
+    int n = 0;
+    pthread_mutex_lock(&handlers_lock);
+    for (int i = 0; i < handler_count; i++) {
+        if (strcmp(handlers[i].base, base) == 0 && (handlers[i].id == ESP_EVENT_ANY_ID || handlers[i].id == event_id)) {
+            matching[n++] = handlers[i];
+        }
+    }
+    pthread_mutex_unlock(&handlers_lock);
+    for (int i = 0; i < n; i++) {
+        matching[i].handler(matching[i].arg, base, event_id, (void *)event_data);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+    (void)config;
+    host_sim_delay_ms(WIFI_INIT_MS);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) { (void)mode; return ESP_OK; }
+
+esp_err_t esp_wifi_start(void) {
+    host_sim_delay_ms(WIFI_START_MS);
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, 0);
+    return ESP_OK;
+}
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    bool up;
+} sim_ap_t;
+
+static pthread_mutex_t link_lock = PTHREAD_MUTEX_INITIALIZER;
+static sim_ap_t aps[HOST_WIFI_APS] = {
+    { { 0x24, 0x0a, 0xc4, 0x5e, 0x10, 0x06 }, 6, -52, true },
+    { { 0x24, 0x0a, 0xc4, 0x5e, 0x10, 0x0b }, 11, -67, true },
+};
+static wifi_sta_config_t sta_config;
+static int assoc_ap = -1;       // AP we are associated with, -1 if none
+static uint32_t link_gen;       // bumped when the link goes away, a connect in flight gives up
+static bool leased;             // DHCP gave us an address before
+
+static esp_ip4_addr_t ip4(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    esp_ip4_addr_t addr;
+    uint8_t bytes[4] = { a, b, c, d };
+    memcpy(&addr.addr, bytes, sizeof(bytes));
+    return addr;
+}
+
+static void post_disconnected(uint8_t reason) {
+    wifi_event_sta_disconnected_t info = { .reason = reason };
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &info, sizeof(info), 0);
+}
+
+// Strongest AP that is up and matches the config, -1 if there is none (link_lock held)
+static int pick_ap(const wifi_sta_config_t *config, bool one_channel) {
+    int best = -1;
+    for (int i = 0; i < HOST_WIFI_APS; i++) {
+        if (!aps[i].up || (config->bssid_set && memcmp(config->bssid, aps[i].bssid, 6) != 0) ||
+            (one_channel && config->channel != aps[i].channel)) {
+            continue;
+        }
+        if (best < 0 || aps[i].rssi > aps[best].rssi) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void *connect_thread(void *arg) {
+    uint32_t gen = (uint32_t)(uintptr_t)arg;
+    pthread_mutex_lock(&link_lock);
+    wifi_sta_config_t config = sta_config;
+    pthread_mutex_unlock(&link_lock);
+
+    // A fast scan with a known channel only listens there, otherwise every channel is scanned
+    bool one_channel = config.scan_method == WIFI_FAST_SCAN && config.channel != 0;
+    host_sim_delay_ms(one_channel ? WIFI_SCAN_CHANNEL_MS : WIFI_SCAN_CHANNEL_MS * WIFI_SCAN_CHANNELS);
+
+    pthread_mutex_lock(&link_lock);
+    int ap = gen == link_gen ? pick_ap(&config, one_channel) : -1;
+    bool cancelled = gen != link_gen;
+    pthread_mutex_unlock(&link_lock);
+    if (ap < 0) {
+        if (!cancelled) {
+            post_disconnected(WIFI_REASON_NO_AP_FOUND);
+        }
+        return NULL;
+    }
+
+    host_sim_delay_ms(WIFI_AUTH_MS);
+    pthread_mutex_lock(&link_lock);
+    cancelled = gen != link_gen;
+    bool ap_up = aps[ap].up;
+    if (!cancelled && ap_up) {
+        assoc_ap = ap;
+    }
+    bool restore = leased;
+    pthread_mutex_unlock(&link_lock);
+    if (cancelled) {
+        return NULL;
+    }
+    if (!ap_up) {
+        post_disconnected(WIFI_REASON_AUTH_EXPIRE);
+        return NULL;
+    }
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, NULL, 0, 0);
+
+    host_sim_delay_ms(restore ? WIFI_DHCP_REBOOT_MS : WIFI_DHCP_MS);
+    ip_event_got_ip_t got = {
+        .ip_info = { ip4(192, 168, 1, 23), ip4(255, 255, 255, 0), ip4(192, 168, 1, 1) },
+        .ip_changed = !restore,
+    };
+    pthread_mutex_lock(&link_lock);
+    // Whoever dropped the link meanwhile posted the disconnect
+    cancelled = gen != link_gen;
+    if (!cancelled) {
+        leased = true;
+        atomic_store(&has_ip, true);
+    }
+    pthread_mutex_unlock(&link_lock);
+    if (!cancelled) {
+        esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got, sizeof(got), 0);
+    }
+    return NULL;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf) {
+    (void)interface;
+    pthread_mutex_lock(&link_lock);
+    sta_config = conf->sta;
+    pthread_mutex_unlock(&link_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void) {
+    pthread_mutex_lock(&link_lock);
+    uint32_t gen = link_gen;
+    pthread_mutex_unlock(&link_lock);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, connect_thread, (void *)(uintptr_t)gen) != 0) {
+        return ESP_FAIL;
+    }
+    pthread_detach(thread);
+    return ESP_OK;
+}
+
+// Forgets the association and the address. True if there was one to lose (link_lock held).
+static bool lose_link(void) {
+    bool had = assoc_ap >= 0;
+    if (had) {
+        assoc_ap = -1;
+        link_gen++;
+        atomic_store(&has_ip, false);
+    }
+    return had;
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+    pthread_mutex_lock(&link_lock);
+    lose_link();
+    // A connect in flight is cancelled too
+    link_gen++;
+    pthread_mutex_unlock(&link_lock);
+    post_disconnected(WIFI_REASON_ASSOC_LEAVE);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+    pthread_mutex_lock(&link_lock);
+    int ap = assoc_ap;
+    if (ap >= 0) {
+        memset(ap_info, 0, sizeof(*ap_info));
+        memcpy(ap_info->bssid, aps[ap].bssid, sizeof(ap_info->bssid));
+        memcpy(ap_info->ssid, sta_config.ssid, sizeof(sta_config.ssid));
+        ap_info->primary = aps[ap].channel;
+        ap_info->rssi = aps[ap].rssi;
+    }
+    pthread_mutex_unlock(&link_lock);
+    return ap >= 0 ? ESP_OK : ESP_ERR_WIFI_NOT_CONNECT;
+}
+
+bool host_wifi_has_ip(void) {
+    return atomic_load(&has_ip);
+}
+
+void host_wifi_set_ap(int ap, bool up) {
+    if (ap < 0 || ap >= HOST_WIFI_APS) {
+        return;
+    }
+    pthread_mutex_lock(&link_lock);
+    aps[ap].up = up;
+    bool lost = !up && assoc_ap == ap && lose_link();
+    pthread_mutex_unlock(&link_lock);
+    if (lost) {
+        post_disconnected(WIFI_REASON_BEACON_TIMEOUT);
+    }
+}
+
+void host_wifi_drop_link(void) {
+    pthread_mutex_lock(&link_lock);
+    bool lost = lose_link();
+    pthread_mutex_unlock(&link_lock);
+    if (lost) {
+        post_disconnected(WIFI_REASON_AUTH_EXPIRE);
+    }
+}
+
+static _Atomic double radio_share;
+static pthread_once_t radio_once = PTHREAD_ONCE_INIT;
+
+static uint64_t wall_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// Spins for the busy part of every period, sleeps for the rest
+static void *radio_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        uint64_t start = wall_us();
+        uint64_t busy = (uint64_t)(atomic_load(&radio_share) * RADIO_LOAD_PERIOD_US);
+        while (wall_us() - start < busy) {
+        }
+        struct timespec idle = { 0, (long)(RADIO_LOAD_PERIOD_US - busy) * 1000 };
+        nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+static void start_radio_thread(void) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, radio_thread, NULL) == 0) {
+        pthread_detach(thread);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void host_set_radio_load(double share) {
+    atomic_store(&radio_share, share < 0 ? 0 : share > 1 ? 1 : share);
+    if (share > 0) {
+        pthread_once(&radio_once, start_radio_thread);
+    }
+}
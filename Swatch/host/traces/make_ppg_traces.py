@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# Writes the PPG traces ppg_test runs: a minute of wrist PPG at 100 and 500 Hz from one
+# script of heart rate, breathing, motion and lost contact, with seeded noise, so the
+# files are the same every time. The true upstroke of every beat (sample index) is
+# listed in the "# beats" line, and the stretch of arm swinging and lost contact (in
+# seconds) in the "# disturbed" line. Only needed to change the traces; the expected
+# outputs come from ppg_test --update.
+#
+#   python3 make_ppg_traces.py
+
+import math
+import random
+
+# One cardiac cycle as in sensor.c: systolic peak and dicrotic wave
+WAVE = [17, 31, 55, 91, 145, 220, 316, 433, 563, 698, 823, 922, 984, 999, 965, 887,
+        775, 645, 512, 389, 286, 209, 160, 139, 144, 170, 212, 260, 305, 338, 351, 340,
+        309, 262, 208, 154, 107, 69, 42, 24, 12, 6, 3, 1, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]
+STEEPEST = 8            # WAVE index of the steepest rise
+SECONDS = 60
+DC = 100000
+
+
+def bpm_at(t):
+    if t < 20:
+        return 62                           # resting
+    if t < 35:
+        return 62 + (t - 20) * 48 / 15      # climbing stairs
+    if t < 50:
+        return 110
+    return 95                               # recovering
+
+
+def wave(phase):
+    x = phase * len(WAVE)
+    i = int(x) % len(WAVE)
+    frac = x - int(x)
+    return WAVE[i] + (WAVE[(i + 1) % len(WAVE)] - WAVE[i]) * frac
+
+
+def make(rate, rng):
+    n = SECONDS * rate
+    samples = []
+    beats = []
+    phase = 0.0
+    interval = 60.0 / bpm_at(0)
+    amplitude = 800
+    for i in range(n):
+        t = i / rate
+        phase += 1.0 / (interval * rate)
+        if phase >= 1.0:
+            phase -= 1.0
+            # Beat to beat variability in interval and amplitude
+            interval = 60.0 / bpm_at(t) * rng.uniform(0.96, 1.04)
+            amplitude = 800 * rng.uniform(0.85, 1.15)
+        if abs(phase - STEEPEST / len(WAVE)) < 0.5 / (interval * rate):
+            beats.append(i)
+        v = DC + amplitude * wave(phase) / 1000
+        v += 300 * math.sin(2 * math.pi * 0.25 * t)         # breathing
+        v += 2000 * t / SECONDS                              # slow drift (sensor warming)
+        v += rng.gauss(0, 30)
+        if 45 <= t < 50:
+            # Arm swinging: 1.5 Hz sway as big as the pulse, and jolts
+            v += 900 * math.sin(2 * math.pi * 1.5 * t) + rng.gauss(0, 150)
+        if 50 <= t < 53:
+            # Lost contact: ambient light only
+            v = DC / 4 + rng.gauss(0, 30)
+        samples.append(int(round(v)))
+    # No beats can be seen while contact is lost
+    beats = [b for b in beats if not (50 * rate <= b < 53 * rate)]
+    return samples, beats
+
+
+for rate in (100, 500):
+    rng = random.Random(rate)
+    samples, beats = make(rate, rng)
+    with open('ppg_%dhz.txt' % rate, 'w') as f:
+        f.write('# rate_hz %d, %d s: resting 62 BPM, climbing to 110, arm swinging 45-50 s, '
+                'no contact 50-53 s, 95 BPM\n' % (rate, SECONDS))
+        f.write('# beats %s\n' % ' '.join(str(b) for b in beats))
+        f.write('# disturbed 45 53\n')
+        for v in samples:
+            f.write('%d\n' % v)
@@ -0,0 +1,222 @@
+#include <string.h>
+#include "aggregate.h"
+
+#define AGG_MASK (AGG_MAX_SAMPLES - 1)
+
+static uint32_t isqrt64(uint64_t v) {
+    uint64_t root = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+static uint16_t clamp16(int64_t v) {
+    return v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : (uint16_t)v;
+}
+
+static void clear(agg_t *agg) {
+    agg->tail = agg->head;
+    agg->min_head = agg->min_tail = 0;
+    agg->max_head = agg->max_tail = 0;
+    agg->bpm_sum = agg->bpm_sq = 0;
+    agg->ibi_n = 0;
+    agg->ibi_sum = agg->ibi_sq = 0;
+    agg->diff_n = 0;
+    agg->diff_sq = 0;
+}
+
+bool agg_init(agg_t *agg, const agg_config_t *config, uint32_t now_ms) {
+    if (config->step_ms == 0 || config->step_ms > config->window_ms) {
+        return false;
+    }
+    memset(agg, 0, sizeof(*agg));
+    agg->config = *config;
+    agg->next_emit_ms = now_ms + config->step_ms;
+    return true;
+}
+
+// Drops the oldest beat and takes it out of the sums and deques
+static void evict_oldest(agg_t *agg) {
+    uint32_t pos = agg->tail;
+    const agg_entry_t *e = &agg->ring[pos & AGG_MASK];
+
+    agg->bpm_sum -= e->bpm;
+    agg->bpm_sq -= (int64_t)e->bpm * e->bpm;
+    if (e->ibi_ms) {
+        agg->ibi_n--;
+        agg->ibi_sum -= e->ibi_ms;
+        agg->ibi_sq -= (int64_t)e->ibi_ms * e->ibi_ms;
+    }
+    // The difference to the next interval goes too
+    if (pos + 1 != agg->head) {
+        const agg_entry_t *next = &agg->ring[(pos + 1) & AGG_MASK];
+        if (e->ibi_ms && next->ibi_ms) {
+            int64_t d = (int64_t)next->ibi_ms - e->ibi_ms;
+            agg->diff_n--;
+            agg->diff_sq -= d * d;
+        }
+    }
+    if (agg->min_head != agg->min_tail && agg->min_q[agg->min_head & AGG_MASK] == (uint16_t)pos) {
+        agg->min_head++;
+    }
+    if (agg->max_head != agg->max_tail && agg->max_q[agg->max_head & AGG_MASK] == (uint16_t)pos) {
+        agg->max_head++;
+    }
+    agg->tail++;
+}
+
+// Drops beats that are older than the window as seen from now
+static void evict_before(agg_t *agg, uint32_t now_ms) {
+    while (agg->tail != agg->head &&
+           now_ms - agg->ring[agg->tail & AGG_MASK].timestamp_ms > agg->config.window_ms) {
+        evict_oldest(agg);
+    }
+}
+
+void agg_add(agg_t *agg, const bpm_sample_t *sample) {
+    evict_before(agg, sample->timestamp_ms);
+    if (agg->head - agg->tail == AGG_MAX_SAMPLES) {
+        evict_oldest(agg);
+        agg->truncated++;
+    }
+
+    agg_entry_t e = {
+        .timestamp_ms = sample->timestamp_ms,
+        .bpm = clamp16(sample->bpm),
+        .ibi_ms = clamp16(sample->ibi_ms),
+    };
+    agg->bpm_sum += e.bpm;
+    agg->bpm_sq += (int64_t)e.bpm * e.bpm;
+    if (e.ibi_ms) {
+        agg->ibi_n++;
+        agg->ibi_sum += e.ibi_ms;
+        agg->ibi_sq += (int64_t)e.ibi_ms * e.ibi_ms;
+        if (agg->head != agg->tail) {
+            const agg_entry_t *prev = &agg->ring[(agg->head - 1) & AGG_MASK];
+            if (prev->ibi_ms) {
+                int64_t d = (int64_t)e.ibi_ms - prev->ibi_ms;
+                agg->diff_n++;
+                agg->diff_sq += d * d;
+            }
+        }
+    }
+
+    // Beats that can never be the min (max) again while this one is in the window go
+    uint32_t pos = agg->head;
+    while (agg->min_tail != agg->min_head &&
+           agg->ring[agg->min_q[(agg->min_tail - 1) & AGG_MASK] & AGG_MASK].bpm >= e.bpm) {
+        agg->min_tail--;
+    }
+    agg->min_q[agg->min_tail++ & AGG_MASK] = (uint16_t)pos;
+    while (agg->max_tail != agg->max_head &&
+           agg->ring[agg->max_q[(agg->max_tail - 1) & AGG_MASK] & AGG_MASK].bpm <= e.bpm) {
+        agg->max_tail--;
+    }
+    agg->max_q[agg->max_tail++ & AGG_MASK] = (uint16_t)pos;
+
+    agg->ring[pos & AGG_MASK] = e;
+    agg->head++;
+}
+
+static void summarize(const agg_t *agg, uint32_t start_ms, uint32_t end_ms, agg_summary_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->start_ms = start_ms;
+    s->end_ms = end_ms;
+    int64_t n = agg->head - agg->tail;
+    s->count = clamp16(n);
+    if (n == 0) {
+        return;
+    }
+
+    s->bpm_min = agg->ring[agg->min_q[agg->min_head & AGG_MASK] & AGG_MASK].bpm;
+    s->bpm_max = agg->ring[agg->max_q[agg->max_head & AGG_MASK] & AGG_MASK].bpm;
+    s->bpm_mean_x10 = clamp16((agg->bpm_sum * 10 + n / 2) / n);
+    // n * sum(x^2) - sum(x)^2 is n^2 times the variance, exact in integers
+    s->bpm_sd_x10 = clamp16(isqrt64((uint64_t)(100 * (n * agg->bpm_sq - agg->bpm_sum * agg->bpm_sum)) / (uint64_t)(n * n)));
+
+    int64_t m = agg->ibi_n;
+    s->intervals = clamp16(m);
+    if (m > 0) {
+        s->ibi_mean_ms = clamp16((agg->ibi_sum + m / 2) / m);
+    }
+    if (m > 1) {
+        s->sdnn_ms = clamp16(isqrt64((uint64_t)(m * agg->ibi_sq - agg->ibi_sum * agg->ibi_sum) / (uint64_t)(m * (m - 1))));
+    }
+    if (agg->diff_n > 0) {
+        s->rmssd_ms = clamp16(isqrt64((uint64_t)agg->diff_sq / agg->diff_n));
+    }
+}
+
+bool agg_poll(agg_t *agg, uint32_t now_ms, agg_summary_t *summary) {
+    if ((int32_t)(now_ms - agg->next_emit_ms) < 0) {
+        return false;
+    }
+
+    bool tumbling = agg->config.step_ms == agg->config.window_ms;
+    evict_before(agg, now_ms);
+    // A tumbling window started where the last one ended
+    uint32_t start = tumbling ? agg->next_emit_ms - agg->config.step_ms : now_ms - agg->config.window_ms;
+    summarize(agg, start, now_ms, summary);
+    if (tumbling) {
+        clear(agg);
+    }
+
+    agg->summaries++;
+    agg->next_emit_ms += agg->config.step_ms;
+    // Fell more than a step behind: skip ahead instead of a burst of catch-up summaries
+    if ((int32_t)(now_ms - agg->next_emit_ms) >= 0) {
+        agg->next_emit_ms = now_ms + agg->config.step_ms;
+    }
+    return true;
+}
+
+uint32_t agg_ms_until(const agg_t *agg, uint32_t now_ms) {
+    int32_t wait = (int32_t)(agg->next_emit_ms - now_ms);
+    return wait > 0 ? (uint32_t)wait : 0;
+}
+
+void agg_peek(agg_t *agg, uint32_t now_ms, agg_summary_t *summary) {
+    evict_before(agg, now_ms);
+    summarize(agg, now_ms - agg->config.window_ms, now_ms, summary);
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+    return put16(put16(p, (uint16_t)v), (uint16_t)(v >> 16));
+}
+
+size_t agg_encode(const agg_summary_t *s, uint8_t *buf, size_t len) {
+    if (len < AGG_ENCODED_SIZE) {
+        return 0;
+    }
+    uint8_t *p = buf;
+    *p++ = AGG_TAG;
+    p = put32(p, s->start_ms);
+    p = put32(p, s->end_ms);
+    p = put16(p, s->count);
+    p = put16(p, s->bpm_min);
+    p = put16(p, s->bpm_max);
+    p = put16(p, s->bpm_mean_x10);
+    p = put16(p, s->bpm_sd_x10);
+    p = put16(p, s->ibi_mean_ms);
+    p = put16(p, s->sdnn_ms);
+    p = put16(p, s->rmssd_ms);
+    p = put16(p, s->intervals);
+    return (size_t)(p - buf);
+}
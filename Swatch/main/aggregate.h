@@ -0,0 +1,112 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sensor.h"
+
+// Windowed statistics over the beats: BPM min/max/mean/SD and the HRV measures SDNN and
+// RMSSD over the inter-beat intervals. Every beat costs O(1): running integer sums,
+// plus monotonic deques for min and max, over a fixed ring of the beats in the window.
+// Nothing is allocated.
+
+// Beats one window can hold (power of two, at most 65536). A window with more beats than
+// this (2 min at 250 BPM, 5 min at 100) loses its oldest ones early and counts them in truncated.
+#define AGG_MAX_SAMPLES 512
+
+// Defaults (each can be overridden at build time)
+
+// Statistics cover this much time (ms)
+#ifndef AGG_WINDOW_MS
+#define AGG_WINDOW_MS 60000
+#endif
+
+// A summary comes out this often (ms). Same as the window: tumbling windows,
+// shorter: sliding windows that overlap.
+#ifndef AGG_STEP_MS
+#define AGG_STEP_MS 60000
+#endif
+
+// Whether single beats are still published next to the summaries (alarms always are)
+#ifndef AGG_PUBLISH_RAW
+#define AGG_PUBLISH_RAW 1
+#endif
+
+// First byte of an encoded summary (tscodec payloads start with TSCODEC_TAG)
+#define AGG_TAG 0xA1
+#define AGG_ENCODED_SIZE 27
+
+typedef struct {
+    uint32_t window_ms;
+    uint32_t step_ms;           // <= window_ms
+} agg_config_t;
+
+typedef struct {
+    uint32_t start_ms;          // the window is [start_ms, end_ms)
+    uint32_t end_ms;
+    uint16_t count;             // beats in the window
+    uint16_t bpm_min;
+    uint16_t bpm_max;
+    uint16_t bpm_mean_x10;      // tenths of a BPM
+    uint16_t bpm_sd_x10;
+    uint16_t ibi_mean_ms;
+    uint16_t sdnn_ms;           // SD of the inter-beat intervals
+    uint16_t rmssd_ms;          // RMS of the differences between successive intervals
+    uint16_t intervals;         // inter-beat intervals the HRV numbers are based on
+} agg_summary_t;
+
+typedef struct {
+    uint32_t timestamp_ms;
+    uint16_t bpm;
+    uint16_t ibi_ms;            // 0 if unknown (first beat)
+} agg_entry_t;
+
+typedef struct {
+    agg_config_t config;
+
+    // Beats in the window, oldest at tail (free running positions, masked on access)
+    agg_entry_t ring[AGG_MAX_SAMPLES];
+    uint32_t head;
+    uint32_t tail;
+
+    // Ring positions (low 16 bits) with increasing (min) / decreasing (max) BPM, front is the answer
+    uint16_t min_q[AGG_MAX_SAMPLES];
+    uint32_t min_head, min_tail;
+    uint16_t max_q[AGG_MAX_SAMPLES];
+    uint32_t max_head, max_tail;
+
+    // Running sums over the window
+    int64_t bpm_sum;
+    int64_t bpm_sq;
+    uint32_t ibi_n;
+    int64_t ibi_sum;
+    int64_t ibi_sq;
+    uint32_t diff_n;
+    int64_t diff_sq;
+
+    uint32_t next_emit_ms;
+    uint32_t summaries;
+    uint32_t truncated;
+} agg_t;
+
+// config must have 0 < step_ms <= window_ms. Returns false otherwise.
+bool agg_init(agg_t *agg, const agg_config_t *config, uint32_t now_ms);
+
+// Adds a beat (timestamps must not go backwards)
+void agg_add(agg_t *agg, const bpm_sample_t *sample);
+
+// If a summary is due, fills it in and returns true. Call until it returns false.
+bool agg_poll(agg_t *agg, uint32_t now_ms, agg_summary_t *summary);
+
+// How long until agg_poll() has something
+uint32_t agg_ms_until(const agg_t *agg, uint32_t now_ms);
+
+// Summary of the window ending now without advancing anything (e.g. for a display)
+void agg_peek(agg_t *agg, uint32_t now_ms, agg_summary_t *summary);
+
+// Packs a summary into AGG_ENCODED_SIZE bytes (AGG_TAG, then the fields above in order,
+// little endian). Returns the length, or 0 if buf is too small.
+size_t agg_encode(const agg_summary_t *summary, uint8_t *buf, size_t len);
+
+#endif
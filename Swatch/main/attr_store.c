@@ -0,0 +1,69 @@
+#include <string.h>
+#include "attr_store.h"
+
+// What goes into the slot: the length and the bytes, padded to whole words
+typedef struct {
+    uint16_t len;
+    uint8_t data[ATTR_VALUE_MAX];
+    uint8_t pad[2];
+} attr_stored_t;
+
+_Static_assert(sizeof(attr_stored_t) <= LATEST_SLOT_MAX_SIZE, "attribute does not fit a latest_slot_t");
+_Static_assert(sizeof(attr_stored_t) % sizeof(uint32_t) == 0, "latest_slot_t stores whole words");
+
+bool attr_init(attr_value_t *attr, uint16_t max_len, const void *initial, uint16_t len) {
+    if (max_len > ATTR_VALUE_MAX || len > max_len) {
+        return false;
+    }
+    attr_stored_t stored = { .len = len };
+    if (initial) {
+        memcpy(stored.data, initial, len);
+    }
+    attr->max_len = max_len;
+    return latest_slot_init(&attr->slot, &stored, sizeof(stored));
+}
+
+bool attr_write(attr_value_t *attr, const void *data, uint16_t len) {
+    if (len > attr->max_len) {
+        return false;
+    }
+    attr_stored_t stored = { .len = len };
+    memcpy(stored.data, data, len);
+    latest_slot_write(&attr->slot, &stored);
+    return true;
+}
+
+bool attr_write_at(attr_value_t *attr, uint16_t offset, const void *data, uint16_t len) {
+    if (offset + len > attr->max_len) {
+        return false;
+    }
+    // Only the writer changes the value, so nothing can slip in between
+    attr_stored_t stored;
+    latest_slot_peek(&attr->slot, &stored);
+    memcpy(stored.data + offset, data, len);
+    if (offset + len > stored.len) {
+        stored.len = offset + len;
+    }
+    latest_slot_write(&attr->slot, &stored);
+    return true;
+}
+
+uint32_t attr_read(attr_value_t *attr, void *out, uint16_t *len) {
+    attr_stored_t stored;
+    uint32_t version = latest_slot_read(&attr->slot, &stored);
+    memcpy(out, stored.data, stored.len);
+    *len = stored.len;
+    return version;
+}
+
+uint32_t attr_version(attr_value_t *attr) {
+    return atomic_load_explicit(&attr->slot.version, memory_order_acquire);
+}
+
+bool attr_read_if_changed(attr_value_t *attr, uint32_t *seen, void *out, uint16_t *len) {
+    if (attr_version(attr) == *seen) {
+        return false;
+    }
+    *seen = attr_read(attr, out, len);
+    return true;
+}
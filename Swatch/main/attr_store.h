@@ -0,0 +1,47 @@
+#ifndef ATTR_STORE_H
+#define ATTR_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "channel.h"
+
+// Values of GATT characteristics shared between the BTC thread (read and write requests)
+// and the tasks that produce them. Each value sits in a latest_slot_t: readers copy it
+// without a lock and never see half of an update, so a read request is answered without
+// blocking the Bluetooth stack. Every attribute has exactly ONE writer, either the BTC
+// thread (values centrals write) or one producer task (values centrals only read).
+//
+// The version changes on every write, so a notify path can remember the version it sent
+// and skip values that haven't changed.
+
+// Biggest value: what fits in one read response at the default ATT MTU of 23
+#define ATTR_VALUE_MAX 20
+
+typedef struct {
+    latest_slot_t slot;     // attr_stored_t
+    uint16_t max_len;
+} attr_value_t;
+
+// max_len is at most ATTR_VALUE_MAX. Returns false if the initial value is longer.
+bool attr_init(attr_value_t *attr, uint16_t max_len, const void *initial, uint16_t len);
+
+// Writer side: replaces the value. False (and nothing changes) if len > max_len.
+bool attr_write(attr_value_t *attr, const void *data, uint16_t len);
+
+// Writer side: overwrites len bytes at offset and keeps the rest, as a GATT write that
+// is shorter than the value does. False if it would go past max_len.
+bool attr_write_at(attr_value_t *attr, uint16_t offset, const void *data, uint16_t len);
+
+// Any task: copies the value (up to ATTR_VALUE_MAX bytes) into out and its length into
+// len. Returns the version of what was copied.
+uint32_t attr_read(attr_value_t *attr, void *out, uint16_t *len);
+
+// Any task: version of the newest value, without copying it
+uint32_t attr_version(attr_value_t *attr);
+
+// Copies the value only if its version isn't *seen any more, and then updates *seen.
+// False if nothing changed.
+bool attr_read_if_changed(attr_value_t *attr, uint32_t *seen, void *out, uint16_t *len);
+
+#endif
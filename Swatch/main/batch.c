@@ -0,0 +1,96 @@
+#include <string.h>
+#include "batch.h"
+#include "tscodec.h"
+
+void batch_init(bpm_batch_t *batch, uint16_t max_samples, uint32_t max_age_ms) {
+    memset(batch, 0, sizeof(*batch));
+    if (max_samples == 0 || max_samples > BATCH_CAPACITY) {
+        max_samples = BATCH_CAPACITY;
+    }
+    batch->max_samples = max_samples;
+    batch->max_age_ms = max_age_ms;
+}
+
+bool batch_add(bpm_batch_t *batch, const bpm_sample_t *sample) {
+    bool kept_all = true;
+
+    // Ring is full, so the oldest sample has to go
+    if (batch->count == BATCH_CAPACITY) {
+        batch->head = (batch->head + 1) % BATCH_CAPACITY;
+        batch->count--;
+        batch->overwritten++;
+        kept_all = false;
+    }
+
+    uint16_t tail = (batch->head + batch->count) % BATCH_CAPACITY;
+    batch->samples[tail] = *sample;
+    batch->count++;
+    return kept_all;
+}
+
+bool batch_should_flush(const bpm_batch_t *batch, uint32_t now_ms) {
+    if (batch->count == 0) {
+        return false;
+    }
+    if (batch->count >= batch->max_samples) {
+        return true;
+    }
+    return batch_ms_until_flush(batch, now_ms) == 0;
+}
+
+uint32_t batch_ms_until_flush(const bpm_batch_t *batch, uint32_t now_ms) {
+    if (batch->count == 0) {
+        return UINT32_MAX;
+    }
+    // Unsigned subtraction keeps working when the ms counter wraps around
+    uint32_t age = now_ms - batch->samples[batch->head].timestamp_ms;
+    if (age >= batch->max_age_ms) {
+        return 0;
+    }
+    return batch->max_age_ms - age;
+}
+
+size_t batch_encode(const bpm_batch_t *batch, uint8_t *buf, size_t len, uint16_t *encoded) {
+    *encoded = 0;
+    if (batch->count == 0) {
+        return 0;
+    }
+
+    ts_encoder_t enc;
+    if (!ts_encoder_init(&enc, buf, len)) {
+        return 0;
+    }
+    uint16_t limit = batch->count < batch->max_samples ? batch->count : batch->max_samples;
+    for (uint16_t i = 0; i < limit; i++) {
+        const bpm_sample_t *s = batch_at(batch, i);
+        // Stop before a sample that would not fit, it goes in the next payload
+        if (!ts_encode(&enc, s->timestamp_ms, s->bpm)) {
+            break;
+        }
+        (*encoded)++;
+    }
+    return *encoded ? ts_encoder_finish(&enc) : 0;
+}
+
+const bpm_sample_t *batch_at(const bpm_batch_t *batch, uint16_t i) {
+    return &batch->samples[(batch->head + i) % BATCH_CAPACITY];
+}
+
+void batch_drop(bpm_batch_t *batch, uint16_t n) {
+    if (n > batch->count) {
+        n = batch->count;
+    }
+    batch->head = (batch->head + n) % BATCH_CAPACITY;
+    batch->count -= n;
+}
+
+void batch_consume(bpm_batch_t *batch, uint16_t n, size_t payload_len) {
+    if (n > batch->count) {
+        n = batch->count;
+    }
+    batch_drop(batch, n);
+
+    batch->publishes++;
+    batch->samples_sent += n;
+    batch->bytes_sent += payload_len;
+}
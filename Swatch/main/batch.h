@@ -0,0 +1,67 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sensor.h"
+
+// How many samples the ring can hold in total (extra room is used while publishing fails)
+#ifndef BATCH_CAPACITY
+#define BATCH_CAPACITY 64
+#endif
+
+// Flush when this many samples are waiting...
+#ifndef BATCH_MAX_SAMPLES
+#define BATCH_MAX_SAMPLES 12
+#endif
+
+// ...or when the oldest waiting sample is this old (ms)
+#ifndef BATCH_MAX_AGE_MS
+#define BATCH_MAX_AGE_MS 60000
+#endif
+
+// Biggest payload one flush can produce
+#define BATCH_PAYLOAD_MAX 512
+
+// Preallocated ring of samples waiting to be published
+typedef struct {
+    bpm_sample_t samples[BATCH_CAPACITY];
+    uint16_t head;          // index of the oldest sample
+    uint16_t count;         // how many samples are waiting
+    uint16_t max_samples;   // count limit (<= BATCH_CAPACITY)
+    uint32_t max_age_ms;    // age limit
+
+    // Counters so we can see how well batching works
+    uint32_t publishes;
+    uint32_t samples_sent;
+    uint32_t bytes_sent;
+    uint32_t overwritten;   // samples lost because the ring was full
+} bpm_batch_t;
+
+void batch_init(bpm_batch_t *batch, uint16_t max_samples, uint32_t max_age_ms);
+
+// Adds a sample. If the ring is full the oldest sample is overwritten and false is returned.
+bool batch_add(bpm_batch_t *batch, const bpm_sample_t *sample);
+
+// True when the count or the age limit has been reached
+bool batch_should_flush(const bpm_batch_t *batch, uint32_t now_ms);
+
+// How long until the age limit kicks in (0 if it already has, UINT32_MAX if empty)
+uint32_t batch_ms_until_flush(const bpm_batch_t *batch, uint32_t now_ms);
+
+// Writes up to max_samples of the oldest samples into buf as one compact payload
+// (timestamp and BPM of each sample, see tscodec.h for the format).
+// Returns the payload length and stores how many samples went in to *encoded.
+size_t batch_encode(const bpm_batch_t *batch, uint8_t *buf, size_t len, uint16_t *encoded);
+
+// The i-th oldest waiting sample (i < count)
+const bpm_sample_t *batch_at(const bpm_batch_t *batch, uint16_t i);
+
+// Drops the n oldest samples after they were published and updates the counters
+void batch_consume(bpm_batch_t *batch, uint16_t n, size_t payload_len);
+
+// Drops the n oldest samples without counting them as published (e.g. moved to flash)
+void batch_drop(bpm_batch_t *batch, uint16_t n);
+
+#endif
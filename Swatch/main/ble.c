@@ -1,33 +1,105 @@
 #include <stdio.h>
 #include <string.h>
 #include "mqtt.h" 
-#include "nvs_flash.h"
 #include "esp_log.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
 #include "esp_gap_ble_api.h"
 #include "esp_gatts_api.h"
+#include "esp_gatt_common_api.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "ble.h"
+#include "hrs.h"
+#include "metrics.h"
+#include "boot.h"
+#include "tasks.h"
+#include "attr_store.h"
+#include "dlog.h"
 
 
 #define TAG "BLE"
 #define DEVICE_NAME "Hexagon Watch"
-// Use the mutex to safely read global_bpm
-extern SemaphoreHandle_t bpmMutex;
 // BLE Profile
 #define PROFILE_APP_ID 0
 
-// UUIDs for the service and characteristics
+// UUIDs for the service and characteristics (the attribute tables point at these)
 static const uint16_t TEST_SERVICE_UUID = 0x1234;
 static const uint16_t TEST_CHAR_UUID = 0x5678;
 static const uint16_t EXTRA_CHAR_UUID = 0x9ABC;
-static const uint16_t BROADCAST_CHAR_UUID = 0x2A37; // Heart Rate Measurement characteristic UUID
-
-// BLE characteristic values
-static int test_char_value = 0;
-static int extra_char_value = 42;
-static int broadcast_char_value = 60; // Initial BPM value
+static const uint16_t MOTION_CHAR_UUID = 0x9ABD;
+static const uint16_t HR_SERVICE_UUID = HRS_SERVICE_UUID;
+static const uint16_t HR_MEASUREMENT_UUID = HRS_MEASUREMENT_UUID;
+static const uint16_t CCCD_UUID = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+static const uint16_t PRIMARY_SERVICE_UUID = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t CHAR_DECLARATION_UUID = ESP_GATT_UUID_CHAR_DECLARE;
+
+// BLE characteristic values (see attr_store.h). Centrals write the two test values, so
+// the BTC thread is their writer; the sensor task is the writer of the motion value.
+static attr_value_t test_char_value;
+static attr_value_t extra_char_value;
+static attr_value_t motion_char_value;
+// Set once the values exist (the sensor task starts before BLE does)
+static _Atomic bool attrs_ready = false;
+
+// Motion value: steps since boot (uint32), cadence in steps/min (uint16), activity_t and
+// whether the last block was too shaky for the PPG, little endian
+#define MOTION_CHAR_LEN 8
+
+// Beats waiting to be sent as RR-intervals (sensor task -> HR notify task)
+#define HR_RING_SIZE 16
+static bpm_sample_t hr_ring_storage[HR_RING_SIZE];
+static spsc_ring_t hr_ring;
+static TaskHandle_t hr_notify_task_handle = NULL;
+// Set once the ring and the notify task exist. The sensor task starts before BLE does
+// and its first beats have nobody to go to anyway.
+static _Atomic bool hr_ready = false;
+
+// Every RR-interval the notify task has seen, the oldest overwritten (power of two).
+// Each central has its own read position in it, so one that falls behind only loses
+// its own oldest intervals and never holds up the others.
+#define HR_RR_HISTORY 64
+static uint16_t rr_history[HR_RR_HISTORY];
+static uint32_t rr_head = 0;        // free running, HR notify task only
+static uint32_t beat_count = 0;
+
+// Most RR-intervals a central gets from before it subscribed
+#define HR_MAX_PENDING_RR 16
+
+// Connection parameters we ask every central for (1.25 ms units, timeout in 10 ms).
+// Beats come about once a second, so 30-50 ms costs nothing in latency and leaves the
+// controller room to interleave the connection events of several links.
+#define BLE_CONN_INT_MIN 0x18
+#define BLE_CONN_INT_MAX 0x28
+#define BLE_CONN_LATENCY 0
+#define BLE_CONN_TIMEOUT 400
+
+// One connected central. The BTC thread fills it in on connect and keeps its CCCD, MTU
+// and congestion state; the HR notify task only reads those and keeps the rest.
+typedef struct {
+    _Atomic bool connected;
+    _Atomic uint32_t generation;    // bumped on every connect so the notify task sees a new central
+    uint16_t conn_id;
+    esp_bd_addr_t remote_bda;
+    _Atomic uint16_t hr_cccd;       // notifications off until the client turns them on
+    _Atomic uint16_t mtu;
+    _Atomic bool congested;         // the stack's queue for this link is full, wait for it to drain
+    uint16_t conn_interval;
+    uint16_t latency;
+    uint16_t timeout;
+
+    // HR notify task only
+    uint32_t seen_generation;
+    uint32_t rr_next;               // next rr_history position this central hasn't got
+    uint32_t beat_sent;             // beat_count when it last got a notification
+} ble_conn_t;
+
+static ble_conn_t conns[BLE_MAX_CONNECTIONS];
+static _Atomic uint32_t rr_lost = 0;
+
+// Advertising runs while there is room for another central (BTC thread only)
+static bool advertising = false;
+static int connection_count = 0;
 
 // BLE advertising parameters
 static esp_ble_adv_params_t adv_params = {
@@ -39,6 +111,12 @@ static esp_ble_adv_params_t adv_params = {
     .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
 };
 
+// Heart Rate Service UUID as 128-bit (the format the advertising API wants)
+static uint8_t adv_service_uuid128[16] = {
+    0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00,
+    HRS_SERVICE_UUID & 0xFF, HRS_SERVICE_UUID >> 8, 0x00, 0x00,
+};
+
 // BLE advertising data
 static esp_ble_adv_data_t adv_data = {
     .set_scan_rsp = false,
@@ -51,32 +129,77 @@ static esp_ble_adv_data_t adv_data = {
     .p_manufacturer_data = NULL,
     .service_data_len = 0,
     .p_service_data = NULL,
-    .service_uuid_len = 0,
-    .p_service_uuid = NULL,
+    .service_uuid_len = sizeof(adv_service_uuid128),
+    .p_service_uuid = adv_service_uuid128, // Tell phones we are a heart rate sensor
     .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT),
 };
 
-// GATT service ID
-static esp_gatt_srvc_id_t service_id = {
-    .is_primary = true,
-    .id = {
-        .inst_id = 0,
-        .uuid = {
-            .len = ESP_UUID_LEN_16,
-            .uuid = { .uuid16 = TEST_SERVICE_UUID },
-        },
-    },
+// Slot of a connected central (BTC thread only), NULL if it isn't one of ours
+static ble_conn_t *find_conn(uint16_t conn_id) {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (atomic_load_explicit(&conns[i].connected, memory_order_relaxed) && conns[i].conn_id == conn_id) {
+            return &conns[i];
+        }
+    }
+    return NULL;
+}
+
+static ble_conn_t *find_conn_by_bda(const esp_bd_addr_t bda) {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (atomic_load_explicit(&conns[i].connected, memory_order_relaxed) &&
+            memcmp(conns[i].remote_bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            return &conns[i];
+        }
+    }
+    return NULL;
+}
+
+// Starts advertising again if it isn't running and another central fits. The controller
+// stops advertising by itself whenever a central connects.
+static void update_advertising(void) {
+    if (advertising || connection_count >= BLE_MAX_CONNECTIONS) {
+        return;
+    }
+    esp_err_t err = esp_ble_gap_start_advertising(&adv_params);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start advertising: %s", esp_err_to_name(err));
+        return;
+    }
+    advertising = true;
+}
+
+static void wake_notify_task(void) {
+    if (hr_notify_task_handle) {
+        xTaskNotifyGive(hr_notify_task_handle);
+    }
+}
+
+// Attributes of the two services, in table order
+enum {
+    TEST_IDX_SVC,
+    TEST_IDX_CHAR_DECL,
+    TEST_IDX_CHAR_VAL,
+    TEST_IDX_EXTRA_DECL,
+    TEST_IDX_EXTRA_VAL,
+    TEST_IDX_MOTION_DECL,
+    TEST_IDX_MOTION_VAL,
+    TEST_IDX_NB,
+};
+
+enum {
+    HRS_IDX_SVC,
+    HRS_IDX_MEAS_DECL,
+    HRS_IDX_MEAS_VAL,          // Heart Rate Measurement value
+    HRS_IDX_MEAS_CCCD,         // Its Client Characteristic Configuration Descriptor
+    HRS_IDX_NB,
 };
 
 // BLE Profile
 struct gatts_profile_inst {
     esp_gatts_cb_t gatts_cb;
     uint16_t gatts_if;
-    uint16_t service_handle;
-    uint16_t char_handle;
-    uint16_t extra_char_handle;
-    uint16_t broadcast_char_handle; // Handle for the broadcsting characteristic
-    uint16_t conn_id;
+    uint16_t test_handles[TEST_IDX_NB];
+    uint16_t hrs_handles[HRS_IDX_NB];
 };
 
 static struct gatts_profile_inst gl_profile = {
@@ -84,29 +207,199 @@ static struct gatts_profile_inst gl_profile = {
     .gatts_if = ESP_GATT_IF_NONE,
 };
 
+// Read and write handlers of one attribute, called on the BTC thread with the central
+// that asked (NULL if it isn't one of ours). No handler: the stack answers by itself
+// (ESP_GATT_AUTO_RSP) or the request is refused.
+typedef struct {
+    esp_gatt_status_t (*read)(ble_conn_t *conn, void *ctx, esp_gatt_value_t *value);
+    esp_gatt_status_t (*write)(ble_conn_t *conn, void *ctx, const uint8_t *data, uint16_t len);
+    void *ctx;
+} ble_attr_ops_t;
+
+// Values from the attribute store, read without a lock whoever writes them
+static esp_gatt_status_t read_attr(ble_conn_t *conn, void *ctx, esp_gatt_value_t *value) {
+    attr_read(ctx, value->value, &value->len);
+    return ESP_GATT_OK;
+}
+
+// Plain int values, as they are in memory. A shorter write changes the first bytes only.
+static esp_gatt_status_t write_int(ble_conn_t *conn, void *ctx, const uint8_t *data, uint16_t len) {
+    if (!attr_write_at(ctx, 0, data, len)) {
+        DLOGW(TAG, "Write request ignored: data length exceeds characteristic size");
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+    int updated = 0;
+    uint16_t updated_len;
+    attr_read(ctx, &updated, &updated_len);
+    DLOGI(TAG, "Updated value: %d", updated);
+    return ESP_GATT_OK;
+}
+
+// Every central sees its own subscription
+static esp_gatt_status_t read_hr_cccd(ble_conn_t *conn, void *ctx, esp_gatt_value_t *value) {
+    uint16_t cccd = conn ? atomic_load(&conn->hr_cccd) : 0;
+    value->len = sizeof(cccd);
+    value->value[0] = cccd & 0xFF;
+    value->value[1] = cccd >> 8;
+    return ESP_GATT_OK;
+}
+
+static esp_gatt_status_t write_hr_cccd(ble_conn_t *conn, void *ctx, const uint8_t *data, uint16_t len) {
+    if (len != 2) {
+        ESP_LOGW(TAG, "Write request ignored: CCCD must be 2 bytes");
+        return ESP_GATT_INVALID_ATTR_LEN;
+    }
+    if (!conn) {
+        return ESP_GATT_WRITE_NOT_PERMIT;
+    }
+    uint16_t cccd = data[0] | (data[1] << 8);
+    atomic_store(&conn->hr_cccd, cccd);
+    ESP_LOGI(TAG, "Heart rate notifications %s on connection %d",
+             (cccd & HRS_CCCD_NOTIFY) ? "enabled" : "disabled", conn->conn_id);
+    // Send what we have right away instead of waiting for the next beat
+    wake_notify_task();
+    return ESP_GATT_OK;
+}
+
+static const uint8_t CHAR_PROP_READ_WRITE = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE;
+static const uint8_t CHAR_PROP_READ = ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t CHAR_PROP_NOTIFY = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint16_t CCCD_OFF = 0;
+
+#define UUID16(u) ESP_UUID_LEN_16, (uint8_t *)&(u)
+
+// Test service: two int characteristics clients can read and write, and the motion
+// value they can only read
+static const esp_gatts_attr_db_t test_db[TEST_IDX_NB] = {
+    [TEST_IDX_SVC] = {{ESP_GATT_AUTO_RSP}, {UUID16(PRIMARY_SERVICE_UUID), ESP_GATT_PERM_READ,
+                      sizeof(uint16_t), sizeof(uint16_t), (uint8_t *)&TEST_SERVICE_UUID}},
+    [TEST_IDX_CHAR_DECL] = {{ESP_GATT_AUTO_RSP}, {UUID16(CHAR_DECLARATION_UUID), ESP_GATT_PERM_READ,
+                            1, 1, (uint8_t *)&CHAR_PROP_READ_WRITE}},
+    [TEST_IDX_CHAR_VAL] = {{ESP_GATT_RSP_BY_APP}, {UUID16(TEST_CHAR_UUID), ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                           sizeof(int), 0, NULL}},
+    [TEST_IDX_EXTRA_DECL] = {{ESP_GATT_AUTO_RSP}, {UUID16(CHAR_DECLARATION_UUID), ESP_GATT_PERM_READ,
+                             1, 1, (uint8_t *)&CHAR_PROP_READ_WRITE}},
+    [TEST_IDX_EXTRA_VAL] = {{ESP_GATT_RSP_BY_APP}, {UUID16(EXTRA_CHAR_UUID), ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                            sizeof(int), 0, NULL}},
+    [TEST_IDX_MOTION_DECL] = {{ESP_GATT_AUTO_RSP}, {UUID16(CHAR_DECLARATION_UUID), ESP_GATT_PERM_READ,
+                              1, 1, (uint8_t *)&CHAR_PROP_READ}},
+    [TEST_IDX_MOTION_VAL] = {{ESP_GATT_RSP_BY_APP}, {UUID16(MOTION_CHAR_UUID), ESP_GATT_PERM_READ,
+                             MOTION_CHAR_LEN, 0, NULL}},
+};
+
+static const ble_attr_ops_t test_ops[TEST_IDX_NB] = {
+    [TEST_IDX_CHAR_VAL] = { read_attr, write_int, &test_char_value },
+    [TEST_IDX_EXTRA_VAL] = { read_attr, write_int, &extra_char_value },
+    [TEST_IDX_MOTION_VAL] = { read_attr, NULL, &motion_char_value },
+};
+
+// Standard Heart Rate Service. The measurement can't be read, it only comes as
+// notifications, as the spec says; the CCCD is kept per central.
+static const esp_gatts_attr_db_t hrs_db[HRS_IDX_NB] = {
+    [HRS_IDX_SVC] = {{ESP_GATT_AUTO_RSP}, {UUID16(PRIMARY_SERVICE_UUID), ESP_GATT_PERM_READ,
+                     sizeof(uint16_t), sizeof(uint16_t), (uint8_t *)&HR_SERVICE_UUID}},
+    [HRS_IDX_MEAS_DECL] = {{ESP_GATT_AUTO_RSP}, {UUID16(CHAR_DECLARATION_UUID), ESP_GATT_PERM_READ,
+                           1, 1, (uint8_t *)&CHAR_PROP_NOTIFY}},
+    [HRS_IDX_MEAS_VAL] = {{ESP_GATT_AUTO_RSP}, {UUID16(HR_MEASUREMENT_UUID), 0,
+                          BLE_LOCAL_MTU - 3, 0, NULL}},
+    [HRS_IDX_MEAS_CCCD] = {{ESP_GATT_RSP_BY_APP}, {UUID16(CCCD_UUID), ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                           sizeof(uint16_t), sizeof(uint16_t), (uint8_t *)&CCCD_OFF}},
+};
+
+static const ble_attr_ops_t hrs_ops[HRS_IDX_NB] = {
+    [HRS_IDX_MEAS_CCCD] = { read_hr_cccd, write_hr_cccd, NULL },
+};
+
+// Every service is one table, registered with one call. First entry is the service.
+typedef struct {
+    const char *name;
+    const esp_gatts_attr_db_t *db;
+    const ble_attr_ops_t *ops;      // indexed like db
+    uint16_t *handles;              // filled in when the stack has created the table
+    uint8_t count;
+} ble_service_t;
+
+static const ble_service_t services[] = {
+    { "Test", test_db, test_ops, gl_profile.test_handles, TEST_IDX_NB },
+    { "Heart rate", hrs_db, hrs_ops, gl_profile.hrs_handles, HRS_IDX_NB },
+};
+
+#define SERVICE_COUNT (sizeof(services) / sizeof(services[0]))
+
+// Handlers of an attribute (NULL if it isn't in one of our tables). The handles of a
+// table are consecutive, so this is a range check and an index per service.
+static const ble_attr_ops_t *find_attr(uint16_t handle) {
+    for (size_t i = 0; i < SERVICE_COUNT; i++) {
+        uint16_t first = services[i].handles[0];
+        if (first && handle >= first && handle - first < services[i].count) {
+            return &services[i].ops[handle - first];
+        }
+    }
+    return NULL;
+}
+
+// The stack created one of the tables: keep its handles and start the service
+static void attr_table_created(const esp_ble_gatts_cb_param_t *param) {
+    const ble_service_t *svc = NULL;
+    for (size_t i = 0; i < SERVICE_COUNT && !svc; i++) {
+        // The service declaration's value is the service UUID
+        if (*(const uint16_t *)services[i].db[0].att_desc.value == param->add_attr_tab.svc_uuid.uuid.uuid16) {
+            svc = &services[i];
+        }
+    }
+    if (param->add_attr_tab.status != ESP_GATT_OK || !svc || param->add_attr_tab.num_handle != svc->count) {
+        ESP_LOGE(TAG, "Failed to create attribute table 0x%04x: 0x%x",
+                 param->add_attr_tab.svc_uuid.uuid.uuid16, param->add_attr_tab.status);
+        return;
+    }
+    for (int i = 1; i < svc->count; i++) {
+        if (param->add_attr_tab.handles[i] != param->add_attr_tab.handles[0] + i) {
+            ESP_LOGE(TAG, "%s service handles aren't consecutive", svc->name);
+            return;
+        }
+    }
+    memcpy(svc->handles, param->add_attr_tab.handles, svc->count * sizeof(uint16_t));
+    ESP_LOGI(TAG, "%s service created, handles %d-%d", svc->name, svc->handles[0], svc->handles[svc->count - 1]);
+    esp_ble_gatts_start_service(svc->handles[0]);
+}
+
 // GAP event handler
 void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
     switch (event) {
         case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
             ESP_LOGI(TAG, "Advertising data set complete. Starting advertising...");
-            esp_err_t adv_start_ret = esp_ble_gap_start_advertising(&adv_params);
-            if (adv_start_ret != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to start advertising: %s", esp_err_to_name(adv_start_ret));
-            }
+            update_advertising();
             break;
 
         case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
             if (param->adv_start_cmpl.status == ESP_BT_STATUS_SUCCESS) {
                 ESP_LOGI(TAG, "Advertising started successfully");
+                boot_mark(BOOT_BLE_ADVERTISING);
             } else {
                 ESP_LOGE(TAG, "Failed to start advertising: %d", param->adv_start_cmpl.status);
+                advertising = false;
             }
             break;
 
         case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
             ESP_LOGI(TAG, "Advertising stopped. Restarting advertising...");
-            esp_ble_gap_start_advertising(&adv_params); // Restart advertising
+            advertising = false;
+            update_advertising();
+            break;
+
+        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: {
+            ble_conn_t *conn = find_conn_by_bda(param->update_conn_params.bda);
+            if (param->update_conn_params.status != ESP_BT_STATUS_SUCCESS || !conn) {
+                ESP_LOGW(TAG, "Connection parameter update failed: %d", param->update_conn_params.status);
+                break;
+            }
+            conn->conn_interval = param->update_conn_params.conn_int;
+            conn->latency = param->update_conn_params.latency;
+            conn->timeout = param->update_conn_params.timeout;
+            ESP_LOGI(TAG, "Connection %d: interval %d x 1.25 ms, latency %d, timeout %d x 10 ms",
+                     conn->conn_id, conn->conn_interval, conn->latency, conn->timeout);
             break;
+        }
 
         default:
             break;
@@ -126,181 +419,286 @@ void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp
             // Set up the advertising data (what is broadcasted to phones)
             esp_ble_gap_config_adv_data(&adv_data);
 
-            // Create the main BLE service for this device
-            // 10 is the number of handles (service + characteristics + descriptors)
-            esp_err_t ret = esp_ble_gatts_create_service(gatts_if, &service_id, 10);
-            if (ret != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to create service: %s", esp_err_to_name(ret));
-            }
-            break;
-
-        case ESP_GATTS_CREATE_EVT:
-            if (param->create.status == ESP_GATT_OK) {
-                ESP_LOGI(TAG, "Service created successfully, handle: %d", param->create.service_handle);
-                gl_profile.service_handle = param->create.service_handle;
-
-                // Add the first characteristic (for example, a test value)
-                esp_bt_uuid_t char_uuid = {
-                    .len = ESP_UUID_LEN_16,
-                    .uuid = { .uuid16 = TEST_CHAR_UUID },
-                };
-                esp_err_t add_char_ret = esp_ble_gatts_add_char(
-                    gl_profile.service_handle,
-                    &char_uuid,
-                    ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, // Allow read and write from client
-                    ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE, // Client can read/write
-                    NULL,
-                    NULL
-                );
-                if (add_char_ret != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to add characteristic: %s", esp_err_to_name(add_char_ret));
-                }
-
-                // Add a second characteristic (could be for extra data)
-                esp_bt_uuid_t extra_char_uuid = {
-                    .len = ESP_UUID_LEN_16,
-                    .uuid = { .uuid16 = EXTRA_CHAR_UUID },
-                };
-                esp_err_t add_extra_char_ret = esp_ble_gatts_add_char(
-                    gl_profile.service_handle,
-                    &extra_char_uuid,
-                    ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-                    ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE,
-                    NULL,
-                    NULL
-                );
-                if (add_extra_char_ret != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to add extra characteristic: %s", esp_err_to_name(add_extra_char_ret));
-                }
-
-                // Add a third characteristic for broadcasting (for example, heart rate)
-                esp_bt_uuid_t broadcast_char_uuid = {
-                    .len = ESP_UUID_LEN_16,
-                    .uuid = { .uuid16 = BROADCAST_CHAR_UUID },
-                };
-                esp_attr_value_t broadcast_char_val = {
-                    .attr_max_len = sizeof(broadcast_char_value),
-                    .attr_len = sizeof(broadcast_char_value),
-                    .attr_value = (uint8_t *)&broadcast_char_value,
-                };
-                esp_err_t add_broadcast_char_ret = esp_ble_gatts_add_char(
-                    gl_profile.service_handle,
-                    &broadcast_char_uuid,
-                    ESP_GATT_PERM_READ, // Only readable
-                    ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_BROADCAST, // Read and broadcast
-                    &broadcast_char_val,
-                    NULL
-                );
-                if (add_broadcast_char_ret != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to add broadcasting characteristic: %s", esp_err_to_name(add_broadcast_char_ret));
+            // Every service in one go, handles come back with ESP_GATTS_CREAT_ATTR_TAB_EVT
+            for (size_t i = 0; i < SERVICE_COUNT; i++) {
+                esp_err_t ret = esp_ble_gatts_create_attr_tab(services[i].db, gatts_if, services[i].count, 0);
+                if (ret != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to create %s service: %s", services[i].name, esp_err_to_name(ret));
                 }
-            } else {
-                ESP_LOGE(TAG, "Failed to create service: %s", esp_err_to_name(param->create.status));
             }
             break;
 
-        case ESP_GATTS_ADD_CHAR_EVT:
-            if (param->add_char.status == ESP_GATT_OK) {
-                ESP_LOGI(TAG, "Characteristic added successfully, handle: %d", param->add_char.attr_handle);
-
-                // Figure out which characteristic was just added by checking its UUID
-                if (param->add_char.char_uuid.uuid.uuid16 == TEST_CHAR_UUID) {
-                    gl_profile.char_handle = param->add_char.attr_handle;
-                } else if (param->add_char.char_uuid.uuid.uuid16 == EXTRA_CHAR_UUID) {
-                    gl_profile.extra_char_handle = param->add_char.attr_handle;
-                } else if (param->add_char.char_uuid.uuid.uuid16 == BROADCAST_CHAR_UUID) {
-                    gl_profile.broadcast_char_handle = param->add_char.attr_handle;
-                }
-
-                // Start the service only after all characteristics are added
-                if (gl_profile.char_handle && gl_profile.extra_char_handle && gl_profile.broadcast_char_handle) {
-                    esp_ble_gatts_start_service(gl_profile.service_handle);
-                }
-            } else {
-                ESP_LOGE(TAG, "Failed to add characteristic: %s", esp_err_to_name(param->add_char.status));
-            }
+        case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+            attr_table_created(param);
             break;
 
-        case ESP_GATTS_READ_EVT:
-            ESP_LOGI(TAG, "Read request received, handle: %d", param->read.handle);
+        case ESP_GATTS_READ_EVT: {
+            DLOGI(TAG, "Read request received, handle: %d", param->read.handle);
+            if (!param->read.need_rsp) {
+                break; // The stack answered already
+            }
+            const ble_attr_ops_t *attr = find_attr(param->read.handle);
             esp_gatt_rsp_t rsp;
             memset(&rsp, 0, sizeof(esp_gatt_rsp_t));
             rsp.attr_value.handle = param->read.handle;
-
-            // Respond with the correct value depending on which characteristic is being read
-            if (param->read.handle == gl_profile.char_handle) {
-                rsp.attr_value.len = sizeof(test_char_value);
-                memcpy(rsp.attr_value.value, &test_char_value, sizeof(test_char_value));
-            } else if (param->read.handle == gl_profile.extra_char_handle) {
-                rsp.attr_value.len = sizeof(extra_char_value);
-                memcpy(rsp.attr_value.value, &extra_char_value, sizeof(extra_char_value));
-            } else if (param->read.handle == gl_profile.broadcast_char_handle) {
-                rsp.attr_value.len = sizeof(broadcast_char_value);
-                memcpy(rsp.attr_value.value, &broadcast_char_value, sizeof(broadcast_char_value));
+            esp_gatt_status_t status = ESP_GATT_READ_NOT_PERMIT;
+            if (attr && attr->read) {
+                status = attr->read(find_conn(param->read.conn_id), attr->ctx, &rsp.attr_value);
             }
 
             // Send the response back to the BLE client (like a phone app)
-            esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, ESP_GATT_OK, &rsp);
+            esp_ble_gatts_send_response(gatts_if, param->read.conn_id, param->read.trans_id, status, &rsp);
             break;
+        }
 
-        case ESP_GATTS_WRITE_EVT:
-            ESP_LOGI(TAG, "Write request received, handle: %d, length: %d", param->write.handle, param->write.len);
+        case ESP_GATTS_WRITE_EVT: {
+            DLOGI(TAG, "Write request received, handle: %d, length: %d", param->write.handle, param->write.len);
+            const ble_attr_ops_t *attr = find_attr(param->write.handle);
+            esp_gatt_status_t status = ESP_GATT_WRITE_NOT_PERMIT;
+            if (attr && attr->write) {
+                status = attr->write(find_conn(param->write.conn_id), attr->ctx, param->write.value, param->write.len);
+            } else {
+                DLOGW(TAG, "Write request ignored: invalid handle");
+            }
+
+            // Answer unless it was a write without response
+            if (param->write.need_rsp) {
+                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, status, NULL);
+            }
+            break;
+        }
+
+        case ESP_GATTS_MTU_EVT: {
+            ble_conn_t *conn = find_conn(param->mtu.conn_id);
+            ESP_LOGI(TAG, "MTU set to %d on connection %d", param->mtu.mtu, param->mtu.conn_id);
+            if (conn) {
+                atomic_store(&conn->mtu, param->mtu.mtu);
+            }
+            break;
+        }
 
-            // Update the correct variable depending on which characteristic was written
-            if (param->write.handle == gl_profile.char_handle) {
-                if (param->write.len <= sizeof(test_char_value)) {
-                    memcpy(&test_char_value, param->write.value, param->write.len);
-                    ESP_LOGI(TAG, "Updated test_char_value: %d", test_char_value);
-                } else {
-                    ESP_LOGW(TAG, "Write request ignored: data length exceeds characteristic size");
+        case ESP_GATTS_CONGEST_EVT: {
+            ble_conn_t *conn = find_conn(param->congest.conn_id);
+            if (conn) {
+                atomic_store(&conn->congested, param->congest.congested);
+                // Drained: send this central what piled up meanwhile
+                if (!param->congest.congested) {
+                    wake_notify_task();
                 }
-            } else if (param->write.handle == gl_profile.extra_char_handle) {
-                if (param->write.len <= sizeof(extra_char_value)) {
-                    memcpy(&extra_char_value, param->write.value, param->write.len);
-                    ESP_LOGI(TAG, "Updated extra_char_value: %d", extra_char_value);
-                } else {
-                    ESP_LOGW(TAG, "Write request ignored: data length exceeds characteristic size");
+            }
+            break;
+        }
+
+        case ESP_GATTS_CONNECT_EVT: {
+            // The controller stopped advertising for this connection
+            advertising = false;
+            ble_conn_t *conn = NULL;
+            for (int i = 0; i < BLE_MAX_CONNECTIONS && !conn; i++) {
+                if (!atomic_load(&conns[i].connected)) {
+                    conn = &conns[i];
                 }
-            } else {
-                ESP_LOGW(TAG, "Write request ignored: invalid handle");
+            }
+            if (!conn) {
+                ESP_LOGW(TAG, "No room for connection %d, closing it", param->connect.conn_id);
+                esp_ble_gatts_close(gatts_if, param->connect.conn_id);
+                break;
             }
 
-            // Always send a response to the client after a write
-            esp_ble_gatts_send_response(gatts_if, param->write.conn_id, param->write.trans_id, ESP_GATT_OK, NULL);
+            conn->conn_id = param->connect.conn_id;
+            memcpy(conn->remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+            atomic_store(&conn->hr_cccd, 0);
+            atomic_store(&conn->mtu, ESP_GATT_DEF_BLE_MTU_SIZE);
+            atomic_store(&conn->congested, false);
+            conn->conn_interval = param->connect.conn_params.interval;
+            conn->latency = param->connect.conn_params.latency;
+            conn->timeout = param->connect.conn_params.timeout;
+            atomic_fetch_add(&conn->generation, 1);
+            atomic_store_explicit(&conn->connected, true, memory_order_release);
+            connection_count++;
+            ESP_LOGI(TAG, "Device connected (connection %d, %d of %d)", conn->conn_id, connection_count, BLE_MAX_CONNECTIONS);
+
+            esp_ble_conn_update_params_t conn_params = {
+                .min_int = BLE_CONN_INT_MIN,
+                .max_int = BLE_CONN_INT_MAX,
+                .latency = BLE_CONN_LATENCY,
+                .timeout = BLE_CONN_TIMEOUT,
+            };
+            memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+            esp_ble_gap_update_conn_params(&conn_params);
+
+            // Keep advertising so the next central can join
+            update_advertising();
             break;
+        }
 
-        case ESP_GATTS_CONNECT_EVT:
-            ESP_LOGI(TAG, "Device connected");
-            gl_profile.conn_id = param->connect.conn_id;
+        case ESP_GATTS_DISCONNECT_EVT: {
+            ESP_LOGI(TAG, "Device disconnected (connection %d). Restarting advertising...", param->disconnect.conn_id);
+            ble_conn_t *conn = find_conn(param->disconnect.conn_id);
+            if (conn) {
+                // Subscriptions don't survive a disconnect (no bonding)
+                atomic_store(&conn->hr_cccd, 0);
+                atomic_store_explicit(&conn->connected, false, memory_order_release);
+                connection_count--;
+            }
+            update_advertising(); // Restart advertising so new devices can connect
             break;
+        }
 
-        case ESP_GATTS_DISCONNECT_EVT:
-            ESP_LOGI(TAG, "Device disconnected. Restarting advertising...");
-            esp_ble_gap_start_advertising(&adv_params); // Restart advertising so new devices can connect
+        default:
             break;
+    }
+}
 
-        default:
+void ble_heart_rate_updated(const bpm_sample_t *sample) {
+    if (!atomic_load_explicit(&hr_ready, memory_order_acquire)) {
+        return;
+    }
+    if (!spsc_push(&hr_ring, sample)) {
+        DLOGW(TAG, "HR ring full, RR-interval dropped");
+    }
+    if (hr_notify_task_handle) {
+        xTaskNotifyGive(hr_notify_task_handle);
+    }
+}
+
+void ble_motion_updated(const motion_block_t *block, uint32_t steps) {
+    if (!atomic_load_explicit(&attrs_ready, memory_order_acquire)) {
+        return;
+    }
+    uint8_t value[MOTION_CHAR_LEN] = {
+        (uint8_t)steps, (uint8_t)(steps >> 8), (uint8_t)(steps >> 16), (uint8_t)(steps >> 24),
+        (uint8_t)block->cadence_spm, (uint8_t)(block->cadence_spm >> 8),
+        block->activity, block->artifact,
+    };
+    attr_write(&motion_char_value, value, sizeof(value));
+}
+
+void ble_hr_ring_stats(uint32_t *waiting, uint32_t *dropped) {
+    *waiting = spsc_count(&hr_ring);
+    *dropped = atomic_load_explicit(&hr_ring.dropped, memory_order_relaxed);
+}
+
+void ble_link_stats(uint32_t *connected, uint32_t *subscribed, uint32_t *lost) {
+    *connected = 0;
+    *subscribed = 0;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (atomic_load_explicit(&conns[i].connected, memory_order_relaxed)) {
+            (*connected)++;
+            if (atomic_load_explicit(&conns[i].hr_cccd, memory_order_relaxed) & HRS_CCCD_NOTIFY) {
+                (*subscribed)++;
+            }
+        }
+    }
+    *lost = atomic_load_explicit(&rr_lost, memory_order_relaxed);
+}
+
+// Sends one central every RR-interval it hasn't had yet, in as few notifications as its
+// MTU allows. Returns true if it got at least one.
+static bool notify_central(ble_conn_t *conn, int bpm, uint8_t *value, size_t value_size) {
+    if (!atomic_load_explicit(&conn->connected, memory_order_acquire)) {
+        return false;
+    }
+    uint32_t generation = atomic_load_explicit(&conn->generation, memory_order_acquire);
+    if (generation != conn->seen_generation) {
+        // New central in this slot: it starts with the newest few intervals
+        conn->seen_generation = generation;
+        conn->rr_next = rr_head - (rr_head < HR_MAX_PENDING_RR ? rr_head : HR_MAX_PENDING_RR);
+        conn->beat_sent = beat_count - 1;
+    }
+    // Nothing new for it (no beat and no interval left over from a full link)
+    if (!(atomic_load(&conn->hr_cccd) & HRS_CCCD_NOTIFY) || atomic_load(&conn->congested) ||
+        (conn->beat_sent == beat_count && conn->rr_next == rr_head)) {
+        return false;
+    }
+
+    // Fell so far behind that its oldest intervals were overwritten
+    if (rr_head - conn->rr_next > HR_RR_HISTORY) {
+        atomic_fetch_add_explicit(&rr_lost, rr_head - conn->rr_next - HR_RR_HISTORY, memory_order_relaxed);
+        conn->rr_next = rr_head - HR_RR_HISTORY;
+    }
+    uint16_t rr[HR_RR_HISTORY];
+    size_t rr_count = rr_head - conn->rr_next;
+    for (size_t i = 0; i < rr_count; i++) {
+        rr[i] = rr_history[(conn->rr_next + i) & (HR_RR_HISTORY - 1)];
+    }
+
+    // Notification payload is at most MTU - 3 bytes; send more than one if needed
+    size_t max_len = atomic_load(&conn->mtu) - 3;
+    if (max_len > value_size) {
+        max_len = value_size;
+    }
+    size_t sent = 0;
+    bool notified = false;
+    do {
+        size_t used = 0;
+        size_t len = hrs_encode_measurement(value, max_len, bpm,
+                                            HRS_FLAG_CONTACT_SUPPORTED | HRS_FLAG_CONTACT_DETECTED,
+                                            rr + sent, rr_count - sent, &used);
+        esp_err_t err = esp_ble_gatts_send_indicate(gl_profile.gatts_if, conn->conn_id,
+                                                    gl_profile.hrs_handles[HRS_IDX_MEAS_VAL], len, value, false);
+        if (err != ESP_OK) {
+            // Usually the link's queue is full; the rest waits for the next beat
+            DLOGW(TAG, "Heart rate notification to connection %d failed: %s", conn->conn_id, esp_err_to_name(err));
             break;
+        }
+        sent += used;
+        notified = true;
+    } while (sent < rr_count && !atomic_load(&conn->congested));
+
+    // Whatever was sent is gone, anything left goes out with the next beat or once the link drains
+    conn->rr_next += sent;
+    if (notified) {
+        conn->beat_sent = beat_count;
     }
+    return notified;
 }
 
-// This task updates the BLE broadcast value every 10 seconds
-void update_broadcast_char_value_task(void *pvParameters) {
+// This task sleeps until the sensor task reports new beats, then sends them to every
+// subscribed central as Heart Rate Measurement notifications (RR-intervals coalesced)
+void hr_notify_task(void *pvParameters) {
+    static uint8_t value[BLE_LOCAL_MTU - 3]; // flags + 16-bit BPM + as many RRs as the biggest MTU takes
+    int bpm = 0;
+    uint32_t newest_ts = 0;
+    bpm_sample_t sample;
+
     while (1) {
-        // Try to lock the mutex for 100ms before reading global_bpm
-        if (xSemaphoreTake(bpmMutex, pdMS_TO_TICKS(100))) {
-            broadcast_char_value = global_bpm;
-            xSemaphoreGive(bpmMutex);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Collect every beat since the last wake-up
+        while (spsc_pop(&hr_ring, &sample)) {
+            bpm = sample.bpm;
+            newest_ts = sample.timestamp_ms;
+            beat_count++;
+            if (sample.ibi_ms > 0) {
+                rr_history[rr_head++ & (HR_RR_HISTORY - 1)] = hrs_rr_from_ms(sample.ibi_ms);
+            }
+        }
+        if (bpm == 0) {
+            continue;
+        }
+
+        // A congested central is skipped and catches up once its link drains
+        bool notified = false;
+        for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+            notified |= notify_central(&conns[i], bpm, value, sizeof(value));
+        }
+
+        // How old the newest beat was when the centrals got it
+        if (notified) {
+            metrics_hist_record(&metrics_ble_latency, now_ms() - newest_ts);
         }
-        ESP_LOGI(TAG, "Updated broadcast_char_value to: %d", broadcast_char_value);
-        esp_ble_gatts_set_attr_value(gl_profile.broadcast_char_handle, sizeof(broadcast_char_value), (uint8_t *)&broadcast_char_value);
-        vTaskDelay(pdMS_TO_TICKS(5000)); // Wait 10 seconds before next update
     }
 }
-// BLE initialization
-void ble_init() {
 
-    ESP_ERROR_CHECK(nvs_flash_init());
+// BLE initialization (NVS is set up by boot_init before this runs)
+void ble_init() {
+    // The values have to exist before the stack can ask for them
+    int test_initial = 0, extra_initial = 42;
+    attr_init(&test_char_value, sizeof(int), &test_initial, sizeof(int));
+    attr_init(&extra_char_value, sizeof(int), &extra_initial, sizeof(int));
+    uint8_t motion_initial[MOTION_CHAR_LEN] = {0};
+    attr_init(&motion_char_value, MOTION_CHAR_LEN, motion_initial, sizeof(motion_initial));
+    atomic_store_explicit(&attrs_ready, true, memory_order_release);
 
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
@@ -318,9 +716,16 @@ void ble_init() {
     ESP_ERROR_CHECK(esp_ble_gatts_register_callback(gatts_event_handler));
     ESP_ERROR_CHECK(esp_ble_gatts_app_register(PROFILE_APP_ID));
 
-    // Start the FreeRTOS task that periodically updates the broadcasted BPM value
-    // Stack size: 2048 words (~8KB), priority: 5 (medium priority for regular updates)
-    xTaskCreate(update_broadcast_char_value_task, "Update Broadcast Char Value Task", 2048, NULL, 5, NULL);
+    // Centrals start the MTU exchange; this is the most we agree to
+    esp_err_t mtu_ret = esp_ble_gatt_set_local_mtu(BLE_LOCAL_MTU);
+    if (mtu_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set local MTU: %s", esp_err_to_name(mtu_ret));
+    }
+
+    // Start the FreeRTOS task that sends heart rate notifications when new beats arrive
+    spsc_init(&hr_ring, hr_ring_storage, sizeof(bpm_sample_t), HR_RING_SIZE);
+    task_start(TASK_HR_NOTIFY, hr_notify_task, NULL, &hr_notify_task_handle);
+    atomic_store_explicit(&hr_ready, true, memory_order_release);
 
     ESP_LOGI(TAG, "BLE initialized");
 }
\ No newline at end of file
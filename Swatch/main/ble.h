@@ -5,10 +5,36 @@
 // #include "esp_gatts_api.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "sensor.h"
+
+// Centrals connected at the same time (phone, bedside gateway and one spare). The
+// controller has to allow as many: CONFIG_BT_ACL_CONNECTIONS and the controller's
+// BLE connection limit (CONFIG_BTDM_CTRL_BLE_MAX_CONN on the ESP32) default to 4 and 3.
+#ifndef BLE_MAX_CONNECTIONS
+#define BLE_MAX_CONNECTIONS 3
+#endif
+
+// MTU we accept when a central asks for a bigger one. 247 fills one LE data packet
+// with data length extension, room for ~120 RR-intervals per notification.
+#ifndef BLE_LOCAL_MTU
+#define BLE_LOCAL_MTU 247
+#endif
+
 // Function to initialize BLE
 void ble_init();
 
-// Function to send data over BLE
-void ble_send_data();
+// Called by the sensor task for every new beat, wakes up the heart rate notify task
+void ble_heart_rate_updated(const bpm_sample_t *sample);
+
+// Called by the sensor task for every accelerometer block, with the steps since boot.
+// Updates the motion characteristic centrals can read.
+void ble_motion_updated(const motion_block_t *block, uint32_t steps);
+
+// Beats waiting for the notify task and beats dropped because it fell behind (for metrics)
+void ble_hr_ring_stats(uint32_t *waiting, uint32_t *dropped);
+
+// Centrals connected, how many of them have heart rate notifications on, and
+// RR-intervals a slow central lost because it fell too far behind (for metrics)
+void ble_link_stats(uint32_t *connected, uint32_t *subscribed, uint32_t *rr_lost);
 
 #endif // BLE_H
@@ -0,0 +1,80 @@
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "nvs_flash.h"
+#include "boot.h"
+#define TAG "BOOT"
+
+EventGroupHandle_t boot_events;
+
+// Milestones reached so far and when (ms since the chip started, esp_timer counts from
+// before app_main so the ROM and bootloader part is in there too). A bit is claimed by
+// the first task that gets there and only shows up in reached once its time is stored.
+static _Atomic uint32_t claimed;
+static _Atomic uint32_t reached;
+static _Atomic uint32_t reached_ms[BOOT_MILESTONES];
+
+static const char *const names[BOOT_MILESTONES] = {
+    "NVS/netif ready", "BLE advertising", "Wi-Fi got IP", "MQTT connected", "first sample", "first publish",
+};
+
+void boot_init(void) {
+    boot_events = xEventGroupCreate();
+    if (boot_events == NULL) {
+        ESP_LOGE(TAG, "Failed to create boot event group");
+    }
+
+    // BLE (bonding keys) and Wi-Fi (calibration, credentials) both keep things in NVS,
+    // so it is set up here once instead of by whichever of them starts first
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_LOGW(TAG, "NVS partition can't be used (%s), erasing it", esp_err_to_name(err));
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(err);
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    boot_mark(BOOT_SHARED_READY);
+}
+
+void boot_mark(EventBits_t bit) {
+    if (atomic_load_explicit(&claimed, memory_order_relaxed) & bit) {
+        return;
+    }
+    uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+    uint32_t before = atomic_fetch_or(&claimed, bit);
+    if (before & bit) {
+        return;
+    }
+    int index = __builtin_ctz(bit);
+    atomic_store(&reached_ms[index], now);
+    uint32_t done = atomic_fetch_or_explicit(&reached, bit, memory_order_release) | bit;
+    if (boot_events != NULL) {
+        xEventGroupSetBits(boot_events, bit);
+    }
+    ESP_LOGI(TAG, "%s after %lu ms", names[index], (unsigned long)now);
+
+    if (done == BOOT_ALL) {
+        ESP_LOGI(TAG, "Up: sample %lu ms, advertising %lu ms, IP %lu ms, MQTT %lu ms, first publish %lu ms",
+                 (unsigned long)boot_ms(BOOT_FIRST_SAMPLE), (unsigned long)boot_ms(BOOT_BLE_ADVERTISING),
+                 (unsigned long)boot_ms(BOOT_WIFI_GOT_IP), (unsigned long)boot_ms(BOOT_MQTT_CONNECTED),
+                 (unsigned long)boot_ms(BOOT_FIRST_PUBLISH));
+    }
+}
+
+bool boot_reached(EventBits_t bit) {
+    return (atomic_load_explicit(&reached, memory_order_acquire) & bit) == bit;
+}
+
+uint32_t boot_ms(EventBits_t bit) {
+    return boot_reached(bit) ? atomic_load(&reached_ms[__builtin_ctz(bit)]) : 0;
+}
+
+bool boot_wait(EventBits_t bits, TickType_t timeout) {
+    EventBits_t got = xEventGroupWaitBits(boot_events, bits, pdFALSE, pdTRUE, timeout);
+    return (got & bits) == bits;
+}
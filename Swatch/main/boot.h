@@ -0,0 +1,46 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+// Start-up milestones. Every part of the watch comes up in its own task as soon as what
+// it needs is there, and sets its bit in boot_events when it gets there:
+//
+//   NVS, netif, event loop --+--> BLE -------------------> advertising
+//                            +--> Wi-Fi --> IP --> MQTT --> connected --> first publish
+//   sensor, data send ----------------------------------> first sample (kept until then)
+//
+// A bit stays set once reached (later disconnects don't clear it), so the bits say
+// how far start-up got and when, not whether the link is up right now.
+#define BOOT_SHARED_READY    (1 << 0)   // NVS, netif and the default event loop
+#define BOOT_BLE_ADVERTISING (1 << 1)
+#define BOOT_WIFI_GOT_IP     (1 << 2)
+#define BOOT_MQTT_CONNECTED  (1 << 3)
+#define BOOT_FIRST_SAMPLE    (1 << 4)   // first beat handed to the MQTT and BLE sides
+#define BOOT_FIRST_PUBLISH   (1 << 5)   // first batch the broker took
+#define BOOT_MILESTONES      6
+#define BOOT_ALL             ((1 << BOOT_MILESTONES) - 1)
+
+extern EventGroupHandle_t boot_events;
+
+// Creates boot_events and does the start-up work BLE and Wi-Fi share (NVS, netif, the
+// default event loop), once, before either of them starts. Call first in app_main.
+void boot_init(void);
+
+// Records that a milestone was reached (the first call per bit counts, later ones are
+// cheap no-ops, so it can sit in a hot path)
+void boot_mark(EventBits_t bit);
+
+// Whether a milestone was reached
+bool boot_reached(EventBits_t bit);
+
+// When a milestone was reached, in ms since the chip started (0 if not yet)
+uint32_t boot_ms(EventBits_t bit);
+
+// Blocks until all of bits are reached or timeout runs out. Returns true if they were.
+bool boot_wait(EventBits_t bits, TickType_t timeout);
+
+#endif
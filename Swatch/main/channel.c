@@ -0,0 +1,124 @@
+#include <string.h>
+#include "channel.h"
+
+bool spsc_init(spsc_ring_t *ring, void *storage, size_t item_size, uint32_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+    ring->storage = storage;
+    ring->item_size = item_size;
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->pushed, 0);
+    atomic_init(&ring->dropped, 0);
+    return true;
+}
+
+bool spsc_push(spsc_ring_t *ring, const void *item) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    // head and tail run freely and wrap, so the difference is always the fill level
+    if (head - tail > ring->mask) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    memcpy(ring->storage + (head & ring->mask) * ring->item_size, item, ring->item_size);
+    // Release so the consumer sees the record before it sees the new head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    atomic_fetch_add_explicit(&ring->pushed, 1, memory_order_relaxed);
+    return true;
+}
+
+bool spsc_pop(spsc_ring_t *ring, void *item) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+
+    memcpy(item, ring->storage + (tail & ring->mask) * ring->item_size, ring->item_size);
+    // Release so the producer doesn't reuse the slot before we finished copying
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+uint32_t spsc_count(spsc_ring_t *ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+bool latest_slot_init(latest_slot_t *slot, const void *initial, size_t size) {
+    if (size == 0 || size > LATEST_SLOT_MAX_SIZE || size % sizeof(uint32_t) != 0) {
+        return false;
+    }
+    slot->size = size;
+    atomic_init(&slot->version, 0);
+    atomic_init(&slot->read_version, 0);
+    atomic_init(&slot->overwritten, 0);
+
+    uint32_t words[LATEST_SLOT_MAX_SIZE / sizeof(uint32_t)] = {0};
+    if (initial) {
+        memcpy(words, initial, size);
+    }
+    for (size_t i = 0; i < LATEST_SLOT_MAX_SIZE / sizeof(uint32_t); i++) {
+        atomic_init(&slot->words[0][i], words[i]);
+        atomic_init(&slot->words[1][i], words[i]);
+    }
+    return true;
+}
+
+void latest_slot_write(latest_slot_t *slot, const void *value) {
+    uint32_t words[LATEST_SLOT_MAX_SIZE / sizeof(uint32_t)];
+    memcpy(words, value, slot->size);
+
+    uint32_t version = atomic_load_explicit(&slot->version, memory_order_relaxed);
+    uint32_t next = version + 1;
+
+    // Make sure our last version bump is visible before we touch the spare buffer,
+    // otherwise a slow reader could see new data together with an old version.
+    atomic_thread_fence(memory_order_release);
+    for (size_t i = 0; i < slot->size / sizeof(uint32_t); i++) {
+        atomic_store_explicit(&slot->words[next & 1u][i], words[i], memory_order_relaxed);
+    }
+
+    // Nobody picked up the value we are replacing
+    if (version != 0 && atomic_load_explicit(&slot->read_version, memory_order_relaxed) != version) {
+        atomic_fetch_add_explicit(&slot->overwritten, 1, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&slot->version, next, memory_order_release);
+}
+
+uint32_t latest_slot_read(latest_slot_t *slot, void *out) {
+    uint32_t words[LATEST_SLOT_MAX_SIZE / sizeof(uint32_t)];
+    uint32_t before, after;
+
+    // Retry only if a whole new value was published while we were copying
+    do {
+        before = atomic_load_explicit(&slot->version, memory_order_acquire);
+        for (size_t i = 0; i < slot->size / sizeof(uint32_t); i++) {
+            words[i] = atomic_load_explicit(&slot->words[before & 1u][i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&slot->version, memory_order_relaxed);
+    } while (before != after);
+
+    memcpy(out, words, slot->size);
+    atomic_store_explicit(&slot->read_version, before, memory_order_relaxed);
+    return before;
+}
+
+void latest_slot_peek(const latest_slot_t *slot, void *out) {
+    // Only the writer changes the slot, so the current buffer holds still
+    uint32_t words[LATEST_SLOT_MAX_SIZE / sizeof(uint32_t)];
+    uint32_t version = atomic_load_explicit(&slot->version, memory_order_relaxed);
+    for (size_t i = 0; i < slot->size / sizeof(uint32_t); i++) {
+        words[i] = atomic_load_explicit(&slot->words[version & 1u][i], memory_order_relaxed);
+    }
+    memcpy(out, words, slot->size);
+}
@@ -0,0 +1,62 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Lock-free single-producer/single-consumer ring of fixed-size records.
+// Exactly one task may push and exactly one task may pop. Nothing ever blocks:
+// a push into a full ring is dropped and counted instead.
+typedef struct {
+    uint8_t *storage;           // capacity * item_size bytes, owned by the caller
+    size_t item_size;
+    uint32_t mask;              // capacity - 1 (capacity is a power of two)
+    _Atomic uint32_t head;      // next slot to write, only the producer changes it
+    _Atomic uint32_t tail;      // next slot to read, only the consumer changes it
+    _Atomic uint32_t pushed;    // records accepted
+    _Atomic uint32_t dropped;   // records rejected because the ring was full
+} spsc_ring_t;
+
+// capacity must be a power of two. Returns false if it isn't.
+bool spsc_init(spsc_ring_t *ring, void *storage, size_t item_size, uint32_t capacity);
+
+// Producer side. Returns false (and counts a drop) if the ring is full.
+bool spsc_push(spsc_ring_t *ring, const void *item);
+
+// Consumer side. Returns false if the ring is empty.
+bool spsc_pop(spsc_ring_t *ring, void *item);
+
+// How many records are waiting right now (a snapshot, safe from either side)
+uint32_t spsc_count(spsc_ring_t *ring);
+
+// Biggest value a latest_slot_t can hold (room for a 20-byte GATT value and its length)
+#define LATEST_SLOT_MAX_SIZE 24
+
+// Lock-free "newest value" slot (a seqlock over two buffers). The writer always fills
+// the buffer readers are NOT using and then flips the version, so readers never block,
+// never see a half-written value, and can't get stuck if they preempt the writer.
+typedef struct {
+    _Atomic uint32_t version;   // bumped on every write, low bit picks the buffer to read
+    _Atomic uint32_t words[2][LATEST_SLOT_MAX_SIZE / sizeof(uint32_t)];
+    size_t size;
+    _Atomic uint32_t read_version; // version of the last value some reader picked up
+    _Atomic uint32_t overwritten;  // values replaced before anyone read them
+} latest_slot_t;
+
+// size must be a multiple of 4 and at most LATEST_SLOT_MAX_SIZE
+bool latest_slot_init(latest_slot_t *slot, const void *initial, size_t size);
+
+// Stores a new value. Only ONE task may ever write a given slot.
+void latest_slot_write(latest_slot_t *slot, const void *value);
+
+// Copies the newest value into out (any number of readers). Returns its version,
+// which changes on every write, so callers can tell if anything is new.
+uint32_t latest_slot_read(latest_slot_t *slot, void *out);
+
+// Copies the newest value into out for the writer, to change part of it. Doesn't count
+// as a read, so overwritten still counts values no reader picked up.
+void latest_slot_peek(const latest_slot_t *slot, void *out);
+
+#endif
@@ -0,0 +1,291 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "command.h"
+#include "channel.h"
+#define TAG "CMD"
+
+// Task handle from main.c (woken up when it has a command waiting)
+extern TaskHandle_t dataSendTaskHandle;
+
+typedef struct {
+    const char *topic;
+    command_id_t id;
+    command_owner_t owner;
+    uint8_t min_args;
+    uint8_t max_args;
+    bool blob;              // payload is handed over as is instead of parsed
+} command_route_t;
+
+static const command_route_t routes[] = {
+    // The bare data topic takes a BPM value too (the original test command)
+    { "hexagon",                            CMD_BPM_OVERRIDE,   CMD_OWNER_SENSOR,    1, 1, false },
+    { COMMAND_TOPIC_PREFIX "bpm",           CMD_BPM_OVERRIDE,   CMD_OWNER_SENSOR,    1, 1, false },
+    { COMMAND_TOPIC_PREFIX "policy",        CMD_PUBLISH_POLICY, CMD_OWNER_DATA_SEND, 5, 5, false },
+    { COMMAND_TOPIC_PREFIX "alarm",         CMD_ALARM_LIMITS,   CMD_OWNER_DATA_SEND, 2, 2, false },
+    { COMMAND_TOPIC_PREFIX "calibration",   CMD_CALIBRATION,    CMD_OWNER_SENSOR,    0, 0, true },
+    { COMMAND_TOPIC_PREFIX "agg",           CMD_AGGREGATION,    CMD_OWNER_DATA_SEND, 3, 3, false },
+};
+#define ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+
+// Open addressing table of route index + 1 (0 = empty), filled by command_init().
+// Twice as many slots as routes keeps the probes short.
+#define ROUTE_SLOTS 16
+static uint8_t route_slots[ROUTE_SLOTS];
+static uint32_t route_hashes[ROUTE_COUNT];
+static size_t route_lens[ROUTE_COUNT];
+
+// One queue per owner. The MQTT task is the only producer, the owner the only consumer.
+static command_t queue_storage[CMD_OWNER_COUNT][COMMAND_QUEUE_SIZE];
+static spsc_ring_t queues[CMD_OWNER_COUNT];
+
+// Reassembly buffers. Only the MQTT task claims one, only the owner of the command
+// in it gives it back.
+static uint8_t blobs[COMMAND_BLOB_COUNT][COMMAND_BLOB_SIZE];
+static _Atomic bool blob_busy[COMMAND_BLOB_COUNT];
+
+// The message being reassembled (MQTT task only). route is NULL while the rest of a
+// message that is being dropped goes by.
+static struct {
+    bool active;
+    const command_route_t *route;
+    uint8_t blob;
+    uint32_t total;
+    uint32_t received;
+} frag;
+
+command_stats_t command_stats;
+
+// FNV-1a
+static uint32_t topic_hash(const char *topic, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)topic[i]) * 16777619u;
+    }
+    return h;
+}
+
+void command_init(void) {
+    _Static_assert(ROUTE_COUNT < ROUTE_SLOTS, "route table too small");
+    memset(route_slots, 0, sizeof(route_slots));
+    for (size_t i = 0; i < ROUTE_COUNT; i++) {
+        route_lens[i] = strlen(routes[i].topic);
+        route_hashes[i] = topic_hash(routes[i].topic, route_lens[i]);
+        uint32_t slot = route_hashes[i] & (ROUTE_SLOTS - 1);
+        while (route_slots[slot] != 0) {
+            slot = (slot + 1) & (ROUTE_SLOTS - 1);
+        }
+        route_slots[slot] = (uint8_t)(i + 1);
+    }
+    for (int i = 0; i < CMD_OWNER_COUNT; i++) {
+        spsc_init(&queues[i], queue_storage[i], sizeof(command_t), COMMAND_QUEUE_SIZE);
+    }
+    for (int i = 0; i < COMMAND_BLOB_COUNT; i++) {
+        atomic_init(&blob_busy[i], false);
+    }
+    memset(&frag, 0, sizeof(frag));
+    memset(&command_stats, 0, sizeof(command_stats));
+}
+
+// The topic in an event is not NUL terminated
+static const command_route_t *route_lookup(const char *topic, size_t len) {
+    uint32_t h = topic_hash(topic, len);
+    for (uint32_t slot = h & (ROUTE_SLOTS - 1); route_slots[slot] != 0; slot = (slot + 1) & (ROUTE_SLOTS - 1)) {
+        size_t i = route_slots[slot] - 1;
+        if (route_hashes[i] == h && route_lens[i] == len && memcmp(routes[i].topic, topic, len) == 0) {
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_command_topic(const char *topic, size_t len) {
+    size_t prefix = sizeof(COMMAND_TOPIC_PREFIX) - 1;
+    return len >= prefix && memcmp(topic, COMMAND_TOPIC_PREFIX, prefix) == 0;
+}
+
+// Reads up to max non-negative numbers separated by ':', ',' or ' ' straight from the
+// payload. Returns how many there were, or -1 if there is anything else in it.
+static int parse_args(const char *p, size_t len, int32_t *args, int max) {
+    int argc = 0;
+    size_t i = 0;
+    // A trailing newline is fine (mosquitto_pub -l and friends)
+    while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r')) {
+        len--;
+    }
+    while (i < len) {
+        if (argc == max || p[i] < '0' || p[i] > '9') {
+            return -1;
+        }
+        int32_t v = 0;
+        while (i < len && p[i] >= '0' && p[i] <= '9') {
+            if (v > 99999999) {
+                return -1;
+            }
+            v = v * 10 + (p[i++] - '0');
+        }
+        args[argc++] = v;
+        if (i < len) {
+            if (p[i] != ':' && p[i] != ',' && p[i] != ' ') {
+                return -1;
+            }
+            // Nothing may follow the last separator
+            if (++i == len) {
+                return -1;
+            }
+        }
+    }
+    return argc;
+}
+
+static int claim_blob(void) {
+    for (int i = 0; i < COMMAND_BLOB_COUNT; i++) {
+        // Acquire so the owner is really done reading before we write into it again
+        if (!atomic_load_explicit(&blob_busy[i], memory_order_acquire)) {
+            atomic_store_explicit(&blob_busy[i], true, memory_order_relaxed);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void free_blob(uint8_t blob) {
+    if (blob < COMMAND_BLOB_COUNT) {
+        atomic_store_explicit(&blob_busy[blob], false, memory_order_release);
+    }
+}
+
+// Parses (or wraps) a complete payload and queues it for its owner. A blob the
+// payload lives in is passed on with the command, or freed if it doesn't need it.
+static void dispatch(const command_route_t *route, const char *payload, size_t len, uint8_t blob) {
+    command_t cmd = {
+        .id = (uint8_t)route->id,
+        .blob = COMMAND_NO_BLOB,
+        .len = (uint16_t)len,
+    };
+    command_stats.received++;
+
+    if (route->blob) {
+        cmd.blob = blob;
+    } else {
+        int argc = parse_args(payload, len, cmd.args, COMMAND_MAX_ARGS);
+        if (argc < route->min_args || argc > route->max_args) {
+            command_stats.bad_payload++;
+            ESP_LOGW(TAG, "Bad payload on %s: %.*s", route->topic, (int)(len > 32 ? 32 : len), payload);
+            free_blob(blob);
+            return;
+        }
+        // The numbers are all the owner needs
+        free_blob(blob);
+        cmd.argc = (uint8_t)argc;
+    }
+
+    if (!spsc_push(&queues[route->owner], &cmd)) {
+        command_stats.queue_full++;
+        free_blob(cmd.blob);
+        ESP_LOGW(TAG, "Command queue full, dropping %s", route->topic);
+        return;
+    }
+    command_stats.dispatched++;
+    if (route->owner == CMD_OWNER_DATA_SEND && dataSendTaskHandle != NULL) {
+        xTaskNotifyGive(dataSendTaskHandle);
+    }
+}
+
+bool command_handle_event(const esp_mqtt_event_t *event) {
+    size_t len = event->data_len > 0 ? (size_t)event->data_len : 0;
+    size_t total = event->total_data_len > event->data_len ? (size_t)event->total_data_len : len;
+    size_t offset = event->current_data_offset > 0 ? (size_t)event->current_data_offset : 0;
+
+    // Only the first fragment of a message carries the topic
+    if (offset > 0) {
+        if (!frag.active) {
+            return false;
+        }
+        if (offset != frag.received || offset + len > frag.total) {
+            command_stats.incomplete++;
+            if (frag.route != NULL) {
+                free_blob(frag.blob);
+            }
+            frag.active = false;
+            return true;
+        }
+        command_stats.fragments++;
+        if (frag.route != NULL) {
+            memcpy(blobs[frag.blob] + offset, event->data, len);
+        }
+        frag.received += len;
+        if (frag.received >= frag.total) {
+            frag.active = false;
+            if (frag.route != NULL) {
+                dispatch(frag.route, (const char *)blobs[frag.blob], frag.total, frag.blob);
+            }
+        }
+        return true;
+    }
+
+    // A new message while the last one is still missing pieces
+    if (frag.active) {
+        command_stats.incomplete++;
+        if (frag.route != NULL) {
+            free_blob(frag.blob);
+        }
+        frag.active = false;
+    }
+
+    size_t topic_len = event->topic_len > 0 ? (size_t)event->topic_len : 0;
+    const command_route_t *route = topic_len ? route_lookup(event->topic, topic_len) : NULL;
+    if (route == NULL) {
+        if (is_command_topic(event->topic, topic_len)) {
+            command_stats.unknown_topic++;
+            ESP_LOGW(TAG, "Unknown command topic %.*s", (int)topic_len, event->topic);
+            return true;
+        }
+        return false;
+    }
+
+    // Small commands are parsed right where the MQTT client put them
+    if (total == len && !route->blob) {
+        dispatch(route, event->data, len, COMMAND_NO_BLOB);
+        return true;
+    }
+
+    // Everything else needs a place to live after this event: fragmented messages are
+    // put back together there, blobs stay there until the owner is done with them
+    int blob = total <= COMMAND_BLOB_SIZE ? claim_blob() : -1;
+    if (blob < 0) {
+        command_stats.too_big++;
+        ESP_LOGW(TAG, "No room for %u bytes on %s", (unsigned)total, route->topic);
+        route = NULL;
+    } else {
+        memcpy(blobs[blob], event->data, len);
+    }
+    if (total == len) {
+        if (route != NULL) {
+            dispatch(route, (const char *)blobs[blob], len, (uint8_t)blob);
+        }
+        return true;
+    }
+
+    command_stats.fragments++;
+    frag.active = true;
+    frag.route = route;
+    frag.blob = blob < 0 ? COMMAND_NO_BLOB : (uint8_t)blob;
+    frag.total = total;
+    frag.received = len;
+    return true;
+}
+
+bool command_take(command_owner_t owner, command_t *cmd) {
+    return spsc_pop(&queues[owner], cmd);
+}
+
+const uint8_t *command_blob(const command_t *cmd) {
+    return cmd->blob < COMMAND_BLOB_COUNT ? blobs[cmd->blob] : NULL;
+}
+
+void command_release(const command_t *cmd) {
+    free_blob(cmd->blob);
+}
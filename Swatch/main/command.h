@@ -0,0 +1,86 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "mqtt_client.h"
+
+// Commands pushed to the watch over MQTT. The MQTT task only routes and parses them
+// (topic lookup in a hash table built at startup, numbers read straight out of the
+// event buffer, multi-fragment messages reassembled into preallocated blobs) and then
+// hands them to the task that owns the state through a lock-free ring. It never
+// touches that state itself.
+
+// Command topics are COMMAND_TOPIC_PREFIX + name (the bare MQTT topic still takes a BPM value)
+#define COMMAND_TOPIC_PREFIX "hexagon/cmd/"
+
+// Numbers a command can carry ("72", "2:30000:5000:120:40", ...)
+#define COMMAND_MAX_ARGS 5
+
+// Bulk payloads (calibration data) are reassembled into one of these buffers and stay
+// there until the owner is done with them. Anything bigger is dropped.
+#define COMMAND_BLOB_COUNT 2
+#define COMMAND_BLOB_SIZE 2048
+#define COMMAND_NO_BLOB 0xFF
+
+// Commands waiting per owner (power of two)
+#define COMMAND_QUEUE_SIZE 8
+
+typedef enum {
+    CMD_NONE = 0,
+    CMD_BPM_OVERRIDE,       // args[0] = BPM reported with the next beat
+    CMD_PUBLISH_POLICY,     // args = deadband:max_silence_ms:min_interval_ms:alarm_high:alarm_low
+    CMD_ALARM_LIMITS,       // args = alarm_high:alarm_low (0 = off)
+    CMD_CALIBRATION,        // blob = raw calibration data for the sensor
+    CMD_AGGREGATION,        // args = window_ms:step_ms:raw (see aggregate.h)
+} command_id_t;
+
+// Task that a command is handed to
+typedef enum {
+    CMD_OWNER_SENSOR = 0,
+    CMD_OWNER_DATA_SEND,
+    CMD_OWNER_COUNT,
+} command_owner_t;
+
+typedef struct {
+    uint8_t id;             // command_id_t
+    uint8_t argc;
+    uint8_t blob;           // blob buffer with the payload, COMMAND_NO_BLOB if there is none
+    uint8_t reserved;
+    uint16_t len;           // payload length
+    int32_t args[COMMAND_MAX_ARGS];
+} command_t;
+
+// What happened to incoming messages so far (written by the MQTT task only)
+typedef struct {
+    uint32_t received;      // complete messages on a command topic
+    uint32_t dispatched;
+    uint32_t unknown_topic;
+    uint32_t bad_payload;
+    uint32_t too_big;       // longer than COMMAND_BLOB_SIZE, or no free blob
+    uint32_t incomplete;    // fragments missing or out of order
+    uint32_t queue_full;
+    uint32_t fragments;
+} command_stats_t;
+
+extern command_stats_t command_stats;
+
+// Builds the topic table and the queues (call once before MQTT starts)
+void command_init(void);
+
+// Feeds one MQTT_EVENT_DATA event (from the MQTT task only). Returns true if the topic
+// is a command topic, whether or not the command was good.
+bool command_handle_event(const esp_mqtt_event_t *event);
+
+// Owner side: takes the next command for this owner, false if there is none.
+// A command with a blob must be given back with command_release().
+bool command_take(command_owner_t owner, command_t *cmd);
+
+// Payload of a command that carries a blob (NULL if it has none)
+const uint8_t *command_blob(const command_t *cmd);
+
+// Hands the blob buffer back so the MQTT task can reuse it
+void command_release(const command_t *cmd);
+
+#endif
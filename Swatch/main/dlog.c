@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "dlog.h"
+
+// One ring per core, so the two cores never fight over a cache line. Tasks on the
+// same core still can (one preempts the other halfway through a record), and an
+// unpinned task may move between picking the ring and writing to it, so producers
+// claim a slot with a compare-and-swap and only the log task consumes.
+#ifndef DLOG_CORES
+#define DLOG_CORES 2
+#endif
+
+// Every slot knows which ring position it is for next: pos & ~(DLOG_RING_SIZE - 1)
+// while free for pos, one more once the record is in, and DLOG_RING_SIZE more when
+// the log task is done with it. All of it wraps cleanly at 2^32, and all zero is
+// "free for the first lap", so the rings work before anything has started.
+typedef struct {
+    _Atomic uint32_t turn;
+    uint32_t timestamp_ms;
+    const dlog_site_t *site;
+    uint32_t nargs;
+    uintptr_t args[DLOG_MAX_ARGS];
+} dlog_entry_t;
+
+typedef struct {
+    dlog_entry_t entries[DLOG_RING_SIZE];
+    _Atomic uint32_t head;      // next slot to claim, any producer
+    uint32_t tail;              // next slot to print, only the log task
+} dlog_ring_t;
+
+_Static_assert((DLOG_RING_SIZE & (DLOG_RING_SIZE - 1)) == 0, "DLOG_RING_SIZE must be a power of two");
+
+static dlog_ring_t rings[DLOG_CORES];
+static _Atomic uint32_t written;
+static _Atomic uint32_t dropped;
+static _Atomic uint32_t printed;
+
+void dlog_write(const dlog_site_t *site, uint32_t nargs, const uintptr_t *args) {
+    dlog_ring_t *ring = &rings[(uint32_t)esp_cpu_get_core_id() % DLOG_CORES];
+    uint32_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    dlog_entry_t *entry;
+    for (;;) {
+        entry = &ring->entries[pos & (DLOG_RING_SIZE - 1)];
+        uint32_t lap = pos & ~(uint32_t)(DLOG_RING_SIZE - 1);
+        int32_t diff = (int32_t)(atomic_load_explicit(&entry->turn, memory_order_acquire) - lap);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The log task hasn't printed this slot's last record yet
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            // Someone else got this slot
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    entry->timestamp_ms = esp_log_timestamp();
+    entry->site = site;
+    entry->nargs = nargs < DLOG_MAX_ARGS ? nargs : DLOG_MAX_ARGS;
+    memcpy(entry->args, args, entry->nargs * sizeof(uintptr_t));
+    atomic_store_explicit(&entry->turn, (pos & ~(uint32_t)(DLOG_RING_SIZE - 1)) + 1, memory_order_release);
+    atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+}
+
+// Does one conversion of a printf format: spec is "%" up to and including the
+// conversion character, the argument is cast back to what that conversion expects
+static int format_one(char *out, size_t size, const char *spec, char conv, bool is_long, uintptr_t arg) {
+    switch (conv) {
+        case 'd':
+        case 'i':
+            return is_long ? snprintf(out, size, spec, (long)(intptr_t)arg) : snprintf(out, size, spec, (int)arg);
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            return is_long ? snprintf(out, size, spec, (unsigned long)arg) : snprintf(out, size, spec, (unsigned)arg);
+        case 'c':
+            return snprintf(out, size, spec, (int)arg);
+        case 's':
+            return snprintf(out, size, spec, arg ? (const char *)arg : "(null)");
+        case 'p':
+            return snprintf(out, size, spec, (void *)arg);
+        default:
+            return snprintf(out, size, "%s", spec);
+    }
+}
+
+size_t dlog_format(const dlog_site_t *site, const uintptr_t *args, uint32_t nargs, char *out, size_t size) {
+    size_t used = 0;
+    uint32_t next = 0;
+    const char *f = site->format;
+    if (size == 0) {
+        return 0;
+    }
+    while (*f && used + 1 < size) {
+        if (*f != '%') {
+            out[used++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[used++] = '%';
+            f += 2;
+            continue;
+        }
+        // Flags, width, precision and length up to the conversion character
+        char spec[16];
+        size_t n = 0;
+        bool is_long = false;
+        spec[n++] = *f++;
+        while (*f && strchr("-+ #0123456789.lhz", *f) && n < sizeof(spec) - 2) {
+            is_long |= *f == 'l' || *f == 'z';
+            spec[n++] = *f++;
+        }
+        if (!*f) {
+            break;
+        }
+        char conv = *f++;
+        spec[n++] = conv;
+        spec[n] = '\0';
+        int len = format_one(out + used, size - used, spec, conv, is_long, next < nargs ? args[next] : 0);
+        next++;
+        if (len > 0) {
+            used += (size_t)len < size - used ? (size_t)len : size - used - 1;
+        }
+    }
+    out[used] = '\0';
+    return used;
+}
+
+// The oldest record waiting on any core, or NULL
+static dlog_entry_t *oldest(dlog_ring_t **from) {
+    dlog_entry_t *best = NULL;
+    for (int c = 0; c < DLOG_CORES; c++) {
+        dlog_ring_t *ring = &rings[c];
+        dlog_entry_t *entry = &ring->entries[ring->tail & (DLOG_RING_SIZE - 1)];
+        uint32_t full = (ring->tail & ~(uint32_t)(DLOG_RING_SIZE - 1)) + 1;
+        if (atomic_load_explicit(&entry->turn, memory_order_acquire) != full) {
+            continue;
+        }
+        if (!best || (int32_t)(entry->timestamp_ms - best->timestamp_ms) < 0) {
+            best = entry;
+            *from = ring;
+        }
+    }
+    return best;
+}
+
+uint32_t dlog_drain(void) {
+    static const char letters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+    char line[DLOG_LINE_MAX];
+    uint32_t count = 0;
+    dlog_ring_t *ring;
+    dlog_entry_t *entry;
+    while ((entry = oldest(&ring)) != NULL) {
+        const dlog_site_t *site = entry->site;
+        if (esp_log_level_get(site->tag) >= site->level) {
+            dlog_format(site, entry->args, entry->nargs, line, sizeof(line));
+            printf("%c (%lu) %s: %s\n", letters[site->level <= ESP_LOG_VERBOSE ? site->level : 0],
+                   (unsigned long)entry->timestamp_ms, site->tag, line);
+        }
+        // Hand the slot to the producers for the next lap
+        atomic_store_explicit(&entry->turn, (ring->tail & ~(uint32_t)(DLOG_RING_SIZE - 1)) + DLOG_RING_SIZE,
+                              memory_order_release);
+        ring->tail++;
+        count++;
+    }
+    atomic_fetch_add_explicit(&printed, count, memory_order_relaxed);
+    return count;
+}
+
+void dlog_get_stats(dlog_stats_t *stats) {
+    stats->written = atomic_load_explicit(&written, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+    stats->printed = atomic_load_explicit(&printed, memory_order_relaxed);
+}
+
+void dlog_task(void *pvParameters) {
+    for (;;) {
+        dlog_drain();
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_MS));
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_log.h"
+
+// Deferred logging for the hot paths. A DLOGx() call formats nothing: it stores which
+// call site it is (a pointer to a static const descriptor holding the tag and format
+// string) and its raw arguments in a lock-free ring of the core it runs on, and returns.
+// The log task (dlog_task, lowest priority) turns the records into the usual
+// "I (timestamp) TAG: text" lines later, with the time the call was made.
+//
+// Arguments are kept as uintptr_t, so only integers up to 32 bits, chars and pointers
+// to strings that outlive the record (literals, static tables) can be logged. No
+// floats, no 64-bit values, no '*' widths: scale to an integer instead.
+//
+// Levels above DLOG_LEVEL are compiled out, call site and all. What gets through is
+// filtered again by the runtime log level of the tag when it is printed.
+
+// Most verbose level compiled in (an esp_log_level_t)
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL ESP_LOG_INFO
+#endif
+
+// Arguments one record can carry
+#define DLOG_MAX_ARGS 8
+
+// Records per core ring (a power of two). A full ring drops new records and counts them.
+#ifndef DLOG_RING_SIZE
+#define DLOG_RING_SIZE 32
+#endif
+
+// How often the log task looks at the rings (ms)
+#ifndef DLOG_DRAIN_MS
+#define DLOG_DRAIN_MS 100
+#endif
+
+// Longest line the log task prints (longer ones are cut)
+#define DLOG_LINE_MAX 160
+
+// One call site. The address is the format id: it is fixed for a build, and the ELF
+// symbol table maps it back to the file if a raw dump ever needs decoding.
+typedef struct {
+    esp_log_level_t level;
+    const char *tag;
+    const char *format;
+} dlog_site_t;
+
+typedef struct {
+    uint32_t written;       // records stored since boot
+    uint32_t dropped;       // records lost to a full ring
+    uint32_t printed;       // records formatted by the log task
+} dlog_stats_t;
+
+#define DLOGE(tag, format, ...) DLOG_RECORD(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG_RECORD(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG_RECORD(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) DLOG_RECORD(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+// The printf in "if (0)" never runs, it is there so the compiler checks the arguments
+// against the format as it does for ESP_LOGx
+#define DLOG_RECORD(level, tag, format, ...) do {                                       \
+        if ((level) <= DLOG_LEVEL) {                                                    \
+            static const dlog_site_t dlog_site_ = { (level), (tag), (format) };         \
+            const uintptr_t dlog_args_[] = { DLOG_CASTS(__VA_ARGS__) 0 };               \
+            dlog_write(&dlog_site_, DLOG_NARGS(__VA_ARGS__), dlog_args_);               \
+            if (0) {                                                                    \
+                printf(format, ##__VA_ARGS__);                                          \
+            }                                                                           \
+        }                                                                               \
+    } while (0)
+
+// Number of arguments (0 to DLOG_MAX_ARGS), and each of them cast with a comma after it
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define DLOG_CASTS(...) DLOG_CAT(DLOG_CASTS_, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a##b
+#define DLOG_CASTS_0()
+#define DLOG_CASTS_1(a) (uintptr_t)(a),
+#define DLOG_CASTS_2(a, ...) (uintptr_t)(a), DLOG_CASTS_1(__VA_ARGS__)
+#define DLOG_CASTS_3(a, ...) (uintptr_t)(a), DLOG_CASTS_2(__VA_ARGS__)
+#define DLOG_CASTS_4(a, ...) (uintptr_t)(a), DLOG_CASTS_3(__VA_ARGS__)
+#define DLOG_CASTS_5(a, ...) (uintptr_t)(a), DLOG_CASTS_4(__VA_ARGS__)
+#define DLOG_CASTS_6(a, ...) (uintptr_t)(a), DLOG_CASTS_5(__VA_ARGS__)
+#define DLOG_CASTS_7(a, ...) (uintptr_t)(a), DLOG_CASTS_6(__VA_ARGS__)
+#define DLOG_CASTS_8(a, ...) (uintptr_t)(a), DLOG_CASTS_7(__VA_ARGS__)
+
+// Stores a record in the ring of the current core. Any task or core, never blocks.
+void dlog_write(const dlog_site_t *site, uint32_t nargs, const uintptr_t *args);
+
+// Formats a record into out like snprintf would. Returns the length written (at most size - 1).
+size_t dlog_format(const dlog_site_t *site, const uintptr_t *args, uint32_t nargs, char *out, size_t size);
+
+// Prints everything waiting, oldest first across the cores. Returns how many records
+// it took out. Only one task may drain (the log task, or a bench once it has stopped).
+uint32_t dlog_drain(void);
+
+void dlog_get_stats(dlog_stats_t *stats);
+
+// The log task: drains every DLOG_DRAIN_MS
+void dlog_task(void *pvParameters);
+
+#endif
@@ -0,0 +1,310 @@
+#include <string.h>
+#include "esp_log.h"
+#include "flashlog.h"
+#define TAG "FLASHLOG"
+
+// Sector header: magic + sequence number (erased flash reads as all 0xFF)
+#define SECTOR_MAGIC 0x474C5248u   // "HRLG"
+#define SECTOR_HEADER_SIZE 8
+
+// Record header: payload length, CRC-16 of the payload, "sent" word
+#define RECORD_HEADER_SIZE 8
+#define RECORD_FREE 0xFFFFu
+#define RECORD_NOT_SENT 0xFFFFFFFFu
+
+typedef struct {
+    uint16_t len;
+    uint16_t crc;
+    uint32_t sent;
+} record_header_t;
+
+// Records are padded to 4 bytes so every header stays word aligned
+static uint32_t record_size(uint16_t len) {
+    return (RECORD_HEADER_SIZE + len + 3u) & ~3u;
+}
+
+// CRC-16/CCITT-FALSE, small and good enough to spot torn writes
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static size_t pos_address(const flashlog_t *log, const flashlog_pos_t *pos) {
+    return (size_t)pos->sector * log->sector_size + pos->offset;
+}
+
+static bool same_pos(const flashlog_pos_t *a, const flashlog_pos_t *b) {
+    return a->sector == b->sector && a->offset == b->offset;
+}
+
+// Reads the record header at pos. Returns false where a sector's records end
+// (free space, or a length that can't be right).
+static bool read_header(const flashlog_t *log, const flashlog_pos_t *pos, record_header_t *hdr) {
+    if (pos->offset + RECORD_HEADER_SIZE > log->sector_size) {
+        return false;
+    }
+    if (esp_partition_read(log->part, pos_address(log, pos), hdr, sizeof(*hdr)) != ESP_OK) {
+        return false;
+    }
+    if (hdr->len == RECORD_FREE || hdr->len > FLASHLOG_RECORD_MAX ||
+        pos->offset + record_size(hdr->len) > log->sector_size) {
+        return false;
+    }
+    return true;
+}
+
+// Moves pos to the next unsent record (crossing into the next sector if needed) and
+// reads its header. Returns false when pos has reached the write position.
+static bool next_record(const flashlog_t *log, flashlog_pos_t *pos, record_header_t *hdr) {
+    while (!same_pos(pos, &log->write)) {
+        if (pos->sector == log->write.sector) {
+            // Can't fail in the write sector, but don't loop forever if it does
+            if (!read_header(log, pos, hdr)) {
+                *pos = log->write;
+                return false;
+            }
+            return true;
+        }
+        if (read_header(log, pos, hdr)) {
+            return true;
+        }
+        pos->sector = (pos->sector + 1) % log->sector_count;
+        pos->offset = SECTOR_HEADER_SIZE;
+    }
+    return false;
+}
+
+// Erases the sector after the write sector and starts writing there
+static esp_err_t start_next_sector(flashlog_t *log) {
+    uint32_t next = (log->write.sector + 1) % log->sector_count;
+
+    // The log is full: whatever is still unsent in the oldest sector goes
+    if (log->read.sector == next) {
+        flashlog_pos_t pos = log->read;
+        record_header_t hdr;
+        while (read_header(log, &pos, &hdr)) {
+            pos.offset += record_size(hdr.len);
+            log->pending--;
+            log->lost++;
+        }
+        log->read.sector = log->pending > 0 ? (next + 1) % log->sector_count : next;
+        log->read.offset = SECTOR_HEADER_SIZE;
+    }
+
+    esp_err_t err = esp_partition_erase_range(log->part, (size_t)next * log->sector_size, log->sector_size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->erases++;
+
+    uint32_t header[2] = { SECTOR_MAGIC, log->write_seq + 1 };
+    err = esp_partition_write(log->part, (size_t)next * log->sector_size, header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->bytes_written += sizeof(header);
+    log->write_seq++;
+    log->write.sector = next;
+    log->write.offset = SECTOR_HEADER_SIZE;
+    return ESP_OK;
+}
+
+esp_err_t flashlog_open(flashlog_t *log, const char *label) {
+    memset(log, 0, sizeof(*log));
+    log->part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (log->part == NULL) {
+        ESP_LOGW(TAG, "No \"%s\" partition, samples can't be kept while offline", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    log->sector_size = log->part->erase_size;
+    log->sector_count = log->part->size / log->sector_size;
+    if (log->sector_count < 2) {
+        ESP_LOGE(TAG, "Partition \"%s\" needs at least 2 sectors", label);
+        log->part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Find the oldest and newest sectors that were written
+    bool found = false;
+    uint32_t oldest = 0, newest = 0;
+    uint32_t oldest_seq = 0;
+    for (uint32_t i = 0; i < log->sector_count; i++) {
+        uint32_t header[2];
+        esp_err_t err = esp_partition_read(log->part, (size_t)i * log->sector_size, header, sizeof(header));
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (header[0] != SECTOR_MAGIC) {
+            continue;
+        }
+        if (!found || header[1] < oldest_seq) {
+            oldest = i;
+            oldest_seq = header[1];
+        }
+        if (!found || header[1] > log->write_seq) {
+            newest = i;
+            log->write_seq = header[1];
+        }
+        found = true;
+    }
+
+    if (!found) {
+        // Fresh partition: start at the first sector
+        log->write.sector = log->sector_count - 1;
+        log->write_seq = 0;
+        log->read = log->write;
+        esp_err_t err = start_next_sector(log);
+        log->read = log->write;
+        ESP_LOGI(TAG, "Started a new log in %lu sectors", (unsigned long)log->sector_count);
+        return err;
+    }
+
+    // Walk the records from oldest to newest. Replay continues after the last one marked sent.
+    log->read.sector = oldest;
+    log->read.offset = SECTOR_HEADER_SIZE;
+    flashlog_pos_t pos = log->read;
+    record_header_t hdr;
+    while (1) {
+        while (read_header(log, &pos, &hdr)) {
+            pos.offset += record_size(hdr.len);
+            if (hdr.sent != RECORD_NOT_SENT) {
+                log->read = pos;
+                log->pending = 0;
+            } else {
+                log->pending++;
+            }
+        }
+        if (pos.sector == newest) {
+            break;
+        }
+        pos.sector = (pos.sector + 1) % log->sector_count;
+        pos.offset = SECTOR_HEADER_SIZE;
+    }
+
+    // Whatever follows the last good record in the newest sector is not trusted,
+    // a damaged tail just makes the next append move on to a fresh sector
+    log->write = pos;
+    if (pos.offset + RECORD_HEADER_SIZE <= log->sector_size &&
+        esp_partition_read(log->part, pos_address(log, &pos), &hdr, sizeof(hdr)) == ESP_OK &&
+        hdr.len != RECORD_FREE) {
+        log->write.offset = log->sector_size;
+    }
+
+    ESP_LOGI(TAG, "Log has %lu unsent records (write sector %lu, seq %lu)",
+             (unsigned long)log->pending, (unsigned long)log->write.sector, (unsigned long)log->write_seq);
+    return ESP_OK;
+}
+
+esp_err_t flashlog_append(flashlog_t *log, const void *data, size_t len) {
+    if (log->part == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len == 0 || len > FLASHLOG_RECORD_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint32_t size = record_size((uint16_t)len);
+    if (log->write.offset + size > log->sector_size) {
+        esp_err_t err = start_next_sector(log);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    // Header and payload go out in one write, padding stays erased (0xFF)
+    record_header_t hdr = {
+        .len = (uint16_t)len,
+        .crc = crc16(data, len),
+        .sent = RECORD_NOT_SENT,
+    };
+    memcpy(log->scratch, &hdr, sizeof(hdr));
+    memcpy(log->scratch + RECORD_HEADER_SIZE, data, len);
+    memset(log->scratch + RECORD_HEADER_SIZE + len, 0xFF, size - RECORD_HEADER_SIZE - len);
+
+    esp_err_t err = esp_partition_write(log->part, pos_address(log, &log->write), log->scratch, size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->write.offset += size;
+    log->bytes_written += size;
+    log->appended++;
+    log->pending++;
+    return ESP_OK;
+}
+
+size_t flashlog_read(flashlog_t *log, uint8_t *buf, size_t len, flashlog_span_t *span) {
+    memset(span, 0, sizeof(*span));
+    span->end = log->read;
+    if (log->part == NULL) {
+        return 0;
+    }
+
+    size_t used = 0;
+    flashlog_pos_t pos = log->read;
+    record_header_t hdr;
+    while (next_record(log, &pos, &hdr)) {
+        if (used + hdr.len > len) {
+            break;
+        }
+        esp_err_t err = esp_partition_read(log->part, pos_address(log, &pos) + RECORD_HEADER_SIZE,
+                                           buf + used, hdr.len);
+        if (err != ESP_OK) {
+            break;
+        }
+
+        if (crc16(buf + used, hdr.len) != hdr.crc) {
+            span->skipped++;
+            log->corrupt++;
+        } else {
+            used += hdr.len;
+            span->records++;
+            span->last = pos;
+        }
+        pos.offset += record_size(hdr.len);
+        span->end = pos;
+    }
+    return used;
+}
+
+esp_err_t flashlog_consume(flashlog_t *log, const flashlog_span_t *span) {
+    if (log->part == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Clearing the sent word of the last record marks everything before it too
+    if (span->records > 0) {
+        uint32_t sent = 0;
+        esp_err_t err = esp_partition_write(log->part, pos_address(log, &span->last) + 4, &sent, sizeof(sent));
+        if (err != ESP_OK) {
+            return err;
+        }
+        log->bytes_written += sizeof(sent);
+    }
+
+    uint32_t n = span->records + span->skipped;
+    log->pending = n > log->pending ? 0 : log->pending - n;
+    log->replayed += span->records;
+    log->read = span->end;
+    return ESP_OK;
+}
+
+uint32_t flashlog_recount(flashlog_t *log) {
+    if (log->part == NULL) {
+        return 0;
+    }
+    uint32_t n = 0;
+    flashlog_pos_t pos = log->read;
+    record_header_t hdr;
+    while (next_record(log, &pos, &hdr)) {
+        pos.offset += record_size(hdr.len);
+        n++;
+    }
+    log->pending = n;
+    return n;
+}
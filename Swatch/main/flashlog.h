@@ -0,0 +1,80 @@
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+// Persistent circular log of payloads in a raw flash partition, used to keep sample
+// batches that could not be published until the broker is back.
+//
+// Layout: the partition is split into erase sectors that are used strictly in order,
+// so every sector is erased exactly once per trip around the partition (even wear).
+// Each sector starts with a small header holding a sequence number, then records are
+// appended into erased space and never rewritten. The only in-place write is clearing
+// the "sent" word of a record (1 -> 0 bits, which NOR flash allows without an erase)
+// to remember how far the replay got. When the log is full the oldest sector is erased
+// and whatever was still unsent in it is lost (and counted).
+
+// Biggest payload one record can hold
+#define FLASHLOG_RECORD_MAX 512
+
+// Where a record starts (sector index and byte offset inside the sector)
+typedef struct {
+    uint32_t sector;
+    uint32_t offset;
+} flashlog_pos_t;
+
+typedef struct {
+    const esp_partition_t *part;
+    uint32_t sector_size;
+    uint32_t sector_count;
+
+    flashlog_pos_t write;       // where the next record goes
+    uint32_t write_seq;         // sequence number of the write sector
+    flashlog_pos_t read;        // oldest record not replayed yet
+    uint32_t pending;           // records not replayed yet
+
+    // Counters so we can see what the log is doing
+    uint32_t appended;
+    uint32_t replayed;
+    uint32_t lost;              // unsent records erased because the log was full
+    uint32_t corrupt;           // records skipped because their CRC didn't match
+    uint32_t erases;
+    uint32_t bytes_written;
+
+    uint8_t scratch[8 + FLASHLOG_RECORD_MAX];   // one record (header + payload)
+} flashlog_t;
+
+// Opens the data partition with this label and finds the write and replay positions
+// left by the previous boot (scans the record headers, so it takes a moment).
+esp_err_t flashlog_open(flashlog_t *log, const char *label);
+
+// Appends one payload (at most FLASHLOG_RECORD_MAX bytes). Erases the next sector first
+// when the current one is full.
+esp_err_t flashlog_append(flashlog_t *log, const void *data, size_t len);
+
+// What one flashlog_read() picked up, handed back to flashlog_consume() once it was sent
+typedef struct {
+    uint32_t records;           // records copied out
+    uint32_t skipped;           // corrupt records stepped over
+    flashlog_pos_t last;        // start of the last record copied out
+    flashlog_pos_t end;         // where the next read starts
+} flashlog_span_t;
+
+// Copies the oldest unsent records into buf back to back (so payloads have to know
+// their own length), without marking them sent. Stops before the first record that
+// would not fit (buf should hold at least FLASHLOG_RECORD_MAX bytes).
+// Returns the number of bytes used.
+size_t flashlog_read(flashlog_t *log, uint8_t *buf, size_t len, flashlog_span_t *span);
+
+// Marks the records of a span as sent, so they are not replayed again (even after a reboot)
+esp_err_t flashlog_consume(flashlog_t *log, const flashlog_span_t *span);
+
+// Counts the unsent records in flash again and sets pending to that, for when a read
+// finds nothing while pending says there is something. Returns the new pending.
+uint32_t flashlog_recount(flashlog_t *log);
+
+#endif
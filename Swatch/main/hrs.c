@@ -0,0 +1,46 @@
+#include "hrs.h"
+
+uint16_t hrs_rr_from_ms(int ibi_ms) {
+    if (ibi_ms <= 0) {
+        return 0;
+    }
+    uint32_t rr = ((uint32_t)ibi_ms * 1024u + 500u) / 1000u;
+    return rr > UINT16_MAX ? UINT16_MAX : (uint16_t)rr;
+}
+
+size_t hrs_encode_measurement(uint8_t *buf, size_t len, int bpm, uint8_t flags,
+                              const uint16_t *rr, size_t n_rr, size_t *rr_used) {
+    *rr_used = 0;
+    if (bpm < 0) {
+        bpm = 0;
+    }
+
+    // Only the flags we know how to fill in are kept
+    flags &= (HRS_FLAG_CONTACT_DETECTED | HRS_FLAG_CONTACT_SUPPORTED);
+    size_t bpm_len = bpm > 255 ? 2 : 1;
+    if (bpm_len == 2) {
+        flags |= HRS_FLAG_VALUE_UINT16;
+    }
+    if (len < 1 + bpm_len) {
+        return 0;
+    }
+
+    size_t pos = 1;
+    buf[pos++] = (uint8_t)(bpm & 0xFF);
+    if (bpm_len == 2) {
+        buf[pos++] = (uint8_t)((bpm >> 8) & 0xFF);
+    }
+
+    // RR-intervals are little-endian uint16, oldest first
+    while (*rr_used < n_rr && pos + 2 <= len) {
+        buf[pos++] = (uint8_t)(rr[*rr_used] & 0xFF);
+        buf[pos++] = (uint8_t)(rr[*rr_used] >> 8);
+        (*rr_used)++;
+    }
+    if (*rr_used > 0) {
+        flags |= HRS_FLAG_RR_PRESENT;
+    }
+
+    buf[0] = flags;
+    return pos;
+}
@@ -0,0 +1,31 @@
+#ifndef HRS_H
+#define HRS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bluetooth SIG Heart Rate Service pieces
+#define HRS_SERVICE_UUID 0x180D
+#define HRS_MEASUREMENT_UUID 0x2A37
+
+// Heart Rate Measurement flags (first byte of the value)
+#define HRS_FLAG_VALUE_UINT16    (1 << 0)
+#define HRS_FLAG_CONTACT_DETECTED (1 << 1)
+#define HRS_FLAG_CONTACT_SUPPORTED (1 << 2)
+#define HRS_FLAG_ENERGY_PRESENT  (1 << 3)
+#define HRS_FLAG_RR_PRESENT      (1 << 4)
+
+// CCCD bit a client writes to turn notifications on
+#define HRS_CCCD_NOTIFY 0x0001
+
+// Converts an interval in ms to the 1/1024 s units the spec uses for RR-intervals
+uint16_t hrs_rr_from_ms(int ibi_ms);
+
+// Builds one Heart Rate Measurement value into buf (at most len bytes, usually MTU - 3).
+// BPM above 255 switches to the 16-bit format. As many of the n_rr RR-intervals as fit
+// are appended; the number used is stored in *rr_used. Returns the value length (0 if
+// len is too small even for the BPM).
+size_t hrs_encode_measurement(uint8_t *buf, size_t len, int bpm, uint8_t flags,
+                              const uint16_t *rr, size_t n_rr, size_t *rr_used);
+
+#endif
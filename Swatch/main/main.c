@@ -1,46 +1,61 @@
 #include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
-#include "freertos/semphr.h"
 #include "ble.h"
 #include "mqtt.h"
+#include "wifi.h"
+#include "sensor.h"
+#include "metrics.h"
+#include "command.h"
+#include "boot.h"
+#include "tasks.h"
+#include "dlog.h"
 #include "esp_mac.h" 
 
 // Task handles for notifications or stack checks)
 TaskHandle_t dataSendTaskHandle = NULL;
-TaskHandle_t randomBpmTaskHandle = NULL;
-TaskHandle_t healthMonitorTaskHandle = NULL;
-
-// This is a queue for sending BPM values between tasks
-QueueHandle_t bpmQueue = NULL;
-
-// Mutex so two tasks don't mess with global_bpm at the same time
-SemaphoreHandle_t bpmMutex = NULL;
+TaskHandle_t sensorTaskHandle = NULL;
+TaskHandle_t metricsTaskHandle = NULL;
+
+// Lock-free ring for sending sensor records (beats and motion) between tasks
+// (size must be a power of two)
+#define SAMPLE_RING_SIZE 16
+static sensor_record_t sample_ring_storage[SAMPLE_RING_SIZE];
+spsc_ring_t sample_ring;
+
+// Bring up one radio each and go away. BLE and Wi-Fi spend most of their start-up
+// waiting on the controller and the access point, so they do it side by side.
+static void ble_start_task(void *pvParameters) {
+    ble_init();
+    vTaskDelete(NULL);
+}
 
-// This task just checks how much stack is left for other tasks (helps spot bugs or stack overflows)
-// void health_monitor_task(void *pvParameters) {
-//     while (1) {
-//         // Prints out how much stack is left for each task (in words)
-//         printf("[Health] DataSendTask stack left: %lu\n", uxTaskGetStackHighWaterMark(dataSendTaskHandle));
-//         printf("[Health] RandomBpmTask stack left: %lu\n", uxTaskGetStackHighWaterMark(randomBpmTaskHandle));
-//         vTaskDelay(pdMS_TO_TICKS(10000)); // Wait 10 seconds (pdMS_TO_TICKS convert ms to ticks)
-//     }
-// }
+static void net_start_task(void *pvParameters) {
+    wifi_init();
+    mqtt_init();    // starts the client once there is an IP address
+    vTaskDelete(NULL);
+}
 
 void app_main(void)
 {
-    // Create the queue and mutex first!
-    bpmQueue = xQueueCreate(5, sizeof(int));
-    if (!bpmQueue) printf("Failed to create BPM queue!\n");
-
-    bpmMutex = xSemaphoreCreateMutex();
-    if (!bpmMutex) printf("Failed to create BPM mutex!\n");
-
-    ble_init();
-    wifi_init();
-    mqtt_init();
-
-    xTaskCreate(data_send_task, "Data Send Task", 4096, NULL, 5, &dataSendTaskHandle);
-    xTaskCreate(random_bpm_task, "Random BPM Task", 2048, NULL, 10, &randomBpmTaskHandle);
+    // NVS, netif and the event loop are shared by BLE and Wi-Fi, so they go first (once)
+    boot_init();
+
+    // Set up the sample channels first!
+    if (!spsc_init(&sample_ring, sample_ring_storage, sizeof(sensor_record_t), SAMPLE_RING_SIZE)) printf("Failed to create sample ring!\n");
+
+    // And the command queues, the sensor task looks at them from its first block on
+    command_init();
+
+    // Sampling doesn't wait for any radio: beats from before the broker is there wait
+    // in the batch (and BLE has nobody to notify yet anyway). Stacks, priorities and
+    // cores are in tasks.c.
+    task_start(TASK_DATA_SEND, data_send_task, NULL, &dataSendTaskHandle);
+    task_start(TASK_SENSOR, sensor_task, NULL, &sensorTaskHandle);
+    task_start(TASK_BLE_START, ble_start_task, NULL, NULL);
+    task_start(TASK_NET_START, net_start_task, NULL, NULL);
+    // Stack use, CPU, heap and latencies of everything above, once a minute over MQTT
+    task_start(TASK_METRICS, metrics_task, NULL, &metricsTaskHandle);
+    // And the log lines the tasks above only recorded
+    task_start(TASK_LOG, dlog_task, NULL, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "metrics.h"
+#include "motion.h"
+#include "mqtt.h"
+#include "ble.h"
+#include "boot.h"
+#include "tasks.h"
+#include "wifi.h"
+#include "dlog.h"
+#define TAG "METRICS"
+
+metrics_hist_t metrics_publish_latency;
+metrics_hist_t metrics_ble_latency;
+metrics_hist_t metrics_sensor_jitter;
+metrics_data_send_t metrics_data_send;
+
+void metrics_hist_record(metrics_hist_t *hist, uint32_t value) {
+    int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    if (bucket >= METRICS_HIST_BUCKETS) {
+        bucket = METRICS_HIST_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&hist->buckets[bucket], 1, memory_order_relaxed);
+
+    uint32_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&hist->max, &max, value,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void metrics_hist_take(metrics_hist_t *hist, metrics_hist_snapshot_t *snap) {
+    snap->count = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        // A value recorded in between just ends up in the next period
+        snap->buckets[i] = atomic_exchange_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+        snap->count += snap->buckets[i];
+    }
+    snap->max = atomic_exchange_explicit(&hist->max, 0, memory_order_relaxed);
+}
+
+void metrics_hist_peek(metrics_hist_t *hist, metrics_hist_snapshot_t *snap) {
+    snap->count = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        snap->buckets[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        snap->count += snap->buckets[i];
+    }
+    snap->max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+}
+
+uint32_t metrics_hist_percentile(const metrics_hist_snapshot_t *snap, uint32_t percent) {
+    if (snap->count == 0) {
+        return 0;
+    }
+    uint32_t target = (uint32_t)(((uint64_t)snap->count * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS - 1; i++) {
+        seen += snap->buckets[i];
+        if (seen >= target) {
+            uint32_t upper = 1u << i;
+            // Never claim more than what was actually seen
+            return upper < snap->max ? upper : snap->max;
+        }
+    }
+    return snap->max;
+}
+
+// snprintf at the end of what is already in buf (keeps counting past the end, so the
+// caller can tell the report got cut off)
+static size_t __attribute__((format(printf, 4, 5))) append(char *buf, size_t len, size_t used, const char *fmt, ...) {
+    if (used >= len) {
+        return used;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + used, len - used, fmt, args);
+    va_end(args);
+    return n < 0 ? used : used + (size_t)n;
+}
+
+static size_t append_hist(char *buf, size_t len, size_t used, const char *name, metrics_hist_t *hist) {
+    metrics_hist_snapshot_t snap;
+    metrics_hist_take(hist, &snap);
+    return append(buf, len, used, ",\"%s\":{\"n\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu}", name,
+                  (unsigned long)snap.count,
+                  (unsigned long)metrics_hist_percentile(&snap, 50),
+                  (unsigned long)metrics_hist_percentile(&snap, 90),
+                  (unsigned long)metrics_hist_percentile(&snap, 99),
+                  (unsigned long)snap.max);
+}
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+// Task list of the last report, to turn the run time counters into CPU use per period
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+static TaskHandle_t prev_handles[METRICS_MAX_TASKS];
+static uint32_t prev_runtime[METRICS_MAX_TASKS];
+static UBaseType_t prev_count = 0;
+static uint32_t prev_total = 0;
+
+// Run time counter of the task at the last report (0 for tasks started since then)
+static uint32_t previous_runtime(TaskHandle_t handle) {
+    for (UBaseType_t i = 0; i < prev_count; i++) {
+        if (prev_handles[i] == handle) {
+            return prev_runtime[i];
+        }
+    }
+    return 0;
+}
+
+// "tasks":[[name,cpu permille of one core,stack high-water mark],...]
+static size_t append_tasks(char *buf, size_t len, size_t used) {
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, &total);
+    if (count == 0) {
+        // More tasks than fit in task_status
+        return append(buf, len, used, ",\"tasks\":null,\"task_count\":%lu", (unsigned long)uxTaskGetNumberOfTasks());
+    }
+
+    uint32_t period = total - prev_total;
+    used = append(buf, len, used, ",\"tasks\":[");
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *t = &task_status[i];
+        uint32_t ran = t->ulRunTimeCounter - previous_runtime(t->xHandle);
+        uint32_t permille = period ? (uint32_t)((uint64_t)ran * 1000 / period) : 0;
+        used = append(buf, len, used, "%s[\"%s\",%lu,%lu]", i ? "," : "", t->pcTaskName,
+                      (unsigned long)permille, (unsigned long)t->usStackHighWaterMark);
+        prev_handles[i] = t->xHandle;
+        prev_runtime[i] = t->ulRunTimeCounter;
+    }
+    prev_count = count;
+    prev_total = total;
+    return append(buf, len, used, "]");
+}
+#else
+static size_t append_tasks(char *buf, size_t len, size_t used) {
+    // Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    return append(buf, len, used, ",\"task_count\":%lu", (unsigned long)uxTaskGetNumberOfTasks());
+}
+#endif
+
+size_t metrics_report(char *buf, size_t len) {
+    uint32_t hr_waiting, hr_dropped;
+    ble_hr_ring_stats(&hr_waiting, &hr_dropped);
+    uint32_t centrals, subscribed, rr_lost;
+    ble_link_stats(&centrals, &subscribed, &rr_lost);
+
+    // Counters are totals since boot, gauges are the value right now
+    size_t used = append(buf, len, 0,
+                         "{\"up\":%lu,\"heap\":%lu,\"heap_min\":%lu"
+                         ",\"ring\":[%lu,%lu],\"hr_ring\":[%lu,%lu],\"centrals\":[%lu,%lu,%lu]"
+                         ",\"batch\":%lu,\"backlog\":%lu,\"pub_fail\":%lu,\"suppressed\":%lu",
+                         (unsigned long)(now_ms() / 1000),
+                         (unsigned long)esp_get_free_heap_size(),
+                         (unsigned long)esp_get_minimum_free_heap_size(),
+                         (unsigned long)spsc_count(&sample_ring),
+                         (unsigned long)atomic_load_explicit(&sample_ring.dropped, memory_order_relaxed),
+                         (unsigned long)hr_waiting, (unsigned long)hr_dropped,
+                         (unsigned long)centrals, (unsigned long)subscribed, (unsigned long)rr_lost,
+                         (unsigned long)atomic_load_explicit(&metrics_data_send.batch_waiting, memory_order_relaxed),
+                         (unsigned long)atomic_load_explicit(&metrics_data_send.backlog_pending, memory_order_relaxed),
+                         (unsigned long)atomic_load_explicit(&metrics_data_send.publish_failures, memory_order_relaxed),
+                         (unsigned long)atomic_load_explicit(&metrics_data_send.suppressed, memory_order_relaxed));
+    // When start-up got where (ms since the chip started, 0 = not yet)
+    used = append(buf, len, used, ",\"boot\":[%lu,%lu,%lu,%lu,%lu]",
+                  (unsigned long)boot_ms(BOOT_FIRST_SAMPLE), (unsigned long)boot_ms(BOOT_BLE_ADVERTISING),
+                  (unsigned long)boot_ms(BOOT_WIFI_GOT_IP), (unsigned long)boot_ms(BOOT_MQTT_CONNECTED),
+                  (unsigned long)boot_ms(BOOT_FIRST_PUBLISH));
+    wifi_stats_t wifi;
+    wifi_get_stats(&wifi);
+    used = append(buf, len, used, ",\"wifi\":[%lu,%lu,%lu,%lu,%lu]", (unsigned long)wifi.connects,
+                  (unsigned long)wifi.fast_connects, (unsigned long)wifi.scans, (unsigned long)wifi.disconnects,
+                  (unsigned long)wifi.last_outage_ms);
+    // Outbox blocks in use and in flight right now, turned away and resent since boot
+    used = append(buf, len, used, ",\"outbox\":[%lu,%lu,%lu,%lu]",
+                  (unsigned long)atomic_load_explicit(&metrics_data_send.outbox_blocks, memory_order_relaxed),
+                  (unsigned long)atomic_load_explicit(&metrics_data_send.outbox_in_flight, memory_order_relaxed),
+                  (unsigned long)atomic_load_explicit(&metrics_data_send.outbox_full, memory_order_relaxed),
+                  (unsigned long)atomic_load_explicit(&metrics_data_send.outbox_resent, memory_order_relaxed));
+    // Steps since boot, what the wearer is doing, and beats measured while moving
+    used = append(buf, len, used, ",\"motion\":[%lu,\"%s\",%lu]",
+                  (unsigned long)atomic_load_explicit(&metrics_data_send.steps, memory_order_relaxed),
+                  motion_activity_name(atomic_load_explicit(&metrics_data_send.activity, memory_order_relaxed)),
+                  (unsigned long)atomic_load_explicit(&metrics_data_send.artifact_beats, memory_order_relaxed));
+    // Deferred log records stored, lost to a full ring and printed since boot
+    dlog_stats_t log;
+    dlog_get_stats(&log);
+    used = append(buf, len, used, ",\"log\":[%lu,%lu,%lu]", (unsigned long)log.written,
+                  (unsigned long)log.dropped, (unsigned long)log.printed);
+    used = append_hist(buf, len, used, "pub_ms", &metrics_publish_latency);
+    used = append_hist(buf, len, used, "ble_ms", &metrics_ble_latency);
+    used = append_hist(buf, len, used, "jitter_us", &metrics_sensor_jitter);
+    used = append(buf, len, used, ",\"profile\":\"%s\"", tasks_profile_name(tasks_profile()));
+    used = append_tasks(buf, len, used);
+    used = append(buf, len, used, "}");
+
+    // Cut off: better no report than broken JSON
+    return used < len ? used : 0;
+}
+
+// This task sends a telemetry report every METRICS_PERIOD_MS (dropped while offline)
+void metrics_task(void *pvParameters) {
+    static char report[METRICS_REPORT_MAX];
+
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(METRICS_PERIOD_MS));
+
+        size_t len = metrics_report(report, sizeof(report));
+        if (len == 0) {
+            ESP_LOGW(TAG, "Report didn't fit in %d bytes", METRICS_REPORT_MAX);
+            continue;
+        }
+        if (!mqtt_publish_metrics(report, len)) {
+            ESP_LOGD(TAG, "Offline, report dropped");
+            continue;
+        }
+        ESP_LOGI(TAG, "Report sent (%u bytes)", (unsigned)len);
+    }
+}
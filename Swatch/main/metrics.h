@@ -0,0 +1,87 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Runtime telemetry. Hot paths only do relaxed atomic adds/stores on the counters
+// below; the metrics task collects them together with task, heap and queue numbers
+// and publishes one compact JSON report per period on the metrics topic (mqtt.c).
+
+// How often a report goes out (ms)
+#ifndef METRICS_PERIOD_MS
+#define METRICS_PERIOD_MS 60000
+#endif
+
+// Tasks the report can list (the rest are counted but not shown)
+#define METRICS_MAX_TASKS 24
+
+// Biggest report
+#define METRICS_REPORT_MAX 1536
+
+// Histogram with power-of-two buckets: bucket 0 holds 0, bucket i holds [2^(i-1), 2^i)
+// and the last one everything from 2^(METRICS_HIST_BUCKETS-2) up. Values are in whatever
+// unit the histogram is kept in, which each one below says.
+#define METRICS_HIST_BUCKETS 18
+
+typedef struct {
+    _Atomic uint32_t buckets[METRICS_HIST_BUCKETS];
+    _Atomic uint32_t max;
+} metrics_hist_t;
+
+// A histogram taken out by the metrics task (and reset for the next period)
+typedef struct {
+    uint32_t buckets[METRICS_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} metrics_hist_snapshot_t;
+
+// Sample timestamp -> MQTT publish (ms)
+extern metrics_hist_t metrics_publish_latency;
+
+// Beat -> BLE notification (ms)
+extern metrics_hist_t metrics_ble_latency;
+
+// How far the time between two sensor wake-ups (PPG reads) was off the block period (us)
+extern metrics_hist_t metrics_sensor_jitter;
+
+// State of the data send task, mirrored for the report (only that task writes them)
+typedef struct {
+    _Atomic uint32_t batch_waiting;     // samples not published yet
+    _Atomic uint32_t backlog_pending;   // batches stored in flash
+    _Atomic uint32_t publish_failures;
+    _Atomic uint32_t suppressed;        // beats dropped by the publish deadband
+    _Atomic uint32_t outbox_blocks;     // outbox pool blocks in use
+    _Atomic uint32_t outbox_blocks_max; // most ever in use
+    _Atomic uint32_t outbox_in_flight;  // QoS 1 messages waiting for their ack
+    _Atomic uint32_t outbox_full;       // messages the full outbox turned away (to flash)
+    _Atomic uint32_t outbox_resent;     // QoS 1 messages sent again after a timeout
+    _Atomic uint32_t steps;             // steps since boot
+    _Atomic uint32_t activity;          // activity_t of the last motion record
+    _Atomic uint32_t artifact_beats;    // beats measured while moving (kept out of the statistics)
+} metrics_data_send_t;
+
+extern metrics_data_send_t metrics_data_send;
+
+// Records one value (any task, never blocks)
+void metrics_hist_record(metrics_hist_t *hist, uint32_t value);
+
+// Takes the histogram out and starts it over (metrics task only)
+void metrics_hist_take(metrics_hist_t *hist, metrics_hist_snapshot_t *snap);
+
+// Copies the histogram without starting it over (any task)
+void metrics_hist_peek(metrics_hist_t *hist, metrics_hist_snapshot_t *snap);
+
+// Upper bound of the bucket holding the given percentile (at most the largest value
+// seen), 0 if empty
+uint32_t metrics_hist_percentile(const metrics_hist_snapshot_t *snap, uint32_t percent);
+
+// Writes the report for the period that just ended into buf. Returns its length.
+size_t metrics_report(char *buf, size_t len);
+
+// Publishes a report every METRICS_PERIOD_MS
+void metrics_task(void *pvParameters);
+
+#endif
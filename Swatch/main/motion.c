@@ -0,0 +1,183 @@
+#include <string.h>
+#include "motion.h"
+
+// Deviation of |a|^2 (in 1/4096 g^2) for an acceleration of 1 g + mg
+static int32_t mg_to_dev(int32_t mg) {
+    int32_t s = mg * MOTION_LSB_PER_G / 1000;
+    return 2 * s + s * s / MOTION_LSB_PER_G;
+}
+
+bool motion_init(motion_t *motion, uint16_t rate_hz) {
+    if (rate_hz < MOTION_MIN_RATE_HZ || rate_hz > MOTION_MAX_RATE_HZ) {
+        return false;
+    }
+    memset(motion, 0, sizeof(*motion));
+    motion->rate_hz = rate_hz;
+
+    // 100 ms moving sum: keeps the step bounce (1.5 - 3 Hz), drops the impact ringing
+    motion->smooth_len = rate_hz / 10;
+    motion->step_threshold = mg_to_dev(MOTION_STEP_MG) * motion->smooth_len;
+    motion->min_step_gap = (uint32_t)rate_hz * MOTION_MIN_STEP_MS / 1000;
+    motion->since_step = motion->min_step_gap;
+    return true;
+}
+
+// Squared magnitude of every sample minus gravity, into motion->dev. Three multiplies
+// and a shift per sample, nothing carried over: this loop vectorizes.
+static void motion_magnitude(motion_t *motion, const int16_t *x, const int16_t *y, const int16_t *z, size_t n) {
+    int32_t *out = motion->dev + motion->smooth_len - 1;
+    const int32_t gravity = motion->gravity;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t sq = (uint32_t)(x[i] * x[i]) + (uint32_t)(y[i] * y[i]) + (uint32_t)(z[i] * z[i]);
+        out[i] = (int32_t)(sq >> 12) - gravity;
+    }
+}
+
+// Moving sum over smooth_len samples, one pass per tap so the inner loop runs over
+// samples and vectorizes (smooth_len is at most 20)
+static void motion_smooth(motion_t *motion, size_t n) {
+    const int32_t *d = motion->dev;
+    int32_t *s = motion->smooth;
+
+    for (size_t i = 0; i < n; i++) {
+        s[i] = d[i];
+    }
+    for (uint16_t k = 1; k < motion->smooth_len; k++) {
+        for (size_t i = 0; i < n; i++) {
+            s[i] += d[i + k];
+        }
+    }
+}
+
+// Counts the rising edges of the smoothed signal through the step threshold. The state
+// goes from one sample to the next, so this is a scan, but a branch-free one: every
+// decision is a 0/1 value folded into the state with masks.
+static uint32_t motion_steps(motion_t *motion, size_t n) {
+    const int32_t *s = motion->smooth;
+    const int32_t high = motion->step_threshold;
+    const uint32_t gap = motion->min_step_gap;
+    uint32_t armed = motion->armed;
+    uint32_t since = motion->since_step;
+    uint32_t steps = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t above = s[i] > high;
+        uint32_t below = s[i] < 0;
+        uint32_t step = armed & above & (since >= gap);
+        steps += step;
+        armed = (armed & (step ^ 1)) | below;
+        // since + 1, back to 0 on a step, and stuck at gap once it got there
+        since = (since + (since < gap)) & (step - 1);
+    }
+
+    motion->armed = armed;
+    motion->since_step = since;
+    return steps;
+}
+
+// Block sums for the activity and the artifact flag (reductions, they vectorize)
+static void motion_block_sums(const motion_t *motion, size_t n, int64_t *dev_sum, uint32_t *abs_sum,
+                              uint32_t *moving) {
+    const int32_t *d = motion->dev + motion->smooth_len - 1;
+    const int32_t limit = mg_to_dev(MOTION_ARTIFACT_MG);
+    int32_t sum = 0;
+    uint32_t total = 0;
+    uint32_t count = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = d[i];
+        int32_t a = v < 0 ? -v : v;
+        sum += v;
+        total += (uint32_t)a;
+        count += a > limit;
+    }
+
+    *dev_sum += sum;
+    *abs_sum += total;
+    *moving += count;
+}
+
+void motion_process_block(motion_t *motion, const int16_t *x, const int16_t *y, const int16_t *z, size_t n,
+                          motion_block_t *out) {
+    uint32_t steps = 0, abs_sum = 0, moving = 0;
+    int64_t dev_sum = 0;
+    size_t total = n;
+
+    // Start the baseline at the real |a|^2 (the watch may sit at an angle, or the scale
+    // may be a little off), otherwise the first block is one big movement
+    if (!motion->gravity_ready && n > 0) {
+        uint32_t first = (uint32_t)(x[0] * x[0]) + (uint32_t)(y[0] * y[0]) + (uint32_t)(z[0] * z[0]);
+        motion->gravity = (int32_t)(first >> 12);
+        motion->gravity_ready = true;
+    }
+
+    while (n > 0) {
+        size_t chunk = n < MOTION_BLOCK_MAX ? n : MOTION_BLOCK_MAX;
+        motion_magnitude(motion, x, y, z, chunk);
+        motion_smooth(motion, chunk);
+        steps += motion_steps(motion, chunk);
+        motion_block_sums(motion, chunk, &dev_sum, &abs_sum, &moving);
+
+        // Keep the newest smooth_len - 1 samples as history for the next chunk
+        memmove(motion->dev, motion->dev + chunk, (motion->smooth_len - 1) * sizeof(int32_t));
+        motion->samples += chunk;
+        x += chunk;
+        y += chunk;
+        z += chunk;
+        n -= chunk;
+    }
+    if (total == 0) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    // Gravity follows the block means slowly, so steps barely move it
+    motion->gravity += (int32_t)(dev_sum / (int64_t)total) >> 2;
+
+    // Cadence over the last MOTION_CADENCE_BLOCKS blocks
+    motion->block_steps[motion->block_pos] = (uint8_t)(steps > 255 ? 255 : steps);
+    motion->block_samples[motion->block_pos] = (uint16_t)total;
+    motion->block_pos = (motion->block_pos + 1) % MOTION_CADENCE_BLOCKS;
+    uint32_t window_steps = 0, window_samples = 0;
+    for (int i = 0; i < MOTION_CADENCE_BLOCKS; i++) {
+        window_steps += motion->block_steps[i];
+        window_samples += motion->block_samples[i];
+    }
+    uint32_t cadence = window_steps * 60u * motion->rate_hz / window_samples;
+
+    // Mean deviation in mg: |a|^2 - 1 is about 2 (|a| - 1) for small movements
+    uint32_t intensity = abs_sum / total * 1000u / (2 * MOTION_LSB_PER_G);
+
+    activity_t activity = ACTIVITY_MOVING;
+    if (intensity < MOTION_STILL_MG) {
+        activity = ACTIVITY_STILL;
+    } else if (cadence >= MOTION_RUN_SPM) {
+        activity = ACTIVITY_RUNNING;
+    } else if (cadence >= MOTION_WALK_SPM) {
+        activity = ACTIVITY_WALKING;
+    }
+
+    out->steps = (uint8_t)(steps > 255 ? 255 : steps);
+    out->activity = (uint8_t)activity;
+    out->artifact = moving * 100 >= total * MOTION_ARTIFACT_PERCENT;
+    out->intensity_mg = (uint16_t)(intensity > UINT16_MAX ? UINT16_MAX : intensity);
+    out->cadence_spm = (uint16_t)cadence;
+
+    motion->steps += steps;
+    motion->artifact_blocks += out->artifact;
+}
+
+const char *motion_activity_name(activity_t activity) {
+    switch (activity) {
+        case ACTIVITY_STILL:
+            return "still";
+        case ACTIVITY_MOVING:
+            return "moving";
+        case ACTIVITY_WALKING:
+            return "walking";
+        case ACTIVITY_RUNNING:
+            return "running";
+    }
+    return "?";
+}
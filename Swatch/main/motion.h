@@ -0,0 +1,101 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Step counting, activity classification and motion-artifact flags for a 3-axis
+// accelerometer, processed in blocks next to the PPG. Integer math only, on fixed-size
+// buffers inside motion_t. The per-sample stages (magnitude, smoothing, block sums) have
+// no dependency from one sample to the next, so the compiler can vectorize them; only the
+// step detector carries state along the block, and it does so without branches.
+
+#define MOTION_MIN_RATE_HZ 25
+#define MOTION_MAX_RATE_HZ 200
+
+// Samples are processed in chunks of at most this many (bigger blocks are split)
+#define MOTION_BLOCK_MAX 64
+
+// Raw counts per g (+-8 g full scale in 16 bits)
+#define MOTION_LSB_PER_G 4096
+
+// Cycle budget for one 250 ms block on the ESP32 (the sensor task counts overruns). The
+// kernel is the second-hottest loop after the PPG estimator.
+#ifndef MOTION_BLOCK_BUDGET_CYCLES
+#define MOTION_BLOCK_BUDGET_CYCLES 8000
+#endif
+
+// A step is a rise of the smoothed acceleration above 1 g + MOTION_STEP_MG, at least
+// MOTION_MIN_STEP_MS after the previous one (at most 4 steps a second)
+#define MOTION_STEP_MG 150
+#define MOTION_MIN_STEP_MS 250
+
+// Mean deviation from 1 g below this is standing still (mg)
+#define MOTION_STILL_MG 40
+
+// Cadence (steps per minute over the last MOTION_CADENCE_BLOCKS blocks) for walking and running
+#define MOTION_WALK_SPM 60
+#define MOTION_RUN_SPM 140
+#define MOTION_CADENCE_BLOCKS 16
+
+// A block whose samples are more than MOTION_ARTIFACT_MG off 1 g for at least
+// MOTION_ARTIFACT_PERCENT of the time moves too much for a clean PPG reading
+#define MOTION_ARTIFACT_MG 75
+#define MOTION_ARTIFACT_PERCENT 25
+
+typedef enum {
+    ACTIVITY_STILL = 0,
+    ACTIVITY_MOVING,        // moving, but not in steps (arm gestures, cycling, ...)
+    ACTIVITY_WALKING,
+    ACTIVITY_RUNNING,
+} activity_t;
+
+// What one block showed
+typedef struct {
+    uint8_t steps;          // steps that ended in this block
+    uint8_t activity;       // activity_t
+    bool artifact;          // the PPG of this block is not to be trusted
+    uint16_t intensity_mg;  // mean deviation from 1 g
+    uint16_t cadence_spm;
+} motion_block_t;
+
+typedef struct {
+    uint16_t rate_hz;
+    uint32_t samples;           // total samples processed
+
+    // |a|^2 in 1/4096 g^2 minus the gravity baseline, with smooth_len - 1 samples of
+    // history in front, then its moving sum over smooth_len samples (100 ms)
+    int32_t dev[MOTION_MAX_RATE_HZ / 10 + MOTION_BLOCK_MAX];
+    int32_t smooth[MOTION_BLOCK_MAX];
+    uint16_t smooth_len;
+    bool gravity_ready;
+    int32_t gravity;            // |a|^2 at rest, follows the block means
+
+    // Step detector: armed once the signal fell back below gravity after a step
+    int32_t step_threshold;     // on the smoothed signal
+    uint32_t armed;
+    uint32_t since_step;        // samples
+    uint32_t min_step_gap;
+
+    // Steps of the last MOTION_CADENCE_BLOCKS blocks, for the cadence
+    uint8_t block_steps[MOTION_CADENCE_BLOCKS];
+    uint16_t block_samples[MOTION_CADENCE_BLOCKS];
+    uint8_t block_pos;
+
+    // Counters
+    uint32_t steps;
+    uint32_t artifact_blocks;
+} motion_t;
+
+// rate_hz must be between MOTION_MIN_RATE_HZ and MOTION_MAX_RATE_HZ
+bool motion_init(motion_t *motion, uint16_t rate_hz);
+
+// Feeds n samples per axis (raw counts, MOTION_LSB_PER_G per g) and describes them in out
+void motion_process_block(motion_t *motion, const int16_t *x, const int16_t *y, const int16_t *z, size_t n,
+                          motion_block_t *out);
+
+// Short name of an activity for logs and telemetry
+const char *motion_activity_name(activity_t activity);
+
+#endif
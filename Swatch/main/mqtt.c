@@ -1,63 +1,167 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include "mqtt_client.h"
-#include "esp_wifi.h"
 #include "esp_event.h"
-#include "nvs_flash.h"
+#include "esp_mac.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "freertos/semphr.h"
+#if CONFIG_MQTT_PROTOCOL_5
+#include "mqtt5_client.h"
+#endif
 #include "esp_log.h"
 #include "mqtt.h"
-#include <time.h>
+#include "batch.h"
+#include "sensor.h"
+#include "tscodec.h"
+#include "publish.h"
+#include "command.h"
+#include "metrics.h"
+#include "aggregate.h"
+#include "boot.h"
+#include "outbox.h"
+#include "sendloop.h"
+#include "dlog.h"
 #define TAG "MQTT"
 
-// Wi-Fi credentials
-#define WIFI_SSID "teamHexagon"
-#define WIFI_PASS "hexagon6"
-
 // MQTT broker URI
 #define MQTT_BROKER_URI "mqtt://broker.hivemq.com:1883"
 
-// MQTT tooic
+// MQTT tooic. Under MQTT 3.1.1 everything is published right under it (the sample
+// batches on the bare topic); under MQTT 5 every watch has its own branch,
+// MQTT_TOPIC/<Wi-Fi MAC in hex>/, with one topic per kind of message.
 #define MQTT_TOPIC "hexagon"
+#define BPM_TOPIC_V5 "/bpm"
+
+// Protocol unless mqtt_set_protocol() picks the other one (5 needs the ESP-MQTT
+// MQTT 5 support, CONFIG_MQTT_PROTOCOL_5 in sdkconfig)
+#ifndef MQTT_PROTOCOL
+#if CONFIG_MQTT_PROTOCOL_5
+#define MQTT_PROTOCOL 5
+#else
+#define MQTT_PROTOCOL 3
+#endif
+#endif
+
+// MQTT 5 topic aliases we use (one per topic, in topic_id_t order). The broker says how
+// many it takes in its CONNACK and ESP-MQTT refuses publishes above that;
+// broker.hivemq.com and Mosquitto take at least 5. 0 turns them off.
+#ifndef MQTT_TOPIC_ALIAS_MAX
+#define MQTT_TOPIC_ALIAS_MAX 5
+#endif
+
+// MQTT 5 content type of sample batches and replays (tscodec.h), and of the reports.
+// NULL leaves it out of the batches, 24 bytes less per packet.
+#ifndef BATCH_CONTENT_TYPE
+#define BATCH_CONTENT_TYPE "application/x-tscodec"
+#endif
+#define METRICS_CONTENT_TYPE "application/json"
+
+// Flash partition that keeps batches while the broker can't be reached
+#define BACKLOG_PARTITION "hrlog"
+
+// Stored batches are replayed on their own topic (sendloop.h)
+#define BACKLOG_TOPIC "/backlog"
 
-// Global BPM value
-int global_bpm = 60;
+// Windowed statistics (aggregate.h), one binary summary per message
+#define AGG_TOPIC "/agg"
 
-// Handles and queue/mutex from main.c
-extern QueueHandle_t bpmQueue;
-extern SemaphoreHandle_t bpmMutex;
+// Motion records (steps and activity every MOTION_RECORD_BLOCKS blocks), 13 bytes each:
+// ACTIVITY_TAG, then end of the period (ms), steps, activity, blocks too shaky for PPG,
+// mean intensity (mg) and cadence (steps/min), little endian
+#define ACTIVITY_TOPIC "/activity"
+#define ACTIVITY_TAG 0xA2
+#define ACTIVITY_ENCODED_SIZE 13
+
+// Telemetry reports from the metrics task
+#define METRICS_TOPIC "/metrics"
+
+// Sample batches and replays go out at this QoS (window summaries always at 0)
+#ifndef DATA_QOS
+#define DATA_QOS 1
+#endif
+
+// ESP-MQTT's own outbox (unacknowledged QoS 1 messages, on the heap) never holds more
+// than our window; the limit only catches a bug
+#define CLIENT_OUTBOX_LIMIT (OUTBOX_WINDOW * OUTBOX_MESSAGE_MAX * 2)
+
+// Task handle from main.c (the sensor task wakes it up with a notification)
 extern TaskHandle_t dataSendTaskHandle;
 
 static esp_mqtt_client_handle_t client;
 
-// Function to connect to Wi-Fi
-void wifi_init() {
-    ESP_ERROR_CHECK(nvs_flash_init());
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+static int protocol = MQTT_PROTOCOL;
 
-    esp_netif_create_default_wifi_sta();
+// Everything we publish, by topic (the outbox keeps pointers into topics[])
+typedef enum {
+    TOPIC_BPM = 0,
+    TOPIC_BACKLOG,
+    TOPIC_AGG,
+    TOPIC_ACTIVITY,
+    TOPIC_METRICS,
+    TOPIC_COUNT,
+} topic_id_t;
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+#define TOPIC_MAX_LEN 40
+static char topics[TOPIC_COUNT][TOPIC_MAX_LEN];
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-        },
-    };
+// The message arriving now is one of our own batches (MQTT event handler only)
+static bool echo_in_progress;
+
+// Counts connections, so an alias set up on an earlier one is never relied on
+static _Atomic uint32_t connection = 0;
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
+#if CONFIG_MQTT_PROTOCOL_5
+// The client keeps publish properties until the next publish of whichever task, so
+// setting them and publishing has to happen in one go
+static SemaphoreHandle_t publish_lock;
 
-    ESP_LOGI(TAG, "Connecting to Wi-Fi...");
-    ESP_ERROR_CHECK(esp_wifi_connect());
+// Connection each topic alias was last sent with its topic on (0 = never)
+static uint32_t alias_connection[TOPIC_COUNT];
+#endif
+
+// Set by the event handler, read by data_send_task
+static _Atomic bool mqtt_connected = false;
+
+// Set once the client runs, before that there is nothing to restart
+static _Atomic bool client_started = false;
+
+// Batches, schedule, statistics, backlog and the outbox everything data_send_task
+// publishes goes through (static, it holds the pool)
+static sendloop_t loop;
+static _Atomic bool outbox_ready = false;
+
+static int send_to_client(void *ctx, const char *topic, const uint8_t *data, size_t len, int qos);
+
+// Settings for the loop (the data_send_set_* calls change them before the task starts)
+static sendloop_config_t send_config = {
+    .backlog_partition = BACKLOG_PARTITION,
+    .policy = PUBLISH_POLICY_DEFAULT,
+    .agg = { .window_ms = AGG_WINDOW_MS, .step_ms = AGG_STEP_MS },
+    .raw = AGG_PUBLISH_RAW,
+    .qos = DATA_QOS,
+    .window = OUTBOX_WINDOW,
+    .send = send_to_client,
+};
+
+// Hands an ack to data_send_task and wakes it up, the window has room again
+static void outbox_acked(int msg_id, bool gave_up) {
+    if (atomic_load(&outbox_ready) && outbox_ack_push(&loop.outbox, msg_id, gave_up) && dataSendTaskHandle != NULL) {
+        xTaskNotifyGive(dataSendTaskHandle);
+    }
+}
+
+static void subscribe(const char *topic, int qos) {
+#if CONFIG_MQTT_PROTOCOL_5
+    if (protocol == 5) {
+        // No-local: the broker doesn't send our own publishes back to us
+        const esp_mqtt5_subscribe_property_config_t no_local = { .no_local_flag = true };
+        esp_mqtt5_client_set_subscribe_property(client, &no_local);
+    }
+#endif
+    esp_mqtt_client_subscribe(client, topic, qos);
 }
 
 // MQTT event handler
@@ -67,22 +171,48 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     switch (event_id) {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT connected");
-            esp_mqtt_client_subscribe(client, MQTT_TOPIC, 0); // Subscribe to the topic
+            subscribe(MQTT_TOPIC, 0); // Subscribe to the topic
+            subscribe(COMMAND_TOPIC_PREFIX "#", 1); // And to the commands
+            atomic_fetch_add(&connection, 1);
+            atomic_store(&mqtt_connected, true);
+            boot_mark(BOOT_MQTT_CONNECTED);
+            // Wake up the data send task so it starts replaying what was stored offline
+            if (dataSendTaskHandle != NULL) {
+                xTaskNotifyGive(dataSendTaskHandle);
+            }
             break;
 
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT disconnected");
+            atomic_store(&mqtt_connected, false);
+            break;
+
+        case MQTT_EVENT_PUBLISHED:
+            outbox_acked(event->msg_id, false);
+            break;
+
+        case MQTT_EVENT_DELETED:
+            // The client gave up retransmitting it, we send it again
+            ESP_LOGW(TAG, "Message %d expired in the client outbox", event->msg_id);
+            outbox_acked(event->msg_id, true);
             break;
 
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "Received data on topic: %.*s", event->topic_len, event->topic);
-            ESP_LOGI(TAG, "Message: %.*s", event->data_len, event->data);
-
-            // Directly parse the received integer data
-            char buffer[16] = {0}; // Temporary buffer to store the received data
-            snprintf(buffer, sizeof(buffer), "%.*s", event->data_len, event->data); // Copy the received data
-            global_bpm = strtol(buffer, NULL, 10); // Convert to integer using strtol
-            ESP_LOGI(TAG, "Updated global BPM to: %d", global_bpm);
+            // Under MQTT 3.1.1 our own batches come back on the topic we publish them on
+            // (MQTT 5 subscriptions are no-local). Only the first fragment has the topic,
+            // so the rest of a big one is recognised by what came before.
+            if (event->current_data_offset == 0) {
+                echo_in_progress = protocol != 5 && event->data_len > 0 && (uint8_t)event->data[0] == TSCODEC_TAG &&
+                                   event->topic_len == (int)strlen(topics[TOPIC_BPM]) &&
+                                   strncmp(event->topic, topics[TOPIC_BPM], event->topic_len) == 0;
+            }
+            if (echo_in_progress) {
+                break;
+            }
+            // Commands are parsed here but applied by the task that owns the state
+            if (!command_handle_event(event)) {
+                ESP_LOGI(TAG, "Ignoring data on topic: %.*s", event->topic_len, event->topic);
+            }
             break;
 
         default:
@@ -90,9 +220,97 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
+bool mqtt_set_protocol(int version) {
+#if CONFIG_MQTT_PROTOCOL_5
+    if (version != 3 && version != 5) {
+        return false;
+    }
+#else
+    if (version != 3) {
+        return false;
+    }
+#endif
+    protocol = version;
+    return true;
+}
+
+// Fills in topics[] for the protocol in use
+static void build_topics(void) {
+    static const char *const suffixes[TOPIC_COUNT] = {
+        [TOPIC_BPM] = "",
+        [TOPIC_BACKLOG] = BACKLOG_TOPIC,
+        [TOPIC_AGG] = AGG_TOPIC,
+        [TOPIC_ACTIVITY] = ACTIVITY_TOPIC,
+        [TOPIC_METRICS] = METRICS_TOPIC,
+    };
+    char device[16] = "";
+    if (protocol == 5) {
+        uint8_t mac[6] = {0};
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+        snprintf(device, sizeof(device), "/%02x%02x%02x%02x%02x%02x", MAC2STR(mac));
+    }
+    for (int i = 0; i < TOPIC_COUNT; i++) {
+        const char *suffix = protocol == 5 && i == TOPIC_BPM ? BPM_TOPIC_V5 : suffixes[i];
+        snprintf(topics[i], TOPIC_MAX_LEN, "%s%s%s", MQTT_TOPIC, device, suffix);
+    }
+    ESP_LOGI(TAG, "MQTT %s, publishing under %s", protocol == 5 ? "5" : "3.1.1", topics[TOPIC_BPM]);
+}
+
+// Which of topics[] a topic from the outbox is
+static topic_id_t topic_id(const char *topic) {
+    for (int i = 0; i < TOPIC_COUNT; i++) {
+        if (topic == topics[i]) {
+            return (topic_id_t)i;
+        }
+    }
+    return TOPIC_COUNT;
+}
+
+// Every publish goes through here. Under MQTT 5 a topic's first publish on a connection
+// sets up its alias, QoS 0 publishes after that send only the alias. QoS 1 ones always
+// carry the topic: ESP-MQTT resends them as they are after a reconnect, and the broker
+// forgets aliases with the connection. Batches and reports say what their payload is.
+static int publish(topic_id_t id, const void *data, size_t len, int qos) {
+#if CONFIG_MQTT_PROTOCOL_5
+    if (protocol == 5) {
+        const char *topic = topics[id];
+        esp_mqtt5_publish_property_config_t properties = {
+            .payload_format_indicator = id == TOPIC_METRICS,    // UTF-8, the rest is binary
+            .content_type = id == TOPIC_METRICS                     ? METRICS_CONTENT_TYPE
+                          : id == TOPIC_BPM || id == TOPIC_BACKLOG ? BATCH_CONTENT_TYPE
+                                                                   : NULL,
+        };
+        uint32_t conn = atomic_load(&connection);
+        xSemaphoreTake(publish_lock, portMAX_DELAY);
+        bool alias = id < MQTT_TOPIC_ALIAS_MAX;
+        if (alias) {
+            properties.topic_alias = (uint16_t)(id + 1);
+            if (qos == 0 && alias_connection[id] == conn) {
+                topic = "";
+            }
+        }
+        esp_mqtt5_client_set_publish_property(client, &properties);
+        int msg_id = esp_mqtt_client_publish(client, topic, (const char *)data, (int)len, qos, 0);
+        if (alias && msg_id >= 0) {
+            alias_connection[id] = conn;
+        }
+        xSemaphoreGive(publish_lock);
+        return msg_id;
+    }
+#endif
+    return esp_mqtt_client_publish(client, topics[id], (const char *)data, (int)len, qos, 0);
+}
+
 // Initialize MQTT client
 void mqtt_init() {
-    const esp_mqtt_client_config_t mqtt_cfg = {}; // Minimal configuration
+    const esp_mqtt_client_config_t mqtt_cfg = {
+        .session.protocol_ver = protocol == 5 ? MQTT_PROTOCOL_V_5 : MQTT_PROTOCOL_V_3_1_1,
+        .outbox.limit = CLIENT_OUTBOX_LIMIT,
+    };
+    build_topics();
+#if CONFIG_MQTT_PROTOCOL_5
+    publish_lock = xSemaphoreCreateMutex();
+#endif
     client = esp_mqtt_client_init(&mqtt_cfg);
 
     if (client == NULL) {
@@ -108,64 +326,184 @@ void mqtt_init() {
     }
 
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+
+    // Starting before there is an IP address only gets a failed connect and the client's
+    // reconnect timeout (10 s) on top of the Wi-Fi time, so wait for it here
+    boot_wait(BOOT_WIFI_GOT_IP, portMAX_DELAY);
     esp_mqtt_client_start(client);
+    atomic_store(&client_started, true);
 }
 
-// This task waits for BPM values from the queue and sends them to MQTT
-void data_send_task(void *pvParameters) {
-    int bpm_val = 0;
-    while (1) {
-        // Wait for a BPM value from the queue (waits up to 5 seconds)
-        if (xQueueReceive(bpmQueue, &bpm_val, pdMS_TO_TICKS(5000)) == pdPASS) {
-            // Try to lock the mutex for 100ms so we can safely update global_bpm
-            if (xSemaphoreTake(bpmMutex, pdMS_TO_TICKS(100))) {
-                global_bpm = bpm_val;
-                xSemaphoreGive(bpmMutex); // Always unlock!
-            }
-            char message[50];
-            snprintf(message, sizeof(message), "%d", bpm_val);
-            esp_mqtt_client_publish(client, MQTT_TOPIC, message, 0, 0, 0);
-            ESP_LOGI(TAG, "Published: %s (from task: %s)", message, pcTaskGetName(NULL));
-        } else {
-            // If nothing new, just send the current value
-            if (xSemaphoreTake(bpmMutex, pdMS_TO_TICKS(100))) {
-                bpm_val = global_bpm;
-                xSemaphoreGive(bpmMutex);
+// Called by the Wi-Fi manager. Without this the client only notices a dead link when its
+// keepalive runs out, and only retries on its own reconnect timeout (10 s) once it is back.
+void mqtt_link_changed(bool up) {
+    if (!atomic_load(&client_started)) {
+        return;
+    }
+    if (up) {
+        ESP_LOGI(TAG, "Link back, reconnecting");
+        esp_mqtt_client_reconnect(client);
+    } else {
+        // Drop the session now so publishes stop going into a dead socket
+        esp_mqtt_client_disconnect(client);
+    }
+}
+
+bool mqtt_publish_metrics(const char *report, size_t len) {
+    return atomic_load(&mqtt_connected) && publish(TOPIC_METRICS, report, len, 0) >= 0;
+}
+
+bool data_send_set_delivery(uint8_t qos, uint8_t window) {
+    if (qos > 1 || window == 0 || window > OUTBOX_ENTRIES) {
+        return false;
+    }
+    send_config.qos = qos;
+    send_config.window = window;
+    return true;
+}
+
+static int send_to_client(void *ctx, const char *topic, const uint8_t *data, size_t len, int qos) {
+    // -1 on error, -2 if the client outbox is full
+    topic_id_t id = topic_id(topic);
+    return id < TOPIC_COUNT ? publish(id, data, len, qos) : -1;
+}
+
+void data_send_set_policy(const publish_policy_t *policy) {
+    send_config.policy = *policy;
+}
+
+bool data_send_set_aggregation(const agg_config_t *config, bool raw) {
+    if (config->step_ms == 0 || config->step_ms > config->window_ms) {
+        return false;
+    }
+    send_config.agg = *config;
+    send_config.raw = raw;
+    return true;
+}
+
+// Publishes a motion record. Like window summaries, they are dropped while offline.
+static void publish_activity(const sensor_record_t *record) {
+    uint8_t message[ACTIVITY_ENCODED_SIZE];
+    uint32_t t = record->timestamp_ms;
+    message[0] = ACTIVITY_TAG;
+    message[1] = (uint8_t)t;
+    message[2] = (uint8_t)(t >> 8);
+    message[3] = (uint8_t)(t >> 16);
+    message[4] = (uint8_t)(t >> 24);
+    message[5] = (uint8_t)record->payload.motion.steps;
+    message[6] = (uint8_t)(record->payload.motion.steps >> 8);
+    message[7] = record->payload.motion.activity;
+    message[8] = record->payload.motion.artifact_blocks;
+    message[9] = (uint8_t)record->payload.motion.intensity_mg;
+    message[10] = (uint8_t)(record->payload.motion.intensity_mg >> 8);
+    message[11] = (uint8_t)record->payload.motion.cadence_spm;
+    message[12] = (uint8_t)(record->payload.motion.cadence_spm >> 8);
+    if (!atomic_load(&mqtt_connected) || !outbox_put(&loop.outbox, topics[TOPIC_ACTIVITY], message, sizeof(message), 0)) {
+        DLOGW(TAG, "Offline, motion record dropped");
+    }
+}
+
+// A beat or a motion record from the sensor task
+static void take_record(const sensor_record_t *record) {
+    if (record->sensor == SENSOR_MOTION) {
+        atomic_fetch_add_explicit(&metrics_data_send.steps, record->payload.motion.steps, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.activity, record->payload.motion.activity, memory_order_relaxed);
+        publish_activity(record);
+        return;
+    }
+    if (record->sensor != SENSOR_HEART) {
+        return;
+    }
+
+    bpm_sample_t sample = sensor_record_beat(record);
+    // Intervals measured while moving would wreck SDNN and RMSSD, so they stay out of the
+    // statistics; the BPM itself still goes out
+    bool artifact = (record->flags & RECORD_FLAG_ARTIFACT) != 0;
+    if (artifact) {
+        atomic_fetch_add_explicit(&metrics_data_send.artifact_beats, 1, memory_order_relaxed);
+    }
+    sendloop_take_beat(&loop, &sample, artifact);
+}
+
+// Applies the commands meant for this task (publish policy and alarm limits)
+static void take_commands(void) {
+    command_t cmd;
+    while (command_take(CMD_OWNER_DATA_SEND, &cmd)) {
+        publish_policy_t policy = loop.sched.policy;
+        switch (cmd.id) {
+            case CMD_PUBLISH_POLICY:
+                policy.deadband_bpm = (uint16_t)cmd.args[0];
+                policy.max_silence_ms = (uint32_t)cmd.args[1];
+                policy.min_interval_ms = (uint32_t)cmd.args[2];
+                policy.alarm_high_bpm = (uint16_t)cmd.args[3];
+                policy.alarm_low_bpm = (uint16_t)cmd.args[4];
+                break;
+
+            case CMD_ALARM_LIMITS:
+                policy.alarm_high_bpm = (uint16_t)cmd.args[0];
+                policy.alarm_low_bpm = (uint16_t)cmd.args[1];
+                break;
+
+            case CMD_AGGREGATION: {
+                agg_config_t config = { .window_ms = (uint32_t)cmd.args[0], .step_ms = (uint32_t)cmd.args[1] };
+                if (!data_send_set_aggregation(&config, cmd.args[2] != 0)) {
+                    ESP_LOGW(TAG, "Bad aggregation window %lu/%lu ms", (unsigned long)config.window_ms, (unsigned long)config.step_ms);
+                    continue;
+                }
+                // The current window starts over
+                sendloop_set_aggregation(&loop, &send_config.agg, send_config.raw, now_ms());
+                ESP_LOGI(TAG, "Aggregation now: %lu ms windows every %lu ms, single beats %s",
+                         (unsigned long)config.window_ms, (unsigned long)config.step_ms, send_config.raw ? "on" : "off");
+                continue;
             }
-            char message[50];
-            snprintf(message, sizeof(message), "%d", bpm_val);
-            esp_mqtt_client_publish(client, MQTT_TOPIC, message, 0, 0, 0);
-            ESP_LOGI(TAG, "Published (timeout): %s", message);
-        }
 
-        // Wait for a notification from the random BPM task, or timeout after 5 seconds
-        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5000));
+            default:
+                command_release(&cmd);
+                continue;
+        }
+        publish_sched_set_policy(&loop.sched, &policy);
+        ESP_LOGI(TAG, "Publish policy now: deadband %u BPM, silence %lu ms, interval %lu ms, alarms %u/%u BPM",
+                 policy.deadband_bpm, (unsigned long)policy.max_silence_ms, (unsigned long)policy.min_interval_ms,
+                 policy.alarm_high_bpm, policy.alarm_low_bpm);
     }
 }
 
-// This task makes up a new BPM every 5 seconds and puts it in the queue
-void random_bpm_task(void *pvParameters) {
-    srand((unsigned int)time(NULL));
-    int new_bpm = 0;
+// This task collects BPM samples from the ring and publishes them in batches
+void data_send_task(void *pvParameters) {
+    sensor_record_t record;
+
+    send_config.bpm_topic = topics[TOPIC_BPM];
+    send_config.backlog_topic = topics[TOPIC_BACKLOG];
+    send_config.agg_topic = topics[TOPIC_AGG];
+    sendloop_init(&loop, &send_config, now_ms());
+    atomic_store(&outbox_ready, true);
+
     while (1) {
-        new_bpm = 60 + (rand() % 101);
+        // Sleep until the sensor task says there is a new sample, an ack comes in, or the
+        // loop has something due
+        uint32_t wait_ms = sendloop_ms_until(&loop, now_ms());
+        ulTaskNotifyTake(pdTRUE, wait_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms));
+        take_commands();
 
-        // Try to put the new BPM in the queue (if it's full, just skip it)
-        if (xQueueSend(bpmQueue, &new_bpm, 0) != pdPASS) {
-            printf("BPM queue full, skipping value!\n");
+        // Take everything the sensor task has pushed so far (no locks involved)
+        while (spsc_pop(&sample_ring, &record)) {
+            take_record(&record);
         }
 
-        // Tell the data send task that there's something new (notification)
-        xTaskNotifyGive(dataSendTaskHandle);
-
-        // Also update global_bpm for BLE (need to lock it first)
-        if (xSemaphoreTake(bpmMutex, pdMS_TO_TICKS(100))) {
-            global_bpm = new_bpm;
-            xSemaphoreGive(bpmMutex);
+        sendloop_run(&loop, atomic_load(&mqtt_connected), now_ms());
+        if (loop.ever_published) {
+            boot_mark(BOOT_FIRST_PUBLISH);
         }
 
-        ESP_LOGI(TAG, "Randomly updated global BPM to: %d (from task: %s)", new_bpm, pcTaskGetName(NULL));
-        vTaskDelay(pdMS_TO_TICKS(5000)); // Wait 5 seconds before next BPM
+        // Let the metrics task see how far behind we are
+        atomic_store_explicit(&metrics_data_send.publish_failures, loop.publish_failures, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.batch_waiting, loop.batch.count, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.backlog_pending, loop.backlog_ok ? loop.backlog.pending : 0, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.suppressed, loop.sched.suppressed, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.outbox_blocks, loop.outbox.stats.blocks_used, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.outbox_blocks_max, loop.outbox.stats.blocks_max, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.outbox_in_flight, loop.outbox.in_flight, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.outbox_full, loop.outbox.stats.full, memory_order_relaxed);
+        atomic_store_explicit(&metrics_data_send.outbox_resent, loop.outbox.stats.resent, memory_order_relaxed);
     }
 }
-
@@ -3,12 +3,36 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "batch.h"
+#include "channel.h"
+#include "publish.h"
+#include "aggregate.h"
 
-extern int global_bpm;
+// Records (sensor_record_t) from the sensor task to data_send_task (lock-free, lives in main.c)
+extern spsc_ring_t sample_ring;
 
 void mqtt_init();
-void wifi_init();
+
+// Picks MQTT 3.1.1 (3) or MQTT 5 (5) before mqtt_init. False if that one isn't built in
+// (MQTT 5 needs CONFIG_MQTT_PROTOCOL_5).
+bool mqtt_set_protocol(int version);
 void data_send_task(void *pvParameters);
-void random_bpm_task(void *pvParameters);
+
+// Tells the client the Wi-Fi link went away or has an address again (see wifi.h)
+void mqtt_link_changed(bool up);
+
+// Publishes a telemetry report on the metrics topic. False while offline.
+bool mqtt_publish_metrics(const char *report, size_t len);
+
+// Sample batches and replays go out at this QoS (0 or 1) with at most window QoS 1
+// messages waiting for their ack (call before data_send_task starts, see outbox.h)
+bool data_send_set_delivery(uint8_t qos, uint8_t window);
+
+// Changes the publish policy (call before data_send_task starts)
+void data_send_set_policy(const publish_policy_t *policy);
+
+// Changes the statistics windows and whether single beats are published next to them
+// (call before data_send_task starts). Returns false if the windows make no sense.
+bool data_send_set_aggregation(const agg_config_t *config, bool raw);
 
 #endif
\ No newline at end of file
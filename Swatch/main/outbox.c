@@ -0,0 +1,212 @@
+#include <string.h>
+#include "outbox.h"
+
+#define NO_BLOCK (-1)
+
+static uint16_t blocks_for(size_t len) {
+    return len == 0 ? 1 : (uint16_t)((len + OUTBOX_BLOCK_SIZE - 1) / OUTBOX_BLOCK_SIZE);
+}
+
+void outbox_init(outbox_t *ob, uint8_t window) {
+    memset(ob, 0, sizeof(*ob));
+    for (int i = 0; i < OUTBOX_BLOCKS; i++) {
+        ob->next_block[i] = i + 1 < OUTBOX_BLOCKS ? i + 1 : NO_BLOCK;
+    }
+    ob->free_block = 0;
+    ob->free_blocks = OUTBOX_BLOCKS;
+    ob->window = window == 0 ? 1 : window > OUTBOX_ENTRIES ? OUTBOX_ENTRIES : window;
+    spsc_init(&ob->acks, ob->ack_storage, sizeof(outbox_ack_t), OUTBOX_ACK_RING);
+}
+
+static outbox_entry_t *free_entry(outbox_t *ob) {
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        if (ob->entries[i].state == OUTBOX_FREE) {
+            return &ob->entries[i];
+        }
+    }
+    return NULL;
+}
+
+bool outbox_has_room(const outbox_t *ob, size_t len) {
+    if (len > OUTBOX_MESSAGE_MAX || blocks_for(len) > ob->free_blocks) {
+        return false;
+    }
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        if (ob->entries[i].state == OUTBOX_FREE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t outbox_fill(const outbox_t *ob) {
+    return (uint8_t)((OUTBOX_BLOCKS - ob->free_blocks) * 100 / OUTBOX_BLOCKS);
+}
+
+bool outbox_put(outbox_t *ob, const char *topic, const void *data, size_t len, uint8_t qos) {
+    outbox_entry_t *e = outbox_has_room(ob, len) ? free_entry(ob) : NULL;
+    if (e == NULL) {
+        ob->stats.full++;
+        return false;
+    }
+
+    // Take blocks off the free list and copy the message in, one block at a time
+    uint16_t n = blocks_for(len);
+    uint16_t total = (uint16_t)len;
+    const uint8_t *src = data;
+    int16_t first = ob->free_block;
+    int16_t block = first;
+    for (uint16_t i = 0; i < n; i++) {
+        size_t chunk = len > OUTBOX_BLOCK_SIZE ? OUTBOX_BLOCK_SIZE : len;
+        memcpy(ob->blocks[block], src, chunk);
+        src += chunk;
+        len -= chunk;
+        if (i + 1 < n) {
+            block = ob->next_block[block];
+        }
+    }
+    ob->free_block = ob->next_block[block];
+    ob->next_block[block] = NO_BLOCK;
+    ob->free_blocks -= n;
+
+    *e = (outbox_entry_t){
+        .topic = topic,
+        .len = total,
+        .qos = qos,
+        .state = OUTBOX_QUEUED,
+        .first_block = first,
+        .seq = ob->next_seq++,
+    };
+    ob->stats.put++;
+    ob->stats.blocks_used = OUTBOX_BLOCKS - ob->free_blocks;
+    if (ob->stats.blocks_used > ob->stats.blocks_max) {
+        ob->stats.blocks_max = ob->stats.blocks_used;
+    }
+    return true;
+}
+
+static void release(outbox_t *ob, outbox_entry_t *e) {
+    // The whole chain goes back to the front of the free list
+    int16_t last = e->first_block;
+    uint16_t n = 1;
+    while (ob->next_block[last] != NO_BLOCK) {
+        last = ob->next_block[last];
+        n++;
+    }
+    ob->next_block[last] = ob->free_block;
+    ob->free_block = e->first_block;
+    ob->free_blocks += n;
+    ob->stats.blocks_used = OUTBOX_BLOCKS - ob->free_blocks;
+    if (e->state == OUTBOX_IN_FLIGHT) {
+        ob->in_flight--;
+    }
+    e->state = OUTBOX_FREE;
+}
+
+// Oldest queued message, NULL if none
+static outbox_entry_t *oldest_queued(outbox_t *ob) {
+    outbox_entry_t *oldest = NULL;
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        outbox_entry_t *e = &ob->entries[i];
+        if (e->state == OUTBOX_QUEUED && (oldest == NULL || (int32_t)(e->seq - oldest->seq) < 0)) {
+            oldest = e;
+        }
+    }
+    return oldest;
+}
+
+static const uint8_t *gather(outbox_t *ob, const outbox_entry_t *e) {
+    size_t left = e->len;
+    uint8_t *dst = ob->scratch;
+    for (int16_t block = e->first_block; block != NO_BLOCK && left > 0; block = ob->next_block[block]) {
+        size_t chunk = left > OUTBOX_BLOCK_SIZE ? OUTBOX_BLOCK_SIZE : left;
+        memcpy(dst, ob->blocks[block], chunk);
+        dst += chunk;
+        left -= chunk;
+    }
+    return ob->scratch;
+}
+
+uint32_t outbox_pump(outbox_t *ob, outbox_send_fn send, void *ctx, uint32_t now_ms) {
+    uint32_t sent = 0;
+    outbox_entry_t *e;
+    // Strictly in order: a QoS 0 message behind a full window waits too
+    while ((e = oldest_queued(ob)) != NULL && (e->qos == 0 || ob->in_flight < ob->window)) {
+        int msg_id = send(ctx, e->topic, gather(ob, e), e->len, e->qos);
+        if (msg_id < 0) {
+            ob->stats.send_failures++;
+            break;
+        }
+        ob->stats.sent++;
+        sent++;
+        if (e->qos == 0) {
+            release(ob, e);
+            continue;
+        }
+        e->state = OUTBOX_IN_FLIGHT;
+        e->msg_id = msg_id;
+        e->sent_ms = now_ms;
+        ob->in_flight++;
+    }
+    return sent;
+}
+
+bool outbox_ack_push(outbox_t *ob, int msg_id, bool gave_up) {
+    outbox_ack_t ack = { .msg_id = msg_id, .gave_up = gave_up };
+    return spsc_push(&ob->acks, &ack);
+}
+
+static void requeue(outbox_t *ob, outbox_entry_t *e) {
+    e->state = OUTBOX_QUEUED;
+    ob->in_flight--;
+    ob->stats.resent++;
+}
+
+void outbox_poll(outbox_t *ob, uint32_t now_ms) {
+    outbox_ack_t ack;
+    while (spsc_pop(&ob->acks, &ack)) {
+        for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+            outbox_entry_t *e = &ob->entries[i];
+            if (e->state != OUTBOX_IN_FLIGHT || e->msg_id != ack.msg_id) {
+                continue;
+            }
+            if (ack.gave_up) {
+                requeue(ob, e);
+            } else {
+                ob->stats.acked++;
+                release(ob, e);
+            }
+            break;
+        }
+    }
+
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        outbox_entry_t *e = &ob->entries[i];
+        if (e->state == OUTBOX_IN_FLIGHT && now_ms - e->sent_ms >= OUTBOX_ACK_TIMEOUT_MS) {
+            requeue(ob, e);
+        }
+    }
+}
+
+uint32_t outbox_ms_until_timeout(const outbox_t *ob, uint32_t now_ms) {
+    uint32_t next = UINT32_MAX;
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        const outbox_entry_t *e = &ob->entries[i];
+        if (e->state == OUTBOX_IN_FLIGHT) {
+            uint32_t since = now_ms - e->sent_ms;
+            uint32_t left = since >= OUTBOX_ACK_TIMEOUT_MS ? 0 : OUTBOX_ACK_TIMEOUT_MS - since;
+            if (left < next) {
+                next = left;
+            }
+        }
+    }
+    return next;
+}
+
+uint16_t outbox_queued(const outbox_t *ob) {
+    uint16_t n = 0;
+    for (int i = 0; i < OUTBOX_ENTRIES; i++) {
+        n += ob->entries[i].state == OUTBOX_QUEUED;
+    }
+    return n;
+}
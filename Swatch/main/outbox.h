@@ -0,0 +1,137 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "channel.h"
+
+// Bounded outbox between data_send_task and the MQTT client. Messages are copied into a
+// fixed pool of blocks (a message takes as many as it needs, chained), so the memory it
+// uses has a hard cap and nothing is ever malloc'ed. At most window QoS 1 messages are
+// handed to the client before their PUBACK (MQTT_EVENT_PUBLISHED) comes back; the rest
+// wait here, in order. ESP-MQTT keeps every unacknowledged QoS 1 message in its own
+// outbox (on the heap), so the window is what keeps that one small too.
+//
+// When the pool is full outbox_put() fails: that is the backpressure, the caller keeps
+// the data (flash, RAM batch) instead of losing it.
+//
+// Only one task may use an outbox. Acks from the MQTT task go through outbox_ack_push().
+
+// Pool: OUTBOX_BLOCKS * OUTBOX_BLOCK_SIZE bytes of payload, the hard cap
+#ifndef OUTBOX_BLOCK_SIZE
+#define OUTBOX_BLOCK_SIZE 128
+#endif
+#ifndef OUTBOX_BLOCKS
+#define OUTBOX_BLOCKS 48
+#endif
+
+// Messages waiting or in flight at once
+#ifndef OUTBOX_ENTRIES
+#define OUTBOX_ENTRIES 16
+#endif
+
+// QoS 1 messages handed to the client and not acknowledged yet (default)
+#ifndef OUTBOX_WINDOW
+#define OUTBOX_WINDOW 4
+#endif
+
+// A QoS 1 message without an ack after this long is sent again (ms). ESP-MQTT retransmits
+// on its own meanwhile and gives up (MQTT_EVENT_DELETED) after 30 s.
+#ifndef OUTBOX_ACK_TIMEOUT_MS
+#define OUTBOX_ACK_TIMEOUT_MS 30000
+#endif
+
+// Biggest message
+#define OUTBOX_MESSAGE_MAX 2048
+
+// Acks and give-ups from the MQTT task, waiting to be applied (power of two)
+#define OUTBOX_ACK_RING 16
+
+typedef enum {
+    OUTBOX_FREE = 0,
+    OUTBOX_QUEUED,          // waiting for its turn
+    OUTBOX_IN_FLIGHT,       // QoS 1, handed to the client, no ack yet
+} outbox_state_t;
+
+typedef struct {
+    const char *topic;      // must stay valid (mqtt.c builds its topics once, before connecting)
+    uint16_t len;
+    uint8_t qos;
+    uint8_t state;
+    int16_t first_block;
+    int msg_id;
+    uint32_t seq;           // order of outbox_put
+    uint32_t sent_ms;
+} outbox_entry_t;
+
+// One ack or give-up on its way from the MQTT task
+typedef struct {
+    int32_t msg_id;
+    int32_t gave_up;
+} outbox_ack_t;
+
+typedef struct {
+    uint32_t put;
+    uint32_t sent;          // handed to the client, resends included
+    uint32_t acked;
+    uint32_t resent;        // timed out or given up by the client, sent again
+    uint32_t full;          // outbox_put refused for lack of room
+    uint32_t send_failures; // the client refused a message (kept, tried again later)
+    uint16_t blocks_used;
+    uint16_t blocks_max;    // most blocks ever in use
+} outbox_stats_t;
+
+// Hands one message to the client. Returns its message id (0 for QoS 0), or < 0 if the
+// client can't take it now.
+typedef int (*outbox_send_fn)(void *ctx, const char *topic, const uint8_t *data, size_t len, int qos);
+
+typedef struct {
+    uint8_t blocks[OUTBOX_BLOCKS][OUTBOX_BLOCK_SIZE];
+    int16_t next_block[OUTBOX_BLOCKS];  // chain of a message, or of the free list
+    int16_t free_block;
+    uint16_t free_blocks;
+    outbox_entry_t entries[OUTBOX_ENTRIES];
+    uint32_t next_seq;
+    uint8_t window;
+    uint8_t in_flight;
+
+    // Pushed by the MQTT task, popped by the owner
+    outbox_ack_t ack_storage[OUTBOX_ACK_RING];
+    spsc_ring_t acks;
+
+    outbox_stats_t stats;
+    uint8_t scratch[OUTBOX_MESSAGE_MAX];    // one message put back together for sending
+} outbox_t;
+
+// window is the number of QoS 1 messages in flight (1..OUTBOX_ENTRIES)
+void outbox_init(outbox_t *ob, uint8_t window);
+
+// Whether a message this long fits right now
+bool outbox_has_room(const outbox_t *ob, size_t len);
+
+// Share of the pool in use, in percent
+uint8_t outbox_fill(const outbox_t *ob);
+
+// Copies a message in. Returns false (and counts it) if there is no room.
+bool outbox_put(outbox_t *ob, const char *topic, const void *data, size_t len, uint8_t qos);
+
+// Hands queued messages to the client, oldest first, as far as the window allows. QoS 0
+// messages are freed once the client took them. Returns how many went out.
+uint32_t outbox_pump(outbox_t *ob, outbox_send_fn send, void *ctx, uint32_t now_ms);
+
+// MQTT task side: the broker acknowledged msg_id (MQTT_EVENT_PUBLISHED), or the client
+// gave up on it (MQTT_EVENT_DELETED, gave_up true). False if the ring was full; the
+// message then times out and goes again.
+bool outbox_ack_push(outbox_t *ob, int msg_id, bool gave_up);
+
+// Owner side: applies the acks that came in and re-queues what timed out
+void outbox_poll(outbox_t *ob, uint32_t now_ms);
+
+// How long until outbox_poll has a timeout to handle (UINT32_MAX if nothing is in flight)
+uint32_t outbox_ms_until_timeout(const outbox_t *ob, uint32_t now_ms);
+
+// Messages waiting for their turn (not in flight)
+uint16_t outbox_queued(const outbox_t *ob);
+
+#endif
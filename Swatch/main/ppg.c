@@ -0,0 +1,228 @@
+#include <string.h>
+#include "ppg.h"
+
+// Smallest shift so that 2^shift >= value
+static uint8_t ceil_log2(uint32_t value) {
+    uint8_t shift = 0;
+    while ((1u << shift) < value) {
+        shift++;
+    }
+    return shift;
+}
+
+bool ppg_init(ppg_t *ppg, uint16_t rate_hz) {
+    if (rate_hz < PPG_MIN_RATE_HZ || rate_hz > PPG_MAX_RATE_HZ) {
+        return false;
+    }
+    memset(ppg, 0, sizeof(*ppg));
+    ppg->rate_hz = rate_hz;
+
+    // High-pass: DC follows the signal with a time constant of about one second
+    ppg->dc_shift = ceil_log2(rate_hz);
+
+    // Low-pass: 100 ms moving sum, first null at 10 Hz and about -3 dB at 4.4 Hz,
+    // which keeps the pulse (0.5 - 3.7 Hz) and removes most sensor noise
+    ppg->box_len = rate_hz / 10;
+
+    // Upstroke over 50 ms
+    ppg->diff_len = rate_hz / 20;
+
+    ppg->refractory = (uint32_t)rate_hz * PPG_MIN_IBI_MS / 1000;
+    ppg->silence = 2u * rate_hz;
+    ppg->decay_shift = ceil_log2(rate_hz / 4);
+    return true;
+}
+
+// Band-pass filter one block into ppg->filtered. The state carried between samples
+// is just a couple of adds and a shift, with no branches in the loop.
+static void ppg_filter(ppg_t *ppg, const int32_t *raw, size_t n) {
+    int32_t dc = ppg->dc_q8;
+    int32_t sum = ppg->box_sum;
+    uint16_t pos = ppg->box_pos;
+    const uint8_t shift = ppg->dc_shift;
+    const uint16_t len = ppg->box_len;
+    int32_t *out = ppg->filtered + ppg->diff_len;
+
+    // Start the DC tracker at the real level, otherwise the first seconds are one huge "beat"
+    if (!ppg->dc_ready) {
+        dc = raw[0] * 256;
+        ppg->dc_ready = true;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        dc += (raw[i] * 256 - dc) >> shift;
+        int32_t x = raw[i] - (dc >> 8);
+        sum += x - ppg->box[pos];
+        ppg->box[pos] = x;
+        pos = (pos + 1 == len) ? 0 : pos + 1;
+        out[i] = sum;
+    }
+
+    ppg->dc_q8 = dc;
+    ppg->box_sum = sum;
+    ppg->box_pos = pos;
+}
+
+// Upstroke for every sample in the block. Nothing is carried from one sample to the
+// next, so the compiler can vectorize this loop.
+static void ppg_upstroke(ppg_t *ppg, size_t n) {
+    const int32_t *f = ppg->filtered;
+    const uint16_t k = ppg->diff_len;
+    int32_t *y = ppg->upstroke;
+
+    for (size_t i = 0; i < n; i++) {
+        y[i] = f[i + k] - f[i];
+    }
+
+    // Keep the newest diff_len filtered samples as history for the next block
+    memmove(ppg->filtered, ppg->filtered + n, k * sizeof(int32_t));
+}
+
+// Middle value of the interval history (insertion sort, at most PPG_IBI_HISTORY entries)
+static uint16_t ppg_median_ibi(const ppg_t *ppg) {
+    uint16_t sorted[PPG_IBI_HISTORY];
+    for (uint8_t i = 0; i < ppg->ibi_count; i++) {
+        uint16_t v = ppg->ibi[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    return sorted[ppg->ibi_count / 2];
+}
+
+// Checks a new interval against the recent ones and updates the BPM. Returns false for outliers.
+static bool ppg_accept_ibi(ppg_t *ppg, uint16_t ibi_ms) {
+    if (ppg->ibi_count >= 3) {
+        uint16_t median = ppg_median_ibi(ppg);
+        uint32_t diff = ibi_ms > median ? ibi_ms - median : median - ibi_ms;
+        if (diff * 100 > (uint32_t)median * PPG_OUTLIER_PERCENT) {
+            ppg->rejected++;
+            // Several outliers in a row: the rate really changed, start over
+            if (++ppg->rejects_in_row >= PPG_MAX_REJECTS) {
+                ppg->ibi_count = 0;
+                ppg->ibi_pos = 0;
+                ppg->rejects_in_row = 0;
+            }
+            return false;
+        }
+    }
+    ppg->rejects_in_row = 0;
+
+    ppg->ibi[ppg->ibi_pos] = ibi_ms;
+    ppg->ibi_pos = (ppg->ibi_pos + 1) % PPG_IBI_HISTORY;
+    if (ppg->ibi_count < PPG_IBI_HISTORY) {
+        ppg->ibi_count++;
+    }
+
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < ppg->ibi_count; i++) {
+        total += ppg->ibi[i];
+    }
+    ppg->bpm = (uint16_t)((60000u * ppg->ibi_count + total / 2) / total);
+    return true;
+}
+
+// A pulse peaked at sample index idx. Returns true if it is a new beat.
+static bool ppg_peak(ppg_t *ppg, uint32_t idx, int32_t value, ppg_beat_t *beat) {
+    if (value <= 0 || value <= ppg->threshold) {
+        return false;
+    }
+    // Nothing can beat again this soon. Once the rhythm is known the window grows to
+    // 60% of the usual interval, which also skips the dicrotic (second, smaller) wave.
+    uint32_t refractory = ppg->refractory;
+    if (ppg->ibi_count >= 3) {
+        uint32_t usual = (uint32_t)ppg_median_ibi(ppg) * ppg->rate_hz * 6 / 10000;
+        if (usual > refractory) {
+            refractory = usual;
+        }
+    }
+    if (ppg->have_peak && idx - ppg->last_peak < refractory) {
+        return false;
+    }
+
+    // Adapt the threshold to the pulse amplitude (half of the recent peak level)
+    ppg->peak_level = ppg->peak_level ? (3 * ppg->peak_level + value) / 4 : value;
+    ppg->threshold = ppg->peak_level / 2;
+
+    if (!ppg->have_peak) {
+        ppg->have_peak = true;
+        ppg->last_peak = idx;
+        return false;
+    }
+
+    uint32_t gap = idx - ppg->last_peak;
+    ppg->last_peak = idx;
+
+    // A long gap (lost contact, missed beats) has no usable interval. Checked in samples,
+    // a gap of hours would overflow in ms.
+    if (gap > (uint32_t)PPG_MAX_IBI_MS * ppg->rate_hz / 1000) {
+        return false;
+    }
+    uint32_t ibi_ms = gap * 1000u / ppg->rate_hz;
+    if (!ppg_accept_ibi(ppg, (uint16_t)ibi_ms)) {
+        return false;
+    }
+
+    ppg->beats++;
+    beat->sample_index = idx;
+    beat->ibi_ms = (uint16_t)ibi_ms;
+    beat->bpm = ppg->bpm;
+    return true;
+}
+
+// Walks the upstroke looking for pulses above the adaptive threshold
+static size_t ppg_detect(ppg_t *ppg, size_t n, ppg_beat_t *beats, size_t max_beats) {
+    const int32_t *y = ppg->upstroke;
+    size_t found = 0;
+    ppg_beat_t spare;       // a beat beyond max_beats still moves the detector on
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t idx = ppg->samples + i;
+
+        // No beat for a while: let the threshold sink so we can lock on again
+        if (ppg->have_peak && idx - ppg->last_peak > ppg->silence) {
+            ppg->peak_level -= ppg->peak_level >> ppg->decay_shift;
+            ppg->threshold = ppg->peak_level / 2;
+        }
+
+        if (!ppg->in_pulse) {
+            if (y[i] > ppg->threshold) {
+                ppg->in_pulse = true;
+                ppg->pulse_max = y[i];
+                ppg->pulse_max_idx = idx;
+            }
+            continue;
+        }
+
+        if (y[i] > ppg->pulse_max) {
+            ppg->pulse_max = y[i];
+            ppg->pulse_max_idx = idx;
+        } else if (y[i] < ppg->threshold / 2) {
+            ppg->in_pulse = false;
+            ppg_beat_t *beat = found < max_beats ? &beats[found] : &spare;
+            if (ppg_peak(ppg, ppg->pulse_max_idx, ppg->pulse_max, beat) && beat != &spare) {
+                found++;
+            }
+        }
+    }
+
+    ppg->samples += n;
+    return found;
+}
+
+size_t ppg_process_block(ppg_t *ppg, const int32_t *raw, size_t n, ppg_beat_t *beats, size_t max_beats) {
+    size_t found = 0;
+
+    while (n > 0) {
+        size_t chunk = n < PPG_BLOCK_MAX ? n : PPG_BLOCK_MAX;
+        ppg_filter(ppg, raw, chunk);
+        ppg_upstroke(ppg, chunk);
+        found += ppg_detect(ppg, chunk, beats + found, max_beats - found);
+        raw += chunk;
+        n -= chunk;
+    }
+    return found;
+}
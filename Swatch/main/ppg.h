@@ -0,0 +1,92 @@
+#ifndef PPG_H
+#define PPG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Streaming heart-rate estimator for raw PPG (photoplethysmogram) samples.
+// Everything is integer math on fixed-size buffers inside ppg_t, so nothing is
+// allocated while samples are being processed.
+
+#define PPG_MIN_RATE_HZ 50
+#define PPG_MAX_RATE_HZ 500
+
+// Samples are processed in chunks of at most this many (bigger blocks are split)
+#define PPG_BLOCK_MAX 64
+
+// How many accepted inter-beat intervals are averaged for the BPM value
+#define PPG_IBI_HISTORY 8
+
+// Beats closer/further apart than this are not heart beats (220 / 30 BPM)
+#define PPG_MIN_IBI_MS 273
+#define PPG_MAX_IBI_MS 2000
+
+// An interval further than this many percent from the recent median is an outlier
+#define PPG_OUTLIER_PERCENT 30
+
+// After this many outliers in a row we assume the heart rate really changed
+#define PPG_MAX_REJECTS 3
+
+// One detected heart beat
+typedef struct {
+    uint32_t sample_index;  // sample of the steepest upstroke, counted from ppg_init()
+    uint16_t ibi_ms;        // time since the previous beat
+    uint16_t bpm;           // heart rate averaged over the recent beats
+} ppg_beat_t;
+
+typedef struct {
+    uint16_t rate_hz;
+    uint32_t samples;           // total samples processed
+
+    // Band-pass: slow DC tracker (high-pass) followed by a short moving sum (low-pass)
+    bool dc_ready;
+    int32_t dc_q8;              // DC level, 8 fractional bits
+    uint8_t dc_shift;           // DC time constant is 2^dc_shift samples (about 1 s)
+    int32_t box[PPG_MAX_RATE_HZ / 10];
+    uint16_t box_len;
+    uint16_t box_pos;
+    int32_t box_sum;
+
+    // Upstroke detector: filtered[i] - filtered[i - diff_len]. Breathing and motion move
+    // the baseline much slower than the systolic upstroke, so this mostly cancels them.
+    uint16_t diff_len;
+
+    // Scratch for the current block. filtered keeps diff_len samples of history in front.
+    int32_t filtered[PPG_MAX_RATE_HZ / 20 + PPG_BLOCK_MAX];
+    int32_t upstroke[PPG_BLOCK_MAX];
+
+    // Peak detection (on the upstroke signal). A pulse starts when the upstroke rises
+    // above threshold and ends when it falls below half of it, the peak is its maximum.
+    bool in_pulse;
+    int32_t pulse_max;
+    uint32_t pulse_max_idx;
+    int32_t peak_level;         // running amplitude of accepted peaks
+    int32_t threshold;          // candidates must be above this
+    uint32_t refractory;        // minimum samples between beats (grows with the rhythm)
+    uint32_t silence;           // samples without a beat before the threshold starts decaying
+    uint8_t decay_shift;
+    bool have_peak;
+    uint32_t last_peak;
+
+    // Interval history for outlier rejection and BPM averaging
+    uint16_t ibi[PPG_IBI_HISTORY];
+    uint8_t ibi_count;
+    uint8_t ibi_pos;
+    uint8_t rejects_in_row;
+    uint16_t bpm;               // latest estimate (0 until the first good interval)
+
+    // Counters
+    uint32_t beats;
+    uint32_t rejected;
+} ppg_t;
+
+// rate_hz must be between PPG_MIN_RATE_HZ and PPG_MAX_RATE_HZ
+bool ppg_init(ppg_t *ppg, uint16_t rate_hz);
+
+// Feeds n raw samples (must fit in 20 bits). Detected beats are written to beats
+// (up to max_beats) and the number written is returned. Beats beyond max_beats are
+// lost, but still count as beats for the intervals that follow.
+size_t ppg_process_block(ppg_t *ppg, const int32_t *raw, size_t n, ppg_beat_t *beats, size_t max_beats);
+
+#endif
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+#include "publish.h"
+
+static bool is_alarm(const publish_policy_t *policy, int bpm, bool in_alarm) {
+    int margin = in_alarm ? PUBLISH_ALARM_HYSTERESIS_BPM : 0;
+    return (policy->alarm_high_bpm && bpm >= policy->alarm_high_bpm - margin) ||
+           (policy->alarm_low_bpm && bpm <= policy->alarm_low_bpm + margin);
+}
+
+void publish_sched_init(publish_sched_t *sched, const publish_policy_t *policy, uint32_t now_ms) {
+    memset(sched, 0, sizeof(*sched));
+    sched->policy = *policy;
+    sched->last_publish_ms = now_ms;
+}
+
+void publish_sched_set_policy(publish_sched_t *sched, const publish_policy_t *policy) {
+    sched->policy = *policy;
+}
+
+bool publish_sched_offer(publish_sched_t *sched, const bpm_sample_t *sample) {
+    sched->offered++;
+    sched->have_seen = true;
+    sched->last_seen = *sample;
+
+    // Entering or leaving the alarm range has to go out right away
+    bool alarm = is_alarm(&sched->policy, sample->bpm, sched->in_alarm);
+    if (alarm != sched->in_alarm) {
+        sched->in_alarm = alarm;
+        if (!sched->urgent) {
+            sched->urgent = true;
+            sched->urgent_ts = sample->timestamp_ms;
+        }
+    } else if (!alarm && sched->have_kept &&
+               abs(sample->bpm - sched->last_kept_bpm) < sched->policy.deadband_bpm) {
+        // Too close to what was already sent to be worth it (alarm values are always kept)
+        sched->suppressed++;
+        return false;
+    }
+
+    sched->have_kept = true;
+    sched->last_kept_bpm = sample->bpm;
+    return true;
+}
+
+publish_reason_t publish_sched_check(const publish_sched_t *sched, const bpm_batch_t *batch, uint32_t now_ms) {
+    if (sched->urgent && batch->count > 0) {
+        return PUBLISH_URGENT;
+    }
+    uint32_t since = now_ms - sched->last_publish_ms;
+    if (batch->count > 0 && since >= sched->policy.min_interval_ms && batch_should_flush(batch, now_ms)) {
+        return PUBLISH_BATCH;
+    }
+    if (sched->have_seen && sched->policy.max_silence_ms && since >= sched->policy.max_silence_ms) {
+        return PUBLISH_HEARTBEAT;
+    }
+    return PUBLISH_WAIT;
+}
+
+uint32_t publish_sched_ms_until(const publish_sched_t *sched, const bpm_batch_t *batch, uint32_t now_ms) {
+    if (sched->urgent && batch->count > 0) {
+        return 0;
+    }
+    uint32_t since = now_ms - sched->last_publish_ms;
+    uint32_t wait = UINT32_MAX;
+
+    if (batch->count > 0) {
+        uint32_t batch_wait = batch->count >= batch->max_samples ? 0 : batch_ms_until_flush(batch, now_ms);
+        uint32_t interval_wait = since >= sched->policy.min_interval_ms ? 0 : sched->policy.min_interval_ms - since;
+        wait = batch_wait > interval_wait ? batch_wait : interval_wait;
+    }
+    if (sched->have_seen && sched->policy.max_silence_ms) {
+        uint32_t silence_wait = since >= sched->policy.max_silence_ms ? 0 : sched->policy.max_silence_ms - since;
+        if (silence_wait < wait) {
+            wait = silence_wait;
+        }
+    }
+    return wait;
+}
+
+void publish_sched_sent(publish_sched_t *sched, publish_reason_t reason, uint32_t now_ms) {
+    sched->publishes++;
+    sched->last_publish_ms = now_ms;
+    if (reason == PUBLISH_HEARTBEAT) {
+        sched->heartbeats++;
+    } else if (reason == PUBLISH_URGENT) {
+        uint32_t latency = now_ms - sched->urgent_ts;
+        sched->urgent = false;
+        sched->urgent_publishes++;
+        sched->urgent_latency_sum_ms += latency;
+        if (latency > sched->urgent_latency_max_ms) {
+            sched->urgent_latency_max_ms = latency;
+        }
+    }
+}
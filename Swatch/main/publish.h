@@ -0,0 +1,101 @@
+#ifndef PUBLISH_H
+#define PUBLISH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sensor.h"
+#include "batch.h"
+
+// Defaults for the publish policy (each can be overridden at build time)
+
+// A beat is only kept if its BPM differs this much from the last kept one (0 = keep all)
+#ifndef PUBLISH_DEADBAND_BPM
+#define PUBLISH_DEADBAND_BPM 2
+#endif
+
+// Publish at least this often, repeating the newest value if nothing changed (ms)
+#ifndef PUBLISH_MAX_SILENCE_MS
+#define PUBLISH_MAX_SILENCE_MS 30000
+#endif
+
+// Normal publishes are at least this far apart (ms)
+#ifndef PUBLISH_MIN_INTERVAL_MS
+#define PUBLISH_MIN_INTERVAL_MS 5000
+#endif
+
+// Going above / below these (and coming back) is published right away (0 = off)
+#ifndef PUBLISH_ALARM_HIGH_BPM
+#define PUBLISH_ALARM_HIGH_BPM 120
+#endif
+#ifndef PUBLISH_ALARM_LOW_BPM
+#define PUBLISH_ALARM_LOW_BPM 40
+#endif
+
+// An alarm only ends once the BPM is this far back inside the limits (stops flapping)
+#define PUBLISH_ALARM_HYSTERESIS_BPM 5
+
+typedef struct {
+    uint16_t deadband_bpm;
+    uint32_t max_silence_ms;
+    uint32_t min_interval_ms;
+    uint16_t alarm_high_bpm;
+    uint16_t alarm_low_bpm;
+} publish_policy_t;
+
+#define PUBLISH_POLICY_DEFAULT {                    \
+        .deadband_bpm = PUBLISH_DEADBAND_BPM,       \
+        .max_silence_ms = PUBLISH_MAX_SILENCE_MS,   \
+        .min_interval_ms = PUBLISH_MIN_INTERVAL_MS, \
+        .alarm_high_bpm = PUBLISH_ALARM_HIGH_BPM,   \
+        .alarm_low_bpm = PUBLISH_ALARM_LOW_BPM,     \
+    }
+
+// Why a publish is due
+typedef enum {
+    PUBLISH_WAIT = 0,       // nothing to do yet
+    PUBLISH_BATCH,          // the batch is full or old enough
+    PUBLISH_HEARTBEAT,      // nothing was published for max_silence_ms
+    PUBLISH_URGENT,         // an alarm threshold was crossed
+} publish_reason_t;
+
+// Decides which beats are worth sending and when the batch goes out
+typedef struct {
+    publish_policy_t policy;
+
+    bool have_kept;
+    int last_kept_bpm;
+    bool have_seen;
+    bpm_sample_t last_seen;     // newest beat, kept or not (heartbeats repeat it)
+    bool in_alarm;
+    bool urgent;                // an alarm change is waiting to be published
+    uint32_t urgent_ts;         // timestamp of the beat that caused it
+    uint32_t last_publish_ms;
+
+    // Counters so policies can be compared
+    uint32_t offered;
+    uint32_t suppressed;        // beats dropped by the deadband
+    uint32_t publishes;
+    uint32_t heartbeats;
+    uint32_t urgent_publishes;
+    uint32_t urgent_latency_max_ms;
+    uint32_t urgent_latency_sum_ms;
+} publish_sched_t;
+
+void publish_sched_init(publish_sched_t *sched, const publish_policy_t *policy, uint32_t now_ms);
+
+// Replaces the policy while running (the alarm state and counters are kept)
+void publish_sched_set_policy(publish_sched_t *sched, const publish_policy_t *policy);
+
+// Looks at a new beat. Returns true if it should go into the batch.
+bool publish_sched_offer(publish_sched_t *sched, const bpm_sample_t *sample);
+
+// Whether (and why) the batch should be published now
+publish_reason_t publish_sched_check(const publish_sched_t *sched, const bpm_batch_t *batch, uint32_t now_ms);
+
+// How long until publish_sched_check() will say something is due (UINT32_MAX = not until a new beat)
+uint32_t publish_sched_ms_until(const publish_sched_t *sched, const bpm_batch_t *batch, uint32_t now_ms);
+
+// Call after the batch went out for the given reason
+void publish_sched_sent(publish_sched_t *sched, publish_reason_t reason, uint32_t now_ms);
+
+#endif
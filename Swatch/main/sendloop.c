@@ -0,0 +1,226 @@
+#include <string.h>
+#include "esp_log.h"
+#include "sendloop.h"
+#include "metrics.h"
+#include "dlog.h"
+#define TAG "SEND"
+
+void sendloop_init(sendloop_t *loop, const sendloop_config_t *config, uint32_t now) {
+    memset(loop, 0, sizeof(*loop));
+    loop->config = *config;
+    batch_init(&loop->batch, BATCH_MAX_SAMPLES, BATCH_MAX_AGE_MS);
+    publish_sched_init(&loop->sched, &config->policy, now);
+    agg_init(&loop->agg, &config->agg, now);
+    loop->backlog_ok = config->backlog_partition != NULL &&
+                       flashlog_open(&loop->backlog, config->backlog_partition) == ESP_OK;
+    outbox_init(&loop->outbox, config->window);
+}
+
+void sendloop_set_aggregation(sendloop_t *loop, const agg_config_t *agg, bool raw, uint32_t now) {
+    loop->config.agg = *agg;
+    loop->config.raw = raw;
+    agg_init(&loop->agg, agg, now);
+}
+
+bool sendloop_take_beat(sendloop_t *loop, const bpm_sample_t *sample, bool artifact) {
+    if (!artifact) {
+        agg_add(&loop->agg, sample);
+    }
+    // Without single beats, only the ones that start or end an alarm go out
+    if (!publish_sched_offer(&loop->sched, sample) || !(loop->config.raw || loop->sched.urgent)) {
+        return false;
+    }
+    if (!batch_add(&loop->batch, sample)) {
+        DLOGW(TAG, "Batch full, oldest sample overwritten");
+    }
+    return true;
+}
+
+// Publishes the oldest waiting samples as one message, or stores them in flash when the
+// broker can't be reached. Returns false if the samples are still waiting.
+static bool flush_batch(sendloop_t *loop, uint32_t now) {
+    uint8_t message[BATCH_PAYLOAD_MAX];
+    uint16_t encoded = 0;
+    size_t len = batch_encode(&loop->batch, message, sizeof(message), &encoded);
+    if (len == 0) {
+        return false;
+    }
+
+    bpm_batch_t *batch = &loop->batch;
+    if (!loop->connected || !outbox_put(&loop->outbox, loop->config.bpm_topic, message, len, loop->config.qos)) {
+        // Still starting up: the broker is seconds away, keep the samples in RAM instead
+        // of a flash write (and a replay) per batch, unless the batch is about to overflow
+        if (!loop->ever_connected && batch->count + BATCH_MAX_SAMPLES <= BATCH_CAPACITY) {
+            return false;
+        }
+        // Offline, or the link can't keep up and the outbox is full: flash takes it
+        if (loop->backlog_ok && flashlog_append(&loop->backlog, message, len) == ESP_OK) {
+            batch_drop(batch, encoded);
+            DLOGI(TAG, "%s, stored %u samples in flash (%lu batches waiting)",
+                  loop->connected ? "Outbox full" : "Offline", encoded, (unsigned long)loop->backlog.pending);
+            return true;
+        }
+        loop->publish_failures++;
+        DLOGW(TAG, "Publish failed, keeping %u samples for later", batch->count);
+        return false;
+    }
+
+    // Age of every sample when it went out
+    for (uint16_t i = 0; i < encoded; i++) {
+        metrics_hist_record(&metrics_publish_latency, now - batch_at(batch, i)->timestamp_ms);
+    }
+    batch_consume(batch, encoded, len);
+    loop->ever_published = true;
+
+    // Averages in tenths, the deferred log only takes integers
+    uint32_t per_publish_x10 = (uint32_t)((uint64_t)batch->samples_sent * 10 / batch->publishes);
+    uint32_t per_sample_x10 = (uint32_t)((uint64_t)batch->bytes_sent * 10 / batch->samples_sent);
+    DLOGI(TAG, "Published %u samples in %u bytes (avg %lu.%lu samples/publish, %lu.%lu bytes/sample, %lu of %lu beats suppressed)",
+          encoded, (unsigned)len, (unsigned long)(per_publish_x10 / 10), (unsigned long)(per_publish_x10 % 10),
+          (unsigned long)(per_sample_x10 / 10), (unsigned long)(per_sample_x10 % 10),
+          (unsigned long)loop->sched.suppressed, (unsigned long)loop->sched.offered);
+    return true;
+}
+
+// Publishes the batch for the given reason. Returns false if the samples are still waiting.
+static bool publish_due(sendloop_t *loop, publish_reason_t reason, uint32_t now) {
+    // Without single beats the window summaries already show the watch is alive
+    if (reason == PUBLISH_HEARTBEAT && !loop->config.raw) {
+        publish_sched_sent(&loop->sched, reason, now);
+        return true;
+    }
+    // A heartbeat with nothing new repeats the newest value
+    if (reason == PUBLISH_HEARTBEAT && loop->batch.count == 0) {
+        batch_add(&loop->batch, &loop->sched.last_seen);
+        loop->heartbeats++;
+    }
+    if (!flush_batch(loop, now)) {
+        return false;
+    }
+
+    publish_sched_sent(&loop->sched, reason, now);
+    if (reason == PUBLISH_URGENT) {
+        DLOGW(TAG, "Alarm: %d BPM published %lu ms after the beat (%lu alarms, max %lu ms)",
+              loop->sched.last_kept_bpm,
+              (unsigned long)(now - loop->sched.urgent_ts),
+              (unsigned long)loop->sched.urgent_publishes,
+              (unsigned long)loop->sched.urgent_latency_max_ms);
+    }
+    return true;
+}
+
+// Publishes a window summary. They are small and come often, so one that can't go out is just dropped.
+static void publish_summary(sendloop_t *loop, const agg_summary_t *summary) {
+    uint8_t message[AGG_ENCODED_SIZE];
+    size_t len = agg_encode(summary, message, sizeof(message));
+    if (!loop->connected || !outbox_put(&loop->outbox, loop->config.agg_topic, message, len, 0)) {
+        DLOGW(TAG, "Offline, window summary dropped");
+        return;
+    }
+    DLOGI(TAG, "Window: %u beats, %u-%u BPM (mean %u.%u), SDNN %u ms, RMSSD %u ms",
+          summary->count, summary->bpm_min, summary->bpm_max,
+          summary->bpm_mean_x10 / 10, summary->bpm_mean_x10 % 10,
+          summary->sdnn_ms, summary->rmssd_ms);
+}
+
+// How long until the next backlog replay may go out (UINT32_MAX if there is nothing to replay)
+static uint32_t ms_until_replay(const sendloop_t *loop, uint32_t now) {
+    // Replays only go into an idle outbox, so they take what the link has left
+    if (!loop->backlog_ok || loop->backlog.pending == 0 || !loop->connected || outbox_queued(&loop->outbox) > 0) {
+        return UINT32_MAX;
+    }
+    uint32_t since = now - loop->last_replay_ms;
+    return since >= REPLAY_INTERVAL_MS ? 0 : REPLAY_INTERVAL_MS - since;
+}
+
+// Publishes the oldest stored batches, as many as fit in one payload
+static void replay_backlog(sendloop_t *loop) {
+    flashlog_span_t span;
+    size_t len = flashlog_read(&loop->backlog, loop->replay_payload, sizeof(loop->replay_payload), &span);
+    if (span.records == 0 && span.skipped == 0) {
+        // pending says there is something but nothing could be read: a flash read error,
+        // or the count went wrong. The first time, try again next interval; after that
+        // count what is really there, so a wrong count doesn't come back every interval.
+        uint32_t pending = loop->backlog.pending;
+        if (++loop->empty_replays == 1) {
+            DLOGW(TAG, "Nothing to replay with %lu batches waiting", (unsigned long)pending);
+        } else if (flashlog_recount(&loop->backlog) != pending) {
+            DLOGW(TAG, "Backlog recounted: %lu batches waiting, not %lu",
+                  (unsigned long)loop->backlog.pending, (unsigned long)pending);
+        }
+        return;
+    }
+    loop->empty_replays = 0;
+    if (len > 0 && !outbox_put(&loop->outbox, loop->config.backlog_topic, loop->replay_payload, len, loop->config.qos)) {
+        // The live data has the outbox, the replay waits for room
+        return;
+    }
+
+    esp_err_t err = flashlog_consume(&loop->backlog, &span);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mark backlog as sent: %s", esp_err_to_name(err));
+    }
+    ESP_LOGI(TAG, "Replayed %lu stored batches in %u bytes, %lu left",
+             (unsigned long)span.records, (unsigned)len, (unsigned long)loop->backlog.pending);
+}
+
+void sendloop_run(sendloop_t *loop, bool connected, uint32_t now) {
+    loop->connected = connected;
+    loop->ever_connected |= connected;
+    outbox_poll(&loop->outbox, now);
+
+    // Send whatever the scheduler says is due. Right after a reboot, what was measured
+    // while the network came up goes out as soon as the broker is there, instead of
+    // waiting for the batch to fill up.
+    loop->last_flush_failed = false;
+    if (!loop->ever_published && connected && loop->batch.count > 0 && !publish_due(loop, PUBLISH_BATCH, now)) {
+        loop->last_flush_failed = true;
+    }
+    publish_reason_t reason;
+    while (!loop->last_flush_failed && (reason = publish_sched_check(&loop->sched, &loop->batch, now)) != PUBLISH_WAIT) {
+        if (!publish_due(loop, reason, now)) {
+            loop->last_flush_failed = true;
+            break;
+        }
+    }
+
+    agg_summary_t summary;
+    while (agg_poll(&loop->agg, now, &summary)) {
+        publish_summary(loop, &summary);
+    }
+
+    // Then catch up on what was stored while offline, one payload at a time
+    if (ms_until_replay(loop, now) == 0) {
+        loop->last_replay_ms = now;
+        replay_backlog(loop);
+    }
+
+    // Everything above only queued; hand over what the window allows
+    uint32_t send_failures = loop->outbox.stats.send_failures;
+    if (connected) {
+        outbox_pump(&loop->outbox, loop->config.send, loop->config.send_ctx, now);
+    }
+    loop->last_send_failed = loop->outbox.stats.send_failures != send_failures;
+}
+
+uint32_t sendloop_ms_until(const sendloop_t *loop, uint32_t now) {
+    // After a failed publish, wait a bit before trying again instead of spinning
+    uint32_t wait = loop->last_flush_failed ? BATCH_RETRY_MS : publish_sched_ms_until(&loop->sched, &loop->batch, now);
+    uint32_t agg_ms = agg_ms_until(&loop->agg, now);
+    if (agg_ms < wait) {
+        wait = agg_ms;
+    }
+    uint32_t replay_ms = ms_until_replay(loop, now);
+    if (replay_ms < wait) {
+        wait = replay_ms;
+    }
+    // Acks wake the task up, but a message the client refused or an ack timeout doesn't
+    uint32_t outbox_ms = outbox_ms_until_timeout(&loop->outbox, now);
+    if (loop->last_send_failed && outbox_ms > BATCH_RETRY_MS) {
+        outbox_ms = BATCH_RETRY_MS;
+    }
+    if (outbox_ms < wait) {
+        wait = outbox_ms;
+    }
+    return wait;
+}
@@ -0,0 +1,83 @@
+#ifndef SENDLOOP_H
+#define SENDLOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "batch.h"
+#include "publish.h"
+#include "aggregate.h"
+#include "outbox.h"
+#include "flashlog.h"
+
+// What data_send_task does with the beats, one pass at a time: the sample batch and the
+// publish scheduler, window summaries, the flash backlog and its replay, and the outbox.
+// It only reaches the MQTT client through the outbox's send function, so the firmware
+// runs one of these (mqtt.c) and host/fleet_bench runs one per simulated watch.
+//
+// Only one task may use a sendloop_t (acks go through outbox_ack_push on its outbox).
+
+// How long to wait before retrying a failed batch publish (ms)
+#define BATCH_RETRY_MS 2000
+
+// Stored batches are replayed back to back. At most one payload this big goes out per
+// interval, so the live data keeps flowing meanwhile.
+#define REPLAY_PAYLOAD_MAX 2048
+#define REPLAY_INTERVAL_MS 1000
+
+typedef struct {
+    // Topics of the batches, the replays and the window summaries (the outbox keeps
+    // pointers to them, so they must stay valid)
+    const char *bpm_topic;
+    const char *backlog_topic;
+    const char *agg_topic;
+    const char *backlog_partition;  // flash log of the backlog, NULL for none
+    publish_policy_t policy;
+    agg_config_t agg;
+    bool raw;                       // single beats are published next to the summaries
+    uint8_t qos;                    // of batches and replays (summaries always go at 0)
+    uint8_t window;                 // QoS 1 messages in flight (outbox.h)
+    outbox_send_fn send;
+    void *send_ctx;
+} sendloop_config_t;
+
+typedef struct {
+    sendloop_config_t config;
+    bpm_batch_t batch;
+    publish_sched_t sched;
+    agg_t agg;
+    outbox_t outbox;
+    flashlog_t backlog;
+    bool backlog_ok;
+    uint32_t last_replay_ms;
+    uint32_t empty_replays;         // replays in a row that found nothing to read
+
+    bool connected;                 // as of the last sendloop_run
+    bool ever_connected;
+    bool ever_published;            // a batch went into the outbox
+    bool last_flush_failed;
+    bool last_send_failed;
+
+    uint32_t publish_failures;      // batches neither the outbox nor flash took
+    uint32_t heartbeats;            // heartbeats that repeated the newest beat
+    uint8_t replay_payload[REPLAY_PAYLOAD_MAX];
+} sendloop_t;
+
+void sendloop_init(sendloop_t *loop, const sendloop_config_t *config, uint32_t now);
+
+// New statistics windows (the current one starts over) and whether single beats go out
+void sendloop_set_aggregation(sendloop_t *loop, const agg_config_t *agg, bool raw, uint32_t now);
+
+// Takes one beat. artifact keeps it out of the statistics (measured while moving).
+// Returns true if it went into the batch.
+bool sendloop_take_beat(sendloop_t *loop, const bpm_sample_t *sample, bool artifact);
+
+// One pass: applies acks, publishes what the scheduler says is due (or stores it in
+// flash), the window summaries, a backlog replay, then hands the outbox to the client.
+// connected is whether the client has a session right now.
+void sendloop_run(sendloop_t *loop, bool connected, uint32_t now);
+
+// How long until sendloop_run has something to do that no new beat or ack brings
+// (UINT32_MAX if nothing)
+uint32_t sendloop_ms_until(const sendloop_t *loop, uint32_t now);
+
+#endif
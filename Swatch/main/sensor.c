@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "sensor.h"
+#include "ppg.h"
+#include "motion.h"
+#include "mqtt.h"
+#include "ble.h"
+#include "command.h"
+#include "boot.h"
+#include "dlog.h"
+#define TAG "SENSOR"
+
+// Task handle from main.c (we wake it up when there are new beats)
+extern TaskHandle_t dataSendTaskHandle;
+
+// Log the DSP cost every this many blocks (10 s)
+#define PPG_STATS_BLOCKS 40
+
+// BPM value pushed to us over MQTT (NO_BPM_OVERRIDE = nothing pending)
+#define NO_BPM_OVERRIDE (-1)
+static int bpm_override = NO_BPM_OVERRIDE;
+
+// Length of one block (us) and how far wake-ups strayed from it since boot
+#define PPG_BLOCK_US (PPG_BLOCK_SAMPLES * 1000000 / PPG_SAMPLE_RATE_HZ)
+static metrics_hist_t jitter_since_boot;
+
+void sensor_jitter_since_boot(metrics_hist_snapshot_t *snap) {
+    metrics_hist_peek(&jitter_since_boot, snap);
+}
+
+// Estimator state and the current block (static so they don't eat the task stack)
+static ppg_t ppg;
+static int32_t ppg_block[PPG_BLOCK_SAMPLES];
+
+// Same for the accelerometer, one array per axis so the kernel can vectorize
+static motion_t motion;
+static int16_t accel_x[ACCEL_BLOCK_SAMPLES];
+static int16_t accel_y[ACCEL_BLOCK_SAMPLES];
+static int16_t accel_z[ACCEL_BLOCK_SAMPLES];
+
+// There is no PPG chip on the board yet, so this simulates one: one cardiac cycle
+// (systolic peak + dicrotic wave) on top of a DC level, with a drifting heart rate.
+// A real driver would read PPG_BLOCK_SAMPLES samples from the sensor FIFO instead.
+static const int16_t ppg_wave[64] = {
+    17, 31, 55, 91, 145, 220, 316, 433, 563, 698, 823, 922, 984, 999, 965, 887,
+    775, 645, 512, 389, 286, 209, 160, 139, 144, 170, 212, 260, 305, 338, 351, 340,
+    309, 262, 208, 154, 107, 69, 42, 24, 12, 6, 3, 1, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+#define PPG_SIM_DC 100000
+#define PPG_SIM_NOISE 100
+
+static uint32_t sim_phase = 0;
+static int sim_bpm = 75;
+
+// The accelerometer sits at an angle to gravity (0.26 g, 0, 0.97 g). Walking and running
+// bounce the wrist up and down once per step, other movement sways it more slowly. All
+// of it also shows up in the PPG (the sensor moves on the skin).
+static const int16_t sim_sine[32] = {
+    0, 195, 383, 556, 707, 831, 924, 981, 1000, 981, 924, 831, 707, 556, 383, 195,
+    0, -195, -383, -556, -707, -831, -924, -981, -1000, -981, -924, -831, -707, -556, -383, -195,
+};
+
+typedef struct {
+    uint16_t per_minute;    // steps (or sways) per minute
+    uint16_t accel_mg;      // bounce amplitude
+    uint16_t ppg;           // what it adds to the PPG
+    bool steps;
+} sim_movement_t;
+
+static const sim_movement_t sim_movements[] = {
+    [ACTIVITY_STILL]   = { 0, 0, 0, false },
+    [ACTIVITY_MOVING]  = { 40, 120, 150, false },
+    [ACTIVITY_WALKING] = { 110, 300, 250, true },
+    [ACTIVITY_RUNNING] = { 165, 800, 600, true },
+};
+#define ACCEL_SIM_NOISE_MG 10
+
+static _Atomic int sim_activity = ACTIVITY_STILL;
+static _Atomic uint32_t sim_steps;
+static uint32_t sim_step_phase = 0;
+static int32_t sim_ppg_motion[ACCEL_BLOCK_SAMPLES];
+
+void sensor_sim_set_activity(activity_t activity) {
+    atomic_store(&sim_activity, activity);
+}
+
+uint32_t sensor_sim_steps(void) {
+    return atomic_load(&sim_steps);
+}
+
+static void accel_sim_read(int16_t *x, int16_t *y, int16_t *z, size_t n) {
+    const sim_movement_t *m = &sim_movements[atomic_load(&sim_activity)];
+    uint32_t step = (uint32_t)(((uint64_t)m->per_minute << 32) / (60u * ACCEL_SAMPLE_RATE_HZ));
+    for (size_t i = 0; i < n; i++) {
+        uint32_t next = sim_step_phase + step;
+        if (m->steps && next < sim_step_phase) {
+            atomic_fetch_add(&sim_steps, 1);
+        }
+        sim_step_phase = next;
+        int32_t wave = sim_sine[sim_step_phase >> 27];
+        int32_t noise = (rand() % (2 * ACCEL_SIM_NOISE_MG + 1)) - ACCEL_SIM_NOISE_MG;
+        // 1 g + bounce, along the direction of gravity
+        int32_t g_mg = 1000 + wave * m->accel_mg / 1000 + noise;
+        x[i] = (int16_t)(g_mg * 26 / 100 * MOTION_LSB_PER_G / 1000);
+        y[i] = (int16_t)(noise * MOTION_LSB_PER_G / 1000);
+        z[i] = (int16_t)(g_mg * 97 / 100 * MOTION_LSB_PER_G / 1000);
+        sim_ppg_motion[i] = wave * m->ppg / 1000;
+    }
+}
+
+static void ppg_sim_read(int32_t *out, size_t n) {
+    uint32_t step = (uint32_t)(((uint64_t)sim_bpm << 32) / (60u * PPG_SAMPLE_RATE_HZ));
+    for (size_t i = 0; i < n; i++) {
+        uint32_t next = sim_phase + step;
+        // New cycle: let the heart rate wander a little
+        if (next < sim_phase) {
+            sim_bpm += (rand() % 5) - 2;
+            if (sim_bpm < 55) sim_bpm = 55;
+            if (sim_bpm > 150) sim_bpm = 150;
+            step = (uint32_t)(((uint64_t)sim_bpm << 32) / (60u * PPG_SAMPLE_RATE_HZ));
+        }
+        sim_phase = next;
+        out[i] = PPG_SIM_DC + ppg_wave[sim_phase >> 26] + (rand() % PPG_SIM_NOISE) - PPG_SIM_NOISE / 2 +
+                 sim_ppg_motion[i * ACCEL_BLOCK_SAMPLES / PPG_BLOCK_SAMPLES];
+    }
+}
+
+bpm_sample_t sensor_record_beat(const sensor_record_t *record) {
+    return (bpm_sample_t){
+        .timestamp_ms = record->timestamp_ms,
+        .bpm = record->payload.beat.bpm,
+        .ibi_ms = record->payload.beat.ibi_ms,
+    };
+}
+
+uint32_t now_ms(void) {
+    return pdTICKS_TO_MS(xTaskGetTickCount());
+}
+
+// Applies what came in over MQTT for us since the last block
+static void take_commands(void) {
+    command_t cmd;
+    while (command_take(CMD_OWNER_SENSOR, &cmd)) {
+        switch (cmd.id) {
+            case CMD_BPM_OVERRIDE:
+                bpm_override = cmd.args[0];
+                ESP_LOGI(TAG, "BPM override requested: %ld", (long)cmd.args[0]);
+                break;
+
+            case CMD_CALIBRATION: {
+                // Nothing to apply it to until there is a real PPG driver, so just check it arrived whole
+                const uint8_t *blob = command_blob(&cmd);
+                uint32_t sum = 0;
+                for (uint16_t i = 0; i < cmd.len; i++) {
+                    sum += blob[i];
+                }
+                ESP_LOGI(TAG, "Calibration data received: %u bytes (sum %lu)", cmd.len, (unsigned long)sum);
+                command_release(&cmd);
+                break;
+            }
+
+            default:
+                command_release(&cmd);
+                break;
+        }
+    }
+}
+
+// Hands one beat to the MQTT and BLE sides. artifact: the wearer moved while it was measured.
+static void publish_beat(const ppg_beat_t *beat, uint32_t block_end_ms, bool artifact) {
+    // The beat happened (samples since then) ago
+    uint32_t age_ms = (ppg.samples - beat->sample_index) * 1000u / PPG_SAMPLE_RATE_HZ;
+    bpm_sample_t sample = {
+        .timestamp_ms = block_end_ms - age_ms,
+        .bpm = beat->bpm,
+        .ibi_ms = beat->ibi_ms,
+    };
+
+    // A value received over MQTT wins over the measured one
+    if (bpm_override != NO_BPM_OVERRIDE) {
+        sample.bpm = bpm_override;
+        bpm_override = NO_BPM_OVERRIDE;
+    }
+
+    // Try to put the new beat in the ring (if it's full, it is skipped and counted)
+    sensor_record_t record = {
+        .sensor = SENSOR_HEART,
+        .flags = artifact ? RECORD_FLAG_ARTIFACT : 0,
+        .timestamp_ms = sample.timestamp_ms,
+        .payload.beat = { .bpm = sample.bpm, .ibi_ms = sample.ibi_ms },
+    };
+    if (!spsc_push(&sample_ring, &record)) {
+        DLOGW(TAG, "Sample ring full, skipping value!");
+    }
+
+    // Also queue it for the BLE heart rate notification
+    ble_heart_rate_updated(&sample);
+    boot_mark(BOOT_FIRST_SAMPLE);
+
+    DLOGI(TAG, "Beat: %d BPM (IBI %d ms)%s", sample.bpm, sample.ibi_ms, artifact ? ", moving" : "");
+}
+
+// Motion blocks summed up until the next record
+typedef struct {
+    uint32_t blocks;
+    uint32_t steps;
+    uint32_t intensity_sum;
+    uint32_t artifact_blocks;
+} motion_period_t;
+
+// Adds one block, and hands out a record once the period is full. Returns true then.
+static bool motion_add(motion_period_t *period, const motion_block_t *block, uint32_t block_end_ms) {
+    period->blocks++;
+    period->steps += block->steps;
+    period->intensity_sum += block->intensity_mg;
+    period->artifact_blocks += block->artifact;
+    if (period->blocks < MOTION_RECORD_BLOCKS) {
+        return false;
+    }
+
+    sensor_record_t record = {
+        .sensor = SENSOR_MOTION,
+        .timestamp_ms = block_end_ms,
+        .payload.motion = {
+            .steps = (uint16_t)period->steps,
+            .activity = block->activity,
+            .artifact_blocks = (uint8_t)period->artifact_blocks,
+            .intensity_mg = (uint16_t)(period->intensity_sum / period->blocks),
+            .cadence_spm = block->cadence_spm,
+        },
+    };
+    if (!spsc_push(&sample_ring, &record)) {
+        DLOGW(TAG, "Sample ring full, skipping motion record!");
+    }
+    DLOGI(TAG, "Motion: %s, %lu steps (%u/min), %lu mg, %lu of %lu blocks too shaky for PPG",
+          motion_activity_name(block->activity), (unsigned long)period->steps, block->cadence_spm,
+          (unsigned long)(period->intensity_sum / period->blocks), (unsigned long)period->artifact_blocks,
+          (unsigned long)period->blocks);
+    memset(period, 0, sizeof(*period));
+    return true;
+}
+
+// This task samples the PPG sensor in blocks and turns the signal into heart beats
+void sensor_task(void *pvParameters) {
+    ppg_beat_t beats[4];
+    uint32_t block_cycles = 0;
+    uint32_t motion_cycles = 0;
+    uint32_t motion_over_budget = 0;
+    uint32_t blocks = 0;
+    motion_period_t period = {0};
+    bool last_artifact = false;
+
+    srand((unsigned int)time(NULL));
+    ppg_init(&ppg, PPG_SAMPLE_RATE_HZ);
+    motion_init(&motion, ACCEL_SAMPLE_RATE_HZ);
+
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t last_read_us = 0;
+    while (1) {
+        // Wake up exactly once per block, no matter how long processing took
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(PPG_BLOCK_SAMPLES * 1000 / PPG_SAMPLE_RATE_HZ));
+        uint32_t block_end_ms = now_ms();
+
+        // Anything that runs instead of us on this core (radio stacks, ISRs) shows up as
+        // reads that are not exactly one block apart
+        int64_t read_us = esp_timer_get_time();
+        if (last_read_us != 0) {
+            int64_t off = read_us - last_read_us - PPG_BLOCK_US;
+            uint32_t jitter = (uint32_t)(off < 0 ? -off : off);
+            metrics_hist_record(&metrics_sensor_jitter, jitter);
+            metrics_hist_record(&jitter_since_boot, jitter);
+        }
+        last_read_us = read_us;
+        take_commands();
+        accel_sim_read(accel_x, accel_y, accel_z, ACCEL_BLOCK_SAMPLES);
+        ppg_sim_read(ppg_block, PPG_BLOCK_SAMPLES);
+
+        // Motion first: it says whether this block's PPG can be trusted
+        motion_block_t moved;
+        uint32_t start = esp_cpu_get_cycle_count();
+        motion_process_block(&motion, accel_x, accel_y, accel_z, ACCEL_BLOCK_SAMPLES, &moved);
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        motion_cycles += cycles;
+        motion_over_budget += cycles > MOTION_BLOCK_BUDGET_CYCLES;
+
+        start = esp_cpu_get_cycle_count();
+        size_t found = ppg_process_block(&ppg, ppg_block, PPG_BLOCK_SAMPLES, beats, sizeof(beats) / sizeof(beats[0]));
+        block_cycles += esp_cpu_get_cycle_count() - start;
+
+        // A beat is found up to a block after its upstroke, so either block's movement counts
+        bool artifact = moved.artifact || last_artifact;
+        last_artifact = moved.artifact;
+        for (size_t i = 0; i < found; i++) {
+            publish_beat(&beats[i], block_end_ms, artifact);
+        }
+        ble_motion_updated(&moved, motion.steps);
+        bool motion_record = motion_add(&period, &moved, block_end_ms);
+        if (found > 0 || motion_record) {
+            // Tell the data send task that there's something new (notification)
+            xTaskNotifyGive(dataSendTaskHandle);
+        }
+
+        if (++blocks == PPG_STATS_BLOCKS) {
+            ESP_LOGI(TAG, "PPG: %lu cycles/block of %d samples, %lu beats, %lu rejected, %lu dropped, jitter max %lu us",
+                     (unsigned long)(block_cycles / blocks), PPG_BLOCK_SAMPLES,
+                     (unsigned long)ppg.beats, (unsigned long)ppg.rejected,
+                     (unsigned long)atomic_load(&sample_ring.dropped),
+                     (unsigned long)atomic_load(&jitter_since_boot.max));
+            ESP_LOGI(TAG, "Motion: %lu cycles/block of %d samples (budget %d, %lu over), %lu steps, %lu shaky blocks",
+                     (unsigned long)(motion_cycles / blocks), ACCEL_BLOCK_SAMPLES, MOTION_BLOCK_BUDGET_CYCLES,
+                     (unsigned long)motion_over_budget, (unsigned long)motion.steps,
+                     (unsigned long)motion.artifact_blocks);
+            block_cycles = 0;
+            motion_cycles = 0;
+            blocks = 0;
+        }
+    }
+}
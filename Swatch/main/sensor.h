@@ -0,0 +1,76 @@
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdint.h>
+#include "metrics.h"
+#include "motion.h"
+
+// PPG sample rate and how many samples are processed per wake-up (250 ms)
+#define PPG_SAMPLE_RATE_HZ 100
+#define PPG_BLOCK_SAMPLES 25
+
+// Accelerometer rate (50 - 100 Hz) and its samples per wake-up
+#ifndef ACCEL_SAMPLE_RATE_HZ
+#define ACCEL_SAMPLE_RATE_HZ 100
+#endif
+#define ACCEL_BLOCK_SAMPLES (ACCEL_SAMPLE_RATE_HZ * PPG_BLOCK_SAMPLES / PPG_SAMPLE_RATE_HZ)
+
+// One motion record sums up this many blocks (10 s)
+#define MOTION_RECORD_BLOCKS 40
+
+// One heart beat as reported by the sensor task (ms since boot)
+typedef struct {
+    uint32_t timestamp_ms;
+    int bpm;
+    int ibi_ms;     // time since the previous beat (RR-interval)
+} bpm_sample_t;
+
+// Which sensor a record comes from
+typedef enum {
+    SENSOR_HEART = 1,       // one beat (payload.beat)
+    SENSOR_MOTION,          // steps and activity of the last MOTION_RECORD_BLOCKS blocks (payload.motion)
+} sensor_id_t;
+
+// The beat was measured while the wearer moved too much for a clean PPG reading
+#define RECORD_FLAG_ARTIFACT (1 << 0)
+
+// What the sensor task hands to data_send_task, whatever sensor it came from (16 bytes)
+typedef struct {
+    uint8_t sensor;         // sensor_id_t
+    uint8_t flags;          // RECORD_FLAG_*
+    uint16_t reserved;
+    uint32_t timestamp_ms;  // the beat, or the end of the motion period
+    union {
+        struct {
+            int32_t bpm;
+            int32_t ibi_ms;
+        } beat;
+        struct {
+            uint16_t steps;
+            uint8_t activity;           // activity_t, at the end of the period
+            uint8_t artifact_blocks;    // blocks whose PPG was flagged
+            uint16_t intensity_mg;      // mean over the period
+            uint16_t cadence_spm;
+        } motion;
+    } payload;
+} sensor_record_t;
+
+// The beat in a SENSOR_HEART record
+bpm_sample_t sensor_record_beat(const sensor_record_t *record);
+
+// Current time in ms since boot, used to timestamp samples
+uint32_t now_ms(void);
+
+// Sensor wake-up jitter since boot (us, see metrics_sensor_jitter)
+void sensor_jitter_since_boot(metrics_hist_snapshot_t *snap);
+
+// Reads PPG and accelerometer blocks, runs the heart-rate estimator and the motion
+// kernel, and hands out one record per beat plus one per motion period
+void sensor_task(void *pvParameters);
+
+// There are no real sensors yet: what the simulated wearer is doing (the bench changes
+// it on the fly), and how many steps they really took so far
+void sensor_sim_set_activity(activity_t activity);
+uint32_t sensor_sim_steps(void);
+
+#endif
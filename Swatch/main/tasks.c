@@ -0,0 +1,83 @@
+#include <string.h>
+#include "esp_log.h"
+#include "tasks.h"
+#define TAG "TASKS"
+
+// The radio stacks live on core 0 (PRO_CPU), core 1 (APP_CPU) is ours
+#define CORE_RADIO 0
+#define CORE_SENSOR 1
+#define ANY tskNO_AFFINITY
+
+typedef struct {
+    const char *name;
+    uint32_t stack;                         // bytes
+    UBaseType_t priority;
+    BaseType_t core[TASK_PROFILE_COUNT];    // split, unpinned, shared
+} task_config_t;
+
+static const task_config_t task_table[TASK_COUNT] = {
+    // Highest of ours: a late wake-up is a late PPG read
+    [TASK_SENSOR]    = { "Sensor Task",    3072, 10, { CORE_SENSOR, ANY, CORE_RADIO } },
+    [TASK_DATA_SEND] = { "Data Send Task", 4096,  5, { CORE_RADIO,  ANY, CORE_RADIO } },
+    [TASK_HR_NOTIFY] = { "HR Notify Task", 2048,  5, { CORE_RADIO,  ANY, CORE_RADIO } },
+    [TASK_METRICS]   = { "Metrics Task",   3072,  2, { CORE_RADIO,  ANY, CORE_RADIO } },
+    // Bluedroid and Wi-Fi calls block on their own tasks, which are on core 0 anyway
+    [TASK_BLE_START] = { "BLE Start",      4096,  6, { CORE_RADIO,  ANY, CORE_RADIO } },
+    [TASK_NET_START] = { "Net Start",      4096,  6, { CORE_RADIO,  ANY, CORE_RADIO } },
+    [TASK_WIFI]      = { "Wi-Fi Manager",  3072,  6, { CORE_RADIO,  ANY, CORE_RADIO } },
+    // Lowest of ours: formatting and the UART only get the time nobody else wants
+    [TASK_LOG]       = { "Log Task",       3072,  1, { CORE_RADIO,  ANY, CORE_RADIO } },
+};
+
+static const char *const profile_names[TASK_PROFILE_COUNT] = { "split", "unpinned", "shared" };
+
+static task_profile_t profile = TASK_PROFILE;
+
+bool tasks_set_profile(task_profile_t p) {
+    if (p >= TASK_PROFILE_COUNT) {
+        return false;
+    }
+    profile = p;
+    return true;
+}
+
+task_profile_t tasks_profile(void) {
+    return profile;
+}
+
+const char *tasks_profile_name(task_profile_t p) {
+    return p < TASK_PROFILE_COUNT ? profile_names[p] : "?";
+}
+
+bool tasks_profile_by_name(const char *name, task_profile_t *p) {
+    for (int i = 0; i < TASK_PROFILE_COUNT; i++) {
+        if (strcmp(name, profile_names[i]) == 0) {
+            *p = (task_profile_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+BaseType_t task_core(task_id_t id) {
+#if CONFIG_FREERTOS_UNICORE
+    // Only core 0 exists, nothing to split
+    return task_table[id].core[profile] == ANY ? ANY : 0;
+#else
+    return task_table[id].core[profile];
+#endif
+}
+
+BaseType_t task_start(task_id_t id, TaskFunction_t fn, void *arg, TaskHandle_t *handle) {
+    const task_config_t *t = &task_table[id];
+    BaseType_t core = task_core(id);
+    BaseType_t ret = xTaskCreatePinnedToCore(fn, t->name, t->stack, arg, t->priority, handle, core);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start %s", t->name);
+    } else if (core == ANY) {
+        ESP_LOGI(TAG, "%s: priority %u, any core", t->name, (unsigned)t->priority);
+    } else {
+        ESP_LOGI(TAG, "%s: priority %u, core %d", t->name, (unsigned)t->priority, (int)core);
+    }
+    return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Stack, priority and core of every task we start, in one table (tasks.c).
+//
+// ESP-IDF runs its own radio work on core 0 by default: the Wi-Fi task and the BT
+// controller at priority 23, Bluedroid at 19-20, lwIP at 18, and ESP-MQTT (pinned by
+// sdkconfig.defaults). All of it is above anything here, so a task on core 0 waits
+// whenever the radios are busy. The profile decides which of our tasks share that core.
+
+typedef enum {
+    TASK_SENSOR = 0,        // PPG read and beat detection, the one that has to be on time
+    TASK_DATA_SEND,
+    TASK_HR_NOTIFY,
+    TASK_METRICS,
+    TASK_BLE_START,         // short-lived start-up tasks (see boot.h)
+    TASK_NET_START,
+    TASK_WIFI,              // Wi-Fi connection manager (wifi.h)
+    TASK_LOG,               // prints what the hot paths logged (dlog.h)
+    TASK_COUNT,
+} task_id_t;
+
+typedef enum {
+    // Sensor and DSP alone on core 1, everything that feeds a radio on core 0 next to the stacks
+    TASK_PROFILE_SPLIT = 0,
+    // No affinity, the scheduler picks a core for every task (what plain xTaskCreate does)
+    TASK_PROFILE_UNPINNED,
+    // Everything on core 0 with the radio stacks (the worst case, for comparison)
+    TASK_PROFILE_SHARED,
+    TASK_PROFILE_COUNT,
+} task_profile_t;
+
+// Profile used unless tasks_set_profile() picks another one
+#ifndef TASK_PROFILE
+#define TASK_PROFILE TASK_PROFILE_SPLIT
+#endif
+
+// Picks the profile (call before the first task_start). False if there is no such profile.
+bool tasks_set_profile(task_profile_t profile);
+
+task_profile_t tasks_profile(void);
+
+// "split", "unpinned" or "shared"
+const char *tasks_profile_name(task_profile_t profile);
+
+// Looks a profile up by name. False if there is none with that name.
+bool tasks_profile_by_name(const char *name, task_profile_t *profile);
+
+// Starts the task with the stack, priority and core the table and profile give it.
+// Returns what xTaskCreatePinnedToCore returns.
+BaseType_t task_start(task_id_t id, TaskFunction_t fn, void *arg, TaskHandle_t *handle);
+
+// Core the task goes on under the current profile (tskNO_AFFINITY if any)
+BaseType_t task_core(task_id_t id);
+
+#endif
@@ -0,0 +1,207 @@
+#include <string.h>
+#include "tscodec.h"
+
+static uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Bits needed for a timestamp delta-of-delta, and the prefix/width to write it with
+static int dod_field(uint32_t zz, uint32_t *prefix, int *prefix_bits, int *width) {
+    if (zz == 0) {
+        *prefix = 0x0; *prefix_bits = 1; *width = 0;
+    } else if (zz < (1u << 7)) {
+        *prefix = 0x2; *prefix_bits = 2; *width = 7;
+    } else if (zz < (1u << 9)) {
+        *prefix = 0x6; *prefix_bits = 3; *width = 9;
+    } else if (zz < (1u << 12)) {
+        *prefix = 0xE; *prefix_bits = 4; *width = 12;
+    } else {
+        *prefix = 0xF; *prefix_bits = 4; *width = 32;
+    }
+    return *prefix_bits + *width;
+}
+
+// Same for a value change
+static int value_field(uint32_t zz, uint32_t *prefix, int *prefix_bits, int *width) {
+    if (zz == 0) {
+        *prefix = 0x0; *prefix_bits = 1; *width = 0;
+    } else if (zz < (1u << 3)) {
+        *prefix = 0x2; *prefix_bits = 2; *width = 3;
+    } else if (zz < (1u << 9)) {
+        *prefix = 0x6; *prefix_bits = 3; *width = 9;
+    } else {
+        *prefix = 0x7; *prefix_bits = 3; *width = 32;
+    }
+    return *prefix_bits + *width;
+}
+
+// Writes the low n bits of v (n <= 32), most significant first. Space was checked by the caller.
+static void put_bits(ts_encoder_t *enc, uint32_t v, int n) {
+    while (n > 0) {
+        size_t byte = enc->bits >> 3;
+        int free_bits = 8 - (int)(enc->bits & 7);
+        if (free_bits == 8) {
+            enc->buf[byte] = 0;
+        }
+        int take = n < free_bits ? n : free_bits;
+        uint32_t chunk = (v >> (n - take)) & ((1u << take) - 1);
+        enc->buf[byte] |= (uint8_t)(chunk << (free_bits - take));
+        enc->bits += take;
+        n -= take;
+    }
+}
+
+// Reads n bits (n <= 32). Returns false if the payload ends first.
+static bool get_bits(ts_decoder_t *dec, int n, uint32_t *out) {
+    if (dec->bits + (size_t)n > dec->len * 8) {
+        return false;
+    }
+    uint32_t v = 0;
+    while (n > 0) {
+        uint8_t byte = dec->buf[dec->bits >> 3];
+        int avail = 8 - (int)(dec->bits & 7);
+        int take = n < avail ? n : avail;
+        uint32_t chunk = (byte >> (avail - take)) & ((1u << take) - 1);
+        v = (v << take) | chunk;
+        dec->bits += take;
+        n -= take;
+    }
+    *out = v;
+    return true;
+}
+
+// Reads a prefix of up to max_ones 1 bits ended by a 0 (or by reaching max_ones)
+static bool get_prefix(ts_decoder_t *dec, int max_ones, int *ones) {
+    *ones = 0;
+    while (*ones < max_ones) {
+        uint32_t bit;
+        if (!get_bits(dec, 1, &bit)) {
+            return false;
+        }
+        if (bit == 0) {
+            break;
+        }
+        (*ones)++;
+    }
+    return true;
+}
+
+bool ts_encoder_init(ts_encoder_t *enc, uint8_t *buf, size_t len) {
+    memset(enc, 0, sizeof(*enc));
+    if (len < TSCODEC_HEADER_SIZE) {
+        return false;
+    }
+    enc->buf = buf;
+    enc->len = len;
+    buf[0] = TSCODEC_TAG;
+    buf[1] = 0;
+    buf[2] = 0;
+    enc->bits = TSCODEC_HEADER_SIZE * 8;
+    return true;
+}
+
+bool ts_encode(ts_encoder_t *enc, uint32_t timestamp, int32_t value) {
+    if (enc->buf == NULL || enc->count == TSCODEC_MAX_SAMPLES) {
+        return false;
+    }
+
+    uint32_t ts_prefix = 0, v_prefix, ts_zz = 0;
+    int ts_prefix_bits = 0, ts_width = 32, v_prefix_bits, v_width;
+    int32_t delta = 0;
+    int ts_bits = 32;
+    if (enc->count > 0) {
+        // Unsigned subtraction keeps working when the ms counter wraps around
+        delta = (int32_t)(timestamp - enc->prev_ts);
+        ts_zz = zigzag((int32_t)((uint32_t)delta - (uint32_t)enc->prev_delta));
+        ts_bits = dod_field(ts_zz, &ts_prefix, &ts_prefix_bits, &ts_width);
+    }
+    uint32_t v_zz = zigzag((int32_t)((uint32_t)value - (uint32_t)enc->prev_value));
+    int v_bits = value_field(v_zz, &v_prefix, &v_prefix_bits, &v_width);
+
+    if (enc->bits + (size_t)ts_bits + (size_t)v_bits > enc->len * 8) {
+        return false;
+    }
+
+    if (enc->count == 0) {
+        put_bits(enc, timestamp, 32);
+    } else {
+        put_bits(enc, ts_prefix, ts_prefix_bits);
+        put_bits(enc, ts_zz, ts_width);
+    }
+    put_bits(enc, v_prefix, v_prefix_bits);
+    put_bits(enc, v_zz, v_width);
+
+    enc->prev_delta = delta;
+    enc->prev_ts = timestamp;
+    enc->prev_value = value;
+    enc->count++;
+    return true;
+}
+
+size_t ts_encoder_finish(ts_encoder_t *enc) {
+    if (enc->buf == NULL) {
+        return 0;
+    }
+    enc->buf[1] = (uint8_t)(enc->count & 0xFF);
+    enc->buf[2] = (uint8_t)(enc->count >> 8);
+    return (enc->bits + 7) / 8;
+}
+
+bool ts_decoder_init(ts_decoder_t *dec, const uint8_t *buf, size_t len) {
+    memset(dec, 0, sizeof(*dec));
+    if (len < TSCODEC_HEADER_SIZE || buf[0] != TSCODEC_TAG) {
+        return false;
+    }
+    dec->buf = buf;
+    dec->len = len;
+    dec->count = (uint16_t)(buf[1] | (buf[2] << 8));
+    dec->bits = TSCODEC_HEADER_SIZE * 8;
+    return true;
+}
+
+bool ts_decode(ts_decoder_t *dec, uint32_t *timestamp, int32_t *value) {
+    if (dec->buf == NULL || dec->decoded == dec->count) {
+        return false;
+    }
+
+    uint32_t ts;
+    int32_t delta = 0;
+    if (dec->decoded == 0) {
+        if (!get_bits(dec, 32, &ts)) {
+            return false;
+        }
+    } else {
+        static const int dod_widths[5] = { 0, 7, 9, 12, 32 };
+        int ones;
+        uint32_t zz = 0;
+        if (!get_prefix(dec, 4, &ones) || !get_bits(dec, dod_widths[ones], &zz)) {
+            return false;
+        }
+        delta = (int32_t)((uint32_t)dec->prev_delta + (uint32_t)unzigzag(zz));
+        ts = dec->prev_ts + (uint32_t)delta;
+    }
+
+    static const int value_widths[4] = { 0, 3, 9, 32 };
+    int ones;
+    uint32_t zz = 0;
+    if (!get_prefix(dec, 3, &ones) || !get_bits(dec, value_widths[ones], &zz)) {
+        return false;
+    }
+    int32_t v = (int32_t)((uint32_t)dec->prev_value + (uint32_t)unzigzag(zz));
+
+    dec->prev_ts = ts;
+    dec->prev_delta = delta;
+    dec->prev_value = v;
+    dec->decoded++;
+    *timestamp = ts;
+    *value = v;
+    return true;
+}
+
+size_t ts_decoder_used(const ts_decoder_t *dec) {
+    return (dec->bits + 7) / 8;
+}
@@ -0,0 +1,75 @@
+#ifndef TSCODEC_H
+#define TSCODEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Compact encoding for series of (timestamp, value) samples, in the style of Gorilla:
+// timestamps are stored as delta-of-delta and values as the change from the previous
+// value, both in variable-size bit fields. A steady heart rate (same interval, same
+// BPM) costs 2 bits per sample, normal beat-to-beat jitter around 15.
+//
+// Layout: 1 byte TSCODEC_TAG, 2 bytes sample count (little-endian), then a bit stream
+// (most significant bit first) padded with zeros to a whole byte.
+//   timestamp: first one as 32 raw bits, then dod = delta - previous delta:
+//     0                 dod == 0
+//     10   + 7 bits     zig-zag dod < 128
+//     110  + 9 bits     zig-zag dod < 512
+//     1110 + 12 bits    zig-zag dod < 4096
+//     1111 + 32 bits    anything else
+//   value: change from the previous value (the first one from 0):
+//     0                 same value
+//     10   + 3 bits     zig-zag change < 8
+//     110  + 9 bits     zig-zag change < 512
+//     111  + 32 bits    anything else
+//
+// Nothing is allocated: the encoder writes into the caller's buffer and the decoder
+// reads straight from the payload.
+
+// First byte of every payload (can't be mistaken for the old ASCII formats)
+#define TSCODEC_TAG 0xB1
+#define TSCODEC_HEADER_SIZE 3
+#define TSCODEC_MAX_SAMPLES UINT16_MAX
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t bits;            // bits used so far (header included)
+    uint16_t count;
+    uint32_t prev_ts;
+    int32_t prev_delta;
+    int32_t prev_value;
+} ts_encoder_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t bits;
+    uint16_t count;         // samples in the payload
+    uint16_t decoded;
+    uint32_t prev_ts;
+    int32_t prev_delta;
+    int32_t prev_value;
+} ts_decoder_t;
+
+// Starts a payload in buf. Returns false if buf can't even hold the header.
+bool ts_encoder_init(ts_encoder_t *enc, uint8_t *buf, size_t len);
+
+// Appends one sample. Returns false (and leaves the payload as it was) if it doesn't fit.
+bool ts_encode(ts_encoder_t *enc, uint32_t timestamp, int32_t value);
+
+// Writes the sample count and returns the payload length in bytes
+size_t ts_encoder_finish(ts_encoder_t *enc);
+
+// Starts reading a payload. Returns false if it isn't one of ours.
+bool ts_decoder_init(ts_decoder_t *dec, const uint8_t *buf, size_t len);
+
+// Reads the next sample. Returns false at the end (or if the payload is cut short).
+bool ts_decode(ts_decoder_t *dec, uint32_t *timestamp, int32_t *value);
+
+// Bytes of the payload read so far. After the last sample this is the payload length,
+// so several payloads can be sent back to back.
+size_t ts_decoder_used(const ts_decoder_t *dec);
+
+#endif
@@ -0,0 +1,302 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "wifi.h"
+#include "mqtt.h"
+#include "sensor.h"
+#include "boot.h"
+#include "tasks.h"
+#define TAG "WIFI"
+
+// Wi-Fi credentials
+#define WIFI_SSID "teamHexagon"
+#define WIFI_PASS "hexagon6"
+
+// Where the last good AP is kept
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_KEY "last_ap"
+#define WIFI_CACHE_VERSION 1
+
+// Last AP that gave us an address. DHCP asks for the same address again on its own
+// (CONFIG_LWIP_DHCP_RESTORE_LAST_IP), the lease here is what we got last time.
+typedef struct {
+    uint8_t version;
+    uint8_t channel;
+    uint8_t bssid[6];
+    esp_netif_ip_info_t lease;
+} wifi_cache_t;
+
+// What the event handlers tell the manager task
+#define WIFI_EV_STARTED      (1 << 0)
+#define WIFI_EV_CONNECTED    (1 << 1)
+#define WIFI_EV_DISCONNECTED (1 << 2)
+#define WIFI_EV_GOT_IP       (1 << 3)
+#define WIFI_EV_ALL          (WIFI_EV_STARTED | WIFI_EV_CONNECTED | WIFI_EV_DISCONNECTED | WIFI_EV_GOT_IP)
+
+typedef enum {
+    LINK_IDLE,          // driver not started yet
+    LINK_CONNECTING,    // scanning, authenticating, associating
+    LINK_ASSOCIATED,    // waiting for DHCP
+    LINK_UP,
+    LINK_BACKOFF,       // waiting before the next full scan
+} link_state_t;
+
+static EventGroupHandle_t wifi_events;
+static _Atomic bool link_up = false;
+
+// Everything below belongs to the manager task (the handlers only fill in got_ip and
+// disconnect_reason before they set the matching bit)
+static wifi_cache_t cache;
+static bool cache_valid = false;
+static esp_netif_ip_info_t got_ip;
+static uint8_t disconnect_reason;
+static link_state_t state = LINK_IDLE;
+static bool attempt_fast = false;
+static uint32_t failures = 0;       // full scans in a row that found nothing
+static uint32_t retry_at_ms = 0;
+static uint32_t lost_at_ms = 0;     // link lost at, 0 while up or never lost
+
+// wifi_stats_t, mirrored for other tasks (only the manager task writes them)
+static struct {
+    _Atomic uint32_t connects;
+    _Atomic uint32_t fast_connects;
+    _Atomic uint32_t fast_misses;
+    _Atomic uint32_t scans;
+    _Atomic uint32_t disconnects;
+    _Atomic uint32_t last_outage_ms;
+    _Atomic uint32_t max_outage_ms;
+} stats;
+
+#define STAT_ADD(field) atomic_fetch_add_explicit(&stats.field, 1, memory_order_relaxed)
+
+uint32_t wifi_backoff_ms(uint32_t attempt, uint32_t random) {
+    uint32_t delay = WIFI_BACKOFF_MAX_MS;
+    if (attempt < 16 && ((uint32_t)WIFI_BACKOFF_MIN_MS << attempt) < WIFI_BACKOFF_MAX_MS) {
+        delay = (uint32_t)WIFI_BACKOFF_MIN_MS << attempt;
+    }
+    return delay / 2 + random % (delay / 2 + 1);
+}
+
+static void load_cache(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(cache);
+    cache_valid = nvs_get_blob(nvs, WIFI_NVS_KEY, &cache, &len) == ESP_OK && len == sizeof(cache) &&
+                  cache.version == WIFI_CACHE_VERSION;
+    nvs_close(nvs);
+    if (cache_valid) {
+        ESP_LOGI(TAG, "Last AP " MACSTR " on channel %u, address " IPSTR,
+                 MAC2STR(cache.bssid), cache.channel, IP2STR(&cache.lease.ip));
+    }
+}
+
+// Keeps the AP we are on and our lease, writing flash only when something changed
+static void remember_ap(void) {
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    wifi_cache_t now = { .version = WIFI_CACHE_VERSION, .channel = ap.primary, .lease = got_ip };
+    memcpy(now.bssid, ap.bssid, sizeof(now.bssid));
+    if (cache_valid && memcmp(&now, &cache, sizeof(now)) == 0) {
+        return;
+    }
+    cache = now;
+    cache_valid = true;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, WIFI_NVS_KEY, &cache, sizeof(cache));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store the AP: %s", esp_err_to_name(err));
+    }
+}
+
+// Fast: straight to the cached AP on its channel. Otherwise every channel is scanned
+// and the strongest AP of our network wins.
+static void start_attempt(bool fast) {
+    wifi_config_t config = {
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASS,
+            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
+        },
+    };
+    if (fast) {
+        config.sta.scan_method = WIFI_FAST_SCAN;
+        config.sta.bssid_set = true;
+        memcpy(config.sta.bssid, cache.bssid, sizeof(config.sta.bssid));
+        config.sta.channel = cache.channel;
+        ESP_LOGI(TAG, "Connecting to " MACSTR " on channel %u", MAC2STR(cache.bssid), cache.channel);
+    } else {
+        config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        STAT_ADD(scans);
+        ESP_LOGI(TAG, "Scanning for %s", WIFI_SSID);
+    }
+
+    attempt_fast = fast;
+    state = LINK_CONNECTING;
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &config);
+    if (err == ESP_OK) {
+        err = esp_wifi_connect();
+    }
+    if (err != ESP_OK) {
+        // No disconnect event is coming for this one, so it fails right here
+        ESP_LOGW(TAG, "Connect failed: %s", esp_err_to_name(err));
+        state = LINK_BACKOFF;
+        retry_at_ms = now_ms() + wifi_backoff_ms(failures++, esp_random());
+    }
+}
+
+static void on_disconnected(uint32_t now) {
+    if (state == LINK_UP) {
+        ESP_LOGW(TAG, "Link lost (reason %u)", disconnect_reason);
+        STAT_ADD(disconnects);
+        lost_at_ms = now;
+        atomic_store(&link_up, false);
+        mqtt_link_changed(false);
+        failures = 0;
+        start_attempt(cache_valid);
+    } else if (state == LINK_CONNECTING || state == LINK_ASSOCIATED) {
+        if (attempt_fast) {
+            // The AP went away or we moved: look around right away
+            STAT_ADD(fast_misses);
+            start_attempt(false);
+        } else {
+            uint32_t delay = wifi_backoff_ms(failures++, esp_random());
+            ESP_LOGW(TAG, "No AP (reason %u), next scan in %lu ms", disconnect_reason, (unsigned long)delay);
+            state = LINK_BACKOFF;
+            retry_at_ms = now + delay;
+        }
+    }
+}
+
+static void on_got_ip(uint32_t now) {
+    STAT_ADD(connects);
+    if (attempt_fast) {
+        STAT_ADD(fast_connects);
+    }
+    if (lost_at_ms != 0) {
+        uint32_t outage = now - lost_at_ms;
+        atomic_store_explicit(&stats.last_outage_ms, outage, memory_order_relaxed);
+        if (outage > atomic_load_explicit(&stats.max_outage_ms, memory_order_relaxed)) {
+            atomic_store_explicit(&stats.max_outage_ms, outage, memory_order_relaxed);
+        }
+        ESP_LOGI(TAG, "Back after %lu ms", (unsigned long)outage);
+        lost_at_ms = 0;
+    }
+    ESP_LOGI(TAG, "Got address " IPSTR, IP2STR(&got_ip.ip));
+
+    state = LINK_UP;
+    failures = 0;
+    remember_ap();
+    atomic_store(&link_up, true);
+    // On the first address the client isn't started yet, mqtt_init waits for this mark
+    mqtt_link_changed(true);
+    boot_mark(BOOT_WIFI_GOT_IP);
+}
+
+// The connection state machine. The driver and lwIP report through the event loop,
+// everything that takes a decision or touches flash happens here.
+static void wifi_task(void *pvParameters) {
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (state == LINK_BACKOFF) {
+            int32_t left = (int32_t)(retry_at_ms - now_ms());
+            wait = left > 0 ? pdMS_TO_TICKS(left) : 0;
+        }
+        EventBits_t events = xEventGroupWaitBits(wifi_events, WIFI_EV_ALL, pdTRUE, pdFALSE, wait);
+        uint32_t now = now_ms();
+
+        if (events & WIFI_EV_STARTED) {
+            start_attempt(cache_valid);
+        }
+        if (events & WIFI_EV_DISCONNECTED) {
+            on_disconnected(now);
+        }
+        if ((events & WIFI_EV_CONNECTED) && state == LINK_CONNECTING) {
+            state = LINK_ASSOCIATED;
+        }
+        if ((events & WIFI_EV_GOT_IP) && state != LINK_UP) {
+            on_got_ip(now);
+        }
+        if (state == LINK_BACKOFF && (int32_t)(retry_at_ms - now) <= 0) {
+            start_attempt(false);
+        }
+    }
+}
+
+static void wifi_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+    if (base == WIFI_EVENT) {
+        switch (event_id) {
+            case WIFI_EVENT_STA_START:
+                xEventGroupSetBits(wifi_events, WIFI_EV_STARTED);
+                break;
+            case WIFI_EVENT_STA_CONNECTED:
+                xEventGroupSetBits(wifi_events, WIFI_EV_CONNECTED);
+                break;
+            case WIFI_EVENT_STA_DISCONNECTED: {
+                const wifi_event_sta_disconnected_t *info = event_data;
+                disconnect_reason = info ? info->reason : 0;
+                xEventGroupSetBits(wifi_events, WIFI_EV_DISCONNECTED);
+                break;
+            }
+            default:
+                break;
+        }
+    } else if (base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        const ip_event_got_ip_t *info = event_data;
+        if (info) {
+            got_ip = info->ip_info;
+        }
+        xEventGroupSetBits(wifi_events, WIFI_EV_GOT_IP);
+    }
+}
+
+void wifi_init(void) {
+    wifi_events = xEventGroupCreate();
+    load_cache();
+
+    esp_netif_create_default_wifi_sta();
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, NULL));
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    // The manager connects once the driver reports it has started
+    task_start(TASK_WIFI, wifi_task, NULL, NULL);
+    ESP_ERROR_CHECK(esp_wifi_start());
+}
+
+bool wifi_is_up(void) {
+    return atomic_load(&link_up);
+}
+
+void wifi_get_stats(wifi_stats_t *out) {
+    out->connects = atomic_load_explicit(&stats.connects, memory_order_relaxed);
+    out->fast_connects = atomic_load_explicit(&stats.fast_connects, memory_order_relaxed);
+    out->fast_misses = atomic_load_explicit(&stats.fast_misses, memory_order_relaxed);
+    out->scans = atomic_load_explicit(&stats.scans, memory_order_relaxed);
+    out->disconnects = atomic_load_explicit(&stats.disconnects, memory_order_relaxed);
+    out->last_outage_ms = atomic_load_explicit(&stats.last_outage_ms, memory_order_relaxed);
+    out->max_outage_ms = atomic_load_explicit(&stats.max_outage_ms, memory_order_relaxed);
+}
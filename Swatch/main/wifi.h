@@ -0,0 +1,47 @@
+#ifndef WIFI_H
+#define WIFI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Wi-Fi connection manager. It keeps the station connected for as long as the watch
+// runs:
+// - The last AP that gave us an address (BSSID, channel) and the lease are kept in NVS.
+// - A lost link first tries that AP directly: no scan, one channel.
+// - If that fails, it falls back to a full scan of every channel.
+// - Full scans that fail are retried with a growing, jittered delay, so a ward full of
+//   watches doesn't hammer the AP in lockstep.
+// The MQTT client is told when the link goes away and when the address is back.
+
+// Delay before the first full scan retry, doubled per failure up to the max (ms)
+#ifndef WIFI_BACKOFF_MIN_MS
+#define WIFI_BACKOFF_MIN_MS 500
+#endif
+#ifndef WIFI_BACKOFF_MAX_MS
+#define WIFI_BACKOFF_MAX_MS 30000
+#endif
+
+typedef struct {
+    uint32_t connects;          // times we got an address
+    uint32_t fast_connects;     // ... from the cached AP without a scan
+    uint32_t fast_misses;       // cached AP not there, fell back to a scan
+    uint32_t scans;             // full scan attempts
+    uint32_t disconnects;       // links lost while up
+    uint32_t last_outage_ms;    // link lost -> address again, last time
+    uint32_t max_outage_ms;
+} wifi_stats_t;
+
+// Sets up the station and starts the manager task (netif and the event loop must exist)
+void wifi_init(void);
+
+// Whether the station has an address right now
+bool wifi_is_up(void);
+
+// Copies the counters field by field (any task; each one is current, not all from the same moment)
+void wifi_get_stats(wifi_stats_t *stats);
+
+// Delay before full scan retry number attempt (0 based): half of min * 2^attempt
+// (capped at max) plus a random share of the other half
+uint32_t wifi_backoff_ms(uint32_t attempt, uint32_t random);
+
+#endif